@@ -26,17 +26,16 @@ abstract class BaseMPVView(context: Context, attrs: AttributeSet) : SurfaceView(
     fun initialize(configDir: String, cacheDir: String) {
         MPVLib.create(context)
 
-        MPVLib.setOptionString("config", "yes")
-        MPVLib.setOptionString("config-dir", configDir)
-        for (opt in arrayOf("gpu-shader-cache-dir", "icc-cache-dir"))
-            MPVLib.setOptionString(opt, cacheDir)
+        MPVLib.setOptions(
+            arrayOf("config", "config-dir", "gpu-shader-cache-dir", "icc-cache-dir"),
+            arrayOf("yes", configDir, cacheDir, cacheDir)
+        )
         initOptions()
 
         MPVLib.init()
 
         postInitOptions()
-        MPVLib.setOptionString("force-window", "no")
-        MPVLib.setOptionString("idle", "once")
+        MPVLib.setOptions(arrayOf("force-window", "idle"), arrayOf("no", "once"))
 
         holder.addCallback(this)
         observeProperties()
@@ -54,6 +53,18 @@ abstract class BaseMPVView(context: Context, attrs: AttributeSet) : SurfaceView(
         MPVLib.destroy()
     }
 
+    /**
+     * Deinitialize libmpv without waiting for it to shut down.
+     *
+     * Like [destroy], but the actual termination happens in the background;
+     * [onComplete] is called from a native thread once it has finished.
+     */
+    fun destroyAsync(onComplete: (() -> Unit)? = null) {
+        holder.removeCallback(this)
+        clearAllProperties()
+        MPVLib.destroyAsync(onComplete)
+    }
+
     protected abstract fun initOptions()
     protected abstract fun postInitOptions()
 
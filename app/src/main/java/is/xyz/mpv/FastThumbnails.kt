@@ -50,6 +50,8 @@ object FastThumbnails {
      * @param position Time position in seconds (default: 0.0)
      * @param dimension Max dimension for longest side (width or height) in pixels (default: 512)
      * @param useHwDec Whether to use hardware acceleration if available (default: true)
+     * @param palette If not null, receives the thumbnail's dominant colours as ARGB, most
+     *                common first and 0 past the ones found (default: null)
      * @return Bitmap thumbnail, or null if generation fails
      * @throws IllegalStateException if not initialized
      */
@@ -59,7 +61,8 @@ object FastThumbnails {
         path: String,
         position: Double = 0.0,
         dimension: Int = 512,
-        useHwDec: Boolean = true
+        useHwDec: Boolean = true,
+        palette: IntArray? = null
     ): Bitmap? {
         check(initialized.get()) {
             "FastThumbnails not initialized. Call initialize(context) first."
@@ -70,7 +73,10 @@ object FastThumbnails {
         }
         
         return try {
-            MPVLib.grabThumbnailFast(path, position, dimension, useHwDec)
+            if (palette != null)
+                MPVLib.grabThumbnailPalette(path, position, dimension, useHwDec, palette)
+            else
+                MPVLib.grabThumbnailFast(path, position, dimension, useHwDec)
         } catch (e: Exception) {
             e.printStackTrace()
             null
@@ -84,15 +90,17 @@ object FastThumbnails {
      * @param position Time position in seconds (default: 0.0)
      * @param dimension Max dimension for longest side (width or height) in pixels (default: 512)
      * @param useHwDec Whether to use hardware acceleration if available (default: true)
+     * @param palette If not null, receives the thumbnail's dominant colours (see [generate])
      * @return Bitmap thumbnail, or null
      */
     suspend fun generateAsync(
         path: String,
         position: Double = 0.0,
         dimension: Int = 512,
-        useHwDec: Boolean = true
+        useHwDec: Boolean = true,
+        palette: IntArray? = null
     ): Bitmap? = withContext(Dispatchers.IO) {
-        generate(path, position, dimension, useHwDec)
+        generate(path, position, dimension, useHwDec, palette)
     }
     
     /**
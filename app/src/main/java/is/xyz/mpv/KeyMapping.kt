@@ -1,6 +1,7 @@
 package `is`.xyz.mpv;
 
 // Mapping between Android and mpv keycodes (special keys)
+// MPVLib.keyEvent uses the same table in native code (input.cpp), keep them in sync
 
 import android.view.KeyEvent.*;
 
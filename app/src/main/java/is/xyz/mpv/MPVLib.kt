@@ -2,7 +2,9 @@ package `is`.xyz.mpv
 
 import android.content.Context
 import android.graphics.Bitmap
+import android.view.KeyEvent
 import android.view.Surface
+import java.nio.ByteBuffer
 import kotlinx.coroutines.CoroutineScope
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.flow.Flow
@@ -26,19 +28,256 @@ object MPVLib {
     external fun create(appctx: Context)
     external fun init()
     external fun destroy()
+    private external fun destroyAsync(token: Long)
     external fun attachSurface(surface: Surface)
     external fun detachSurface()
 
     external fun command(vararg cmd: String)
     external fun commandNode(vararg cmd: String): MPVNode?
 
+    /**
+     * Forward a key event to mpv without blocking. [keycode] and [action] are the
+     * [KeyEvent] values, [modifiers] its meta state and [unicodeChar] the character
+     * the key produces (0 if none). Returns false if mpv has no such key.
+     */
+    external fun keyEvent(keycode: Int, action: Int, modifiers: Int, unicodeChar: Int = 0): Boolean
+
+    @JvmStatic
+    fun keyEvent(event: KeyEvent): Boolean {
+        // Ctrl/Alt/Meta are sent as modifiers rather than folded into the character
+        val char = event.getUnicodeChar(event.metaState and (KeyEvent.META_SHIFT_MASK or KeyEvent.META_CAPS_LOCK_ON))
+        return keyEvent(event.keyCode, event.action, event.metaState, char)
+    }
+
+    /**
+     * Nanoseconds from [create] to init, the last loadfile, FILE_LOADED and the first
+     * PLAYBACK_RESTART after it, in that order (first element is always 0).
+     * Stages not reached yet are -1.
+     */
+    external fun getStartupTimings(): LongArray?
+
+    /**
+     * Latency of every native entry point ("MPVLib.<name>"), event type delivered to
+     * Java ("event:<name>") and property access ("getPropertyNode:<property>", ...)
+     * as a map of name to {count, mean, p50, p90, p99, max}, all in nanoseconds.
+     * [reset] starts a new period for the following call; max is not reset.
+     */
+    external fun getNativeStats(reset: Boolean = false): MPVNode?
+
+    /**
+     * Seekbar scrubbing: call [scrubBegin] when the drag starts, [scrubTo] for every
+     * touch move and [scrubEnd] on release. Moves are coalesced into keyframe seeks,
+     * at most one in flight; the release seeks exactly. None of these block.
+     */
+    external fun scrubBegin()
+    external fun scrubTo(position: Double)
+    external fun scrubEnd(position: Double)
+    /**
+     * Since the last [scrubBegin]: seeks issued, seeks completed, moves coalesced,
+     * seeks per second, mean and max seek latency (ms), latency of the exact seek (ms).
+     */
+    external fun getScrubStats(): DoubleArray?
+
     external fun setOptionString(name: String, value: String): Int
+    external fun setOptions(names: Array<String>, values: Array<String>): IntArray?
+
+    external fun parseOptionProfile(data: ByteArray): Long
+    external fun applyOptionProfile(profile: Long): IntArray?
+    external fun freeOptionProfile(profile: Long)
 
     external fun grabThumbnail(dimension: Int): Bitmap?
+    /**
+     * Save the current video frame at full resolution to [path], as PNG if it ends in ".png"
+     * and as JPEG of [quality] (1-100) otherwise. Only the frame copy happens here; encoding
+     * runs in the background and [ScreenshotObserver]s are told when the file is written.
+     * Returns false if there is no frame or too many captures are waiting.
+     */
+    external fun captureScreenshot(path: String, quality: Int = 90, subtitles: Boolean = false): Boolean
     external fun grabThumbnailFast(path: String, position: Double = 0.0, dimension: Int, useHwDec: Boolean = true): Bitmap?
+    /**
+     * Like [grabThumbnailFast], also filling [palette] with the thumbnail's dominant colours
+     * as opaque ARGB, most common first, 0 past the ones found.
+     */
+    external fun grabThumbnailPalette(path: String, position: Double, dimension: Int, useHwDec: Boolean,
+                                      palette: IntArray): Bitmap?
     external fun setThumbnailJavaVM(appctx: Context)
     external fun clearThumbnailCache()
 
+    /**
+     * Capture a downscaled preview of the playing video every [interval] seconds into the
+     * per-file storyboard cache, which [grabThumbnailFast] consults before decoding.
+     * Frames are at most [dimension] pixels on their longest side.
+     */
+    external fun setTrickplayCapture(enable: Boolean, interval: Double = 10.0, dimension: Int = 256)
+    /** Cached preview near [position], or null. A [dimension] of 0 keeps the stored size. */
+    external fun getTrickplayFrame(path: String, position: Double, dimension: Int = 0): Bitmap?
+    /** Persist storyboards in [dir] so they survive restarts (null to keep them in memory only). */
+    external fun setTrickplayCacheDir(dir: String?)
+    external fun setTrickplayCacheBudget(bytes: Long)
+    /** Drop all storyboards, including those persisted in the cache dir. */
+    external fun clearTrickplayCache()
+
+    // see SharedOverlay
+    external fun overlayCreate(id: Int, width: Int, height: Int): Long
+    external fun overlayBuffer(handle: Long): ByteBuffer?
+    external fun overlayPost(handle: Long, x: Int, y: Int, dw: Int, dh: Int): Int
+    external fun overlayPostBitmap(handle: Long, bitmap: Bitmap, x: Int, y: Int, dw: Int, dh: Int): Int
+    external fun overlayRemove(handle: Long)
+    external fun overlayDestroy(handle: Long)
+
+    /**
+     * Tune streams opened through [Utils.readaheadUri] afterwards: [threads] parallel
+     * fetchers reading [blockSize] byte blocks, at most [maxDepth] blocks ahead of the
+     * reader and [cacheBytes] kept in memory per stream.
+     */
+    external fun setReadaheadConfig(threads: Int = 4, blockSize: Int = 512 * 1024, maxDepth: Int = 32, cacheBytes: Long = 32L shl 20)
+    /**
+     * Totals over all read-ahead streams: bytes fetched, bytes delivered, fetch ns,
+     * stalls, stall ns, cancelled blocks, largest current prefetch depth, open streams.
+     */
+    external fun getReadaheadStats(): LongArray?
+
+    /**
+     * Sample playback health (frame drops, cache, fps, avsync, buffering) natively every
+     * [intervalMs] into a ring of [capacity] samples. Threshold crossings are reported to
+     * [QosObserver]s, see [setQosThresholds].
+     */
+    external fun startQosSampler(intervalMs: Int = 500, capacity: Int = 600)
+    external fun stopQosSampler()
+    /**
+     * Alert when more than [maxDropRate] frames/s are dropped over the last 5 seconds,
+     * the demuxer cache falls below [minCacheSeconds] while playing or |avsync| exceeds
+     * [maxAvsync] seconds. Stalls waiting for the cache always alert.
+     */
+    external fun setQosThresholds(maxDropRate: Double = 2.0, minCacheSeconds: Double = 1.0, maxAvsync: Double = 0.1)
+    /**
+     * Aggregates over the last [windowSeconds] (0 for the whole ring): samples, seconds
+     * covered, dropped frames/s, decoder drops/s, delayed frames/s, dropped share of frames,
+     * stalls, cache underruns, mean and min cache, mean fps, mean and max |avsync|.
+     * Rates are per second of playback; unavailable values are NaN.
+     */
+    external fun getQosSummary(windowSeconds: Double = 0.0): DoubleArray?
+    /** The ring, oldest first: time, drops, decoder drops, delayed, cache, fps, avsync, buffering. */
+    external fun getQosSamples(): DoubleArray?
+
+    /**
+     * Keep the demuxer and storyboard caches inside [ceilingBytes] of native heap,
+     * re-balancing them every 2 seconds. Limits are only ever lowered from their
+     * configured values. -1 picks a ceiling for the device's memory size, 0 stops
+     * adjusting and restores the configured limits.
+     */
+    external fun setMemoryBudget(ceilingBytes: Long = -1)
+    /**
+     * Bytes: RSS, heap allocated, heap size, demuxer cache, demuxer cache ahead,
+     * storyboard cache, budget ceiling, demuxer-max-bytes, demuxer-max-back-bytes,
+     * storyboard budget. -1 where unavailable.
+     */
+    external fun getMemoryReport(): LongArray?
+
+    /**
+     * Index the faces in the system font directories and [extraDirs] into [indexPath],
+     * unless it already matches the installed fonts. Returns the number of faces, -1 on error.
+     */
+    external fun buildFontIndex(indexPath: String, extraDirs: Array<String>? = null): Int
+    /**
+     * Symlink the indexed fonts needed to render [sample] into [fontsDir] (libass only
+     * loads fonts from there). Returns the number of fonts linked, -1 without an index.
+     */
+    external fun linkIndexedFonts(indexPath: String, fontsDir: String, sample: String): Int
+
+    /**
+     * Read duration, streams, HDR, rotation and chapters of each path from its container
+     * headers, in parallel and without decoding. One MPVNode map per path, see [MediaProbe]
+     * for the keys, or MPVNode.None if the file could not be opened.
+     */
+    external fun probeMedia(paths: Array<String>): Array<MPVNode>?
+    /**
+     * Keep probe results of local files in [cachePath] across launches, keyed by content id
+     * (see [setContentIdCache]), so they follow files that are moved or renamed and are
+     * dropped once the content changes. null disables the cache.
+     */
+    external fun setProbeCache(cachePath: String?)
+
+    /**
+     * Content ids of [paths], hashed in parallel from their size and sampled blocks: stable
+     * keys that survive renames, moves and copies. null for URLs and unreadable files.
+     * Native caches (probe, thumbnails, waveforms, storyboards, subtitle index) use them.
+     */
+    external fun getContentIds(paths: Array<String>): Array<String?>
+    /** Remember content ids in [cachePath] across launches, null keeps them in memory only. */
+    external fun setContentIdCache(cachePath: String?)
+
+    /**
+     * Walk [roots] in the background and probe and thumbnail only files that are new or
+     * changed since the scan recorded in [indexPath]. Thumbnails are JPEGs in [thumbDir]
+     * (none if null) no larger than [thumbSize]. Results reach [ScanObserver]s in batches
+     * of [batchSize]. Returns false if a scan is already running.
+     */
+    external fun startLibraryScan(roots: Array<String>, indexPath: String, thumbDir: String?,
+                                  thumbSize: Int = 320, batchSize: Int = 32): Boolean
+    /** Stop the running scan after the current batch. */
+    external fun cancelLibraryScan()
+
+    /**
+     * Decode the audio of [path] (stream [streamIndex], -1 for the default one) and return
+     * min, max and RMS, interleaved, for each of [buckets] equal slices of its duration.
+     * Blocks until decoded; results are cached. null without audio or a known duration.
+     */
+    external fun getWaveform(path: String, buckets: Int, streamIndex: Int = -1): FloatArray?
+    /** Also keep waveforms of local files in [dir] across launches, null for memory only. */
+    external fun setWaveformCacheDir(dir: String?)
+
+    /**
+     * Measure EBU R128 loudness of [paths] on low-priority background threads. Results are
+     * stored in the probe cache, see [setProbeCache]; URLs are skipped.
+     */
+    external fun analyzeLoudness(paths: Array<String>)
+    /**
+     * Integrated loudness (LUFS), true peak (dBTP) and the gain (dB) normalizing [path] to
+     * -18 LUFS without clipping, for `setPropertyDouble("volume-gain", gain)` before
+     * playback. null until analyzed. Only reads the probe cache, never the file, so it is
+     * safe to call on the UI thread; files whose content id is not remembered (see
+     * [setContentIdCache]) read as not analyzed.
+     */
+    external fun getLoudness(path: String): DoubleArray?
+
+    /**
+     * Extract the text subtitles of [paths] without playback and index them into [indexDir],
+     * skipping files whose content is indexed already. Blocks; returns the number of files
+     * with subtitle text.
+     */
+    external fun indexSubtitles(indexDir: String, paths: Array<String>): Int
+    /**
+     * Find subtitle lines of the indexed [paths] containing every word of [query] (words
+     * match by prefix). Hits are maps with "path", "time" and "end" in seconds, "stream"
+     * and "text", in file and time order. Files without a current index are skipped.
+     */
+    external fun searchSubtitles(indexDir: String, paths: Array<String>, query: String,
+                                 maxHits: Int = 100): Array<MPVNode>?
+
+    /**
+     * Perceptual fingerprints of [paths], decoding six frames of each at fixed fractions of
+     * the duration. Blocks; null for files without decodable video.
+     */
+    external fun getFingerprints(paths: Array<String>): Array<LongArray?>
+    /**
+     * Pairs of [signatures] from [getFingerprints] at most [maxDistance] bits apart (of 384),
+     * flattened as (i, j, distance) with i < j. Re-encodes of the same video are usually
+     * within about 40; values above 71 are clamped.
+     */
+    external fun findDuplicates(signatures: Array<LongArray?>, maxDistance: Int = 40): IntArray
+
+    /**
+     * Copy [start] to [end] seconds of [src] into [dst] without re-encoding, in the background.
+     * The clip begins at the last keyframe at or before [start]. [container] is "mov",
+     * "matroska" or "mpegts", null to pick by the extension of [dst]. Streams the container
+     * cannot hold are left out. Returns false if the range is invalid or an export is running;
+     * otherwise [ExportObserver]s are told about progress and the result.
+     */
+    external fun exportClip(src: String, start: Double, end: Double, dst: String, container: String? = null): Boolean
+    /** Stop the running export, deleting its partial output. */
+    external fun cancelClipExport()
+
     external fun getPropertyInt(property: String): Int?
     external fun setPropertyInt(property: String, value: Int)
     external fun getPropertyDouble(property: String): Double?
@@ -61,6 +300,36 @@ object MPVLib {
 
     external fun observeProperty(property: String, format: Int)
 
+    private val destroyCallbacks: MutableMap<Long, () -> Unit> = HashMap()
+    private var nextDestroyToken = 1L
+
+    /**
+     * Destroy the current instance without blocking the caller.
+     *
+     * The instance is detached immediately and a new one may be created right away,
+     * while the old one shuts down on a native thread. Its video output lets go of the
+     * attached Surface first thing there; [attachSurface] on a new instance waits for
+     * that, which is only noticeable when attaching straight away. [onComplete] is
+     * invoked on that thread once the old instance is fully gone.
+     */
+    @JvmStatic
+    @JvmOverloads
+    fun destroyAsync(onComplete: (() -> Unit)? = null) {
+        val token = synchronized(destroyCallbacks) {
+            val token = nextDestroyToken++
+            if (onComplete != null)
+                destroyCallbacks[token] = onComplete
+            token
+        }
+        destroyAsync(token)
+    }
+
+    @JvmStatic
+    fun destroyComplete(token: Long) {
+        val callback = synchronized(destroyCallbacks) { destroyCallbacks.remove(token) }
+        callback?.invoke()
+    }
+
     private val observers: MutableList<EventObserver> = ArrayList()
 
     private val scope = CoroutineScope(Dispatchers.IO)
@@ -207,6 +476,96 @@ object MPVLib {
         scope.launch { logFlow.emit(Triple(prefix, level, text)) }
     }
 
+    private val qos_observers: MutableList<QosObserver> = ArrayList()
+
+    @JvmStatic
+    fun addQosObserver(o: QosObserver) {
+        synchronized(qos_observers) { qos_observers.add(o) }
+    }
+
+    @JvmStatic
+    fun removeQosObserver(o: QosObserver) {
+        synchronized(qos_observers) { qos_observers.remove(o) }
+    }
+
+    @JvmStatic
+    fun qosAlert(kind: Int, value: Double) {
+        synchronized(qos_observers) {
+            for (o in qos_observers) o.qosAlert(kind, value)
+        }
+    }
+
+    private val scan_observers: MutableList<ScanObserver> = ArrayList()
+
+    @JvmStatic
+    fun addScanObserver(o: ScanObserver) {
+        synchronized(scan_observers) { scan_observers.add(o) }
+    }
+
+    @JvmStatic
+    fun removeScanObserver(o: ScanObserver) {
+        synchronized(scan_observers) { scan_observers.remove(o) }
+    }
+
+    @JvmStatic
+    fun scanBatch(files: Array<MPVNode>) {
+        synchronized(scan_observers) {
+            for (o in scan_observers) o.scanBatch(files)
+        }
+    }
+
+    @JvmStatic
+    fun scanFinished(found: Int, processed: Int, removed: Int, cancelled: Boolean) {
+        synchronized(scan_observers) {
+            for (o in scan_observers) o.scanFinished(found, processed, removed, cancelled)
+        }
+    }
+
+    private val export_observers: MutableList<ExportObserver> = ArrayList()
+
+    @JvmStatic
+    fun addExportObserver(o: ExportObserver) {
+        synchronized(export_observers) { export_observers.add(o) }
+    }
+
+    @JvmStatic
+    fun removeExportObserver(o: ExportObserver) {
+        synchronized(export_observers) { export_observers.remove(o) }
+    }
+
+    @JvmStatic
+    fun exportProgress(progress: Double) {
+        synchronized(export_observers) {
+            for (o in export_observers) o.exportProgress(progress)
+        }
+    }
+
+    @JvmStatic
+    fun exportFinished(path: String, success: Boolean, cancelled: Boolean) {
+        synchronized(export_observers) {
+            for (o in export_observers) o.exportFinished(path, success, cancelled)
+        }
+    }
+
+    private val screenshot_observers: MutableList<ScreenshotObserver> = ArrayList()
+
+    @JvmStatic
+    fun addScreenshotObserver(o: ScreenshotObserver) {
+        synchronized(screenshot_observers) { screenshot_observers.add(o) }
+    }
+
+    @JvmStatic
+    fun removeScreenshotObserver(o: ScreenshotObserver) {
+        synchronized(screenshot_observers) { screenshot_observers.remove(o) }
+    }
+
+    @JvmStatic
+    fun screenshotSaved(path: String, success: Boolean) {
+        synchronized(screenshot_observers) {
+            for (o in screenshot_observers) o.screenshotSaved(path, success)
+        }
+    }
+
     interface EventObserver {
         fun eventProperty(property: String)
         fun eventProperty(property: String, value: Long)
@@ -221,6 +580,41 @@ object MPVLib {
         fun logMessage(prefix: String, level: Int, text: String)
     }
 
+    interface ScanObserver {
+        /**
+         * Maps with "path" and "status" ("new", "changed" or "removed"). Other than removed
+         * files also have "size", "mtime" (ms), "info" (as from [probeMedia]), "id" (as from
+         * [getContentIds]) and, if one was made, "thumbnail" (path of the JPEG).
+         */
+        fun scanBatch(files: Array<MPVNode>)
+        /** [found] media files in the roots, [processed] of them new or changed. */
+        fun scanFinished(found: Int, processed: Int, removed: Int, cancelled: Boolean)
+    }
+
+    interface ExportObserver {
+        /** Fraction of the clip written so far, from 0 to 1, in steps of at least 0.01. */
+        fun exportProgress(progress: Double)
+        /** The export to [path] is complete; on failure or cancellation nothing is left there. */
+        fun exportFinished(path: String, success: Boolean, cancelled: Boolean)
+    }
+
+    interface ScreenshotObserver {
+        /** A [captureScreenshot] to [path] is complete, in the order they were made. */
+        fun screenshotSaved(path: String, success: Boolean)
+    }
+
+    interface QosObserver {
+        /** [kind] is one of [QosAlert], [value] the measurement that crossed the threshold. */
+        fun qosAlert(kind: Int, value: Double)
+    }
+
+    object QosAlert {
+        const val DROP_RATE: Int = 0
+        const val CACHE_LOW: Int = 1
+        const val AVSYNC: Int = 2
+        const val STALL: Int = 3
+    }
+
     object MpvFormat {
         const val MPV_FORMAT_NONE: Int = 0
         const val MPV_FORMAT_STRING: Int = 1
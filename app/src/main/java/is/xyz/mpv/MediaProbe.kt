@@ -0,0 +1,101 @@
+package `is`.xyz.mpv
+
+import android.content.Context
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.withContext
+import java.io.File
+
+/**
+ * Library metadata read straight from container headers, for listing files
+ * without loading them into the player.
+ */
+object MediaProbe {
+    data class Track(
+        val type: String, // "video", "audio" or "sub"
+        val codec: String,
+        val language: String?,
+        val title: String?,
+        val isDefault: Boolean,
+        val width: Int = 0,
+        val height: Int = 0,
+        val channels: Int = 0,
+        val sampleRate: Int = 0
+    )
+
+    data class Chapter(val time: Double, val title: String)
+
+    data class MediaInfo(
+        val duration: Double?, // seconds
+        val bitRate: Long?,
+        val format: String,
+        val videoCodec: String?,
+        val width: Int,
+        val height: Int,
+        val fps: Double,
+        val rotation: Int, // clockwise degrees
+        val hdr: String?, // "hdr10", "hlg" or "dolby-vision"
+        val tracks: List<Track>,
+        val chapters: List<Chapter>
+    )
+
+    /**
+     * Cache results in the app's cache directory across launches.
+     * Call once before probing (typically in Application.onCreate).
+     */
+    @JvmStatic
+    fun initialize(context: Context) {
+        MPVLib.setContentIdCache(File(context.cacheDir, "content-id.cache").path)
+        MPVLib.setProbeCache(File(context.cacheDir, "probe.cache").path)
+    }
+
+    /**
+     * Probe all paths, in parallel.
+     *
+     * @return one entry per path, null where the file could not be opened
+     */
+    @JvmStatic
+    fun probe(paths: List<String>): List<MediaInfo?> {
+        val nodes = MPVLib.probeMedia(paths.toTypedArray()) ?: return paths.map { null }
+        return nodes.map { parse(it) }
+    }
+
+    /**
+     * Probe asynchronously (IO dispatcher).
+     */
+    suspend fun probeAsync(paths: List<String>): List<MediaInfo?> = withContext(Dispatchers.IO) {
+        probe(paths)
+    }
+
+    private fun parse(node: MPVNode): MediaInfo? {
+        if (node.asMap() == null)
+            return null
+        val video = node["video"]
+        return MediaInfo(
+            duration = node["duration"]?.asDouble(),
+            bitRate = node["bitrate"]?.asInt(),
+            format = node["format"]?.asString() ?: "",
+            videoCodec = video?.get("codec")?.asString(),
+            width = video?.get("width")?.asInt()?.toInt() ?: 0,
+            height = video?.get("height")?.asInt()?.toInt() ?: 0,
+            fps = video?.get("fps")?.asDouble() ?: 0.0,
+            rotation = video?.get("rotation")?.asInt()?.toInt() ?: 0,
+            hdr = video?.get("hdr")?.asString(),
+            tracks = node["tracks"]?.asArray()?.map { t ->
+                Track(
+                    type = t["type"]?.asString() ?: "",
+                    codec = t["codec"]?.asString() ?: "",
+                    language = t["lang"]?.asString(),
+                    title = t["title"]?.asString(),
+                    isDefault = t["default"]?.asBoolean() ?: false,
+                    width = t["width"]?.asInt()?.toInt() ?: 0,
+                    height = t["height"]?.asInt()?.toInt() ?: 0,
+                    channels = t["channels"]?.asInt()?.toInt() ?: 0,
+                    sampleRate = t["samplerate"]?.asInt()?.toInt() ?: 0
+                )
+            } ?: emptyList(),
+            chapters = node["chapters"]?.asArray()?.map { c ->
+                Chapter(c["time"]?.asDouble() ?: 0.0, c["title"]?.asString() ?: "")
+            } ?: emptyList()
+        )
+    }
+}
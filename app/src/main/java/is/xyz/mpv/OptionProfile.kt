@@ -0,0 +1,79 @@
+package `is`.xyz.mpv
+
+import java.io.ByteArrayOutputStream
+import java.io.Closeable
+
+/**
+ * A set of mpv options that is parsed once into native memory and can then be
+ * applied with a single JNI call, e.g. before every [MPVLib.init].
+ *
+ * The binary form returned by [toByteArray] can be persisted and passed to
+ * [fromBytes] on later launches to skip re-encoding.
+ */
+class OptionProfile private constructor(private var handle: Long) : Closeable {
+    /**
+     * Apply all options of this profile to the current mpv instance.
+     *
+     * @return mpv error code per option (0 on success), in profile order
+     */
+    fun apply(): IntArray {
+        check(handle != 0L) { "OptionProfile is closed" }
+        return MPVLib.applyOptionProfile(handle) ?: IntArray(0)
+    }
+
+    override fun close() {
+        if (handle != 0L) {
+            MPVLib.freeOptionProfile(handle)
+            handle = 0L
+        }
+    }
+
+    companion object {
+        private const val VERSION = 1
+
+        /**
+         * Encode options into the binary profile format.
+         */
+        @JvmStatic
+        fun encode(options: List<Pair<String, String>>): ByteArray {
+            val out = ByteArrayOutputStream()
+            fun u16(v: Int) {
+                out.write(v and 0xff)
+                out.write((v shr 8) and 0xff)
+            }
+            fun u32(v: Int) {
+                u16(v and 0xffff)
+                u16((v shr 16) and 0xffff)
+            }
+
+            out.write("MPVO".toByteArray(Charsets.US_ASCII))
+            out.write(VERSION)
+            u32(options.size)
+            for ((key, value) in options) {
+                val k = key.toByteArray(Charsets.UTF_8)
+                val v = value.toByteArray(Charsets.UTF_8)
+                require(k.size <= 0xffff) { "Option name too long: $key" }
+                u16(k.size)
+                out.write(k)
+                u32(v.size)
+                out.write(v)
+            }
+            return out.toByteArray()
+        }
+
+        /**
+         * Parse a profile previously produced by [encode].
+         *
+         * @return the profile, or null if the data is malformed
+         */
+        @JvmStatic
+        fun fromBytes(data: ByteArray): OptionProfile? {
+            val handle = MPVLib.parseOptionProfile(data)
+            return if (handle != 0L) OptionProfile(handle) else null
+        }
+
+        @JvmStatic
+        fun of(options: List<Pair<String, String>>): OptionProfile =
+            fromBytes(encode(options))!!
+    }
+}
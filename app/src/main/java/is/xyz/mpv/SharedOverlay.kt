@@ -0,0 +1,61 @@
+package `is`.xyz.mpv
+
+import android.graphics.Bitmap
+import java.io.Closeable
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+
+/**
+ * A bitmap overlay shown through mpv's `overlay-add`, backed by a native
+ * memory buffer instead of temporary files.
+ *
+ * Draw premultiplied BGRA pixels into [buffer] and call [post]; mpv copies them,
+ * so the next frame can be drawn right after. Alternatively [post] an ARGB_8888
+ * Bitmap of the same size.
+ *
+ * @param id overlay-add id, 0-63
+ */
+class SharedOverlay(val id: Int, val width: Int, val height: Int) : Closeable {
+    private var handle: Long = MPVLib.overlayCreate(id, width, height)
+
+    init {
+        require(handle != 0L) { "Failed to create overlay $id (${width}x$height)" }
+    }
+
+    /** The buffer to draw the next frame into, `width * 4` bytes per row. */
+    val buffer: ByteBuffer
+        get() {
+            check(handle != 0L) { "SharedOverlay is closed" }
+            return MPVLib.overlayBuffer(handle)!!.order(ByteOrder.LITTLE_ENDIAN)
+        }
+
+    /**
+     * Show what was drawn into [buffer] at ([x], [y]), optionally scaled to [dw]x[dh].
+     *
+     * @return mpv error code, 0 on success
+     */
+    @JvmOverloads
+    fun post(x: Int, y: Int, dw: Int = 0, dh: Int = 0): Int {
+        check(handle != 0L) { "SharedOverlay is closed" }
+        return MPVLib.overlayPost(handle, x, y, dw, dh)
+    }
+
+    @JvmOverloads
+    fun post(bitmap: Bitmap, x: Int, y: Int, dw: Int = 0, dh: Int = 0): Int {
+        check(handle != 0L) { "SharedOverlay is closed" }
+        return MPVLib.overlayPostBitmap(handle, bitmap, x, y, dw, dh)
+    }
+
+    /** Hide the overlay, it can be shown again with [post]. */
+    fun hide() {
+        if (handle != 0L)
+            MPVLib.overlayRemove(handle)
+    }
+
+    override fun close() {
+        if (handle != 0L) {
+            MPVLib.overlayDestroy(handle)
+            handle = 0L
+        }
+    }
+}
@@ -49,6 +49,27 @@ object Utils {
         }
     }
 
+    /**
+     * Make the system fonts for the device languages available to subtitles. The
+     * font index is only rebuilt when the installed fonts change, so this is cheap
+     * after the first launch. Call it before [BaseMPVView.initialize].
+     */
+    fun prepareSystemFonts(context: Context) {
+        val index = "${context.cacheDir.path}/fonts.idx"
+        if (MPVLib.buildFontIndex(index) <= 0)
+            return
+        // each language's name written in that language covers its script
+        val locales = if (Build.VERSION.SDK_INT >= Build.VERSION_CODES.N) {
+            val list = context.resources.configuration.locales
+            (0 until list.size()).map { list[it] }
+        } else {
+            @Suppress("DEPRECATION")
+            listOf(context.resources.configuration.locale)
+        }
+        val sample = locales.joinToString(" ") { it.getDisplayName(it) }
+        MPVLib.linkIndexedFonts(index, "${context.filesDir.path}/fonts", sample)
+    }
+
     fun findRealPath(fd: Int): String? {
         var ins: InputStream? = null
         try {
@@ -63,6 +84,20 @@ object Utils {
         return null
     }
 
+    /**
+     * URI that makes mpv read [fd] through the native fdstream protocol, without
+     * resolving a real path. The descriptor is duplicated when mpv opens it, so it
+     * has to stay open until the file is loaded; closing it is up to the caller.
+     */
+    fun fdStreamUri(fd: Int): String = "fdstream://$fd"
+
+    /**
+     * URI that makes mpv read [uri] through the parallel read-ahead layer. Worth it
+     * for high-latency sources: http(s) servers that support range requests, slow
+     * network mounts or [fdStreamUri] descriptors.
+     */
+    fun readaheadUri(uri: String): String = "readahead://$uri"
+
     fun convertDp(context: Context, dp: Float): Int {
         return TypedValue.applyDimension(TypedValue.COMPLEX_UNIT_DIP, dp,
                 context.resources.displayMetrics).toInt()
@@ -76,8 +76,40 @@ LOCAL_SRC_FILES := \
 	property.cpp \
 	event.cpp \
 	node.cpp \
-	thumbnail.cpp
-LOCAL_LDLIBS    := -llog -lGLESv3 -lEGL -latomic
+	audio_decode.cpp \
+	clip.cpp \
+	content_id.cpp \
+	fdstream.cpp \
+	fingerprint.cpp \
+	fontindex.cpp \
+	input.cpp \
+	loudness.cpp \
+	memory.cpp \
+	options.cpp \
+	overlay.cpp \
+	palette.cpp \
+	probe.cpp \
+	qos.cpp \
+	readahead.cpp \
+	readahead_stream.cpp \
+	scanner.cpp \
+	screenshot.cpp \
+	scrub.cpp \
+	stats.cpp \
+	startup_timing.cpp \
+	storyboard.cpp \
+	subindex.cpp \
+	thumbnail.cpp \
+	trace.cpp \
+	trickplay.cpp \
+	waveform.cpp \
+	workpool.cpp
+LOCAL_LDLIBS    := -llog -lGLESv3 -lEGL -ljnigraphics -latomic
 LOCAL_SHARED_LIBRARIES := swscale avcodec avformat avutil mpv
+# ndk-build MPV_TRACE=1 adds trace spans (see trace.h)
+ifeq ($(MPV_TRACE),1)
+LOCAL_CFLAGS    += -DMPV_TRACE
+LOCAL_LDLIBS    += -ldl
+endif
 
 include $(BUILD_SHARED_LIBRARY)
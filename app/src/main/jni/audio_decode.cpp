@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <vector>
+
+extern "C" {
+    #include <libavformat/avformat.h>
+    #include <libavcodec/avcodec.h>
+};
+
+#include "audio_decode.h"
+#include "log.h"
+#include "trace.h"
+#include "workpool.h"
+
+// ============================================================================
+// AUDIO SEGMENT DECODING
+// Whole-file audio analysis splits the stream into segments that are decoded
+// in parallel, each from its own demuxer seeked to the segment start. Samples
+// before the start (the seek lands on an earlier packet) are dropped, so
+// segments cover the stream exactly once.
+// ============================================================================
+
+// below this, one decoder is faster than opening several
+static const double MIN_SEGMENT_SECONDS = 60;
+static const int MAX_SEGMENTS = 8;
+
+// Opens path with every stream but the chosen audio stream discarded.
+static AVFormatContext *open_audio(const char *path, int stream, int *index)
+{
+    AVFormatContext *fmt = NULL;
+    if (avformat_open_input(&fmt, path, NULL, NULL) < 0) {
+        ALOGV("Audio | Failed to open %s", path);
+        return NULL;
+    }
+    // also settles the output sample rate of codecs like HE-AAC
+    fmt->probesize = 500000;
+    fmt->max_analyze_duration = 500000;
+    if (avformat_find_stream_info(fmt, NULL) < 0)
+        ALOGV("Audio | Incomplete stream info for %s", path);
+
+    int idx = stream;
+    if (idx < 0)
+        idx = av_find_best_stream(fmt, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+    if (idx < 0 || idx >= (int)fmt->nb_streams || fmt->streams[idx]->codecpar->codec_type != AVMEDIA_TYPE_AUDIO) {
+        ALOGV("Audio | No audio stream in %s", path);
+        avformat_close_input(&fmt);
+        return NULL;
+    }
+    for (unsigned i = 0; i < fmt->nb_streams; i++)
+        fmt->streams[i]->discard = (int)i == idx ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    *index = idx;
+    return fmt;
+}
+
+static int64_t stream_start(const AVStream *st)
+{
+    return st->start_time != AV_NOPTS_VALUE ? st->start_time : 0;
+}
+
+bool audio_stream_open_info(const char *path, int stream, audio_stream_info *out)
+{
+    TRACE_SCOPE("audio:open");
+    int idx;
+    AVFormatContext *fmt = open_audio(path, stream, &idx);
+    if (!fmt)
+        return false;
+    const AVStream *st = fmt->streams[idx];
+    double duration = -1;
+    if (st->duration != AV_NOPTS_VALUE)
+        duration = st->duration * av_q2d(st->time_base);
+    else if (fmt->duration != AV_NOPTS_VALUE)
+        duration = fmt->duration / (double)AV_TIME_BASE;
+
+    out->stream = idx;
+    out->sample_rate = st->codecpar->sample_rate;
+    out->channels = st->codecpar->ch_layout.nb_channels;
+    out->total_samples = (int64_t)(duration * out->sample_rate);
+    out->channel_ids.resize(std::max(out->channels, 0));
+    for (int c = 0; c < out->channels; c++)
+        out->channel_ids[c] = av_channel_layout_channel_from_index(&st->codecpar->ch_layout, c);
+    avformat_close_input(&fmt);
+    return out->sample_rate > 0 && out->channels > 0 && out->total_samples > 0;
+}
+
+int audio_segment_count(const audio_stream_info &info)
+{
+    double seconds = info.total_samples / (double)info.sample_rate;
+    int by_length = (int)(seconds / MIN_SEGMENT_SECONDS);
+    int by_threads = workpool_threads() + 1;
+    return std::max(1, std::min(std::min(by_length, by_threads), MAX_SEGMENTS));
+}
+
+// Points planes at `count` samples of every channel from `offset`, converting
+// to float in scratch unless the frame is planar float already.
+static bool frame_planes(const AVFrame *frame, int channels, int offset, int count,
+    std::vector<float> &scratch, std::vector<const float*> &planes)
+{
+    enum AVSampleFormat format = (enum AVSampleFormat)frame->format;
+    planes.resize(channels);
+    if (format == AV_SAMPLE_FMT_FLTP) {
+        for (int c = 0; c < channels; c++)
+            planes[c] = reinterpret_cast<const float*>(frame->extended_data[c]) + offset;
+        return true;
+    }
+
+    bool planar = av_sample_fmt_is_planar(format);
+    scratch.resize((size_t)channels * count);
+    for (int c = 0; c < channels; c++) {
+        float *dst = &scratch[(size_t)c * count];
+        planes[c] = dst;
+        const uint8_t *src = frame->extended_data[planar ? c : 0];
+        // index of sample i of this channel
+        size_t step = planar ? 1 : channels, first = planar ? offset : (size_t)offset * channels + c;
+        switch (format) {
+        case AV_SAMPLE_FMT_U8:
+        case AV_SAMPLE_FMT_U8P:
+            for (int i = 0; i < count; i++)
+                dst[i] = (src[first + i * step] - 128) * (1.0f / 128);
+            break;
+        case AV_SAMPLE_FMT_S16:
+        case AV_SAMPLE_FMT_S16P:
+            for (int i = 0; i < count; i++)
+                dst[i] = reinterpret_cast<const int16_t*>(src)[first + i * step] * (1.0f / 32768);
+            break;
+        case AV_SAMPLE_FMT_S32:
+        case AV_SAMPLE_FMT_S32P:
+            for (int i = 0; i < count; i++)
+                dst[i] = reinterpret_cast<const int32_t*>(src)[first + i * step] * (1.0f / 2147483648.0f);
+            break;
+        case AV_SAMPLE_FMT_FLT:
+            for (int i = 0; i < count; i++)
+                dst[i] = reinterpret_cast<const float*>(src)[first + i * step];
+            break;
+        case AV_SAMPLE_FMT_DBL:
+        case AV_SAMPLE_FMT_DBLP:
+            for (int i = 0; i < count; i++)
+                dst[i] = reinterpret_cast<const double*>(src)[first + i * step];
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+bool decode_audio_range(const char *path, const audio_stream_info &info, int64_t first, int64_t end,
+    const audio_sink &sink)
+{
+    TRACE_SCOPE("audio:decode-range");
+    int idx;
+    AVFormatContext *fmt = open_audio(path, info.stream, &idx);
+    if (!fmt)
+        return false;
+    AVStream *st = fmt->streams[idx];
+    const AVCodec *codec = avcodec_find_decoder(st->codecpar->codec_id);
+    AVCodecContext *dec = codec ? avcodec_alloc_context3(codec) : NULL;
+    if (!dec || avcodec_parameters_to_context(dec, st->codecpar) < 0) {
+        ALOGE("Audio | No decoder for %s", avcodec_get_name(st->codecpar->codec_id));
+        avcodec_free_context(&dec);
+        avformat_close_input(&fmt);
+        return false;
+    }
+    dec->pkt_timebase = st->time_base;
+    // segments already run in parallel
+    dec->thread_count = 1;
+    if (avcodec_open2(dec, codec, NULL) < 0) {
+        ALOGE("Audio | Failed to open decoder");
+        avcodec_free_context(&dec);
+        avformat_close_input(&fmt);
+        return false;
+    }
+
+    AVRational sample_tb = { 1, info.sample_rate };
+    if (first > 0) {
+        int64_t ts = stream_start(st) + av_rescale_q(first, sample_tb, st->time_base);
+        if (av_seek_frame(fmt, idx, ts, AVSEEK_FLAG_BACKWARD) < 0)
+            ALOGV("Audio | Seek failed, decoding from the start");
+    }
+
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    std::vector<float> scratch;
+    std::vector<const float*> planes;
+    int64_t next_pos = first > 0 ? -1 : 0;  // -1: unknown until a timestamp shows up
+    bool done = false, eof = false;
+    while (packet && frame && !done) {
+        if (!eof) {
+            int ret = av_read_frame(fmt, packet);
+            if (ret < 0) {
+                eof = true;
+                avcodec_send_packet(dec, NULL);
+            } else {
+                if (packet->stream_index == idx)
+                    avcodec_send_packet(dec, packet);
+                av_packet_unref(packet);
+            }
+        }
+        int ret = 0;
+        while (!done && (ret = avcodec_receive_frame(dec, frame)) >= 0) {
+            int64_t pos = next_pos;
+            if (frame->best_effort_timestamp != AV_NOPTS_VALUE)
+                pos = av_rescale_q(frame->best_effort_timestamp - stream_start(st), st->time_base, sample_tb);
+            int count = frame->nb_samples;
+            if (pos >= 0) {
+                next_pos = pos + count;
+                int skip = (int)std::max<int64_t>(0, std::min<int64_t>(first - pos, count));
+                int take = (int)std::max<int64_t>(0, std::min<int64_t>(end - pos, count) - skip);
+                int channels = frame->ch_layout.nb_channels;
+                if (take > 0 && frame_planes(frame, channels, skip, take, scratch, planes))
+                    sink(planes.data(), channels, pos + skip, take);
+                done = pos + count >= end;
+            }
+            av_frame_unref(frame);
+        }
+        // drained
+        if (eof && ret < 0)
+            break;
+    }
+
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    avcodec_free_context(&dec);
+    avformat_close_input(&fmt);
+    return true;
+}
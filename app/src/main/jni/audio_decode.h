@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+// Decodes one audio stream of a file with FFmpeg, straight to planar float,
+// for whole-file analysis (waveforms, loudness). Every other stream is
+// discarded at the demuxer. Positions are counted in samples per channel
+// from the start of the stream.
+
+struct audio_stream_info {
+    int stream;             // index in the container
+    int sample_rate;
+    int channels;
+    int64_t total_samples;  // from the container duration, estimated
+    std::vector<int> channel_ids; // AVChannel of each channel, AV_CHAN_NONE if unknown
+};
+
+// Called with `count` samples of every channel, the first at `pos`.
+typedef std::function<void(const float *const *planes, int channels, int64_t pos, int count)> audio_sink;
+
+// Find the audio stream (`stream` < 0 picks the default one). False if there
+// is none or the duration is unknown.
+bool audio_stream_open_info(const char *path, int stream, audio_stream_info *out);
+
+// Decode samples [first, end) of the stream, delivered in order. Returns
+// false if the file could not be decoded at all.
+bool decode_audio_range(const char *path, const audio_stream_info &info, int64_t first, int64_t end,
+    const audio_sink &sink);
+
+// Number of segments worth decoding in parallel for a stream of this length.
+int audio_segment_count(const audio_stream_info &info);
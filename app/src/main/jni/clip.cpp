@@ -0,0 +1,386 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <jni.h>
+
+extern "C" {
+    #include <libavformat/avformat.h>
+    #include <libavcodec/avcodec.h>
+};
+
+#include "jni_utils.h"
+#include "log.h"
+#include "stats.h"
+#include "trace.h"
+
+extern "C" {
+    jni_func(jboolean, exportClip, jstring jsrc, jdouble start, jdouble end, jstring jdst, jstring jcontainer);
+    jni_func(void, cancelClipExport);
+};
+
+// ============================================================================
+// CLIP EXPORT
+// Copies the packets of [start, end] into a new file without decoding. The
+// clip begins at the last video keyframe at or before start, since nothing
+// before it can be decoded; timestamps are shifted so it starts at zero. Seeks
+// that land past that keyframe are retried from further back.
+// Runs on its own thread, reporting to MPVLib.exportProgress() and
+// MPVLib.exportFinished(). Only the muxers enabled in the FFmpeg build
+// (mov, matroska, mpegts) are available.
+// ============================================================================
+
+// packets held from the keyframe the clip may start at until it is certain
+static const size_t MAX_PENDING = 2048;
+// how far before start to seek when a seek lands past the keyframe it needs,
+// doubled on every retry
+static const int64_t SEEK_BACKOFF = 5 * AV_TIME_BASE;
+
+struct export_ctx {
+    JavaVM *vm;
+    JNIEnv *env;
+    std::string src, dst;
+    std::string container;      // muxer name, empty: by dst extension
+    double start, end;
+    int last_percent;
+};
+
+static std::atomic<bool> g_export_running(false);
+static std::atomic<bool> g_export_cancel(false);
+
+static void report_progress(export_ctx *ctx, double fraction)
+{
+    int percent = (int)(std::min(std::max(fraction, 0.0), 1.0) * 100);
+    if (!ctx->env || percent <= ctx->last_percent)
+        return;
+    ctx->last_percent = percent;
+    ctx->env->CallStaticVoidMethod(mpv_MPVLib, mpv_MPVLib_exportProgress, (jdouble)(percent / 100.0));
+    if (ctx->env->ExceptionCheck())
+        ctx->env->ExceptionClear();
+}
+
+// Output streams for the audio, video and subtitle streams the muxer takes.
+// map[i] is the output index of input stream i, -1 if it is left out.
+static bool add_streams(AVFormatContext *in, AVFormatContext *out, std::vector<int> *map)
+{
+    map->assign(in->nb_streams, -1);
+    for (unsigned i = 0; i < in->nb_streams; i++) {
+        AVStream *ist = in->streams[i];
+        AVCodecParameters *par = ist->codecpar;
+        bool wanted = par->codec_type == AVMEDIA_TYPE_VIDEO || par->codec_type == AVMEDIA_TYPE_AUDIO ||
+            par->codec_type == AVMEDIA_TYPE_SUBTITLE;
+        if (!wanted || (ist->disposition & AV_DISPOSITION_ATTACHED_PIC) ||
+                avformat_query_codec(out->oformat, par->codec_id, FF_COMPLIANCE_NORMAL) != 1) {
+            ALOGV("Clip | Leaving out stream %u (%s)", i, avcodec_get_name(par->codec_id));
+            ist->discard = AVDISCARD_ALL;
+            continue;
+        }
+        AVStream *ost = avformat_new_stream(out, NULL);
+        if (!ost || avcodec_parameters_copy(ost->codecpar, par) < 0)
+            return false;
+        // tags are container specific, let the muxer pick its own
+        ost->codecpar->codec_tag = 0;
+        ost->time_base = ist->time_base;
+        ost->disposition = ist->disposition;
+        av_dict_copy(&ost->metadata, ist->metadata, 0);
+        (*map)[i] = ost->index;
+    }
+    for (int m : *map) {
+        if (m >= 0)
+            return true;
+    }
+    ALOGE("Clip | No streams the %s muxer can take", out->oformat->name);
+    return false;
+}
+
+// Shifts the packet by offset (AV_TIME_BASE units) and writes it.
+static bool write_packet(AVFormatContext *in, AVFormatContext *out, const std::vector<int> &map,
+    int64_t offset, AVPacket *packet)
+{
+    AVStream *ist = in->streams[packet->stream_index];
+    AVStream *ost = out->streams[map[packet->stream_index]];
+    int64_t shift = av_rescale_q(offset, AV_TIME_BASE_Q, ist->time_base);
+    if (packet->pts != AV_NOPTS_VALUE)
+        packet->pts -= shift;
+    if (packet->dts != AV_NOPTS_VALUE)
+        packet->dts -= shift;
+    av_packet_rescale_ts(packet, ist->time_base, ost->time_base);
+    packet->stream_index = ost->index;
+    packet->pos = -1;
+    return av_interleaved_write_frame(out, packet) >= 0;
+}
+
+static inline int64_t packet_time(AVFormatContext *in, const AVPacket *packet)
+{
+    int64_t ts = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+    if (ts == AV_NOPTS_VALUE)
+        return AV_NOPTS_VALUE;
+    return av_rescale_q(ts, in->streams[packet->stream_index]->time_base, AV_TIME_BASE_Q);
+}
+
+static void drop_pending(std::vector<AVPacket*> *pending)
+{
+    for (AVPacket *p : *pending)
+        av_packet_free(&p);
+    pending->clear();
+}
+
+// Writes the held packets from offset on.
+static bool flush_pending(AVFormatContext *in, AVFormatContext *out, const std::vector<int> &map,
+    int64_t offset, std::vector<AVPacket*> *pending)
+{
+    bool ok = true;
+    for (AVPacket *p : *pending) {
+        int64_t pt = p ? packet_time(in, p) : AV_NOPTS_VALUE;
+        if (ok && pt != AV_NOPTS_VALUE && pt >= offset)
+            ok = write_packet(in, out, map, offset, p);
+    }
+    drop_pending(pending);
+    return ok;
+}
+
+// Copies the packets from the last keyframe at or before start up to end.
+static bool copy_packets(export_ctx *ctx, AVFormatContext *in, AVFormatContext *out, const std::vector<int> &map)
+{
+    TRACE_SCOPE("clip:copy");
+    int64_t base = in->start_time != AV_NOPTS_VALUE ? in->start_time : 0;
+    int64_t start = base + (int64_t)(ctx->start * AV_TIME_BASE);
+    int64_t end = base + (int64_t)(ctx->end * AV_TIME_BASE);
+    // nothing earlier to seek back to once the file is read from its beginning
+    bool at_beginning = av_seek_frame(in, -1, start, AVSEEK_FLAG_BACKWARD) < 0 || start <= base;
+    if (at_beginning && start > base)
+        ALOGV("Clip | Seek failed, copying from the beginning");
+    int64_t backoff = SEEK_BACKOFF;
+
+    // the clip starts at a video keyframe, or at start for audio only
+    int video = -1;
+    for (unsigned i = 0; i < in->nb_streams && video < 0; i++) {
+        if (map[i] >= 0 && in->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+            video = i;
+    }
+    int64_t offset = video < 0 ? start : AV_NOPTS_VALUE;
+    // latest keyframe at or before start seen so far
+    int64_t candidate = AV_NOPTS_VALUE;
+    std::vector<AVPacket*> pending;
+    bool overflowed = false;
+    // copying stops once every audio and video stream is past end; subtitle
+    // streams are too sparse to wait for
+    std::vector<bool> done(in->nb_streams, false);
+    int remaining = 0;
+    for (unsigned i = 0; i < in->nb_streams; i++)
+        remaining += map[i] >= 0 && in->streams[i]->codecpar->codec_type != AVMEDIA_TYPE_SUBTITLE;
+    const int streams = remaining;
+
+    AVPacket *packet = av_packet_alloc();
+    bool ok = packet != NULL;
+    while (ok && remaining > 0 && !g_export_cancel && av_read_frame(in, packet) >= 0) {
+        int idx = packet->stream_index;
+        int64_t t = packet_time(in, packet);
+        if (map[idx] < 0 || done[idx]) {
+            av_packet_unref(packet);
+            continue;
+        }
+
+        if (offset == AV_NOPTS_VALUE && idx == video && t != AV_NOPTS_VALUE) {
+            bool key = packet->flags & AV_PKT_FLAG_KEY;
+            if (key && t <= start) {
+                // a later keyframe still in time, what came before is not needed
+                drop_pending(&pending);
+                candidate = t;
+            } else if (t > start && candidate == AV_NOPTS_VALUE && !at_beginning) {
+                // the seek landed past the keyframe start needs, go further back
+                int64_t seek_to = std::max(base, start - backoff);
+                backoff *= 2;
+                ALOGV("Clip | No keyframe before start, retrying from %.3f", (seek_to - base) / (double)AV_TIME_BASE);
+                at_beginning = av_seek_frame(in, -1, seek_to, AVSEEK_FLAG_BACKWARD) < 0 || seek_to <= base;
+                drop_pending(&pending);
+                done.assign(in->nb_streams, false);
+                remaining = streams;
+                av_packet_unref(packet);
+                continue;
+            } else if (key && candidate == AV_NOPTS_VALUE) {
+                // nothing earlier in the file, start at the first keyframe there is
+                candidate = t;
+            }
+            if (candidate != AV_NOPTS_VALUE && t > start) {
+                offset = candidate;
+                ok = flush_pending(in, out, map, offset, &pending);
+            }
+        }
+        if (t != AV_NOPTS_VALUE && t > end) {
+            done[idx] = true;
+            remaining -= in->streams[idx]->codecpar->codec_type != AVMEDIA_TYPE_SUBTITLE;
+            av_packet_unref(packet);
+            continue;
+        }
+
+        if (offset == AV_NOPTS_VALUE) {
+            // video before the first keyframe is not decodable, the rest waits
+            // until it is clear where the clip starts
+            if (idx != video || candidate != AV_NOPTS_VALUE) {
+                if (pending.size() < MAX_PENDING) {
+                    pending.push_back(av_packet_clone(packet));
+                } else if (!overflowed) {
+                    ALOGW("Clip | More than %zu packets before start, dropping the rest", MAX_PENDING);
+                    overflowed = true;
+                }
+            }
+            av_packet_unref(packet);
+            continue;
+        }
+        if (t != AV_NOPTS_VALUE && t < offset) {
+            av_packet_unref(packet);
+            continue;
+        }
+        ok = ok && write_packet(in, out, map, offset, packet);
+        av_packet_unref(packet);
+        if (idx == video || video < 0)
+            report_progress(ctx, t == AV_NOPTS_VALUE ? 0 : (double)(t - offset) / std::max<int64_t>(1, end - offset));
+    }
+    if (ok && offset == AV_NOPTS_VALUE && candidate != AV_NOPTS_VALUE && !g_export_cancel) {
+        // the file ended before the video got past start
+        offset = candidate;
+        ok = flush_pending(in, out, map, offset, &pending);
+    }
+    drop_pending(&pending);
+    av_packet_free(&packet);
+    if (ok && offset == AV_NOPTS_VALUE) {
+        ALOGE("Clip | No keyframe in range");
+        return false;
+    }
+    return ok;
+}
+
+static bool export_clip(export_ctx *ctx)
+{
+    AVFormatContext *in = NULL;
+    if (avformat_open_input(&in, ctx->src.c_str(), NULL, NULL) < 0) {
+        ALOGE("Clip | Failed to open %s", ctx->src.c_str());
+        return false;
+    }
+    if (avformat_find_stream_info(in, NULL) < 0)
+        ALOGV("Clip | Incomplete stream info");
+
+    AVFormatContext *out = NULL;
+    avformat_alloc_output_context2(&out, NULL, ctx->container.empty() ? NULL : ctx->container.c_str(),
+        ctx->dst.c_str());
+    if (!out) {
+        ALOGE("Clip | No muxer for %s", ctx->container.empty() ? ctx->dst.c_str() : ctx->container.c_str());
+        avformat_close_input(&in);
+        return false;
+    }
+    std::vector<int> map;
+    if (!add_streams(in, out, &map)) {
+        avformat_free_context(out);
+        avformat_close_input(&in);
+        return false;
+    }
+
+    // written next to dst and renamed, so a failed export leaves nothing behind
+    std::string tmp = ctx->dst + ".tmp";
+    if (avio_open(&out->pb, tmp.c_str(), AVIO_FLAG_WRITE) < 0) {
+        ALOGE("Clip | Failed to create %s", tmp.c_str());
+        avformat_free_context(out);
+        avformat_close_input(&in);
+        return false;
+    }
+    bool ok = avformat_write_header(out, NULL) >= 0;
+    if (!ok)
+        ALOGE("Clip | Failed to write header");
+    ok = ok && copy_packets(ctx, in, out, map) && !g_export_cancel;
+    ok = ok && av_write_trailer(out) >= 0;
+    avio_closep(&out->pb);
+    avformat_free_context(out);
+    avformat_close_input(&in);
+
+    if (ok && rename(tmp.c_str(), ctx->dst.c_str()) != 0) {
+        ALOGE("Clip | Failed to rename to %s", ctx->dst.c_str());
+        ok = false;
+    }
+    if (!ok)
+        unlink(tmp.c_str());
+    return ok;
+}
+
+static void *export_thread(void *arg)
+{
+    pthread_setname_np(pthread_self(), "clip-export");
+    export_ctx *ctx = static_cast<export_ctx*>(arg);
+    if (!acquire_jni_env(ctx->vm, &ctx->env))
+        ctx->env = NULL;
+
+    bool ok = export_clip(ctx);
+    bool cancelled = g_export_cancel;
+    ALOGV("Clip | %s %s", ctx->dst.c_str(), ok ? "done" : cancelled ? "cancelled" : "failed");
+    if (ctx->env) {
+        jstring jdst = ctx->env->NewStringUTF(ctx->dst.c_str());
+        ctx->env->CallStaticVoidMethod(mpv_MPVLib, mpv_MPVLib_exportFinished, jdst, (jboolean)ok, (jboolean)cancelled);
+        if (ctx->env->ExceptionCheck())
+            ctx->env->ExceptionClear();
+        ctx->env->DeleteLocalRef(jdst);
+        ctx->vm->DetachCurrentThread();
+    }
+
+    delete ctx;
+    g_export_running = false;
+    return NULL;
+}
+
+// Exports the clip in the background, false if the arguments are invalid or
+// an export is already running.
+jni_func(jboolean, exportClip, jstring jsrc, jdouble start, jdouble end, jstring jdst, jstring jcontainer) {
+    STATS_SCOPE("MPVLib.exportClip");
+    init_methods_cache(env);
+    if (start < 0 || end <= start) {
+        ALOGE("Clip | Invalid range %.3f-%.3f", start, end);
+        return JNI_FALSE;
+    }
+    if (g_export_running.exchange(true)) {
+        ALOGV("Clip | Already running");
+        return JNI_FALSE;
+    }
+    g_export_cancel = false;
+
+    export_ctx *ctx = new export_ctx();
+    env->GetJavaVM(&ctx->vm);
+    ctx->env = NULL;
+    const char *src = env->GetStringUTFChars(jsrc, NULL);
+    ctx->src = src;
+    env->ReleaseStringUTFChars(jsrc, src);
+    const char *dst = env->GetStringUTFChars(jdst, NULL);
+    ctx->dst = dst;
+    env->ReleaseStringUTFChars(jdst, dst);
+    if (jcontainer) {
+        const char *container = env->GetStringUTFChars(jcontainer, NULL);
+        ctx->container = container;
+        env->ReleaseStringUTFChars(jcontainer, container);
+    }
+    ctx->start = start;
+    ctx->end = end;
+    ctx->last_percent = -1;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, &attr, export_thread, ctx) != 0) {
+        ALOGE("Clip | Failed to start thread");
+        pthread_attr_destroy(&attr);
+        delete ctx;
+        g_export_running = false;
+        return JNI_FALSE;
+    }
+    pthread_attr_destroy(&attr);
+    return JNI_TRUE;
+}
+
+// Stops the running export; the partial output is deleted.
+jni_func(void, cancelClipExport) {
+    STATS_SCOPE("MPVLib.cancelClipExport");
+    g_export_cancel = true;
+}
@@ -0,0 +1,361 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <jni.h>
+
+#include "content_id.h"
+#include "jni_utils.h"
+#include "log.h"
+#include "stats.h"
+#include "trace.h"
+#include "workpool.h"
+
+extern "C" {
+    jni_func(jobjectArray, getContentIds, jobjectArray jpaths);
+    jni_func(void, setContentIdCache, jstring jpath);
+};
+
+// ============================================================================
+// CONTENT IDS
+// XXH64 over the file size and sampled blocks read with pread, with the
+// kernel told not to read ahead around them. Ids are remembered per path
+// (with size and mtime) in memory and in an append-only file, so a file is
+// only read again after it changed or showed up under a new path.
+// ============================================================================
+
+#define CACHE_MAGIC "MPVCID"
+static const uint32_t CACHE_VERSION = 1;
+static const size_t EDGE_BLOCK = 64 * 1024;
+static const size_t MIDDLE_BLOCK = 16 * 1024;
+static const int MIDDLE_BLOCKS = 6;
+// smaller files are hashed whole
+static const int64_t SAMPLED_SIZE = 2 * EDGE_BLOCK + MIDDLE_BLOCKS * MIDDLE_BLOCK;
+
+struct known_id {
+    int64_t size, mtime;
+    uint64_t hash;
+};
+
+static std::unordered_map<std::string, known_id> g_known;
+static std::string g_cache_path;
+static FILE *g_cache_file;  // open for appending
+static std::mutex g_known_mutex;
+
+// ----------------------------------------------------------------------------
+// hashing
+// ----------------------------------------------------------------------------
+
+static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t lane)
+{
+    acc += lane * PRIME64_2;
+    return rotl64(acc, 31) * PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t v)
+{
+    acc ^= xxh64_round(0, v);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+// XXH64, little-endian like every ABI we ship
+static uint64_t xxh64(const uint8_t *p, size_t len, uint64_t seed)
+{
+    const uint8_t *end = p + len;
+    uint64_t h;
+    if (len >= 32) {
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2, v2 = seed + PRIME64_2, v3 = seed, v4 = seed - PRIME64_1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = xxh64_round(v1, read64(p));
+            v2 = xxh64_round(v2, read64(p + 8));
+            v3 = xxh64_round(v3, read64(p + 16));
+            v4 = xxh64_round(v4, read64(p + 24));
+        }
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh64_merge(h, v1);
+        h = xxh64_merge(h, v2);
+        h = xxh64_merge(h, v3);
+        h = xxh64_merge(h, v4);
+    } else {
+        h = seed + PRIME64_5;
+    }
+    h += len;
+    for (; p + 8 <= end; p += 8)
+        h = rotl64(h ^ xxh64_round(0, read64(p)), 27) * PRIME64_1 + PRIME64_4;
+    if (p + 4 <= end) {
+        h = rotl64(h ^ (read32(p) * PRIME64_1), 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++)
+        h = rotl64(h ^ (*p * PRIME64_5), 11) * PRIME64_1;
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static bool pread_full(int fd, uint8_t *buf, size_t len, int64_t offset)
+{
+    while (len > 0) {
+        ssize_t r = pread(fd, buf, len, offset);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        buf += r;
+        len -= r;
+        offset += r;
+    }
+    return true;
+}
+
+bool content_hash(const char *path, uint64_t *out)
+{
+    TRACE_SCOPE("content-id:hash");
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+    int64_t size = st.st_size;
+    // the samples are far apart, reading ahead around them is wasted
+    posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+
+    std::vector<uint8_t> buf(std::min<int64_t>(size, SAMPLED_SIZE));
+    bool ok;
+    if (size <= SAMPLED_SIZE) {
+        ok = pread_full(fd, buf.data(), size, 0);
+    } else {
+        uint8_t *p = buf.data();
+        ok = pread_full(fd, p, EDGE_BLOCK, 0);
+        p += EDGE_BLOCK;
+        int64_t span = size - 2 * EDGE_BLOCK - MIDDLE_BLOCK;
+        for (int i = 0; ok && i < MIDDLE_BLOCKS; i++) {
+            ok = pread_full(fd, p, MIDDLE_BLOCK, EDGE_BLOCK + span * i / (MIDDLE_BLOCKS - 1));
+            p += MIDDLE_BLOCK;
+        }
+        ok = ok && pread_full(fd, p, EDGE_BLOCK, size - EDGE_BLOCK);
+    }
+    close(fd);
+    if (!ok)
+        return false;
+    *out = xxh64(buf.data(), buf.size(), (uint64_t)size);
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// remembered ids
+// ----------------------------------------------------------------------------
+
+static bool write_record(FILE *f, const std::string &path, const known_id &id)
+{
+    uint32_t len = path.size();
+    return fwrite(&len, sizeof(len), 1, f) == 1 && fwrite(path.data(), len, 1, f) == 1 &&
+        fwrite(&id.size, sizeof(id.size), 1, f) == 1 && fwrite(&id.mtime, sizeof(id.mtime), 1, f) == 1 &&
+        fwrite(&id.hash, sizeof(id.hash), 1, f) == 1;
+}
+
+// Rewrites the file with one record per path. Must be called with
+// g_known_mutex held.
+static bool cache_compact()
+{
+    std::string tmp = g_cache_path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f)
+        return false;
+    bool ok = fwrite(CACHE_MAGIC, sizeof(CACHE_MAGIC), 1, f) == 1 &&
+        fwrite(&CACHE_VERSION, sizeof(CACHE_VERSION), 1, f) == 1;
+    for (auto it = g_known.begin(); ok && it != g_known.end(); ++it)
+        ok = write_record(f, it->first, it->second);
+    ok = fclose(f) == 0 && ok;
+    if (ok && rename(tmp.c_str(), g_cache_path.c_str()) == 0)
+        return true;
+    unlink(tmp.c_str());
+    return false;
+}
+
+// Must be called with g_known_mutex held.
+static void cache_open()
+{
+    g_known.clear();
+    size_t records = 0;
+    bool valid = false;
+    FILE *f = fopen(g_cache_path.c_str(), "rb");
+    if (f) {
+        char magic[sizeof(CACHE_MAGIC)];
+        uint32_t version;
+        valid = fread(magic, sizeof(magic), 1, f) == 1 && !memcmp(magic, CACHE_MAGIC, sizeof(magic)) &&
+            fread(&version, sizeof(version), 1, f) == 1 && version == CACHE_VERSION;
+        std::string path;
+        while (valid) {
+            uint32_t len;
+            known_id id;
+            long start = ftell(f);
+            if (fread(&len, sizeof(len), 1, f) != 1) {
+                valid = ftell(f) == start;
+                break;
+            }
+            path.resize(std::min<uint32_t>(len, PATH_MAX));
+            // a record cut short by a crash, appending after it would misalign the rest
+            if (len > PATH_MAX || (len && fread(&path[0], len, 1, f) != 1) || fread(&id.size, sizeof(id.size), 1, f) != 1 ||
+                    fread(&id.mtime, sizeof(id.mtime), 1, f) != 1 || fread(&id.hash, sizeof(id.hash), 1, f) != 1) {
+                valid = false;
+                break;
+            }
+            g_known[path] = id;
+            records++;
+        }
+        fclose(f);
+    }
+
+    // later records override earlier ones for the same path
+    if ((!valid || records > 2 * g_known.size() + 1024) && !cache_compact())
+        ALOGE("ContentId | Failed to write %s: %s", g_cache_path.c_str(), strerror(errno));
+    g_cache_file = fopen(g_cache_path.c_str(), "ab");
+}
+
+// hashes the file unless known_only, then the id is answered from memory only
+static bool lookup_id(const std::string &path, bool known_only, std::string *out)
+{
+    struct stat st;
+    if (path.find("://") != std::string::npos || stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+    known_id id;
+    id.size = st.st_size;
+    id.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+
+    bool known;
+    {
+        std::lock_guard<std::mutex> lock(g_known_mutex);
+        auto it = g_known.find(path);
+        known = it != g_known.end() && it->second.size == id.size && it->second.mtime == id.mtime;
+        if (known)
+            id.hash = it->second.hash;
+    }
+    if (!known && known_only)
+        return false;
+    if (!known) {
+        if (!content_hash(path.c_str(), &id.hash))
+            return false;
+        std::lock_guard<std::mutex> lock(g_known_mutex);
+        g_known[path] = id;
+        if (g_cache_file && (!write_record(g_cache_file, path, id) || fflush(g_cache_file) != 0)) {
+            ALOGE("ContentId | Failed to append to %s", g_cache_path.c_str());
+            fclose(g_cache_file);
+            g_cache_file = NULL;
+        }
+    }
+
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)id.hash);
+    *out = hex;
+    return true;
+}
+
+bool content_id(const std::string &path, std::string *out)
+{
+    return lookup_id(path, false, out);
+}
+
+bool content_id_known(const std::string &path, std::string *out)
+{
+    return lookup_id(path, true, out);
+}
+
+std::string content_cache_key(const std::string &path)
+{
+    std::string id;
+    return content_id(path, &id) ? id : path;
+}
+
+// Content ids of all paths, hashed in parallel; null where a path is not a
+// readable local file.
+jni_func(jobjectArray, getContentIds, jobjectArray jpaths) {
+    STATS_SCOPE("MPVLib.getContentIds");
+    init_methods_cache(env);
+    int count = env->GetArrayLength(jpaths);
+    std::vector<std::string> paths(count);
+    for (int i = 0; i < count; i++) {
+        jstring jpath = (jstring)env->GetObjectArrayElement(jpaths, i);
+        const char *path = env->GetStringUTFChars(jpath, NULL);
+        paths[i] = path;
+        env->ReleaseStringUTFChars(jpath, path);
+        env->DeleteLocalRef(jpath);
+    }
+
+    std::vector<std::string> ids(count);
+    std::vector<char> found(count);
+    workpool_run(count, [&](size_t i) {
+        found[i] = content_id(paths[i], &ids[i]);
+    });
+
+    jobjectArray arr = env->NewObjectArray(count, java_String, NULL);
+    if (!arr)
+        return NULL;
+    for (int i = 0; i < count; i++) {
+        if (!found[i])
+            continue;
+        jstring id = env->NewStringUTF(ids[i].c_str());
+        env->SetObjectArrayElement(arr, i, id);
+        env->DeleteLocalRef(id);
+    }
+    return arr;
+}
+
+// Remember content ids in the file at path across launches; null only keeps
+// them in memory.
+jni_func(void, setContentIdCache, jstring jpath) {
+    STATS_SCOPE("MPVLib.setContentIdCache");
+    std::lock_guard<std::mutex> lock(g_known_mutex);
+    if (g_cache_file) {
+        fclose(g_cache_file);
+        g_cache_file = NULL;
+    }
+    if (!jpath) {
+        g_cache_path.clear();
+        return;
+    }
+    const char *path = env->GetStringUTFChars(jpath, NULL);
+    g_cache_path = path;
+    env->ReleaseStringUTFChars(jpath, path);
+    cache_open();
+}
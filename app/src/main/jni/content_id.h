@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+// Identifies local files by content instead of by path, so caches keyed by it
+// survive renames, moves and copies. The hash covers the size and sampled
+// blocks (head, tail and a few spread over the middle), which reads about
+// 224 KiB whatever the file size. Results are remembered per path while size
+// and mtime are unchanged, persistently if MPVLib.setContentIdCache() was
+// called.
+
+// Hash of the sampled content of the file at path, not remembered.
+bool content_hash(const char *path, uint64_t *out);
+
+// Content id of a local file as 16 hex digits; false for URLs and unreadable
+// files. Thread-safe.
+bool content_id(const std::string &path, std::string *out);
+
+// Like content_id(), but only if the id is remembered for the file as it is
+// now; never reads it.
+bool content_id_known(const std::string &path, std::string *out);
+
+// Cache key for path: its content id where there is one, the path otherwise.
+std::string content_cache_key(const std::string &path);
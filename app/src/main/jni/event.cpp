@@ -1,14 +1,21 @@
 #include <jni.h>
+#include <atomic>
+#include <string>
 
 #include <mpv/client.h>
 
 #include "globals.h"
+#include "event.h"
 #include "jni_utils.h"
 #include "log.h"
 #include "node.h"
+#include "startup_timing.h"
+#include "trace.h"
+#include "stats.h"
 
 static void sendPropertyUpdateToJava(JNIEnv *env, mpv_event_property *prop)
 {
+    TRACE_SCOPE("sendPropertyUpdateToJava");
     jstring jprop = env->NewStringUTF(prop->name);
     jstring jvalue = NULL;
     switch (prop->format) {
@@ -54,6 +61,7 @@ static void sendPropertyUpdateToJava(JNIEnv *env, mpv_event_property *prop)
 
 static void sendEventToJava(JNIEnv *env, int event, mpv_node *event_node)
 {
+    TRACE_SCOPE("sendEventToJava");
     jobject jnode = mpv_node_to_jobject(env, event_node);
     if (jnode) {
         env->CallStaticVoidMethod(mpv_MPVLib, mpv_MPVLib_event, event, jnode);
@@ -63,6 +71,7 @@ static void sendEventToJava(JNIEnv *env, int event, mpv_node *event_node)
 
 static void sendLogMessageToJava(JNIEnv *env, mpv_event_log_message *msg)
 {
+    TRACE_SCOPE("sendLogMessageToJava");
     // filter the most obvious cases of invalid utf-8, since Java would choke on it
     const auto invalid_utf8 = [] (unsigned char c) {
         return c == 0xc0 || c == 0xc1 || c >= 0xf5;
@@ -84,8 +93,24 @@ static void sendLogMessageToJava(JNIEnv *env, mpv_event_log_message *msg)
         env->DeleteLocalRef(jtext);
 }
 
+// "event:<name>" metric of an event type, registered on first delivery
+static int event_metric(mpv_event_id id)
+{
+    static std::atomic<int> ids[64]; // id + 1, 0 if not registered yet
+    if (id < 0 || id >= 64)
+        return -1;
+    int cached = ids[id].load(std::memory_order_relaxed);
+    if (cached)
+        return cached - 1;
+    std::string name = std::string("event:") + mpv_event_name(id);
+    int metric = stats_metric(name.c_str());
+    ids[id].store(metric + 1, std::memory_order_relaxed);
+    return metric;
+}
+
 void *event_thread(void *arg)
 {
+    event_thread_ctx *ctx = static_cast<event_thread_ctx*>(arg);
     JNIEnv *env = NULL;
     acquire_jni_env(g_vm, &env);
     if (!env)
@@ -96,14 +121,19 @@ void *event_thread(void *arg)
         mpv_event_property *mp_property = NULL;
         mpv_event_log_message *msg = NULL;
 
-        mp_event = mpv_wait_event(g_mpv, -1.0);
+        mp_event = mpv_wait_event(ctx->mpv, -1.0);
 
-        if (g_event_thread_request_exit)
+        if (ctx->request_exit)
             break;
 
         if (mp_event->event_id == MPV_EVENT_NONE)
             continue;
+        if (mp_event->event_id == MPV_EVENT_COMMAND_REPLY && mp_event->reply_userdata == ASYNC_REPLY_IGNORE)
+            continue;
 
+        // one span per delivered event, named after it
+        TRACE_SCOPE(mpv_event_name(mp_event->event_id));
+        stats_scope event_stats(event_metric(mp_event->event_id));
         switch (mp_event->event_id) {
         case MPV_EVENT_LOG_MESSAGE:
             msg = (mpv_event_log_message*)mp_event->data;
@@ -114,6 +144,11 @@ void *event_thread(void *arg)
             mp_property = (mpv_event_property*)mp_event->data;
             sendPropertyUpdateToJava(env, mp_property);
             break;
+        case MPV_EVENT_FILE_LOADED:
+        case MPV_EVENT_PLAYBACK_RESTART:
+            startup_timing_mark(ctx->mpv, mp_event->event_id == MPV_EVENT_FILE_LOADED ?
+                STARTUP_FILE_LOADED : STARTUP_PLAYBACK_RESTART);
+            // fallthrough
         default:
             ALOGV("event: %s\n", mpv_event_name(mp_event->event_id));
             mpv_node event_node;
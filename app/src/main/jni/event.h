@@ -1,3 +1,23 @@
 #pragma once
 
+#include <atomic>
+#include <pthread.h>
+
+struct mpv_handle;
+
+// State of one event thread, owned by whoever started it. Each mpv instance
+// has its own so an instance that is being torn down in the background does
+// not interfere with a newly created one.
+struct event_thread_ctx {
+    mpv_handle *mpv;
+    pthread_t thread;
+    std::atomic<bool> request_exit;
+
+    explicit event_thread_ctx(mpv_handle *mpv) : mpv(mpv), thread(), request_exit(false) {}
+};
+
+// reply_userdata of fire-and-forget async commands, their replies are not
+// forwarded to Java
+#define ASYNC_REPLY_IGNORE 0x6e6f7265706c79ULL
+
 void *event_thread(void *arg);
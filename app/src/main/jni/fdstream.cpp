@@ -0,0 +1,237 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#include <mpv/client.h>
+#include <mpv/stream_cb.h>
+
+#include "fdstream.h"
+#include "log.h"
+
+// ============================================================================
+// FD STREAMS
+// mpv reads content:// and SAF items through a descriptor we hand it. Local
+// regular files are mmap'd, anything else seekable goes through pread() with
+// a large aligned read buffer, pipes and sockets are read sequentially.
+// The descriptor is dup'd on open, so the caller keeps ownership of its own.
+// ============================================================================
+
+#define FDSTREAM_PROTOCOL "fdstream"
+
+// pread() granularity, aligned so reads map onto whole pages of the page cache
+static const size_t READ_ALIGN = 4096;
+static const size_t READ_BUFFER_SIZE = 1024 * 1024;
+// mapping whole files eats address space, which is scarce on 32-bit
+static const int64_t MAX_MAP_SIZE = sizeof(void*) >= 8 ? INT64_MAX : 64 * 1024 * 1024;
+
+struct fd_stream {
+    int fd;
+    bool seekable;
+    int64_t size;       // -1 if unknown
+    int64_t pos;
+    const uint8_t *map; // whole file, or NULL
+    uint8_t *buf;       // READ_BUFFER_SIZE bytes, READ_ALIGN aligned
+    int64_t buf_start;
+    size_t buf_len;
+};
+
+static ssize_t pread_full(int fd, uint8_t *dst, size_t len, int64_t offset)
+{
+    size_t done = 0;
+    while (done < len) {
+        ssize_t r = pread(fd, dst + done, len - done, offset + done);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0)
+            return done ? (ssize_t)done : -1;
+        if (r == 0)
+            break;
+        done += r;
+    }
+    return done;
+}
+
+// switch a mapped stream over to buffered pread(), size is the current one
+static bool unmap_stream(fd_stream *s, int64_t size)
+{
+    munmap(const_cast<uint8_t*>(s->map), s->size);
+    s->map = NULL;
+    s->size = size;
+    if (posix_memalign(reinterpret_cast<void**>(&s->buf), READ_ALIGN, READ_BUFFER_SIZE) != 0) {
+        s->buf = NULL;
+        return false;
+    }
+    return true;
+}
+
+static int64_t fd_read(void *cookie, char *out, uint64_t nbytes)
+{
+    fd_stream *s = static_cast<fd_stream*>(cookie);
+    uint8_t *dst = reinterpret_cast<uint8_t*>(out);
+
+    if (s->map) {
+        // touching mapped pages past the end of a truncated file raises SIGBUS,
+        // so a file that changed size since it was mapped is read with pread()
+        struct stat st;
+        bool known = fstat(s->fd, &st) == 0;
+        if (!known || st.st_size != s->size) {
+            ALOGV("fdstream | File size changed, no longer mapped");
+            if (!unmap_stream(s, known ? st.st_size : -1))
+                return -1;
+        }
+    }
+
+    if (s->map) {
+        if (s->pos >= s->size)
+            return 0;
+        size_t len = std::min<uint64_t>(nbytes, s->size - s->pos);
+        memcpy(dst, s->map + s->pos, len);
+        s->pos += len;
+        return len;
+    }
+
+    if (!s->seekable) {
+        ssize_t r;
+        do {
+            r = read(s->fd, dst, nbytes);
+        } while (r < 0 && errno == EINTR);
+        if (r > 0)
+            s->pos += r;
+        return r < 0 ? -1 : r;
+    }
+
+    // serve from the buffer if possible
+    if (s->pos >= s->buf_start && s->pos < s->buf_start + (int64_t)s->buf_len) {
+        size_t off = s->pos - s->buf_start;
+        size_t len = std::min<uint64_t>(nbytes, s->buf_len - off);
+        memcpy(dst, s->buf + off, len);
+        s->pos += len;
+        return len;
+    }
+
+    // large reads don't benefit from buffering
+    if (nbytes >= READ_BUFFER_SIZE) {
+        ssize_t r = pread_full(s->fd, dst, nbytes, s->pos);
+        if (r > 0)
+            s->pos += r;
+        return r;
+    }
+
+    s->buf_start = s->pos & ~(int64_t)(READ_ALIGN - 1);
+    ssize_t r = pread_full(s->fd, s->buf, READ_BUFFER_SIZE, s->buf_start);
+    if (r < 0) {
+        s->buf_len = 0;
+        return -1;
+    }
+    s->buf_len = r;
+    if (s->pos >= s->buf_start + r)
+        return 0; // EOF
+    size_t off = s->pos - s->buf_start;
+    size_t len = std::min<uint64_t>(nbytes, s->buf_len - off);
+    memcpy(dst, s->buf + off, len);
+    s->pos += len;
+    return len;
+}
+
+static int64_t fd_seek(void *cookie, int64_t offset)
+{
+    fd_stream *s = static_cast<fd_stream*>(cookie);
+    if (offset < 0)
+        return MPV_ERROR_GENERIC;
+    s->pos = offset;
+    return offset;
+}
+
+static int64_t fd_size(void *cookie)
+{
+    fd_stream *s = static_cast<fd_stream*>(cookie);
+    return s->size >= 0 ? s->size : (int64_t)MPV_ERROR_UNSUPPORTED;
+}
+
+static void fd_close(void *cookie)
+{
+    fd_stream *s = static_cast<fd_stream*>(cookie);
+    if (s->map)
+        munmap(const_cast<uint8_t*>(s->map), s->size);
+    free(s->buf);
+    close(s->fd);
+    delete s;
+}
+
+static int fd_open(void *user_data, char *uri, mpv_stream_cb_info *info)
+{
+    const char *prefix = FDSTREAM_PROTOCOL "://";
+    if (strncmp(uri, prefix, strlen(prefix)) != 0)
+        return MPV_ERROR_LOADING_FAILED;
+    char *end;
+    long src_fd = strtol(uri + strlen(prefix), &end, 10);
+    if (end == uri + strlen(prefix) || *end || src_fd < 0)
+        return MPV_ERROR_LOADING_FAILED;
+
+    int fd = fcntl((int)src_fd, F_DUPFD_CLOEXEC, 0);
+    if (fd < 0) {
+        ALOGE("fdstream | Cannot dup fd %ld: %s", src_fd, strerror(errno));
+        return MPV_ERROR_LOADING_FAILED;
+    }
+
+    fd_stream *s = new fd_stream();
+    s->fd = fd;
+    s->size = -1;
+    s->pos = 0;
+    s->map = NULL;
+    s->buf = NULL;
+    s->buf_start = 0;
+    s->buf_len = 0;
+
+    struct stat st;
+    bool regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    int64_t start = lseek(fd, 0, SEEK_CUR);
+    s->seekable = start >= 0;
+    if (s->seekable) {
+        if (regular) {
+            s->size = st.st_size;
+        } else {
+            int64_t size = lseek(fd, 0, SEEK_END);
+            if (size >= 0)
+                s->size = size;
+            lseek(fd, start, SEEK_SET);
+        }
+    }
+
+    if (s->seekable && regular && s->size > 0 && s->size <= MAX_MAP_SIZE) {
+        void *map = mmap(NULL, s->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, s->size, MADV_SEQUENTIAL);
+            s->map = static_cast<const uint8_t*>(map);
+        }
+    }
+    if (!s->map && s->seekable) {
+        if (posix_memalign(reinterpret_cast<void**>(&s->buf), READ_ALIGN, READ_BUFFER_SIZE) != 0) {
+            close(fd);
+            delete s;
+            return MPV_ERROR_NOMEM;
+        }
+    }
+
+    ALOGV("fdstream | Opened fd %ld, size %lld, %s", src_fd, (long long)s->size,
+        s->map ? "mapped" : s->seekable ? "buffered" : "sequential");
+
+    info->cookie = s;
+    info->read_fn = fd_read;
+    info->seek_fn = s->seekable ? fd_seek : NULL;
+    info->size_fn = fd_size;
+    info->close_fn = fd_close;
+    return 0;
+}
+
+void fdstream_register(mpv_handle *mpv)
+{
+    int result = mpv_stream_cb_add_ro(mpv, FDSTREAM_PROTOCOL, NULL, fd_open);
+    if (result < 0)
+        ALOGE("mpv_stream_cb_add_ro(%s) returned error %s", FDSTREAM_PROTOCOL, mpv_error_string(result));
+}
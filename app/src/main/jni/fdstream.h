@@ -0,0 +1,7 @@
+#pragma once
+
+struct mpv_handle;
+
+// Registers the "fdstream://<fd>" protocol, which plays an already opened file
+// descriptor (e.g. from a ParcelFileDescriptor) entirely in native code.
+void fdstream_register(mpv_handle *mpv);
@@ -0,0 +1,405 @@
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <jni.h>
+
+extern "C" {
+    #include <libavformat/avformat.h>
+    #include <libavcodec/avcodec.h>
+    #include <libswscale/swscale.h>
+};
+
+#include "jni_utils.h"
+#include "log.h"
+#include "stats.h"
+#include "trace.h"
+#include "workpool.h"
+
+extern "C" {
+    jni_func(jobjectArray, getFingerprints, jobjectArray jpaths);
+    jni_func(jintArray, findDuplicates, jobjectArray jsignatures, jint max_distance);
+};
+
+// ============================================================================
+// VIDEO FINGERPRINTS
+// A signature is the 64-bit difference hash (dHash) of frames at fixed
+// fractions of the duration, taken after cropping black bars, so re-encodes,
+// rescales and remuxes of a video land a few bits apart. Duplicate search
+// splits signatures into 16-bit chunks: two within distance d share at least
+// one chunk within d / chunks bits (pigeonhole), so candidates come from a
+// handful of bucket lookups per chunk rather than comparing every pair.
+// ============================================================================
+
+static const int FRAMES = 6;
+// frames are reduced to this many pixels square before hashing
+static const int GRID = 64;
+// rows and columns darker than this are bars
+static const int BLACK_LEVEL = 32;
+// decoding towards a position gives up after this many frames
+static const int MAX_DECODED = 600;
+
+static const int CHUNK_BITS = 16;
+static const int CHUNKS = FRAMES * 64 / CHUNK_BITS;
+// neighbours within 2 bits of a 16-bit chunk are 137 probes; more gets slow
+static const int MAX_CHUNK_RADIUS = 2;
+
+// ----------------------------------------------------------------------------
+// signatures
+// ----------------------------------------------------------------------------
+
+// Scales the frame to GRID x GRID luma.
+static bool to_gray(const AVFrame *frame, SwsContext **sws, uint8_t *out)
+{
+    *sws = sws_getCachedContext(*sws, frame->width, frame->height, (AVPixelFormat)frame->format,
+        GRID, GRID, AV_PIX_FMT_GRAY8, SWS_AREA, NULL, NULL, NULL);
+    if (!*sws)
+        return false;
+    uint8_t *dst_data[4] = { out };
+    int dst_linesize[4] = { GRID };
+    sws_scale(*sws, frame->data, frame->linesize, 0, frame->height, dst_data, dst_linesize);
+    return true;
+}
+
+// Decodes up to the first frame at or after ts. Non-reference frames are
+// skipped on the way, so the frame returned may be a few past ts.
+static bool decode_at(AVFormatContext *fmt, AVCodecContext *dec, int idx, int64_t ts,
+    AVPacket *packet, AVFrame *frame)
+{
+    bool eof = false;
+    for (int decoded = 0; decoded < MAX_DECODED; ) {
+        if (!eof) {
+            if (av_read_frame(fmt, packet) < 0) {
+                eof = true;
+                avcodec_send_packet(dec, NULL);
+            } else {
+                if (packet->stream_index == idx)
+                    avcodec_send_packet(dec, packet);
+                av_packet_unref(packet);
+            }
+        }
+        int ret;
+        while ((ret = avcodec_receive_frame(dec, frame)) >= 0) {
+            decoded++;
+            if (frame->best_effort_timestamp == AV_NOPTS_VALUE || frame->best_effort_timestamp >= ts)
+                return true;
+            av_frame_unref(frame);
+        }
+        if (eof && ret < 0)
+            return false;
+    }
+    return false;
+}
+
+// Luma of the FRAMES sample frames of path's main video stream.
+static bool decode_gray_frames(const char *path, std::vector<uint8_t> *grays)
+{
+    TRACE_SCOPE("fingerprint:decode");
+    AVFormatContext *fmt = NULL;
+    if (avformat_open_input(&fmt, path, NULL, NULL) < 0) {
+        ALOGV("Fingerprint | Failed to open %s", path);
+        return false;
+    }
+    fmt->probesize = 500000;
+    fmt->max_analyze_duration = 500000;
+    if (avformat_find_stream_info(fmt, NULL) < 0)
+        ALOGV("Fingerprint | Incomplete stream info for %s", path);
+
+    int idx = av_find_best_stream(fmt, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (idx < 0 || (fmt->streams[idx]->disposition & AV_DISPOSITION_ATTACHED_PIC)) {
+        ALOGV("Fingerprint | No video in %s", path);
+        avformat_close_input(&fmt);
+        return false;
+    }
+    AVStream *st = fmt->streams[idx];
+    for (unsigned i = 0; i < fmt->nb_streams; i++)
+        fmt->streams[i]->discard = (int)i == idx ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    double duration = -1;
+    if (st->duration != AV_NOPTS_VALUE)
+        duration = st->duration * av_q2d(st->time_base);
+    else if (fmt->duration != AV_NOPTS_VALUE)
+        duration = fmt->duration / (double)AV_TIME_BASE;
+    if (duration <= 0) {
+        ALOGV("Fingerprint | Unknown duration of %s", path);
+        avformat_close_input(&fmt);
+        return false;
+    }
+
+    const AVCodec *codec = avcodec_find_decoder(st->codecpar->codec_id);
+    AVCodecContext *dec = codec ? avcodec_alloc_context3(codec) : NULL;
+    if (!dec || avcodec_parameters_to_context(dec, st->codecpar) < 0) {
+        ALOGE("Fingerprint | No decoder for %s", avcodec_get_name(st->codecpar->codec_id));
+        avcodec_free_context(&dec);
+        avformat_close_input(&fmt);
+        return false;
+    }
+    dec->pkt_timebase = st->time_base;
+    // files are fingerprinted in parallel already
+    dec->thread_count = 1;
+    dec->skip_frame = AVDISCARD_NONREF;
+    dec->skip_loop_filter = AVDISCARD_ALL;
+    if (avcodec_open2(dec, codec, NULL) < 0) {
+        ALOGE("Fingerprint | Failed to open decoder");
+        avcodec_free_context(&dec);
+        avformat_close_input(&fmt);
+        return false;
+    }
+
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    SwsContext *sws = NULL;
+    int64_t start = st->start_time != AV_NOPTS_VALUE ? st->start_time : 0;
+    grays->resize(FRAMES * GRID * GRID);
+    bool ok = packet && frame;
+    for (int i = 0; ok && i < FRAMES; i++) {
+        // away from intros and end credits, which copies often add or cut
+        double position = duration * (i + 1) / (FRAMES + 1);
+        int64_t ts = start + (int64_t)(position / av_q2d(st->time_base));
+        ok = av_seek_frame(fmt, idx, ts, AVSEEK_FLAG_BACKWARD) >= 0;
+        avcodec_flush_buffers(dec);
+        ok = ok && decode_at(fmt, dec, idx, ts, packet, frame) && frame->format >= 0 &&
+            to_gray(frame, &sws, grays->data() + i * GRID * GRID);
+        av_frame_unref(frame);
+    }
+    if (!ok)
+        ALOGV("Fingerprint | Failed to decode frames of %s", path);
+
+    sws_freeContext(sws);
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    avcodec_free_context(&dec);
+    avformat_close_input(&fmt);
+    return ok;
+}
+
+static int area_mean(const uint8_t *gray, int x0, int y0, int x1, int y1)
+{
+    int sum = 0;
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++)
+            sum += gray[y * GRID + x];
+    }
+    return sum / std::max(1, (x1 - x0) * (y1 - y0));
+}
+
+// dHash: whether each of 8x8 cells is darker than its right neighbour, on a
+// 9x8 grid over the picture without letterbox or pillarbox bars.
+static uint64_t dhash(const uint8_t *gray)
+{
+    int top = 0, bottom = GRID, left = 0, right = GRID;
+    while (top < GRID / 4 && area_mean(gray, 0, top, GRID, top + 1) <= BLACK_LEVEL)
+        top++;
+    while (bottom > GRID * 3 / 4 && area_mean(gray, 0, bottom - 1, GRID, bottom) <= BLACK_LEVEL)
+        bottom--;
+    while (left < GRID / 4 && area_mean(gray, left, top, left + 1, bottom) <= BLACK_LEVEL)
+        left++;
+    while (right > GRID * 3 / 4 && area_mean(gray, right - 1, top, right, bottom) <= BLACK_LEVEL)
+        right--;
+
+    uint64_t hash = 0;
+    int h = bottom - top, w = right - left;
+    for (int y = 0; y < 8; y++) {
+        int y0 = top + h * y / 8, y1 = top + h * (y + 1) / 8;
+        int prev = 0;
+        for (int x = 0; x < 9; x++) {
+            int cell = area_mean(gray, left + w * x / 9, y0, left + w * (x + 1) / 9, y1);
+            if (x > 0 && prev < cell)
+                hash |= 1ULL << (y * 8 + x - 1);
+            prev = cell;
+        }
+    }
+    return hash;
+}
+
+static bool fingerprint(const char *path, uint64_t *signature)
+{
+    std::vector<uint8_t> grays;
+    if (!decode_gray_frames(path, &grays))
+        return false;
+    for (int i = 0; i < FRAMES; i++)
+        signature[i] = dhash(grays.data() + i * GRID * GRID);
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// duplicate search
+// ----------------------------------------------------------------------------
+
+static inline uint16_t chunk(const uint64_t *signature, int c)
+{
+    return signature[c / 4] >> (CHUNK_BITS * (c % 4));
+}
+
+static inline int distance(const uint64_t *a, const uint64_t *b)
+{
+    int d = 0;
+    for (int i = 0; i < FRAMES; i++)
+        d += __builtin_popcountll(a[i] ^ b[i]);
+    return d;
+}
+
+// Signatures by the value of one chunk: ids[offsets[v] .. offsets[v + 1]).
+struct chunk_table {
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> ids;
+};
+
+static void build_table(const std::vector<uint64_t> &sigs, const std::vector<bool> &valid, int c, chunk_table *t)
+{
+    size_t n = valid.size();
+    t->offsets.assign((1 << CHUNK_BITS) + 1, 0);
+    for (size_t i = 0; i < n; i++) {
+        if (valid[i])
+            t->offsets[chunk(&sigs[i * FRAMES], c) + 1]++;
+    }
+    for (size_t v = 0; v < (1 << CHUNK_BITS); v++)
+        t->offsets[v + 1] += t->offsets[v];
+    std::vector<uint32_t> fill(t->offsets.begin(), t->offsets.end() - 1);
+    t->ids.resize(t->offsets.back());
+    for (size_t i = 0; i < n; i++) {
+        if (valid[i])
+            t->ids[fill[chunk(&sigs[i * FRAMES], c)]++] = i;
+    }
+}
+
+// v and every value within radius bits of it
+static void neighbours(uint16_t v, int radius, std::vector<uint16_t> *out)
+{
+    out->clear();
+    out->push_back(v);
+    for (int a = 0; radius >= 1 && a < CHUNK_BITS; a++) {
+        out->push_back(v ^ (1 << a));
+        for (int b = a + 1; radius >= 2 && b < CHUNK_BITS; b++)
+            out->push_back(v ^ (1 << a) ^ (1 << b));
+    }
+}
+
+struct match {
+    uint32_t a, b;
+    int distance;
+};
+
+static void find_matches(const std::vector<uint64_t> &sigs, const std::vector<bool> &valid, int max_distance,
+    std::vector<match> *out)
+{
+    TRACE_SCOPE("fingerprint:search");
+    size_t n = valid.size();
+    std::vector<chunk_table> tables(CHUNKS);
+    workpool_run(CHUNKS, [&](size_t c) {
+        build_table(sigs, valid, c, &tables[c]);
+    });
+
+    int radius = max_distance / CHUNKS;
+    size_t blocks = std::min(n, (size_t)workpool_threads() + 1);
+    std::vector<std::vector<match>> found(blocks);
+    workpool_run(blocks, [&](size_t block) {
+        // seen[j] == i: j was already compared against i
+        std::vector<uint32_t> seen(n, UINT32_MAX);
+        std::vector<uint16_t> probes;
+        for (size_t i = block; i < n; i += blocks) {
+            if (!valid[i])
+                continue;
+            const uint64_t *sig = &sigs[i * FRAMES];
+            for (int c = 0; c < CHUNKS; c++) {
+                const chunk_table &t = tables[c];
+                neighbours(chunk(sig, c), radius, &probes);
+                for (uint16_t v : probes) {
+                    for (uint32_t k = t.offsets[v]; k < t.offsets[v + 1]; k++) {
+                        uint32_t j = t.ids[k];
+                        if (j <= i || seen[j] == i)
+                            continue;
+                        seen[j] = i;
+                        int d = distance(sig, &sigs[(size_t)j * FRAMES]);
+                        if (d <= max_distance)
+                            found[block].push_back({ (uint32_t)i, j, d });
+                    }
+                }
+            }
+        }
+    });
+
+    for (const std::vector<match> &f : found)
+        out->insert(out->end(), f.begin(), f.end());
+    std::sort(out->begin(), out->end(), [](const match &x, const match &y) {
+        return x.a != y.a ? x.a < y.a : x.b < y.b;
+    });
+}
+
+// Signatures of all paths, computed in parallel; null where a file has no
+// decodable video or no known duration.
+jni_func(jobjectArray, getFingerprints, jobjectArray jpaths) {
+    STATS_SCOPE("MPVLib.getFingerprints");
+    int count = env->GetArrayLength(jpaths);
+    std::vector<std::string> paths(count);
+    for (int i = 0; i < count; i++) {
+        jstring jpath = (jstring)env->GetObjectArrayElement(jpaths, i);
+        const char *path = env->GetStringUTFChars(jpath, NULL);
+        paths[i] = path;
+        env->ReleaseStringUTFChars(jpath, path);
+        env->DeleteLocalRef(jpath);
+    }
+
+    std::vector<uint64_t> sigs((size_t)count * FRAMES);
+    std::vector<char> ok(count);
+    workpool_run(count, [&](size_t i) {
+        ok[i] = fingerprint(paths[i].c_str(), &sigs[i * FRAMES]);
+    });
+
+    // long[], looked up here since this is called once per batch
+    jclass long_array = env->FindClass("[J");
+    jobjectArray arr = long_array ? env->NewObjectArray(count, long_array, NULL) : NULL;
+    env->DeleteLocalRef(long_array);
+    if (!arr)
+        return NULL;
+    for (int i = 0; i < count; i++) {
+        if (!ok[i])
+            continue;
+        jlongArray sig = env->NewLongArray(FRAMES);
+        if (!sig)
+            return NULL;
+        env->SetLongArrayRegion(sig, 0, FRAMES, reinterpret_cast<const jlong*>(&sigs[(size_t)i * FRAMES]));
+        env->SetObjectArrayElement(arr, i, sig);
+        env->DeleteLocalRef(sig);
+    }
+    return arr;
+}
+
+// Pairs of signatures at most max_distance bits apart, as (i, j, distance)
+// triples with i < j, sorted. Null or malformed signatures match nothing.
+jni_func(jintArray, findDuplicates, jobjectArray jsignatures, jint max_distance) {
+    STATS_SCOPE("MPVLib.findDuplicates");
+    int limit = CHUNKS * (MAX_CHUNK_RADIUS + 1) - 1;
+    if (max_distance > limit) {
+        ALOGV("Fingerprint | Distance %d too large, using %d", max_distance, limit);
+        max_distance = limit;
+    }
+    int count = env->GetArrayLength(jsignatures);
+    std::vector<uint64_t> sigs((size_t)count * FRAMES);
+    std::vector<bool> valid(count, false);
+    for (int i = 0; i < count; i++) {
+        jlongArray sig = (jlongArray)env->GetObjectArrayElement(jsignatures, i);
+        if (sig && env->GetArrayLength(sig) == FRAMES) {
+            env->GetLongArrayRegion(sig, 0, FRAMES, reinterpret_cast<jlong*>(&sigs[(size_t)i * FRAMES]));
+            valid[i] = true;
+        }
+        env->DeleteLocalRef(sig);
+    }
+
+    std::vector<match> matches;
+    if (max_distance >= 0)
+        find_matches(sigs, valid, max_distance, &matches);
+
+    std::vector<jint> flat;
+    flat.reserve(matches.size() * 3);
+    for (const match &m : matches) {
+        flat.push_back(m.a);
+        flat.push_back(m.b);
+        flat.push_back(m.distance);
+    }
+    jintArray arr = env->NewIntArray(flat.size());
+    if (arr)
+        env->SetIntArrayRegion(arr, 0, flat.size(), flat.data());
+    return arr;
+}
@@ -0,0 +1,633 @@
+#include <jni.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "jni_utils.h"
+#include "log.h"
+#include "stats.h"
+
+extern "C" {
+    jni_func(jint, buildFontIndex, jstring jpath, jobjectArray jdirs);
+    jni_func(jint, linkIndexedFonts, jstring jpath, jstring jfonts_dir, jstring jsample);
+};
+
+// ============================================================================
+// FONT INDEX
+// libass is built without a system font provider here, so it only sees the
+// fonts in mpv's sub-fonts-dir, and it reads and parses every file in there
+// whenever a renderer is set up. Pointing it at the system fonts directly
+// would mean hundreds of megabytes on every subtitle start.
+//
+// Instead the system fonts are indexed once per font set (family, style and
+// which 256-codepoint pages each face covers) into a flat file that is mmap'd
+// on later launches. From the index, the few faces needed for a sample text
+// (usually the device languages) are symlinked into the fonts directory, so
+// libass only loads what can actually be used.
+// ============================================================================
+
+#define INDEX_MAGIC "MPVFIDX"
+static const uint32_t INDEX_VERSION = 1;
+// covers the BMP and the supplementary planes used by CJK extensions
+static const int COVERAGE_PAGES = 0x30000 >> 8;
+#define LINK_PREFIX "sysfont-"
+
+static const char *const system_font_dirs[] = {
+    "/system/fonts",
+    "/product/fonts",
+    "/system_ext/fonts",
+};
+
+struct index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t signature;
+    uint32_t strings_offset;
+    uint32_t strings_size;
+};
+
+// strings are offsets into the string pool after the entries
+struct index_entry {
+    uint32_t path;
+    uint32_t family;
+    uint32_t style;
+    uint32_t face_index;
+    uint32_t file_size;
+    uint16_t weight;
+    uint8_t italic;
+    uint8_t pad;
+    uint8_t coverage[COVERAGE_PAGES / 8];
+};
+
+struct font_file {
+    std::string path;
+    int64_t size;
+    int64_t mtime;
+};
+
+// ----------------------------------------------------------------------------
+// sfnt parsing (TrueType/OpenType fonts and collections)
+// ----------------------------------------------------------------------------
+
+struct sfnt {
+    const uint8_t *data;
+    size_t size;
+
+    bool has(size_t offset, size_t len) const { return offset <= size && len <= size - offset; }
+    uint16_t u16(size_t offset) const {
+        return has(offset, 2) ? (data[offset] << 8) | data[offset + 1] : 0;
+    }
+    uint32_t u32(size_t offset) const {
+        return has(offset, 4) ? ((uint32_t)u16(offset) << 16) | u16(offset + 2) : 0;
+    }
+};
+
+struct face_info {
+    std::string family, style;
+    uint16_t weight;
+    bool italic;
+    uint8_t coverage[COVERAGE_PAGES / 8];
+};
+
+static bool find_table(const sfnt &f, size_t face, const char *tag, size_t *offset, size_t *len)
+{
+    uint16_t num_tables = f.u16(face + 4);
+    for (int i = 0; i < num_tables; i++) {
+        size_t rec = face + 12 + i * 16;
+        if (!f.has(rec, 16))
+            return false;
+        if (!memcmp(f.data + rec, tag, 4)) {
+            *offset = f.u32(rec + 8);
+            *len = f.u32(rec + 12);
+            return f.has(*offset, *len);
+        }
+    }
+    return false;
+}
+
+static std::string name_string(const sfnt &f, size_t offset, size_t len, bool utf16)
+{
+    std::string out;
+    if (!f.has(offset, len))
+        return out;
+    if (!utf16) {
+        // Mac Roman; only ASCII is kept, which is what family names use in practice
+        for (size_t i = 0; i < len; i++) {
+            if (f.data[offset + i] < 0x80)
+                out += (char)f.data[offset + i];
+        }
+        return out;
+    }
+    for (size_t i = 0; i + 1 < len; i += 2) {
+        uint32_t c = f.u16(offset + i);
+        if (c >= 0xd800 && c < 0xdc00 && i + 3 < len) {
+            c = 0x10000 + ((c - 0xd800) << 10) + (f.u16(offset + i + 2) - 0xdc00);
+            i += 2;
+        }
+        if (c < 0x80) {
+            out += (char)c;
+        } else if (c < 0x800) {
+            out += (char)(0xc0 | (c >> 6));
+            out += (char)(0x80 | (c & 0x3f));
+        } else if (c < 0x10000) {
+            out += (char)(0xe0 | (c >> 12));
+            out += (char)(0x80 | ((c >> 6) & 0x3f));
+            out += (char)(0x80 | (c & 0x3f));
+        } else {
+            out += (char)(0xf0 | (c >> 18));
+            out += (char)(0x80 | ((c >> 12) & 0x3f));
+            out += (char)(0x80 | ((c >> 6) & 0x3f));
+            out += (char)(0x80 | (c & 0x3f));
+        }
+    }
+    return out;
+}
+
+// Family and style, preferring the typographic names (16/17) and US English.
+static void parse_names(const sfnt &f, size_t face, face_info *info)
+{
+    size_t table, len;
+    if (!find_table(f, face, "name", &table, &len))
+        return;
+    uint16_t count = f.u16(table + 2);
+    size_t strings = table + f.u16(table + 4);
+    int best_score[2] = { -1, -1 };
+    for (int i = 0; i < count; i++) {
+        size_t rec = table + 6 + i * 12;
+        if (!f.has(rec, 12))
+            break;
+        uint16_t platform = f.u16(rec), encoding = f.u16(rec + 2), language = f.u16(rec + 4);
+        uint16_t name_id = f.u16(rec + 6);
+        int which;
+        if (name_id == 1 || name_id == 16)
+            which = 0;
+        else if (name_id == 2 || name_id == 17)
+            which = 1;
+        else
+            continue;
+        bool utf16;
+        int score = name_id >= 16 ? 4 : 0;
+        if (platform == 3 && (encoding == 1 || encoding == 10)) {
+            utf16 = true;
+            score += language == 0x409 ? 2 : 1;
+        } else if (platform == 0) {
+            utf16 = true;
+            score += 1;
+        } else if (platform == 1 && encoding == 0) {
+            utf16 = false;
+        } else {
+            continue;
+        }
+        if (score <= best_score[which])
+            continue;
+        std::string s = name_string(f, strings + f.u16(rec + 10), f.u16(rec + 8), utf16);
+        if (s.empty())
+            continue;
+        best_score[which] = score;
+        (which ? info->style : info->family) = s;
+    }
+}
+
+static void parse_style(const sfnt &f, size_t face, face_info *info)
+{
+    size_t table, len;
+    info->weight = 400;
+    info->italic = false;
+    if (find_table(f, face, "OS/2", &table, &len) && len >= 64) {
+        info->weight = f.u16(table + 4);
+        info->italic = f.u16(table + 62) & 1;
+    } else if (find_table(f, face, "head", &table, &len) && len >= 46) {
+        uint16_t mac_style = f.u16(table + 44);
+        info->weight = (mac_style & 1) ? 700 : 400;
+        info->italic = mac_style & 2;
+    }
+}
+
+static void cover(face_info *info, uint32_t first, uint32_t last)
+{
+    last = std::min<uint32_t>(last, COVERAGE_PAGES * 256 - 1);
+    for (uint32_t page = first >> 8; first <= last && page <= (last >> 8); page++)
+        info->coverage[page >> 3] |= 1 << (page & 7);
+}
+
+static void parse_cmap(const sfnt &f, size_t face, face_info *info)
+{
+    size_t table, len;
+    if (!find_table(f, face, "cmap", &table, &len))
+        return;
+    // prefer a full Unicode subtable (format 12) over a BMP one (format 4)
+    size_t best = 0;
+    int best_format = 0;
+    uint16_t count = f.u16(table + 2);
+    for (int i = 0; i < count; i++) {
+        size_t rec = table + 4 + i * 8;
+        uint16_t platform = f.u16(rec), encoding = f.u16(rec + 2);
+        if (!(platform == 0 || (platform == 3 && (encoding == 1 || encoding == 10))))
+            continue;
+        size_t sub = table + f.u32(rec + 4);
+        uint16_t format = f.u16(sub);
+        if ((format == 12 && best_format != 12) || (format == 4 && !best_format)) {
+            best = sub;
+            best_format = format;
+        }
+    }
+
+    if (best_format == 4) {
+        uint16_t segs = f.u16(best + 6) / 2;
+        size_t ends = best + 14, starts = ends + segs * 2 + 2;
+        for (int i = 0; i < segs; i++) {
+            uint16_t start = f.u16(starts + i * 2), end = f.u16(ends + i * 2);
+            if (start == 0xffff)
+                continue;
+            cover(info, start, end);
+        }
+    } else if (best_format == 12) {
+        uint32_t groups = f.u32(best + 12);
+        for (uint32_t i = 0; i < groups && f.has(best + 16 + i * 12, 12); i++)
+            cover(info, f.u32(best + 16 + i * 12), f.u32(best + 20 + i * 12));
+    }
+}
+
+static bool parse_face(const sfnt &f, size_t face, face_info *info)
+{
+    uint32_t version = f.u32(face);
+    if (version != 0x00010000 && version != 0x4f54544f /* OTTO */ && version != 0x74727565 /* true */)
+        return false;
+    memset(info->coverage, 0, sizeof(info->coverage));
+    parse_names(f, face, info);
+    parse_style(f, face, info);
+    parse_cmap(f, face, info);
+    return !info->family.empty();
+}
+
+static void index_file(const font_file &file, std::vector<index_entry> *entries, std::string *pool)
+{
+    int fd = open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    void *map = file.size > 0 ? mmap(NULL, file.size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED)
+        return;
+
+    sfnt f = { static_cast<const uint8_t*>(map), (size_t)file.size };
+    std::vector<size_t> faces;
+    if (f.has(0, 12) && !memcmp(f.data, "ttcf", 4)) {
+        uint32_t num = f.u32(8);
+        for (uint32_t i = 0; i < num && f.has(12 + i * 4, 4); i++)
+            faces.push_back(f.u32(12 + i * 4));
+    } else {
+        faces.push_back(0);
+    }
+
+    uint32_t path = pool->size();
+    *pool += file.path;
+    *pool += '\0';
+    for (size_t i = 0; i < faces.size(); i++) {
+        face_info info;
+        if (!parse_face(f, faces[i], &info))
+            continue;
+        index_entry e;
+        memset(&e, 0, sizeof(e));
+        e.path = path;
+        e.family = pool->size();
+        *pool += info.family;
+        *pool += '\0';
+        e.style = pool->size();
+        *pool += info.style;
+        *pool += '\0';
+        e.face_index = i;
+        e.file_size = file.size;
+        e.weight = info.weight;
+        e.italic = info.italic;
+        memcpy(e.coverage, info.coverage, sizeof(e.coverage));
+        entries->push_back(e);
+    }
+    munmap(map, file.size);
+}
+
+// ----------------------------------------------------------------------------
+// index file
+// ----------------------------------------------------------------------------
+
+static bool is_font_name(const char *name)
+{
+    const char *ext = strrchr(name, '.');
+    return ext && (!strcasecmp(ext, ".ttf") || !strcasecmp(ext, ".otf") ||
+        !strcasecmp(ext, ".ttc") || !strcasecmp(ext, ".otc"));
+}
+
+static void list_fonts(const std::vector<std::string> &dirs, std::vector<font_file> *files)
+{
+    for (const std::string &dir : dirs) {
+        DIR *d = opendir(dir.c_str());
+        if (!d)
+            continue;
+        while (struct dirent *de = readdir(d)) {
+            if (!is_font_name(de->d_name))
+                continue;
+            font_file file;
+            file.path = dir + "/" + de->d_name;
+            struct stat st;
+            if (stat(file.path.c_str(), &st) < 0 || !S_ISREG(st.st_mode))
+                continue;
+            file.size = st.st_size;
+            file.mtime = st.st_mtime;
+            files->push_back(file);
+        }
+        closedir(d);
+    }
+    std::sort(files->begin(), files->end(), [](const font_file &a, const font_file &b) {
+        return a.path < b.path;
+    });
+}
+
+// Identifies the font set: changes whenever a font is added, removed or replaced.
+static uint64_t font_set_signature(const std::vector<font_file> &files)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    auto mix = [&h](const void *p, size_t len) {
+        for (size_t i = 0; i < len; i++) {
+            h ^= static_cast<const uint8_t*>(p)[i];
+            h *= 0x100000001b3ULL;
+        }
+    };
+    mix(&INDEX_VERSION, sizeof(INDEX_VERSION));
+    for (const font_file &file : files) {
+        mix(file.path.c_str(), file.path.size() + 1);
+        mix(&file.size, sizeof(file.size));
+        mix(&file.mtime, sizeof(file.mtime));
+    }
+    return h;
+}
+
+struct font_index {
+    const uint8_t *map;
+    size_t size;
+    const index_header *header;
+    const index_entry *entries;
+    const char *strings;
+
+    const char *str(uint32_t offset) const {
+        return offset < header->strings_size ? strings + offset : "";
+    }
+};
+
+static bool index_open(const char *path, font_index *idx)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(index_header))
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    idx->map = static_cast<const uint8_t*>(map);
+    idx->size = st.st_size;
+    idx->header = reinterpret_cast<const index_header*>(map);
+    const index_header *h = idx->header;
+    bool valid = !memcmp(h->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) && h->version == INDEX_VERSION &&
+        h->strings_offset == sizeof(index_header) + (uint64_t)h->count * sizeof(index_entry) &&
+        (uint64_t)h->strings_offset + h->strings_size <= idx->size &&
+        h->strings_size > 0 && idx->map[h->strings_offset + h->strings_size - 1] == '\0';
+    if (!valid) {
+        munmap(map, st.st_size);
+        return false;
+    }
+    idx->entries = reinterpret_cast<const index_entry*>(idx->map + sizeof(index_header));
+    idx->strings = reinterpret_cast<const char*>(idx->map + h->strings_offset);
+    return true;
+}
+
+static void index_close(font_index *idx)
+{
+    munmap(const_cast<uint8_t*>(idx->map), idx->size);
+}
+
+static bool write_full(int fd, const void *data, size_t len)
+{
+    const uint8_t *p = static_cast<const uint8_t*>(data);
+    while (len > 0) {
+        ssize_t r = write(fd, p, len);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        p += r;
+        len -= r;
+    }
+    return true;
+}
+
+// Written to a temporary file and renamed, so readers never see a partial index.
+static bool index_write(const char *path, uint64_t signature,
+    const std::vector<index_entry> &entries, const std::string &pool)
+{
+    index_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    h.version = INDEX_VERSION;
+    h.count = entries.size();
+    h.signature = signature;
+    h.strings_offset = sizeof(h) + entries.size() * sizeof(index_entry);
+    h.strings_size = pool.size();
+
+    std::string tmp = std::string(path) + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+    bool ok = write_full(fd, &h, sizeof(h)) &&
+        write_full(fd, entries.data(), entries.size() * sizeof(index_entry)) &&
+        write_full(fd, pool.data(), pool.size());
+    ok = close(fd) == 0 && ok;
+    if (ok && rename(tmp.c_str(), path) == 0)
+        return true;
+    unlink(tmp.c_str());
+    return false;
+}
+
+static int index_build(const char *path, const std::vector<std::string> &dirs)
+{
+    std::vector<font_file> files;
+    list_fonts(dirs, &files);
+    uint64_t signature = font_set_signature(files);
+
+    font_index idx;
+    if (index_open(path, &idx)) {
+        bool current = idx.header->signature == signature;
+        int count = idx.header->count;
+        index_close(&idx);
+        if (current)
+            return count;
+    }
+
+    int64_t start = stats_now_ns();
+    std::vector<index_entry> entries;
+    std::string pool(1, '\0');
+    for (const font_file &file : files)
+        index_file(file, &entries, &pool);
+    if (!index_write(path, signature, entries, pool)) {
+        ALOGE("FontIndex | Failed to write %s: %s", path, strerror(errno));
+        return -1;
+    }
+    ALOGV("FontIndex | Indexed %d faces from %d files in %lld ms", (int)entries.size(),
+        (int)files.size(), (long long)((stats_now_ns() - start) / 1000000));
+    return entries.size();
+}
+
+// ----------------------------------------------------------------------------
+// font selection
+// ----------------------------------------------------------------------------
+
+static int count_pages(const uint8_t *coverage, const std::vector<bool> &needed)
+{
+    int n = 0;
+    for (int page = 0; page < COVERAGE_PAGES; page++) {
+        if (needed[page] && (coverage[page >> 3] & (1 << (page & 7))))
+            n++;
+    }
+    return n;
+}
+
+// Greedy set cover over the upright regular faces: keep taking the face that
+// covers the most missing pages, the smaller file on ties.
+static std::vector<std::string> select_fonts(const font_index &idx, std::vector<bool> needed)
+{
+    std::vector<std::string> paths;
+    while (1) {
+        const index_entry *best = NULL;
+        int best_pages = 0;
+        for (uint32_t i = 0; i < idx.header->count; i++) {
+            const index_entry *e = &idx.entries[i];
+            if (e->italic || e->weight < 350 || e->weight > 500)
+                continue;
+            int pages = count_pages(e->coverage, needed);
+            if (pages > best_pages || (pages && pages == best_pages && e->file_size < best->file_size)) {
+                best = e;
+                best_pages = pages;
+            }
+        }
+        if (!best)
+            break;
+        for (int page = 0; page < COVERAGE_PAGES; page++) {
+            if (best->coverage[page >> 3] & (1 << (page & 7)))
+                needed[page] = false;
+        }
+        ALOGV("FontIndex | Using %s (%s %s)", idx.str(best->path), idx.str(best->family), idx.str(best->style));
+        paths.push_back(idx.str(best->path));
+    }
+    return paths;
+}
+
+static std::string link_name(const std::string &path)
+{
+    size_t slash = path.rfind('/');
+    return LINK_PREFIX + path.substr(slash == std::string::npos ? 0 : slash + 1);
+}
+
+// Replaces the links from an earlier selection with the new one. Other files
+// in the directory (user fonts) are left alone.
+static int link_fonts(const char *fonts_dir, const std::vector<std::string> &paths)
+{
+    mkdir(fonts_dir, 0755);
+    if (DIR *d = opendir(fonts_dir)) {
+        while (struct dirent *de = readdir(d)) {
+            if (strncmp(de->d_name, LINK_PREFIX, strlen(LINK_PREFIX)))
+                continue;
+            std::string link = std::string(fonts_dir) + "/" + de->d_name;
+            bool keep = false;
+            for (const std::string &path : paths)
+                keep = keep || link_name(path) == de->d_name;
+            if (!keep)
+                unlink(link.c_str());
+        }
+        closedir(d);
+    }
+
+    int linked = 0;
+    for (const std::string &path : paths) {
+        std::string link = std::string(fonts_dir) + "/" + link_name(path);
+        char target[PATH_MAX];
+        ssize_t len = readlink(link.c_str(), target, sizeof(target) - 1);
+        if (len >= 0 && path.compare(0, std::string::npos, target, len) == 0) {
+            linked++;
+            continue;
+        }
+        unlink(link.c_str());
+        if (symlink(path.c_str(), link.c_str()) == 0)
+            linked++;
+        else
+            ALOGE("FontIndex | Failed to link %s: %s", path.c_str(), strerror(errno));
+    }
+    return linked;
+}
+
+// Indexes the system font directories plus dirs (may be NULL) into the file at
+// path, unless the index there already matches the installed fonts. Returns the
+// number of indexed faces, -1 on failure.
+jni_func(jint, buildFontIndex, jstring jpath, jobjectArray jdirs) {
+    STATS_SCOPE("MPVLib.buildFontIndex");
+    std::vector<std::string> dirs(system_font_dirs, system_font_dirs + sizeof(system_font_dirs) / sizeof(system_font_dirs[0]));
+    int len = jdirs ? env->GetArrayLength(jdirs) : 0;
+    for (int i = 0; i < len; i++) {
+        jstring jdir = (jstring)env->GetObjectArrayElement(jdirs, i);
+        const char *dir = env->GetStringUTFChars(jdir, NULL);
+        dirs.push_back(dir);
+        env->ReleaseStringUTFChars(jdir, dir);
+        env->DeleteLocalRef(jdir);
+    }
+
+    const char *path = env->GetStringUTFChars(jpath, NULL);
+    int count = index_build(path, dirs);
+    env->ReleaseStringUTFChars(jpath, path);
+    return count;
+}
+
+// Links the fonts needed to render the characters in sample into fonts_dir.
+// Returns the number of fonts linked, -1 if the index can't be read.
+jni_func(jint, linkIndexedFonts, jstring jpath, jstring jfonts_dir, jstring jsample) {
+    STATS_SCOPE("MPVLib.linkIndexedFonts");
+    std::vector<bool> needed(COVERAGE_PAGES, false);
+    const jchar *sample = env->GetStringChars(jsample, NULL);
+    jsize sample_len = env->GetStringLength(jsample);
+    for (jsize i = 0; i < sample_len; i++) {
+        uint32_t c = sample[i];
+        if (c >= 0xd800 && c < 0xdc00 && i + 1 < sample_len) {
+            c = 0x10000 + ((c - 0xd800) << 10) + (sample[i + 1] - 0xdc00);
+            i++;
+        }
+        if (c < (uint32_t)COVERAGE_PAGES * 256)
+            needed[c >> 8] = true;
+    }
+    env->ReleaseStringChars(jsample, sample);
+
+    const char *path = env->GetStringUTFChars(jpath, NULL);
+    font_index idx;
+    bool opened = index_open(path, &idx);
+    env->ReleaseStringUTFChars(jpath, path);
+    if (!opened)
+        return -1;
+    std::vector<std::string> paths = select_fonts(idx, needed);
+    index_close(&idx);
+
+    const char *fonts_dir = env->GetStringUTFChars(jfonts_dir, NULL);
+    int linked = link_fonts(fonts_dir, paths);
+    env->ReleaseStringUTFChars(jfonts_dir, fonts_dir);
+    return linked;
+}
@@ -0,0 +1,215 @@
+#include <jni.h>
+#include <string.h>
+#include <mutex>
+#include <map>
+#include <string>
+
+#include <mpv/client.h>
+
+#include "jni_utils.h"
+#include "globals.h"
+#include "event.h"
+#include "log.h"
+#include "stats.h"
+
+extern "C" {
+    jni_func(jboolean, keyEvent, jint keycode, jint action, jint modifiers, jint unicode_char);
+};
+
+// ============================================================================
+// INPUT
+// Android key events go to mpv without leaving native code: the keycode is
+// translated here and sent as an async keydown/keyup, so the UI thread never
+// waits on the core.
+// ============================================================================
+
+// android.view.KeyEvent
+enum {
+    ACTION_DOWN = 0,
+    ACTION_UP = 1,
+    ACTION_MULTIPLE = 2,
+
+    META_SHIFT_ON = 0x1,
+    META_ALT_ON = 0x2,
+    META_CTRL_ON = 0x1000,
+    META_META_ON = 0x10000,
+};
+
+struct key_name {
+    int keycode;
+    const char *name;
+};
+
+// https://github.com/mpv-player/mpv/blob/master/input/keycodes.h
+static const key_name special_keys[] = {
+    { 19, "UP" },               // KEYCODE_DPAD_UP
+    { 20, "DOWN" },             // KEYCODE_DPAD_DOWN
+    { 21, "LEFT" },             // KEYCODE_DPAD_LEFT
+    { 22, "RIGHT" },            // KEYCODE_DPAD_RIGHT
+    { 61, "TAB" },              // KEYCODE_TAB
+    { 62, "SPACE" },            // KEYCODE_SPACE
+    { 66, "ENTER" },            // KEYCODE_ENTER
+    { 67, "BS" },               // KEYCODE_DEL
+    { 85, "PLAYPAUSE" },        // KEYCODE_MEDIA_PLAY_PAUSE
+    { 86, "STOP" },             // KEYCODE_MEDIA_STOP
+    { 87, "NEXT" },             // KEYCODE_MEDIA_NEXT
+    { 88, "PREV" },             // KEYCODE_MEDIA_PREVIOUS
+    { 89, "REWIND" },           // KEYCODE_MEDIA_REWIND
+    { 90, "FORWARD" },          // KEYCODE_MEDIA_FAST_FORWARD
+    { 92, "PGUP" },             // KEYCODE_PAGE_UP
+    { 93, "PGDWN" },            // KEYCODE_PAGE_DOWN
+    { 111, "ESC" },             // KEYCODE_ESCAPE
+    { 112, "DEL" },             // KEYCODE_FORWARD_DEL
+    { 120, "PRINT" },           // KEYCODE_SYSRQ
+    { 122, "HOME" },            // KEYCODE_MOVE_HOME
+    { 123, "END" },             // KEYCODE_MOVE_END
+    { 124, "INS" },             // KEYCODE_INSERT
+    { 126, "PLAYONLY" },        // KEYCODE_MEDIA_PLAY
+    { 127, "PAUSEONLY" },       // KEYCODE_MEDIA_PAUSE
+    { 130, "RECORD" },          // KEYCODE_MEDIA_RECORD
+    { 131, "F1" },              // KEYCODE_F1 ...
+    { 132, "F2" },
+    { 133, "F3" },
+    { 134, "F4" },
+    { 135, "F5" },
+    { 136, "F6" },
+    { 137, "F7" },
+    { 138, "F8" },
+    { 139, "F9" },
+    { 140, "F10" },
+    { 141, "F11" },
+    { 142, "F12" },             // ... KEYCODE_F12
+    { 144, "KP0" },             // KEYCODE_NUMPAD_0 ...
+    { 145, "KP1" },
+    { 146, "KP2" },
+    { 147, "KP3" },
+    { 148, "KP4" },
+    { 149, "KP5" },
+    { 150, "KP6" },
+    { 151, "KP7" },
+    { 152, "KP8" },
+    { 153, "KP9" },             // ... KEYCODE_NUMPAD_9
+    { 158, "KP_DEC" },          // KEYCODE_NUMPAD_DOT
+    { 160, "KP_ENTER" },        // KEYCODE_NUMPAD_ENTER
+    { 166, "CHANNEL_UP" },      // KEYCODE_CHANNEL_UP
+    { 167, "CHANNEL_DOWN" },    // KEYCODE_CHANNEL_DOWN
+    { 168, "ZOOMIN" },          // KEYCODE_ZOOM_IN
+    { 169, "ZOOMOUT" },         // KEYCODE_ZOOM_OUT
+    { 183, "F13" },             // KEYCODE_PROG_RED
+    { 184, "F14" },             // KEYCODE_PROG_GREEN
+    { 185, "F15" },             // KEYCODE_PROG_YELLOW
+    { 186, "F16" },             // KEYCODE_PROG_BLUE
+};
+
+// keycode -> name of the keys mpv currently considers held. Releases use the
+// name from the press, in case modifiers were let go first.
+static std::map<int, std::string> g_held_keys;
+static std::mutex g_input_mutex;
+
+static const char *special_key_name(int keycode)
+{
+    for (const key_name &k : special_keys) {
+        if (k.keycode == keycode)
+            return k.name;
+    }
+    return NULL;
+}
+
+static void append_utf8(std::string &out, uint32_t c)
+{
+    if (c < 0x80) {
+        out += (char)c;
+    } else if (c < 0x800) {
+        out += (char)(0xc0 | (c >> 6));
+        out += (char)(0x80 | (c & 0x3f));
+    } else if (c < 0x10000) {
+        out += (char)(0xe0 | (c >> 12));
+        out += (char)(0x80 | ((c >> 6) & 0x3f));
+        out += (char)(0x80 | (c & 0x3f));
+    } else {
+        out += (char)(0xf0 | (c >> 18));
+        out += (char)(0x80 | ((c >> 12) & 0x3f));
+        out += (char)(0x80 | ((c >> 6) & 0x3f));
+        out += (char)(0x80 | (c & 0x3f));
+    }
+}
+
+static bool key_to_mpv(int keycode, int modifiers, int unicode_char, std::string *out)
+{
+    const char *special = special_key_name(keycode);
+    bool printable = !special && unicode_char > 0x20 && unicode_char <= 0x10ffff && unicode_char != 0x7f;
+    if (!special && !printable)
+        return false;
+
+    out->clear();
+    if (modifiers & META_CTRL_ON)
+        *out += "Ctrl+";
+    if (modifiers & META_ALT_ON)
+        *out += "Alt+";
+    if (modifiers & META_META_ON)
+        *out += "Meta+";
+    // the character already has shift applied
+    if ((modifiers & META_SHIFT_ON) && special)
+        *out += "Shift+";
+
+    if (special)
+        *out += special;
+    else if (unicode_char == '#')
+        *out += "SHARP";
+    else
+        append_utf8(*out, unicode_char);
+    return true;
+}
+
+static bool send_key(const char *cmd, const std::string &key)
+{
+    mpv_node args[2];
+    args[0].format = MPV_FORMAT_STRING;
+    args[0].u.string = const_cast<char*>(cmd);
+    args[1].format = MPV_FORMAT_STRING;
+    args[1].u.string = const_cast<char*>(key.c_str());
+    mpv_node_list list = { 2, args, NULL };
+    mpv_node node;
+    node.format = MPV_FORMAT_NODE_ARRAY;
+    node.u.list = &list;
+
+    int result = mpv_command_node_async(g_mpv, ASYNC_REPLY_IGNORE, &node);
+    if (result < 0) {
+        ALOGE("Input | %s %s returned error %s", cmd, key.c_str(), mpv_error_string(result));
+        return false;
+    }
+    return true;
+}
+
+// Returns whether the key has an mpv equivalent and was dispatched. unicode_char
+// is the character the key produces with shift applied, 0 if none.
+jni_func(jboolean, keyEvent, jint keycode, jint action, jint modifiers, jint unicode_char) {
+    STATS_SCOPE("MPVLib.keyEvent");
+    CHECK_MPV_INIT();
+
+    std::lock_guard<std::mutex> lock(g_input_mutex);
+    std::string key;
+    auto held = g_held_keys.find(keycode);
+    if (action == ACTION_UP && held != g_held_keys.end()) {
+        key = held->second;
+        g_held_keys.erase(held);
+        return send_key("keyup", key);
+    }
+    if (!key_to_mpv(keycode, modifiers, unicode_char, &key))
+        return JNI_FALSE;
+
+    switch (action) {
+    case ACTION_DOWN:
+        // Android auto-repeat sends more downs, mpv generates its own repeats
+        if (held != g_held_keys.end())
+            return JNI_TRUE;
+        g_held_keys[keycode] = key;
+        return send_key("keydown", key);
+    case ACTION_UP:
+        return send_key("keyup", key);
+    case ACTION_MULTIPLE:
+        return send_key("keypress", key);
+    default:
+        return JNI_FALSE;
+    }
+}
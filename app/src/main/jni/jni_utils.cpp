@@ -40,6 +40,7 @@ void init_methods_cache(JNIEnv *env)
     java_Double_init = env->GetMethodID(java_Double, "<init>", "(D)V");
     java_Boolean = FIND_CLASS("java/lang/Boolean");
     java_Boolean_init = env->GetMethodID(java_Boolean, "<init>", "(Z)V");
+    java_String = FIND_CLASS("java/lang/String");
 
     android_graphics_Bitmap = FIND_CLASS("android/graphics/Bitmap");
     // createBitmap(int[], int, int, android.graphics.Bitmap$Config)
@@ -57,6 +58,13 @@ void init_methods_cache(JNIEnv *env)
     mpv_MPVLib_eventProperty_SN = env->GetStaticMethodID(mpv_MPVLib, "eventProperty", "(Ljava/lang/String;Lis/xyz/mpv/MPVNode;)V"); // eventProperty(String, MPVNode)
     mpv_MPVLib_event = env->GetStaticMethodID(mpv_MPVLib, "event", "(ILis/xyz/mpv/MPVNode;)V"); // event(int, MPVNode)
     mpv_MPVLib_logMessage_SiS = env->GetStaticMethodID(mpv_MPVLib, "logMessage", "(Ljava/lang/String;ILjava/lang/String;)V"); // logMessage(String, int, String)
+    mpv_MPVLib_destroyComplete_J = env->GetStaticMethodID(mpv_MPVLib, "destroyComplete", "(J)V"); // destroyComplete(long)
+    mpv_MPVLib_qosAlert_ID = env->GetStaticMethodID(mpv_MPVLib, "qosAlert", "(ID)V"); // qosAlert(int, double)
+    mpv_MPVLib_scanBatch = env->GetStaticMethodID(mpv_MPVLib, "scanBatch", "([Lis/xyz/mpv/MPVNode;)V"); // scanBatch(MPVNode[])
+    mpv_MPVLib_scanFinished = env->GetStaticMethodID(mpv_MPVLib, "scanFinished", "(IIIZ)V"); // scanFinished(int, int, int, boolean)
+    mpv_MPVLib_exportProgress = env->GetStaticMethodID(mpv_MPVLib, "exportProgress", "(D)V"); // exportProgress(double)
+    mpv_MPVLib_exportFinished = env->GetStaticMethodID(mpv_MPVLib, "exportFinished", "(Ljava/lang/String;ZZ)V"); // exportFinished(String, boolean, boolean)
+    mpv_MPVLib_screenshotSaved = env->GetStaticMethodID(mpv_MPVLib, "screenshotSaved", "(Ljava/lang/String;Z)V"); // screenshotSaved(String, boolean)
 
     // for array node creation, tbh, it might be better to use "List" instead but i wanted consitent naming
     mpv_MPVNode = FIND_CLASS("is/xyz/mpv/MPVNode");
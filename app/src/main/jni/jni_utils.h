@@ -12,7 +12,7 @@ void init_methods_cache(JNIEnv *env);
 #define UTIL_EXTERN extern
 #endif
 
-UTIL_EXTERN jclass java_Integer, java_Double, java_Boolean;
+UTIL_EXTERN jclass java_Integer, java_Double, java_Boolean, java_String;
 UTIL_EXTERN jmethodID java_Integer_init, java_Double_init, java_Boolean_init;
 
 UTIL_EXTERN jclass android_graphics_Bitmap, android_graphics_Bitmap_Config;
@@ -27,7 +27,14 @@ UTIL_EXTERN jmethodID mpv_MPVLib_eventProperty_S,
 	mpv_MPVLib_eventProperty_SS,
 	mpv_MPVLib_eventProperty_SN,
 	mpv_MPVLib_event,
-	mpv_MPVLib_logMessage_SiS;
+	mpv_MPVLib_logMessage_SiS,
+	mpv_MPVLib_destroyComplete_J,
+	mpv_MPVLib_qosAlert_ID,
+	mpv_MPVLib_scanBatch,
+	mpv_MPVLib_scanFinished,
+	mpv_MPVLib_exportProgress,
+	mpv_MPVLib_exportFinished,
+	mpv_MPVLib_screenshotSaved;
 
 UTIL_EXTERN jclass mpv_MPVNode_None, mpv_MPVNode_StringNode, mpv_MPVNode_BooleanNode,
 	mpv_MPVNode_IntNode, mpv_MPVNode_DoubleNode, mpv_MPVNode_ArrayNode, mpv_MPVNode_MapNode, mpv_MPVNode;
@@ -0,0 +1,309 @@
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <jni.h>
+
+extern "C" {
+    #include <libavutil/channel_layout.h>
+};
+
+#include "audio_decode.h"
+#include "jni_utils.h"
+#include "log.h"
+#include "probe.h"
+#include "stats.h"
+#include "trace.h"
+
+extern "C" {
+    jni_func(void, analyzeLoudness, jobjectArray jpaths);
+    jni_func(jdoubleArray, getLoudness, jstring jpath);
+};
+
+// ============================================================================
+// LOUDNESS ANALYSIS
+// EBU R128 / ITU-R BS.1770-4 integrated loudness and true peak, measured in
+// the background on a couple of low-priority threads and stored with the
+// file's probe cache entry. Playback then only sets a precomputed gain
+// instead of running af=loudnorm.
+// ============================================================================
+
+static const int ANALYZER_THREADS = 2;
+static const int ANALYZER_NICE = 10;
+// ReplayGain 2.0 reference level
+static const double REFERENCE_LUFS = -18.0;
+static const double MAX_TRUE_PEAK = -1.0;
+
+static std::mutex g_queue_mutex;
+static std::condition_variable g_queue_cv;
+static std::deque<std::string> g_queue;
+static int g_analyzers;
+
+// y = b0 x + b1 x1 + b2 x2 - a1 y1 - a2 y2, transposed direct form II
+struct biquad {
+    double b0, b1, b2, a1, a2;
+    double z1 = 0, z2 = 0;
+
+    double run(double x) {
+        double y = b0 * x + z1;
+        z1 = b1 * x - a1 * y + z2;
+        z2 = b2 * x - a2 * y;
+        return y;
+    }
+};
+
+// 4x oversampling interpolator for the true peak, 12 taps per phase
+static const int TP_PHASES = 4;
+static const int TP_TAPS = 12;
+
+struct true_peak_filter {
+    float coeffs[TP_PHASES][TP_TAPS];
+    float history[TP_TAPS] = {};
+    int pos = 0;
+
+    true_peak_filter() {
+        // Hann-windowed sinc lowpass at the original Nyquist frequency
+        const int n = TP_PHASES * TP_TAPS;
+        for (int i = 0; i < n; i++) {
+            double t = (i - (n - 1) / 2.0) / TP_PHASES;
+            double sinc = t == 0 ? 1 : sin(M_PI * t) / (M_PI * t);
+            double window = 0.5 - 0.5 * cos(2 * M_PI * (i + 0.5) / n);
+            coeffs[i % TP_PHASES][i / TP_PHASES] = (float)(sinc * window);
+        }
+    }
+
+    // max |x| of the interpolated signal up to and including x
+    float run(float x) {
+        history[pos] = x;
+        float peak = 0;
+        for (int p = 0; p < TP_PHASES; p++) {
+            float acc = 0;
+            for (int k = 0; k < TP_TAPS; k++)
+                acc += coeffs[p][k] * history[(pos - k + TP_TAPS) % TP_TAPS];
+            peak = std::max(peak, fabsf(acc));
+        }
+        pos = (pos + 1) % TP_TAPS;
+        return std::max(peak, fabsf(x));
+    }
+};
+
+struct channel_state {
+    biquad shelf, highpass;
+    true_peak_filter tp;
+    double weight;
+};
+
+// The two K-weighting stages for sample rate fs, as specified for 48 kHz
+// and re-derived from their analog prototypes for other rates.
+static void k_weighting(double fs, biquad *shelf, biquad *highpass)
+{
+    double f0 = 1681.974450955533, gain = 3.999843853973347, q = 0.7071752369554196;
+    double k = tan(M_PI * f0 / fs);
+    double vh = pow(10.0, gain / 20.0);
+    double vb = pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+    shelf->b0 = (vh + vb * k / q + k * k) / a0;
+    shelf->b1 = 2.0 * (k * k - vh) / a0;
+    shelf->b2 = (vh - vb * k / q + k * k) / a0;
+    shelf->a1 = 2.0 * (k * k - 1.0) / a0;
+    shelf->a2 = (1.0 - k / q + k * k) / a0;
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = tan(M_PI * f0 / fs);
+    a0 = 1.0 + k / q + k * k;
+    highpass->b0 = 1.0;
+    highpass->b1 = -2.0;
+    highpass->b2 = 1.0;
+    highpass->a1 = 2.0 * (k * k - 1.0) / a0;
+    highpass->a2 = (1.0 - k / q + k * k) / a0;
+}
+
+// BS.1770 channel weights: LFE is ignored, side and back surrounds count 1.41.
+static double channel_weight(int id)
+{
+    switch (id) {
+    case AV_CHAN_LOW_FREQUENCY:
+    case AV_CHAN_LOW_FREQUENCY_2:
+        return 0.0;
+    case AV_CHAN_SIDE_LEFT:
+    case AV_CHAN_SIDE_RIGHT:
+    case AV_CHAN_BACK_LEFT:
+    case AV_CHAN_BACK_RIGHT:
+        return 1.41;
+    default:
+        return 1.0;
+    }
+}
+
+static double energy_to_lufs(double energy)
+{
+    return -0.691 + 10.0 * log10(energy);
+}
+
+static bool measure(const char *path, double *loudness, double *true_peak)
+{
+    TRACE_SCOPE("loudness:measure");
+    audio_stream_info info;
+    if (!audio_stream_open_info(path, -1, &info))
+        return false;
+
+    // gating blocks are 400 ms overlapping by 75%, so keep 100 ms sub-blocks
+    const int sub_len = std::max(1, info.sample_rate / 10);
+    std::vector<double> subs;
+    double sub_acc = 0;
+    int sub_fill = 0;
+    std::vector<channel_state> state;
+    float peak = 0;
+
+    bool ok = decode_audio_range(path, info, 0, INT64_MAX,
+        [&](const float *const *planes, int channels, int64_t, int count) {
+            if (state.size() != (size_t)channels) {
+                // channel count changed mid-stream, start filters over
+                state.assign(channels, channel_state());
+                for (int c = 0; c < channels; c++) {
+                    k_weighting(info.sample_rate, &state[c].shelf, &state[c].highpass);
+                    // a layout that no longer matches the stream's counts every channel fully
+                    state[c].weight = (size_t)channels == info.channel_ids.size() ?
+                        channel_weight(info.channel_ids[c]) : 1.0;
+                }
+            }
+            for (int i = 0; i < count; ) {
+                int n = std::min(count - i, sub_len - sub_fill);
+                for (int c = 0; c < channels; c++) {
+                    channel_state &cs = state[c];
+                    const float *x = planes[c] + i;
+                    double sum = 0;
+                    for (int j = 0; j < n; j++) {
+                        double y = cs.highpass.run(cs.shelf.run(x[j]));
+                        sum += y * y;
+                        peak = std::max(peak, cs.tp.run(x[j]));
+                    }
+                    sub_acc += cs.weight * sum;
+                }
+                i += n;
+                sub_fill += n;
+                if (sub_fill == sub_len) {
+                    subs.push_back(sub_acc / sub_len);
+                    sub_acc = 0;
+                    sub_fill = 0;
+                }
+            }
+        });
+    if (!ok || subs.size() < 4)
+        return false;
+
+    // absolute gate at -70 LUFS, then relative gate 10 LU below the mean
+    std::vector<double> blocks;
+    for (size_t j = 0; j + 4 <= subs.size(); j++) {
+        double e = (subs[j] + subs[j + 1] + subs[j + 2] + subs[j + 3]) / 4;
+        if (e > 0 && energy_to_lufs(e) > -70.0)
+            blocks.push_back(e);
+    }
+    if (blocks.empty()) {
+        // digital silence
+        *loudness = -70.0;
+    } else {
+        double sum = 0;
+        for (double e : blocks)
+            sum += e;
+        double gate = energy_to_lufs(sum / blocks.size()) - 10.0;
+        double gated = 0;
+        size_t n = 0;
+        for (double e : blocks) {
+            if (energy_to_lufs(e) > gate) {
+                gated += e;
+                n++;
+            }
+        }
+        *loudness = energy_to_lufs(gated / n);
+    }
+    *true_peak = peak > 0 ? 20.0 * log10(peak) : -INFINITY;
+    return true;
+}
+
+static void analyzer_loop()
+{
+    pthread_setname_np(pthread_self(), "loudness");
+    // never compete with playback
+    setpriority(PRIO_PROCESS, gettid(), ANALYZER_NICE);
+    std::unique_lock<std::mutex> lock(g_queue_mutex);
+    while (1) {
+        g_queue_cv.wait(lock, [] { return !g_queue.empty(); });
+        std::string path = g_queue.front();
+        g_queue.pop_front();
+        lock.unlock();
+
+        media_info info;
+        double loudness, true_peak;
+        // the result is stored in the file's cache entry, which probing makes
+        // sure exists; without one (cache disabled, URLs) the decode is wasted
+        if (!probe_cache_accepts(path)) {
+            ALOGV("Loudness | Not analyzing %s, no probe cache for it", path.c_str());
+        } else if (probe_media_cached(path, &info) && isnan(info.loudness) && probe_cache_lookup(path, &info)) {
+            if (measure(path.c_str(), &loudness, &true_peak) &&
+                    probe_cache_set_loudness(path, loudness, true_peak)) {
+                ALOGV("Loudness | %s: %.1f LUFS, %.1f dBTP", path.c_str(), loudness, true_peak);
+            } else {
+                ALOGV("Loudness | Failed to analyze %s", path.c_str());
+            }
+        }
+
+        lock.lock();
+        if (g_queue.empty()) {
+            lock.unlock();
+            probe_cache_save();
+            lock.lock();
+        }
+    }
+}
+
+// Queues files for background analysis; results land in the probe cache, so
+// it needs to be enabled with setProbeCache().
+jni_func(void, analyzeLoudness, jobjectArray jpaths) {
+    STATS_SCOPE("MPVLib.analyzeLoudness");
+    int count = env->GetArrayLength(jpaths);
+    std::lock_guard<std::mutex> lock(g_queue_mutex);
+    for (int i = 0; i < count; i++) {
+        jstring jpath = (jstring)env->GetObjectArrayElement(jpaths, i);
+        const char *path = env->GetStringUTFChars(jpath, NULL);
+        g_queue.push_back(path);
+        env->ReleaseStringUTFChars(jpath, path);
+        env->DeleteLocalRef(jpath);
+    }
+    for (; g_analyzers < ANALYZER_THREADS; g_analyzers++)
+        std::thread(analyzer_loop).detach();
+    g_queue_cv.notify_all();
+}
+
+// Integrated loudness (LUFS), true peak (dBTP) and the gain (dB) that brings
+// the file to the reference level without the peak exceeding -1 dBTP; null
+// until analyzed.
+jni_func(jdoubleArray, getLoudness, jstring jpath) {
+    STATS_SCOPE("MPVLib.getLoudness");
+    const char *cpath = env->GetStringUTFChars(jpath, NULL);
+    std::string path = cpath;
+    env->ReleaseStringUTFChars(jpath, cpath);
+
+    media_info info;
+    // never probes, this may be called on the UI thread
+    if (!probe_cache_lookup(path, &info) || isnan(info.loudness))
+        return NULL;
+    double gain = REFERENCE_LUFS - info.loudness;
+    if (std::isfinite(info.true_peak))
+        gain = std::min(gain, MAX_TRUE_PEAK - info.true_peak);
+
+    jdouble values[3] = { info.loudness, info.true_peak, gain };
+    jdoubleArray arr = env->NewDoubleArray(3);
+    if (arr)
+        env->SetDoubleArrayRegion(arr, 0, 3, values);
+    return arr;
+}
@@ -1,6 +1,7 @@
 #include <jni.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <locale.h>
 #include <atomic>
@@ -17,6 +18,12 @@ extern "C" {
 #include "jni_utils.h"
 #include "event.h"
 #include "node.h"
+#include "startup_timing.h"
+#include "trace.h"
+#include "fdstream.h"
+#include "readahead_stream.h"
+#include "render.h"
+#include "stats.h"
 
 #define ARRAYLEN(a) (sizeof(a)/sizeof(a[0]))
 
@@ -24,16 +31,18 @@ extern "C" {
     jni_func(void, create, jobject appctx);
     jni_func(void, init);
     jni_func(void, destroy);
+    jni_func(void, destroyAsync, jlong token);
 
     jni_func(void, command, jobjectArray jarray);
     jni_func(jobject, commandNode, jobjectArray jarray);
+
+    jni_func(jlongArray, getStartupTimings);
 };
 
 JavaVM *g_vm;
 mpv_handle *g_mpv;
-std::atomic<bool> g_event_thread_request_exit(false);
 
-static pthread_t event_thread_id;
+static event_thread_ctx *event_ctx;
 
 static void prepare_environment(JNIEnv *env, jobject appctx) {
     setlocale(LC_NUMERIC, "C");
@@ -49,6 +58,9 @@ static void prepare_environment(JNIEnv *env, jobject appctx) {
 }
 
 jni_func(void, create, jobject appctx) {
+    TRACE_SCOPE("MPVLib.create");
+    STATS_SCOPE("MPVLib.create");
+    startup_timing_reset();
     prepare_environment(env, appctx);
 
     if (g_mpv)
@@ -57,42 +69,131 @@ jni_func(void, create, jobject appctx) {
     g_mpv = mpv_create();
     if (!g_mpv)
         die("context init failed");
+    startup_timing_bind(g_mpv);
 
     // use terminal log level but request verbose messages
     // this way --msg-level can be used to adjust later
     mpv_request_log_messages(g_mpv, "terminal-default");
     mpv_set_option_string(g_mpv, "msg-level", "all=v");
+
+    fdstream_register(g_mpv);
+    readahead_register(g_mpv);
 }
 
 jni_func(void, init) {
+    TRACE_SCOPE("MPVLib.init");
+    STATS_SCOPE("MPVLib.init");
     if (!g_mpv)
         die("mpv is not created");
 
     if (mpv_initialize(g_mpv) < 0)
         die("mpv init failed");
+    startup_timing_mark(g_mpv, STARTUP_INIT);
 
-    g_event_thread_request_exit = false;
-    if (pthread_create(&event_thread_id, NULL, event_thread, NULL) != 0)
+    event_ctx = new event_thread_ctx(g_mpv);
+    if (pthread_create(&event_ctx->thread, NULL, event_thread, event_ctx) != 0)
         die("thread create failed");
-    pthread_setname_np(event_thread_id, "event_thread");
+    pthread_setname_np(event_ctx->thread, "event_thread");
+}
+
+// poke event thread so it stops delivering events, does not wait for it
+static void request_event_thread_exit(event_thread_ctx *ctx)
+{
+    ctx->request_exit = true;
+    mpv_wakeup(ctx->mpv);
 }
 
 jni_func(void, destroy) {
+    TRACE_SCOPE("MPVLib.destroy");
+    STATS_SCOPE("MPVLib.destroy");
     if (!g_mpv) {
         ALOGV("mpv destroy called but it's already destroyed");
         return;
     }
 
     // poke event thread and wait for it to exit
-    g_event_thread_request_exit = true;
-    mpv_wakeup(g_mpv);
-    pthread_join(event_thread_id, NULL);
+    if (event_ctx) {
+        request_event_thread_exit(event_ctx);
+        pthread_join(event_ctx->thread, NULL);
+        delete event_ctx;
+        event_ctx = NULL;
+    }
 
     mpv_terminate_destroy(g_mpv);
     g_mpv = NULL;
 }
 
+struct reaper_job {
+    mpv_handle *mpv;
+    event_thread_ctx *events;
+    jobject surface;    // global reference, NULL if none was attached
+    jlong token;
+};
+
+static void *reaper_thread(void *arg)
+{
+    reaper_job *job = static_cast<reaper_job*>(arg);
+    pthread_setname_np(pthread_self(), "mpv_reaper");
+
+    JNIEnv *env = NULL;
+    if (!acquire_jni_env(g_vm, &env))
+        env = NULL;
+    // the Surface first, it may already be wanted by the next instance
+    render_release_surface(env, job->mpv, job->surface);
+
+    if (job->events) {
+        pthread_join(job->events->thread, NULL);
+        delete job->events;
+    }
+    mpv_terminate_destroy(job->mpv);
+    ALOGV("mpv instance %p destroyed in background", job->mpv);
+
+    if (env) {
+        env->CallStaticVoidMethod(mpv_MPVLib, mpv_MPVLib_destroyComplete_J, job->token);
+        if (env->ExceptionCheck())
+            env->ExceptionClear();
+        g_vm->DetachCurrentThread();
+    }
+
+    delete job;
+    return NULL;
+}
+
+// Detaches the current instance from Java immediately and hands termination to
+// a reaper thread. MPVLib.destroyComplete(token) is called once it is gone.
+// A new instance may be created right away.
+jni_func(void, destroyAsync, jlong token) {
+    STATS_SCOPE("MPVLib.destroyAsync");
+    init_methods_cache(env);
+    if (!g_mpv) {
+        ALOGV("mpv destroyAsync called but it's already destroyed");
+        env->CallStaticVoidMethod(mpv_MPVLib, mpv_MPVLib_destroyComplete_J, token);
+        return;
+    }
+
+    reaper_job *job = new reaper_job();
+    job->mpv = g_mpv;
+    job->events = event_ctx;
+    // the VO is shut down on the reaper, which can take a while
+    job->surface = render_take_surface();
+    job->token = token;
+    if (event_ctx)
+        request_event_thread_exit(event_ctx);
+    g_mpv = NULL;
+    event_ctx = NULL;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t reaper_id;
+    if (pthread_create(&reaper_id, &attr, reaper_thread, job) != 0)
+        die("thread create failed");
+    pthread_attr_destroy(&attr);
+}
+
 jni_func(void, command, jobjectArray jarray) {
+    TRACE_SCOPE("MPVLib.command");
+    STATS_SCOPE("MPVLib.command");
     CHECK_MPV_INIT();
 
     const char *arguments[128] = {0};
@@ -103,6 +204,8 @@ jni_func(void, command, jobjectArray jarray) {
     for (int i = 0; i < len; ++i)
         arguments[i] = env->GetStringUTFChars((jstring)env->GetObjectArrayElement(jarray, i), NULL);
 
+    if (len > 0 && !strcmp(arguments[0], "loadfile"))
+        startup_timing_mark(g_mpv, STARTUP_LOADFILE);
     mpv_command(g_mpv, arguments);
 
     for (int i = 0; i < len; ++i)
@@ -110,6 +213,8 @@ jni_func(void, command, jobjectArray jarray) {
 }
 
 jni_func(jobject, commandNode, jobjectArray jarray) {
+    TRACE_SCOPE("MPVLib.commandNode");
+    STATS_SCOPE("MPVLib.commandNode");
     CHECK_MPV_INIT();
 
     int len = env->GetArrayLength(jarray);
@@ -129,6 +234,9 @@ jni_func(jobject, commandNode, jobjectArray jarray) {
         env->ReleaseStringUTFChars((jstring)env->GetObjectArrayElement(jarray, i), str);
     }
 
+    if (!strcmp(args.u.list->values[0].u.string, "loadfile"))
+        startup_timing_mark(g_mpv, STARTUP_LOADFILE);
+
     mpv_node result;
     int error = mpv_command_node(g_mpv, &args, &result);
 
@@ -143,3 +251,20 @@ jni_func(jobject, commandNode, jobjectArray jarray) {
 
     return jresult;
 }
+
+// Nanoseconds from create() to each startup stage, -1 where not reached yet.
+// Order: create, init, loadfile, file-loaded, playback-restart.
+jni_func(jlongArray, getStartupTimings) {
+    STATS_SCOPE("MPVLib.getStartupTimings");
+    int64_t timings[STARTUP_STAGE_COUNT];
+    startup_timing_get(timings);
+
+    jlongArray jtimings = env->NewLongArray(STARTUP_STAGE_COUNT);
+    if (!jtimings)
+        return NULL;
+    jlong values[STARTUP_STAGE_COUNT];
+    for (int i = 0; i < STARTUP_STAGE_COUNT; i++)
+        values[i] = timings[i];
+    env->SetLongArrayRegion(jtimings, 0, STARTUP_STAGE_COUNT, values);
+    return jtimings;
+}
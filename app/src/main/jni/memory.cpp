@@ -0,0 +1,294 @@
+#include <jni.h>
+#include <stdio.h>
+#include <string.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <atomic>
+#include <mutex>
+#include <stdlib.h>
+#include <algorithm>
+
+#include <mpv/client.h>
+
+#include "jni_utils.h"
+#include "globals.h"
+#include "log.h"
+#include "stats.h"
+#include "storyboard.h"
+
+extern "C" {
+    jni_func(jlongArray, getMemoryReport);
+    jni_func(void, setMemoryBudget, jlong ceiling);
+};
+
+// ============================================================================
+// NATIVE MEMORY ACCOUNTING
+// The report combines the malloc heap (which also holds FFmpeg's buffers, it
+// has no usage accounting of its own), the process RSS, mpv's demuxer cache
+// and the storyboard cache.
+//
+// The budget controller keeps the caches that can be resized inside a ceiling:
+// every few seconds it takes what the rest of the heap uses off the ceiling and
+// splits the remainder between demuxer-max-bytes, demuxer-max-back-bytes and
+// the storyboard budget. It only ever lowers the limits configured when it
+// started, and puts them back as headroom returns or when it is stopped.
+// ============================================================================
+
+static const int64_t MiB = 1024 * 1024;
+// the caches always get at least this much, however full the heap is
+static const int64_t MIN_CACHE_BYTES = 16 * MiB;
+static const int64_t MAX_STORYBOARD_BYTES = 32 * MiB;
+static const double CONTROL_INTERVAL = 2.0;
+
+struct memory_report {
+    int64_t rss;
+    int64_t heap_allocated, heap_total;
+    int64_t demuxer_bytes, demuxer_fw_bytes;
+    int64_t storyboard_bytes;
+};
+
+struct budget_ctx {
+    mpv_handle *mpv;
+    int64_t ceiling;
+    // the user's limits, which the budget may lower but never raise
+    int64_t configured_fw, configured_back, configured_storyboard;
+    std::atomic<bool> stop;
+};
+
+static budget_ctx *g_budget;
+static std::mutex g_budget_mutex;
+
+static void heap_usage(int64_t *allocated, int64_t *total)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 mi = mallinfo2();
+#else
+    // bionic's mallinfo() has size_t fields, so it does not overflow like glibc's
+    struct mallinfo mi = mallinfo();
+#endif
+    *allocated = (int64_t)mi.uordblks + (int64_t)mi.hblkhd;
+    *total = (int64_t)mi.arena + (int64_t)mi.hblkhd;
+}
+
+static int64_t resident_bytes()
+{
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f)
+        return -1;
+    long long size = 0, resident = 0;
+    int n = fscanf(f, "%lld %lld", &size, &resident);
+    fclose(f);
+    return n == 2 ? resident * sysconf(_SC_PAGESIZE) : -1;
+}
+
+static int64_t node_map_int(const mpv_node *map, const char *key)
+{
+    if (map->format != MPV_FORMAT_NODE_MAP)
+        return 0;
+    for (int i = 0; i < map->u.list->num; i++) {
+        if (!strcmp(map->u.list->keys[i], key) && map->u.list->values[i].format == MPV_FORMAT_INT64)
+            return map->u.list->values[i].u.int64;
+    }
+    return 0;
+}
+
+static void collect(mpv_handle *mpv, memory_report *r)
+{
+    memset(r, 0, sizeof(*r));
+    r->rss = resident_bytes();
+    heap_usage(&r->heap_allocated, &r->heap_total);
+    r->storyboard_bytes = storyboard_bytes();
+
+    mpv_node state;
+    if (mpv && mpv_get_property(mpv, "demuxer-cache-state", MPV_FORMAT_NODE, &state) >= 0) {
+        r->demuxer_bytes = node_map_int(&state, "total-bytes");
+        r->demuxer_fw_bytes = node_map_int(&state, "fw-bytes");
+        mpv_free_node_contents(&state);
+    }
+}
+
+// Ceiling by device class, from the physical memory size.
+static int64_t auto_ceiling()
+{
+    int64_t ram = (int64_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+    if (ram <= 0 || ram <= 2048 * MiB)
+        return 128 * MiB;
+    if (ram <= 4096 * MiB)
+        return 256 * MiB;
+    if (ram <= 8192 * MiB)
+        return 512 * MiB;
+    return 768 * MiB;
+}
+
+static bool differs(int64_t a, int64_t b)
+{
+    // ignore small changes so options are not rewritten on every round
+    return llabs(a - b) > std::max(a, b) / 10;
+}
+
+// whether to apply target over applied; the configured value is always
+// restored exactly
+static bool should_apply(int64_t target, int64_t applied, int64_t configured)
+{
+    if (applied < 0)
+        return true;
+    if (target == configured)
+        return applied != configured;
+    return differs(target, applied);
+}
+
+static void set_demuxer_limits(mpv_handle *mpv, int64_t fw, int64_t back)
+{
+    mpv_set_property(mpv, "demuxer-max-bytes", MPV_FORMAT_INT64, &fw);
+    mpv_set_property(mpv, "demuxer-max-back-bytes", MPV_FORMAT_INT64, &back);
+}
+
+static void *budget_thread(void *arg)
+{
+    budget_ctx *ctx = static_cast<budget_ctx*>(arg);
+    pthread_setname_np(pthread_self(), "membudget");
+    int64_t applied_fw = -1, applied_back = -1, applied_storyboard = -1;
+    int64_t configured_fw = ctx->configured_fw, configured_back = ctx->configured_back;
+    int64_t configured_storyboard = ctx->configured_storyboard;
+    bool shutdown = false;
+
+    while (!ctx->stop) {
+        memory_report r;
+        collect(ctx->mpv, &r);
+
+        // heap not held by the resizable caches
+        int64_t other = std::max<int64_t>(0, r.heap_allocated - r.demuxer_bytes - r.storyboard_bytes);
+        int64_t available = std::max(MIN_CACHE_BYTES, ctx->ceiling - other);
+        int64_t storyboard = std::min(MAX_STORYBOARD_BYTES, available / 8);
+        int64_t demuxer = available - storyboard;
+        int64_t fw = std::min(configured_fw, demuxer * 3 / 4);
+        int64_t back = std::min(configured_back, demuxer - demuxer * 3 / 4);
+        storyboard = std::min(configured_storyboard, storyboard);
+
+        if (should_apply(fw, applied_fw, configured_fw) || should_apply(back, applied_back, configured_back)) {
+            set_demuxer_limits(ctx->mpv, fw, back);
+            applied_fw = fw;
+            applied_back = back;
+            ALOGV("Memory | %lld MiB used outside caches, demuxer cache set to %lld+%lld MiB",
+                (long long)(other / MiB), (long long)(fw / MiB), (long long)(back / MiB));
+        }
+        if (should_apply(storyboard, applied_storyboard, configured_storyboard)) {
+            storyboard_set_budget(storyboard);
+            applied_storyboard = storyboard;
+        }
+        if (other + MIN_CACHE_BYTES > ctx->ceiling)
+            ALOGW("Memory | Over budget: %lld MiB used outside caches, ceiling %lld MiB",
+                (long long)(other / MiB), (long long)(ctx->ceiling / MiB));
+
+        mpv_event *ev = mpv_wait_event(ctx->mpv, CONTROL_INTERVAL);
+        if (ev->event_id == MPV_EVENT_SHUTDOWN) {
+            shutdown = true;
+            break;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(g_budget_mutex);
+        if (g_budget == ctx)
+            g_budget = NULL;
+        // stopped rather than replaced by a new controller
+        if (!shutdown && !g_budget) {
+            set_demuxer_limits(ctx->mpv, configured_fw, configured_back);
+            storyboard_set_budget(configured_storyboard);
+        }
+    }
+    mpv_destroy(ctx->mpv);
+    delete ctx;
+    return NULL;
+}
+
+// must be called with g_budget_mutex held
+static void stop_controller()
+{
+    if (!g_budget)
+        return;
+    // the thread cleans up after itself
+    g_budget->stop = true;
+    mpv_wakeup(g_budget->mpv);
+    g_budget = NULL;
+}
+
+// [rss, heap allocated, heap size, demuxer cache, demuxer cache ahead, storyboard cache,
+//  budget ceiling (0 if none), demuxer-max-bytes, demuxer-max-back-bytes, storyboard budget]
+// in bytes, -1 where unavailable.
+jni_func(jlongArray, getMemoryReport) {
+    STATS_SCOPE("MPVLib.getMemoryReport");
+    memory_report r;
+    collect(g_mpv, &r);
+
+    int64_t ceiling = 0;
+    {
+        std::lock_guard<std::mutex> lock(g_budget_mutex);
+        if (g_budget)
+            ceiling = g_budget->ceiling;
+    }
+    int64_t max_bytes = -1, max_back_bytes = -1;
+    if (g_mpv) {
+        mpv_get_property(g_mpv, "demuxer-max-bytes", MPV_FORMAT_INT64, &max_bytes);
+        mpv_get_property(g_mpv, "demuxer-max-back-bytes", MPV_FORMAT_INT64, &max_back_bytes);
+    }
+
+    jlong values[] = {
+        r.rss, r.heap_allocated, r.heap_total, r.demuxer_bytes, r.demuxer_fw_bytes,
+        r.storyboard_bytes, ceiling, max_bytes, max_back_bytes, (jlong)storyboard_budget(),
+    };
+    jlongArray jvalues = env->NewLongArray(sizeof(values) / sizeof(values[0]));
+    if (jvalues)
+        env->SetLongArrayRegion(jvalues, 0, sizeof(values) / sizeof(values[0]), values);
+    return jvalues;
+}
+
+// Keep the resizable caches inside ceiling bytes of native heap, never above
+// their configured limits. A negative ceiling picks one from the device's
+// memory size, 0 stops the controller and restores the configured limits.
+jni_func(void, setMemoryBudget, jlong ceiling) {
+    STATS_SCOPE("MPVLib.setMemoryBudget");
+    std::lock_guard<std::mutex> lock(g_budget_mutex);
+    budget_ctx *previous = g_budget;
+    int64_t configured_fw = 0, configured_back = 0, configured_storyboard = 0;
+    if (previous) {
+        // the current limits may be lowered already
+        configured_fw = previous->configured_fw;
+        configured_back = previous->configured_back;
+        configured_storyboard = previous->configured_storyboard;
+    }
+    stop_controller();
+    if (ceiling == 0)
+        return;
+
+    CHECK_MPV_INIT();
+    if (!previous) {
+        mpv_get_property(g_mpv, "demuxer-max-bytes", MPV_FORMAT_INT64, &configured_fw);
+        mpv_get_property(g_mpv, "demuxer-max-back-bytes", MPV_FORMAT_INT64, &configured_back);
+        configured_storyboard = storyboard_budget();
+    }
+    budget_ctx *ctx = new budget_ctx();
+    ctx->mpv = mpv_create_client(g_mpv, "membudget");
+    ctx->ceiling = ceiling > 0 ? ceiling : auto_ceiling();
+    ctx->configured_fw = configured_fw;
+    ctx->configured_back = configured_back;
+    ctx->configured_storyboard = configured_storyboard;
+    ctx->stop = false;
+    if (!ctx->mpv) {
+        ALOGE("Memory | Failed to create client");
+        delete ctx;
+        return;
+    }
+    ALOGV("Memory | Budget ceiling %lld MiB", (long long)(ctx->ceiling / MiB));
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, &attr, budget_thread, ctx) != 0)
+        die("thread create failed");
+    pthread_attr_destroy(&attr);
+
+    g_budget = ctx;
+}
@@ -3,10 +3,12 @@
 #include <string.h>
 #include <mpv/client.h>
 #include "jni_utils.h"
+#include "node.h"
+#include "trace.h"
 
 void free_mpv_node(mpv_node *node);
 
-jobject mpv_node_to_jobject(JNIEnv *env, const mpv_node *node) {
+static jobject node_to_jobject(JNIEnv *env, const mpv_node *node) {
     if (!node) return NULL;
 
     switch (node->format) {
@@ -29,7 +31,7 @@ jobject mpv_node_to_jobject(JNIEnv *env, const mpv_node *node) {
         case MPV_FORMAT_NODE_ARRAY: {
             jobjectArray nodeArray = env->NewObjectArray(node->u.list->num, mpv_MPVNode, NULL);
             for (int i = 0; i < node->u.list->num; i++) {
-                jobject childNode = mpv_node_to_jobject(env, &node->u.list->values[i]);
+                jobject childNode = node_to_jobject(env, &node->u.list->values[i]);
                 if (childNode) {
                     env->SetObjectArrayElement(nodeArray, i, childNode);
                     env->DeleteLocalRef(childNode);
@@ -41,7 +43,7 @@ jobject mpv_node_to_jobject(JNIEnv *env, const mpv_node *node) {
             jobject hashMap = env->NewObject(java_util_HashMap, java_util_HashMap_init);
             for (int i = 0; i < node->u.list->num; i++) {
                 jstring key = env->NewStringUTF(node->u.list->keys[i]);
-                jobject childNode = mpv_node_to_jobject(env, &node->u.list->values[i]);
+                jobject childNode = node_to_jobject(env, &node->u.list->values[i]);
                 if (childNode) env->CallObjectMethod(hashMap, java_util_HashMap_put, key, childNode);
             }
             return env->NewObject(mpv_MPVNode_MapNode, mpv_MPVNode_MapNode_init, hashMap);
@@ -52,7 +54,7 @@ jobject mpv_node_to_jobject(JNIEnv *env, const mpv_node *node) {
 }
 
 // recursively adding all nodes for map and arrays
-int jobject_to_mpv_node(JNIEnv *env, jobject jnode, mpv_node *node) {
+static int jobject_to_node(JNIEnv *env, jobject jnode, mpv_node *node) {
     if (!jnode || !node) return -1;
 
     jclass nodeClass = env->GetObjectClass(jnode);
@@ -117,7 +119,7 @@ int jobject_to_mpv_node(JNIEnv *env, jobject jnode, mpv_node *node) {
             for (int i = 0; i < size; i++) {
                 jobject childNode = env->GetObjectArrayElement(jarray, i);
                 if (childNode) {
-                    jobject_to_mpv_node(env, childNode, &node->u.list->values[i]);
+                    jobject_to_node(env, childNode, &node->u.list->values[i]);
                     env->DeleteLocalRef(childNode);
                 }
             }
@@ -170,7 +172,7 @@ int jobject_to_mpv_node(JNIEnv *env, jobject jnode, mpv_node *node) {
                     }
 
                     if (valueObj) {
-                        jobject_to_mpv_node(env, valueObj, &node->u.list->values[i]);
+                        jobject_to_node(env, valueObj, &node->u.list->values[i]);
                         env->DeleteLocalRef(valueObj);
                     }
 
@@ -193,6 +195,17 @@ int jobject_to_mpv_node(JNIEnv *env, jobject jnode, mpv_node *node) {
     return -1;
 }
 
+// entry points, traced once per conversion rather than once per child
+jobject mpv_node_to_jobject(JNIEnv *env, const mpv_node *node) {
+    TRACE_SCOPE("mpv_node_to_jobject");
+    return node_to_jobject(env, node);
+}
+
+int jobject_to_mpv_node(JNIEnv *env, jobject jnode, mpv_node *node) {
+    TRACE_SCOPE("jobject_to_mpv_node");
+    return jobject_to_node(env, jnode, node);
+}
+
 void free_mpv_node(mpv_node *node) {
     if (!node) return;
 
@@ -226,3 +239,86 @@ void free_mpv_node(mpv_node *node) {
     }
     node->format = MPV_FORMAT_NONE;
 }
+
+// tags come straight from files, NewStringUTF aborts on invalid UTF-8
+static std::string valid_utf8(const std::string &s) {
+    std::string out;
+    const unsigned char *p = reinterpret_cast<const unsigned char*>(s.c_str());
+    size_t len = s.size();
+    for (size_t i = 0; i < len; ) {
+        int n = p[i] < 0x80 ? 1 : (p[i] >> 5) == 0x6 ? 2 : (p[i] >> 4) == 0xe ? 3 : (p[i] >> 3) == 0x1e ? 4 : 0;
+        bool ok = n > 0 && i + n <= len && p[i] != 0;
+        for (int k = 1; ok && k < n; k++)
+            ok = (p[i + k] & 0xc0) == 0x80;
+        if (ok) {
+            out.append(s, i, n);
+            i += n;
+        } else {
+            out += '?';
+            i++;
+        }
+    }
+    return out;
+}
+
+mpv_node node_builder::none() {
+    mpv_node n;
+    n.format = MPV_FORMAT_NONE;
+    return n;
+}
+
+mpv_node node_builder::str(const std::string &s) {
+    strings.push_back(valid_utf8(s));
+    mpv_node n;
+    n.format = MPV_FORMAT_STRING;
+    n.u.string = const_cast<char*>(strings.back().c_str());
+    return n;
+}
+
+mpv_node node_builder::num(int64_t v) {
+    mpv_node n;
+    n.format = MPV_FORMAT_INT64;
+    n.u.int64 = v;
+    return n;
+}
+
+mpv_node node_builder::dbl(double v) {
+    mpv_node n;
+    n.format = MPV_FORMAT_DOUBLE;
+    n.u.double_ = v;
+    return n;
+}
+
+mpv_node node_builder::flag(bool v) {
+    mpv_node n;
+    n.format = MPV_FORMAT_FLAG;
+    n.u.flag = v;
+    return n;
+}
+
+mpv_node node_builder::map(const std::vector<entry> &entries) {
+    values.push_back(std::vector<mpv_node>());
+    keys.push_back(std::vector<char*>());
+    for (const entry &e : entries) {
+        keys.back().push_back(const_cast<char*>(e.first));
+        values.back().push_back(e.second);
+    }
+    return list(MPV_FORMAT_NODE_MAP, keys.back().data());
+}
+
+mpv_node node_builder::array(const std::vector<mpv_node> &items) {
+    values.push_back(items);
+    return list(MPV_FORMAT_NODE_ARRAY, NULL);
+}
+
+mpv_node node_builder::list(mpv_format format, char **list_keys) {
+    mpv_node_list l;
+    l.num = values.back().size();
+    l.values = values.back().data();
+    l.keys = list_keys;
+    lists.push_back(l);
+    mpv_node n;
+    n.format = format;
+    n.u.list = &lists.back();
+    return n;
+}
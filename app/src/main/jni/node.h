@@ -1,9 +1,39 @@
 #pragma once
 
 #include <jni.h>
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
 
-struct mpv_node;
+#include <mpv/client.h>
 
 jobject mpv_node_to_jobject(JNIEnv *env, const mpv_node *node);
 int jobject_to_mpv_node(JNIEnv *env, jobject jnode, mpv_node *node);
 void free_mpv_node(mpv_node *node);
+
+// Builds mpv_node trees for handing results to Java. Owns everything the
+// nodes point into, so they stay valid as long as the builder does.
+// Strings are made valid UTF-8 as JNI requires.
+class node_builder {
+public:
+    typedef std::pair<const char*, mpv_node> entry;
+
+    mpv_node none();
+    mpv_node str(const std::string &s);
+    mpv_node num(int64_t v);
+    mpv_node dbl(double v);
+    mpv_node flag(bool v);
+    mpv_node map(const std::vector<entry> &entries);
+    mpv_node array(const std::vector<mpv_node> &items);
+
+private:
+    mpv_node list(mpv_format format, char **list_keys);
+
+    // deques, so earlier elements never move while later ones are added
+    std::deque<std::string> strings;
+    std::deque<std::vector<mpv_node>> values;
+    std::deque<std::vector<char*>> keys;
+    std::deque<mpv_node_list> lists;
+};
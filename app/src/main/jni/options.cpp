@@ -0,0 +1,212 @@
+#include <jni.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <mpv/client.h>
+
+#include "jni_utils.h"
+#include "log.h"
+#include "globals.h"
+#include "stats.h"
+
+extern "C" {
+    jni_func(jintArray, setOptions, jobjectArray jkeys, jobjectArray jvalues);
+
+    jni_func(jlong, parseOptionProfile, jbyteArray jdata);
+    jni_func(jintArray, applyOptionProfile, jlong jprofile);
+    jni_func(void, freeOptionProfile, jlong jprofile);
+};
+
+// Applies a batch of options with a single JNI transition. The returned array
+// holds the mpv error code of every option (0 on success), in input order.
+jni_func(jintArray, setOptions, jobjectArray jkeys, jobjectArray jvalues) {
+    STATS_SCOPE("MPVLib.setOptions");
+    CHECK_MPV_INIT();
+
+    int len = env->GetArrayLength(jkeys);
+    if (len != env->GetArrayLength(jvalues)) {
+        ALOGE("setOptions: %d keys but %d values", len, env->GetArrayLength(jvalues));
+        return NULL;
+    }
+
+    std::vector<jint> results(len);
+    for (int i = 0; i < len; ++i) {
+        jstring jkey = (jstring)env->GetObjectArrayElement(jkeys, i);
+        jstring jvalue = (jstring)env->GetObjectArrayElement(jvalues, i);
+        if (!jkey || !jvalue) {
+            results[i] = MPV_ERROR_INVALID_PARAMETER;
+        } else {
+            const char *key = env->GetStringUTFChars(jkey, NULL);
+            const char *value = env->GetStringUTFChars(jvalue, NULL);
+            results[i] = mpv_set_option_string(g_mpv, key, value);
+            if (results[i] < 0)
+                ALOGE("mpv_set_option_string(%s, %s) returned error %s", key, value, mpv_error_string(results[i]));
+            env->ReleaseStringUTFChars(jkey, key);
+            env->ReleaseStringUTFChars(jvalue, value);
+        }
+        if (jkey)
+            env->DeleteLocalRef(jkey);
+        if (jvalue)
+            env->DeleteLocalRef(jvalue);
+    }
+
+    jintArray jresults = env->NewIntArray(len);
+    if (jresults && len > 0)
+        env->SetIntArrayRegion(jresults, 0, len, results.data());
+    return jresults;
+}
+
+// ============================================================================
+// OPTION PROFILES
+// A profile is a pre-encoded list of options which is parsed once into native
+// memory and can then be applied to any number of mpv instances.
+//
+// Binary layout (all integers little-endian):
+//   magic "MPVO", u8 version, u32 count,
+//   count * { u16 key length, key bytes, u32 value length, value bytes }
+// Strings are UTF-8 and not NUL-terminated.
+// ============================================================================
+
+static const char PROFILE_MAGIC[4] = { 'M', 'P', 'V', 'O' };
+static const uint8_t PROFILE_VERSION = 1;
+
+struct OptionProfile {
+    std::vector<std::string> keys;
+    std::vector<std::string> values;
+};
+
+class ProfileReader {
+public:
+    ProfileReader(const uint8_t *data, size_t size) : p(data), end(data + size) {}
+
+    bool read_u8(uint8_t *out) {
+        if (end - p < 1)
+            return false;
+        *out = *p++;
+        return true;
+    }
+
+    bool read_u16(uint16_t *out) {
+        if (end - p < 2)
+            return false;
+        *out = (uint16_t)(p[0] | (p[1] << 8));
+        p += 2;
+        return true;
+    }
+
+    bool read_u32(uint32_t *out) {
+        if (end - p < 4)
+            return false;
+        *out = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+        p += 4;
+        return true;
+    }
+
+    bool read_string(size_t len, std::string *out) {
+        if ((size_t)(end - p) < len)
+            return false;
+        out->assign(reinterpret_cast<const char*>(p), len);
+        p += len;
+        return true;
+    }
+
+    bool at_end() const { return p == end; }
+
+private:
+    const uint8_t *p, *end;
+};
+
+static OptionProfile *parse_profile(const uint8_t *data, size_t size)
+{
+    ProfileReader r(data, size);
+
+    std::string magic;
+    uint8_t version;
+    uint32_t count;
+    if (!r.read_string(sizeof(PROFILE_MAGIC), &magic) ||
+        memcmp(magic.data(), PROFILE_MAGIC, sizeof(PROFILE_MAGIC)) != 0) {
+        ALOGE("Option profile | Bad magic");
+        return NULL;
+    }
+    if (!r.read_u8(&version) || version != PROFILE_VERSION) {
+        ALOGE("Option profile | Unsupported version");
+        return NULL;
+    }
+    // every entry takes at least six bytes, which bounds the reservation below
+    if (!r.read_u32(&count) || count > size / 6) {
+        ALOGE("Option profile | Bad entry count");
+        return NULL;
+    }
+
+    OptionProfile *profile = new OptionProfile();
+    profile->keys.reserve(count);
+    profile->values.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        uint16_t key_len;
+        uint32_t value_len;
+        std::string key, value;
+        if (!r.read_u16(&key_len) || !r.read_string(key_len, &key) ||
+            !r.read_u32(&value_len) || !r.read_string(value_len, &value)) {
+            ALOGE("Option profile | Truncated entry %u", i);
+            delete profile;
+            return NULL;
+        }
+        profile->keys.push_back(std::move(key));
+        profile->values.push_back(std::move(value));
+    }
+    if (!r.at_end()) {
+        ALOGE("Option profile | Trailing data");
+        delete profile;
+        return NULL;
+    }
+
+    return profile;
+}
+
+jni_func(jlong, parseOptionProfile, jbyteArray jdata) {
+    STATS_SCOPE("MPVLib.parseOptionProfile");
+    if (!jdata)
+        return 0;
+
+    jsize size = env->GetArrayLength(jdata);
+    jbyte *data = env->GetByteArrayElements(jdata, NULL);
+    if (!data)
+        return 0;
+
+    OptionProfile *profile = parse_profile(reinterpret_cast<const uint8_t*>(data), size);
+    env->ReleaseByteArrayElements(jdata, data, JNI_ABORT);
+
+    return reinterpret_cast<jlong>(profile);
+}
+
+jni_func(jintArray, applyOptionProfile, jlong jprofile) {
+    STATS_SCOPE("MPVLib.applyOptionProfile");
+    CHECK_MPV_INIT();
+
+    OptionProfile *profile = reinterpret_cast<OptionProfile*>(jprofile);
+    if (!profile)
+        return NULL;
+
+    int len = profile->keys.size();
+    std::vector<jint> results(len);
+    for (int i = 0; i < len; i++) {
+        const char *key = profile->keys[i].c_str();
+        const char *value = profile->values[i].c_str();
+        results[i] = mpv_set_option_string(g_mpv, key, value);
+        if (results[i] < 0)
+            ALOGE("mpv_set_option_string(%s, %s) returned error %s", key, value, mpv_error_string(results[i]));
+    }
+
+    jintArray jresults = env->NewIntArray(len);
+    if (jresults && len > 0)
+        env->SetIntArrayRegion(jresults, 0, len, results.data());
+    return jresults;
+}
+
+jni_func(void, freeOptionProfile, jlong jprofile) {
+    STATS_SCOPE("MPVLib.freeOptionProfile");
+    delete reinterpret_cast<OptionProfile*>(jprofile);
+}
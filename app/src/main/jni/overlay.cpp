@@ -0,0 +1,167 @@
+#include <jni.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <android/bitmap.h>
+#include <mpv/client.h>
+
+#include "jni_utils.h"
+#include "globals.h"
+#include "log.h"
+#include "stats.h"
+
+extern "C" {
+    jni_func(jlong, overlayCreate, jint id, jint width, jint height);
+    jni_func(jobject, overlayBuffer, jlong handle);
+    jni_func(jint, overlayPost, jlong handle, jint x, jint y, jint dw, jint dh);
+    jni_func(jint, overlayPostBitmap, jlong handle, jobject bitmap, jint x, jint y, jint dw, jint dh);
+    jni_func(void, overlayRemove, jlong handle);
+    jni_func(void, overlayDestroy, jlong handle);
+};
+
+// ============================================================================
+// SHARED MEMORY OVERLAYS
+// One BGRA buffer per overlay-add id. Kotlin draws into it through a direct
+// ByteBuffer and posting hands its address to overlay-add, which copies the
+// pixels before returning, so the buffer can be redrawn right away.
+// ============================================================================
+
+struct shm_overlay {
+    int id;
+    int width, height, stride;
+    size_t size;     // mapped bytes
+    uint8_t *mem;
+    bool shown;
+};
+
+jni_func(jlong, overlayCreate, jint id, jint width, jint height) {
+    STATS_SCOPE("MPVLib.overlayCreate");
+    // mpv supports ids 0-63
+    if (id < 0 || id > 63 || width <= 0 || height <= 0 || width > 8192 || height > 8192) {
+        ALOGE("Overlay | Invalid id or size");
+        return 0;
+    }
+
+    shm_overlay *o = new shm_overlay();
+    o->id = id;
+    o->width = width;
+    o->height = height;
+    o->stride = width * 4;
+    long page = sysconf(_SC_PAGESIZE);
+    o->size = ((size_t)o->stride * height + page - 1) & ~(size_t)(page - 1);
+    o->shown = false;
+
+    // mpv is in-process and copies on overlay-add, so anonymous memory is all it takes
+    o->mem = (uint8_t*)mmap(NULL, o->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (o->mem == MAP_FAILED) {
+        ALOGE("Overlay | Failed to map %zu bytes", o->size);
+        delete o;
+        return 0;
+    }
+
+    return reinterpret_cast<jlong>(o);
+}
+
+jni_func(jobject, overlayBuffer, jlong handle) {
+    STATS_SCOPE("MPVLib.overlayBuffer");
+    shm_overlay *o = reinterpret_cast<shm_overlay*>(handle);
+    if (!o)
+        return NULL;
+    return env->NewDirectByteBuffer(o->mem, (jlong)o->stride * o->height);
+}
+
+static int post_buffer(shm_overlay *o, int x, int y, int dw, int dh)
+{
+    char id[16], sx[16], sy[16], src[32], w[16], h[16], stride[16], sdw[16], sdh[16];
+    snprintf(id, sizeof(id), "%d", o->id);
+    snprintf(sx, sizeof(sx), "%d", x);
+    snprintf(sy, sizeof(sy), "%d", y);
+    snprintf(src, sizeof(src), "&%llu", (unsigned long long)(uintptr_t)o->mem);
+    snprintf(w, sizeof(w), "%d", o->width);
+    snprintf(h, sizeof(h), "%d", o->height);
+    snprintf(stride, sizeof(stride), "%d", o->stride);
+    snprintf(sdw, sizeof(sdw), "%d", dw > 0 ? dw : o->width);
+    snprintf(sdh, sizeof(sdh), "%d", dh > 0 ? dh : o->height);
+
+    const char *cmd[] = { "overlay-add", id, sx, sy, src, "0", "bgra", w, h, stride, sdw, sdh, NULL };
+    int result = mpv_command(g_mpv, cmd);
+    if (result < 0) {
+        ALOGE("Overlay | overlay-add returned error %s", mpv_error_string(result));
+        return result;
+    }
+
+    o->shown = true;
+    return 0;
+}
+
+// The buffer was drawn through overlayBuffer(), show it.
+jni_func(jint, overlayPost, jlong handle, jint x, jint y, jint dw, jint dh) {
+    STATS_SCOPE("MPVLib.overlayPost");
+    CHECK_MPV_INIT();
+    shm_overlay *o = reinterpret_cast<shm_overlay*>(handle);
+    if (!o)
+        return MPV_ERROR_INVALID_PARAMETER;
+    return post_buffer(o, x, y, dw, dh);
+}
+
+// Show a premultiplied ARGB_8888 Bitmap of the overlay's size. mpv only takes
+// BGRA, so its pixels are swizzled into the buffer on the way.
+jni_func(jint, overlayPostBitmap, jlong handle, jobject bitmap, jint x, jint y, jint dw, jint dh) {
+    STATS_SCOPE("MPVLib.overlayPostBitmap");
+    CHECK_MPV_INIT();
+    shm_overlay *o = reinterpret_cast<shm_overlay*>(handle);
+    if (!o || !bitmap)
+        return MPV_ERROR_INVALID_PARAMETER;
+
+    AndroidBitmapInfo info;
+    if (AndroidBitmap_getInfo(env, bitmap, &info) != ANDROID_BITMAP_RESULT_SUCCESS ||
+        info.format != ANDROID_BITMAP_FORMAT_RGBA_8888 ||
+        (int)info.width != o->width || (int)info.height != o->height) {
+        ALOGE("Overlay | Bitmap must be ARGB_8888 and %dx%d", o->width, o->height);
+        return MPV_ERROR_INVALID_PARAMETER;
+    }
+    void *pixels;
+    if (AndroidBitmap_lockPixels(env, bitmap, &pixels) != ANDROID_BITMAP_RESULT_SUCCESS)
+        return MPV_ERROR_GENERIC;
+
+    uint8_t *dst = o->mem;
+    for (int row = 0; row < o->height; row++) {
+        const uint32_t *s = reinterpret_cast<const uint32_t*>((const uint8_t*)pixels + (size_t)row * info.stride);
+        uint32_t *d = reinterpret_cast<uint32_t*>(dst + (size_t)row * o->stride);
+        // RGBA in memory -> BGRA: swap the R and B bytes
+        for (int col = 0; col < o->width; col++) {
+            uint32_t p = s[col];
+            d[col] = (p & 0xff00ff00) | ((p & 0xff) << 16) | ((p >> 16) & 0xff);
+        }
+    }
+    AndroidBitmap_unlockPixels(env, bitmap);
+
+    return post_buffer(o, x, y, dw, dh);
+}
+
+jni_func(void, overlayRemove, jlong handle) {
+    STATS_SCOPE("MPVLib.overlayRemove");
+    shm_overlay *o = reinterpret_cast<shm_overlay*>(handle);
+    if (!o || !o->shown || !g_mpv)
+        return;
+
+    char id[16];
+    snprintf(id, sizeof(id), "%d", o->id);
+    const char *cmd[] = { "overlay-remove", id, NULL };
+    mpv_command(g_mpv, cmd);
+    o->shown = false;
+}
+
+jni_func(void, overlayDestroy, jlong handle) {
+    STATS_SCOPE("MPVLib.overlayDestroy");
+    shm_overlay *o = reinterpret_cast<shm_overlay*>(handle);
+    if (!o)
+        return;
+
+    jni_func_name(overlayRemove)(env, obj, handle);
+    munmap(o->mem, o->size);
+    delete o;
+}
@@ -0,0 +1,148 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "palette.h"
+#include "trace.h"
+
+// ============================================================================
+// PALETTE EXTRACTION
+// Sampled pixels are binned into a 4-bit-per-channel histogram, then the
+// non-empty bins are clustered with weighted k-means. Seeds are picked far
+// from each other and weighted by population, so a small but distinct accent
+// colour still gets a swatch next to large areas of similar tones.
+// ============================================================================
+
+static const int MAX_SAMPLES = 16384;
+static const int BIN_BITS = 4;
+static const int BINS = 1 << (3 * BIN_BITS);
+static const int ITERATIONS = 8;
+// bins whose mean colour has no channel this bright are left out
+static const float NEAR_BLACK = 32;
+
+struct colour {
+    float r, g, b;
+    float weight;
+};
+
+// Squared distance, channels weighted roughly by how much the eye notices.
+static inline float distance(const colour &a, const colour &b)
+{
+    float dr = a.r - b.r, dg = a.g - b.g, db = a.b - b.b;
+    return 2 * dr * dr + 4 * dg * dg + 3 * db * db;
+}
+
+// Mean colours of the non-empty histogram bins, weighted by pixel count.
+static void histogram(const uint8_t *bgra, int width, int height, int stride, std::vector<colour> *out)
+{
+    std::vector<uint32_t> count(BINS), sum(BINS * 3);
+    int step = std::max(1, (int)sqrt((double)width * height / MAX_SAMPLES));
+    for (int y = 0; y < height; y += step) {
+        const uint8_t *row = bgra + (size_t)y * stride;
+        for (int x = 0; x < width; x += step) {
+            const uint8_t *p = row + x * 4;
+            int bin = (p[2] >> (8 - BIN_BITS)) << (2 * BIN_BITS) |
+                (p[1] >> (8 - BIN_BITS)) << BIN_BITS | p[0] >> (8 - BIN_BITS);
+            count[bin]++;
+            sum[bin * 3] += p[2];
+            sum[bin * 3 + 1] += p[1];
+            sum[bin * 3 + 2] += p[0];
+        }
+    }
+
+    // near-black is letterboxing and shadows rather than a colour, unless
+    // there is nothing else
+    std::vector<colour> dark;
+    for (int i = 0; i < BINS; i++) {
+        if (!count[i])
+            continue;
+        float n = count[i];
+        colour c = { sum[i * 3] / n, sum[i * 3 + 1] / n, sum[i * 3 + 2] / n, n };
+        if (std::max(c.r, std::max(c.g, c.b)) < NEAR_BLACK)
+            dark.push_back(c);
+        else
+            out->push_back(c);
+    }
+    if (out->empty())
+        out->swap(dark);
+}
+
+int extract_palette(const uint8_t *bgra, int width, int height, int stride, uint32_t *out, int count)
+{
+    TRACE_SCOPE("palette:extract");
+    if (width <= 0 || height <= 0 || count <= 0)
+        return 0;
+    std::vector<colour> points;
+    histogram(bgra, width, height, stride, &points);
+    if (points.empty())
+        return 0;
+
+    // seeds: the heaviest bin, then whichever bin is most populous relative
+    // to how close it is to the seeds so far
+    int k = std::min<int>(count, points.size());
+    std::vector<colour> centres;
+    std::vector<float> nearest(points.size(), INFINITY);
+    centres.push_back(*std::max_element(points.begin(), points.end(),
+        [](const colour &a, const colour &b) { return a.weight < b.weight; }));
+    while ((int)centres.size() < k) {
+        size_t best = 0;
+        float best_score = -1;
+        for (size_t i = 0; i < points.size(); i++) {
+            nearest[i] = std::min(nearest[i], distance(points[i], centres.back()));
+            float score = points[i].weight * nearest[i];
+            if (score > best_score) {
+                best_score = score;
+                best = i;
+            }
+        }
+        if (best_score <= 0)
+            break; // fewer distinct colours than asked for
+        centres.push_back(points[best]);
+    }
+
+    std::vector<int> assigned(points.size());
+    for (int iter = 0; iter < ITERATIONS; iter++) {
+        bool changed = false;
+        for (size_t i = 0; i < points.size(); i++) {
+            int best = 0;
+            float best_dist = INFINITY;
+            for (size_t c = 0; c < centres.size(); c++) {
+                float d = distance(points[i], centres[c]);
+                if (d < best_dist) {
+                    best_dist = d;
+                    best = c;
+                }
+            }
+            changed |= iter == 0 || assigned[i] != best;
+            assigned[i] = best;
+        }
+        if (!changed)
+            break;
+        std::vector<colour> sums(centres.size(), colour{ 0, 0, 0, 0 });
+        for (size_t i = 0; i < points.size(); i++) {
+            colour &s = sums[assigned[i]];
+            const colour &p = points[i];
+            s.r += p.r * p.weight;
+            s.g += p.g * p.weight;
+            s.b += p.b * p.weight;
+            s.weight += p.weight;
+        }
+        for (size_t c = 0; c < centres.size(); c++) {
+            const colour &s = sums[c];
+            centres[c] = s.weight > 0 ? colour{ s.r / s.weight, s.g / s.weight, s.b / s.weight, s.weight }
+                : colour{ centres[c].r, centres[c].g, centres[c].b, 0 };
+        }
+    }
+
+    std::sort(centres.begin(), centres.end(),
+        [](const colour &a, const colour &b) { return a.weight > b.weight; });
+    int found = 0;
+    for (const colour &c : centres) {
+        if (c.weight <= 0)
+            break;
+        out[found++] = 0xFF000000u | (uint32_t)lrintf(c.r) << 16 | (uint32_t)lrintf(c.g) << 8 | (uint32_t)lrintf(c.b);
+    }
+    return found;
+}
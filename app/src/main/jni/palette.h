@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+
+// Dominant colours of a thumbnail, for tinting UI around it. Works on the
+// small BGRA images the thumbnail paths produce anyway, so it costs about as
+// much as one pass over a few thousand sampled pixels.
+//
+// Kept free of JNI, mpv and Android dependencies so benchmarks can build it
+// on the host.
+
+// Up to `count` dominant colours of a packed BGRA image as opaque ARGB, most
+// common first. Near-black is left out unless the image has nothing else.
+// Returns how many colours were found.
+int extract_palette(const uint8_t *bgra, int width, int height, int stride, uint32_t *out, int count);
@@ -0,0 +1,578 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <jni.h>
+#include <mpv/client.h>
+
+extern "C" {
+    #include <libavformat/avformat.h>
+    #include <libavutil/display.h>
+};
+
+#include "content_id.h"
+#include "jni_utils.h"
+#include "log.h"
+#include "node.h"
+#include "probe.h"
+#include "stats.h"
+#include "trace.h"
+#include "workpool.h"
+
+extern "C" {
+    jni_func(jobjectArray, probeMedia, jobjectArray jpaths);
+    jni_func(void, setProbeCache, jstring jpath);
+};
+
+// ============================================================================
+// MEDIA PROBING
+// Library metadata (duration, resolution, codecs, HDR, rotation, languages,
+// chapters) straight from the container headers, without starting playback
+// or decoding a frame. Batches run in parallel on the worker pool.
+//
+// Results for local files are kept in a cache keyed by content id (see
+// content_id.h) which persists across launches, so rescanning a library only
+// opens files that changed, and moved or renamed files are not probed again.
+// ============================================================================
+
+#define CACHE_MAGIC "MPVPRB"
+static const uint32_t CACHE_VERSION = 3;
+static const size_t MAX_CACHE_ENTRIES = 20000;
+// network sources should not hold a worker forever
+static const char *NETWORK_TIMEOUT_US = "10000000";
+
+struct cache_entry {
+    uint64_t used;          // g_cache_clock when last looked up
+    media_info info;
+};
+
+static std::unordered_map<std::string, cache_entry> g_cache;
+static std::string g_cache_path;
+static bool g_cache_dirty;
+static uint64_t g_cache_clock;
+static std::mutex g_cache_mutex;
+
+// ----------------------------------------------------------------------------
+// probing
+// ----------------------------------------------------------------------------
+
+static std::string tag(AVDictionary *metadata, const char *key)
+{
+    AVDictionaryEntry *e = av_dict_get(metadata, key, NULL, 0);
+    return e && e->value ? e->value : "";
+}
+
+static bool headers_complete(const AVFormatContext *fmt)
+{
+    if (fmt->duration == AV_NOPTS_VALUE)
+        return false;
+    for (unsigned i = 0; i < fmt->nb_streams; i++) {
+        const AVCodecParameters *par = fmt->streams[i]->codecpar;
+        if (par->codec_id == AV_CODEC_ID_NONE)
+            return false;
+        if (par->codec_type == AVMEDIA_TYPE_VIDEO && (par->width <= 0 || par->height <= 0))
+            return false;
+        if (par->codec_type == AVMEDIA_TYPE_AUDIO && (par->sample_rate <= 0 || par->ch_layout.nb_channels <= 0))
+            return false;
+    }
+    return true;
+}
+
+static int stream_rotation(const AVStream *st)
+{
+    const AVPacketSideData *sd = av_packet_side_data_get(st->codecpar->coded_side_data,
+        st->codecpar->nb_coded_side_data, AV_PKT_DATA_DISPLAYMATRIX);
+    if (!sd || sd->size < 9 * sizeof(int32_t))
+        return 0;
+    double angle = -av_display_rotation_get(reinterpret_cast<const int32_t*>(sd->data));
+    if (isnan(angle))
+        return 0;
+    int deg = (int)lround(angle) % 360;
+    return deg < 0 ? deg + 360 : deg;
+}
+
+static const char *stream_hdr(const AVStream *st)
+{
+    const AVCodecParameters *par = st->codecpar;
+    if (av_packet_side_data_get(par->coded_side_data, par->nb_coded_side_data, AV_PKT_DATA_DOVI_CONF))
+        return "dolby-vision";
+    if (par->color_trc == AVCOL_TRC_SMPTE2084)
+        return "hdr10";
+    if (par->color_trc == AVCOL_TRC_ARIB_STD_B67)
+        return "hlg";
+    return "";
+}
+
+bool probe_media(const char *url, media_info *out)
+{
+    TRACE_SCOPE("probe:open");
+    AVFormatContext *fmt = NULL;
+    AVDictionary *opts = NULL;
+    av_dict_set(&opts, "rw_timeout", NETWORK_TIMEOUT_US, 0);
+    int ret = avformat_open_input(&fmt, url, NULL, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        ALOGV("Probe | Failed to open %s", url);
+        return false;
+    }
+
+    if (!headers_complete(fmt)) {
+        TRACE_SCOPE("probe:find-stream-info");
+        fmt->probesize = 500000;
+        fmt->max_analyze_duration = 500000;
+        if (avformat_find_stream_info(fmt, NULL) < 0)
+            ALOGV("Probe | Incomplete stream info for %s", url);
+    }
+
+    *out = media_info();
+    out->duration = fmt->duration != AV_NOPTS_VALUE ? fmt->duration / (double)AV_TIME_BASE : -1;
+    out->bit_rate = std::max<int64_t>(fmt->bit_rate, 0);
+    out->format = fmt->iformat ? fmt->iformat->name : "";
+
+    const AVStream *main_video = NULL;
+    for (unsigned i = 0; i < fmt->nb_streams; i++) {
+        const AVStream *st = fmt->streams[i];
+        const AVCodecParameters *par = st->codecpar;
+        media_track t = media_track();
+        switch (par->codec_type) {
+        case AVMEDIA_TYPE_VIDEO:
+            // cover art is not a video track
+            if (st->disposition & AV_DISPOSITION_ATTACHED_PIC)
+                continue;
+            t.type = TRACK_VIDEO;
+            t.width = par->width;
+            t.height = par->height;
+            if (!main_video || ((st->disposition & AV_DISPOSITION_DEFAULT) &&
+                    !(main_video->disposition & AV_DISPOSITION_DEFAULT)))
+                main_video = st;
+            break;
+        case AVMEDIA_TYPE_AUDIO:
+            t.type = TRACK_AUDIO;
+            t.channels = par->ch_layout.nb_channels;
+            t.sample_rate = par->sample_rate;
+            break;
+        case AVMEDIA_TYPE_SUBTITLE:
+            t.type = TRACK_SUB;
+            break;
+        default:
+            continue;
+        }
+        t.codec = avcodec_get_name(par->codec_id);
+        t.language = tag(st->metadata, "language");
+        t.title = tag(st->metadata, "title");
+        t.is_default = st->disposition & AV_DISPOSITION_DEFAULT;
+        out->tracks.push_back(t);
+    }
+
+    if (main_video) {
+        const AVCodecParameters *par = main_video->codecpar;
+        AVRational rate = main_video->avg_frame_rate.num && main_video->avg_frame_rate.den ?
+            main_video->avg_frame_rate : main_video->r_frame_rate;
+        out->video_codec = avcodec_get_name(par->codec_id);
+        out->width = par->width;
+        out->height = par->height;
+        out->fps = rate.num && rate.den ? av_q2d(rate) : 0;
+        out->rotation = stream_rotation(main_video);
+        out->hdr = stream_hdr(main_video);
+    }
+
+    for (unsigned i = 0; i < fmt->nb_chapters; i++) {
+        const AVChapter *ch = fmt->chapters[i];
+        media_chapter c;
+        c.time = ch->start * av_q2d(ch->time_base);
+        c.title = tag(ch->metadata, "title");
+        out->chapters.push_back(c);
+    }
+
+    avformat_close_input(&fmt);
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// cache
+// ----------------------------------------------------------------------------
+
+static void put_u32(std::string &buf, uint32_t v)
+{
+    buf.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+static void put_i64(std::string &buf, int64_t v)
+{
+    buf.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+static void put_double(std::string &buf, double v)
+{
+    buf.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+static void put_str(std::string &buf, const std::string &s)
+{
+    put_u32(buf, s.size());
+    buf += s;
+}
+
+struct reader {
+    const char *p, *end;
+    bool ok;
+
+    bool take(void *dst, size_t len) {
+        ok = ok && (size_t)(end - p) >= len;
+        if (ok) {
+            memcpy(dst, p, len);
+            p += len;
+        }
+        return ok;
+    }
+    uint32_t u32() { uint32_t v = 0; take(&v, sizeof(v)); return v; }
+    int64_t i64() { int64_t v = 0; take(&v, sizeof(v)); return v; }
+    double dbl() { double v = 0; take(&v, sizeof(v)); return v; }
+    std::string str() {
+        uint32_t len = u32();
+        ok = ok && (size_t)(end - p) >= len;
+        if (!ok)
+            return "";
+        std::string s(p, len);
+        p += len;
+        return s;
+    }
+};
+
+static void put_info(std::string &buf, const media_info &info)
+{
+    put_double(buf, info.duration);
+    put_i64(buf, info.bit_rate);
+    put_str(buf, info.format);
+    put_str(buf, info.video_codec);
+    put_u32(buf, info.width);
+    put_u32(buf, info.height);
+    put_double(buf, info.fps);
+    put_u32(buf, info.rotation);
+    put_str(buf, info.hdr);
+    put_u32(buf, info.tracks.size());
+    for (const media_track &t : info.tracks) {
+        put_u32(buf, t.type);
+        put_str(buf, t.codec);
+        put_str(buf, t.language);
+        put_str(buf, t.title);
+        put_u32(buf, t.is_default);
+        put_u32(buf, t.width);
+        put_u32(buf, t.height);
+        put_u32(buf, t.channels);
+        put_u32(buf, t.sample_rate);
+    }
+    put_u32(buf, info.chapters.size());
+    for (const media_chapter &c : info.chapters) {
+        put_double(buf, c.time);
+        put_str(buf, c.title);
+    }
+    put_double(buf, info.loudness);
+    put_double(buf, info.true_peak);
+}
+
+static bool get_info(reader &r, media_info *info)
+{
+    info->duration = r.dbl();
+    info->bit_rate = r.i64();
+    info->format = r.str();
+    info->video_codec = r.str();
+    info->width = r.u32();
+    info->height = r.u32();
+    info->fps = r.dbl();
+    info->rotation = r.u32();
+    info->hdr = r.str();
+    uint32_t tracks = r.u32();
+    for (uint32_t i = 0; r.ok && i < tracks; i++) {
+        media_track t;
+        uint32_t type = r.u32();
+        // indexes the type names when converted, a damaged entry must not
+        r.ok = r.ok && type <= TRACK_SUB;
+        t.type = type;
+        t.codec = r.str();
+        t.language = r.str();
+        t.title = r.str();
+        t.is_default = r.u32();
+        t.width = r.u32();
+        t.height = r.u32();
+        t.channels = r.u32();
+        t.sample_rate = r.u32();
+        info->tracks.push_back(t);
+    }
+    uint32_t chapters = r.u32();
+    for (uint32_t i = 0; r.ok && i < chapters; i++) {
+        media_chapter c;
+        c.time = r.dbl();
+        c.title = r.str();
+        info->chapters.push_back(c);
+    }
+    info->loudness = r.dbl();
+    info->true_peak = r.dbl();
+    return r.ok;
+}
+
+// must be called with g_cache_mutex held
+static void cache_load()
+{
+    g_cache.clear();
+    g_cache_dirty = false;
+    FILE *f = fopen(g_cache_path.c_str(), "rb");
+    if (!f)
+        return;
+    std::string data;
+    char chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+        data.append(chunk, n);
+    fclose(f);
+
+    reader r = { data.data(), data.data() + data.size(), true };
+    char magic[sizeof(CACHE_MAGIC)];
+    if (!r.take(magic, sizeof(magic)) || memcmp(magic, CACHE_MAGIC, sizeof(magic)) || r.u32() != CACHE_VERSION)
+        return;
+    uint32_t count = r.u32();
+    for (uint32_t i = 0; r.ok && i < count; i++) {
+        std::string key = r.str();
+        cache_entry e;
+        e.used = 0;
+        if (get_info(r, &e.info))
+            g_cache[key] = e;
+    }
+    if (!r.ok)
+        ALOGE("Probe | Cache file %s is truncated", g_cache_path.c_str());
+}
+
+void probe_cache_save()
+{
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    if (!g_cache_dirty || g_cache_path.empty())
+        return;
+
+    if (g_cache.size() > MAX_CACHE_ENTRIES) {
+        // forget the entries looked up longest ago
+        std::vector<uint64_t> used;
+        for (const auto &it : g_cache)
+            used.push_back(it.second.used);
+        std::nth_element(used.begin(), used.begin() + (used.size() - MAX_CACHE_ENTRIES), used.end());
+        uint64_t cutoff = used[used.size() - MAX_CACHE_ENTRIES];
+        for (auto it = g_cache.begin(); it != g_cache.end() && g_cache.size() > MAX_CACHE_ENTRIES; ) {
+            if (it->second.used < cutoff)
+                it = g_cache.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    std::string buf(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    put_u32(buf, CACHE_VERSION);
+    put_u32(buf, g_cache.size());
+    for (const auto &it : g_cache) {
+        put_str(buf, it.first);
+        put_info(buf, it.second.info);
+    }
+
+    // replaced atomically, a crash mid-write must not lose the old cache
+    std::string tmp = g_cache_path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    bool ok = f && fwrite(buf.data(), 1, buf.size(), f) == buf.size();
+    ok = f && fclose(f) == 0 && ok;
+    if (ok && rename(tmp.c_str(), g_cache_path.c_str()) == 0) {
+        g_cache_dirty = false;
+    } else {
+        ALOGE("Probe | Failed to write %s: %s", g_cache_path.c_str(), strerror(errno));
+        unlink(tmp.c_str());
+    }
+}
+
+bool probe_media_cached(const std::string &path, media_info *out)
+{
+    std::string key;
+    bool cacheable = content_id(path, &key);
+    if (cacheable) {
+        std::lock_guard<std::mutex> lock(g_cache_mutex);
+        auto it = g_cache.find(key);
+        if (it != g_cache.end()) {
+            it->second.used = ++g_cache_clock;
+            *out = it->second.info;
+            return true;
+        }
+    }
+
+    if (!probe_media(path.c_str(), out))
+        return false;
+
+    if (cacheable) {
+        std::lock_guard<std::mutex> lock(g_cache_mutex);
+        if (!g_cache_path.empty()) {
+            cache_entry &e = g_cache[key];
+            e.used = ++g_cache_clock;
+            e.info = *out;
+            g_cache_dirty = true;
+        }
+    }
+    return true;
+}
+
+bool probe_cache_accepts(const std::string &path)
+{
+    if (path.find("://") != std::string::npos)
+        return false;
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    return !g_cache_path.empty();
+}
+
+bool probe_cache_lookup(const std::string &path, media_info *out)
+{
+    std::string key;
+    if (!content_id_known(path, &key))
+        return false;
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    auto it = g_cache.find(key);
+    if (it == g_cache.end())
+        return false;
+    it->second.used = ++g_cache_clock;
+    *out = it->second.info;
+    return true;
+}
+
+bool probe_cache_set_loudness(const std::string &path, double loudness, double true_peak)
+{
+    std::string key;
+    if (!content_id(path, &key))
+        return false;
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    auto it = g_cache.find(key);
+    if (it == g_cache.end())
+        return false;
+    it->second.info.loudness = loudness;
+    it->second.info.true_peak = true_peak;
+    g_cache_dirty = true;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// Java conversion
+// ----------------------------------------------------------------------------
+
+mpv_node media_info_to_node(node_builder &b, const media_info *info)
+{
+    if (!info)
+        return b.none();
+
+    static const char *track_types[] = { "video", "audio", "sub" };
+    std::vector<mpv_node> tracks, chapters;
+    for (const media_track &t : info->tracks) {
+        std::vector<node_builder::entry> e = {
+            { "type", b.str(track_types[t.type]) },
+            { "codec", b.str(t.codec) },
+            { "default", b.flag(t.is_default) },
+        };
+        if (!t.language.empty())
+            e.push_back({ "lang", b.str(t.language) });
+        if (!t.title.empty())
+            e.push_back({ "title", b.str(t.title) });
+        if (t.type == TRACK_VIDEO) {
+            e.push_back({ "width", b.num(t.width) });
+            e.push_back({ "height", b.num(t.height) });
+        } else if (t.type == TRACK_AUDIO) {
+            e.push_back({ "channels", b.num(t.channels) });
+            e.push_back({ "samplerate", b.num(t.sample_rate) });
+        }
+        tracks.push_back(b.map(e));
+    }
+    for (const media_chapter &c : info->chapters)
+        chapters.push_back(b.map({ { "time", b.dbl(c.time) }, { "title", b.str(c.title) } }));
+
+    std::vector<node_builder::entry> root = {
+        { "format", b.str(info->format) },
+        { "tracks", b.array(tracks) },
+        { "chapters", b.array(chapters) },
+    };
+    if (info->duration >= 0)
+        root.push_back({ "duration", b.dbl(info->duration) });
+    if (info->bit_rate > 0)
+        root.push_back({ "bitrate", b.num(info->bit_rate) });
+    if (!info->video_codec.empty()) {
+        std::vector<node_builder::entry> video = {
+            { "codec", b.str(info->video_codec) },
+            { "width", b.num(info->width) },
+            { "height", b.num(info->height) },
+            { "fps", b.dbl(info->fps) },
+            { "rotation", b.num(info->rotation) },
+        };
+        if (!info->hdr.empty())
+            video.push_back({ "hdr", b.str(info->hdr) });
+        root.push_back({ "video", b.map(video) });
+    }
+    if (!isnan(info->loudness)) {
+        root.push_back({ "loudness", b.map({
+            { "integrated", b.dbl(info->loudness) },
+            { "truepeak", b.dbl(info->true_peak) },
+        }) });
+    }
+    return b.map(root);
+}
+
+jobject media_info_to_jobject(JNIEnv *env, const media_info *info)
+{
+    node_builder b;
+    mpv_node node = media_info_to_node(b, info);
+    return mpv_node_to_jobject(env, &node);
+}
+
+// Probes all paths in parallel. Returns one MPVNode per path, None if it could
+// not be opened.
+jni_func(jobjectArray, probeMedia, jobjectArray jpaths) {
+    STATS_SCOPE("MPVLib.probeMedia");
+    init_methods_cache(env);
+
+    int count = env->GetArrayLength(jpaths);
+    std::vector<std::string> paths(count);
+    for (int i = 0; i < count; i++) {
+        jstring jpath = (jstring)env->GetObjectArrayElement(jpaths, i);
+        const char *path = env->GetStringUTFChars(jpath, NULL);
+        paths[i] = path;
+        env->ReleaseStringUTFChars(jpath, path);
+        env->DeleteLocalRef(jpath);
+    }
+
+    std::vector<media_info> infos(count);
+    std::vector<char> ok(count);
+    workpool_run(count, [&](size_t i) {
+        ok[i] = probe_media_cached(paths[i], &infos[i]);
+    });
+    probe_cache_save();
+
+    jobjectArray result = env->NewObjectArray(count, mpv_MPVNode, NULL);
+    for (int i = 0; result && i < count; i++) {
+        jobject node = media_info_to_jobject(env, ok[i] ? &infos[i] : NULL);
+        env->SetObjectArrayElement(result, i, node);
+        env->DeleteLocalRef(node);
+    }
+    return result;
+}
+
+// Keeps probe results for local files in the file at path across launches;
+// null disables the cache.
+jni_func(void, setProbeCache, jstring jpath) {
+    STATS_SCOPE("MPVLib.setProbeCache");
+    probe_cache_save();
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    if (!jpath) {
+        g_cache_path.clear();
+        g_cache.clear();
+        return;
+    }
+    const char *path = env->GetStringUTFChars(jpath, NULL);
+    g_cache_path = path;
+    env->ReleaseStringUTFChars(jpath, path);
+    cache_load();
+}
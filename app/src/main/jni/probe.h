@@ -0,0 +1,75 @@
+#pragma once
+
+#include <jni.h>
+#include <math.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "node.h"
+
+enum media_track_type {
+    TRACK_VIDEO,
+    TRACK_AUDIO,
+    TRACK_SUB,
+};
+
+struct media_track {
+    int type;               // media_track_type
+    std::string codec;
+    std::string language;   // as tagged, usually ISO 639-2
+    std::string title;
+    bool is_default;
+    int width, height;      // video
+    int channels, sample_rate; // audio
+};
+
+struct media_chapter {
+    double time;
+    std::string title;
+};
+
+// What a library listing needs to know about a file, read from its headers.
+struct media_info {
+    double duration;        // seconds, -1 if unknown
+    int64_t bit_rate;       // 0 if unknown
+    std::string format;
+    // main video stream, empty codec if there is none
+    std::string video_codec;
+    int width, height;
+    double fps;
+    int rotation;           // clockwise degrees
+    std::string hdr;        // "hdr10", "hlg", "dolby-vision" or empty
+    std::vector<media_track> tracks;
+    std::vector<media_chapter> chapters;
+    // filled in by the loudness analyzer, NAN until then
+    double loudness = NAN;  // integrated, LUFS
+    double true_peak = NAN; // dBTP
+};
+
+// Reads container and stream headers of url, decoding only when the headers
+// leave codec parameters or the duration unknown.
+bool probe_media(const char *url, media_info *out);
+
+// Like probe_media(), but answered from the persistent cache for local files
+// with known content, wherever they are now. Thread-safe.
+bool probe_media_cached(const std::string &path, media_info *out);
+
+// Whether the cache is enabled and path is a local file, which it may keep an
+// entry for. Thread-safe.
+bool probe_cache_accepts(const std::string &path);
+
+// The cached entry for path, without probing or reading the file; false if
+// there is none. Thread-safe.
+bool probe_cache_lookup(const std::string &path, media_info *out);
+
+// Records loudness analysis results for path, if its cache entry still
+// matches the file. Thread-safe.
+bool probe_cache_set_loudness(const std::string &path, double loudness, double true_peak);
+
+// Writes the cache to its file if it changed since the last save.
+void probe_cache_save();
+
+// Map as documented on MPVLib.probeMedia(), or MPV_FORMAT_NONE if info is NULL.
+mpv_node media_info_to_node(node_builder &b, const media_info *info);
+jobject media_info_to_jobject(JNIEnv *env, const media_info *info);
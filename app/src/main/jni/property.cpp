@@ -1,5 +1,7 @@
 #include <jni.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 
 #include <mpv/client.h>
 
@@ -7,6 +9,8 @@
 #include "log.h"
 #include "globals.h"
 #include "node.h"
+#include "trace.h"
+#include "stats.h"
 
 extern "C" {
     jni_func(jint, setOptionString, jstring option, jstring value);
@@ -26,6 +30,7 @@ extern "C" {
 }
 
 jni_func(jint, setOptionString, jstring joption, jstring jvalue) {
+    STATS_SCOPE("MPVLib.setOptionString");
     CHECK_MPV_INIT();
 
     const char *option = env->GetStringUTFChars(joption, NULL);
@@ -39,11 +44,53 @@ jni_func(jint, setOptionString, jstring joption, jstring jvalue) {
     return result;
 }
 
+enum { PROPERTY_GET, PROPERTY_SET, PROPERTY_GET_NODE, PROPERTY_SET_NODE, PROPERTY_KINDS };
+static const char *PROPERTY_KIND_NAMES[] = { "getProperty", "setProperty", "getPropertyNode", "setPropertyNode" };
+
+// properties timed on their own, e.g. "getProperty:track-list"; everything
+// else shares "getProperty:other", names are open-ended
+static const char *TIMED_PROPERTIES[] = {
+    "aid", "android-surface-size", "audio-params", "avsync", "chapter-list",
+    "core-idle", "demuxer-cache-duration", "demuxer-cache-state", "duration",
+    "eof-reached", "estimated-vf-fps", "filename", "frame-drop-count",
+    "hwdec-current", "media-title", "metadata", "path", "pause",
+    "paused-for-cache", "percent-pos", "playback-time", "seeking", "sid",
+    "speed", "time-pos", "track-list", "vid", "video-params", "volume",
+};
+static const int TIMED_COUNT = sizeof(TIMED_PROPERTIES) / sizeof(TIMED_PROPERTIES[0]);
+
+// metric ids resolved once, so timing a property call takes no lock
+struct property_metrics {
+    int ids[PROPERTY_KINDS][TIMED_COUNT + 1];
+
+    property_metrics() {
+        char name[64];
+        for (int kind = 0; kind < PROPERTY_KINDS; kind++) {
+            for (int i = 0; i <= TIMED_COUNT; i++) {
+                snprintf(name, sizeof(name), "%s:%s", PROPERTY_KIND_NAMES[kind],
+                    i < TIMED_COUNT ? TIMED_PROPERTIES[i] : "other");
+                ids[kind][i] = stats_metric(name);
+            }
+        }
+    }
+};
+
+static int property_metric(int kind, const char *prop)
+{
+    static const property_metrics metrics;
+    int i = 0;
+    while (i < TIMED_COUNT && strcmp(TIMED_PROPERTIES[i], prop))
+        i++;
+    return metrics.ids[kind][i];
+}
+
 static int common_get_property(JNIEnv *env, jstring jproperty, mpv_format format, void *output)
 {
+    TRACE_SCOPE("getProperty");
     CHECK_MPV_INIT();
 
     const char *prop = env->GetStringUTFChars(jproperty, NULL);
+    stats_scope prop_stats(property_metric(PROPERTY_GET, prop));
     int result = mpv_get_property(g_mpv, prop, format, output);
     if (result < 0)
         ALOGE("mpv_get_property(%s) format %d returned error %s", prop, format, mpv_error_string(result));
@@ -54,9 +101,11 @@ static int common_get_property(JNIEnv *env, jstring jproperty, mpv_format format
 
 static int common_set_property(JNIEnv *env, jstring jproperty, mpv_format format, void *value)
 {
+    TRACE_SCOPE("setProperty");
     CHECK_MPV_INIT();
 
     const char *prop = env->GetStringUTFChars(jproperty, NULL);
+    stats_scope prop_stats(property_metric(PROPERTY_SET, prop));
     int result = mpv_set_property(g_mpv, prop, format, value);
     if (result < 0)
         ALOGE("mpv_set_property(%s, %p) format %d returned error %s", prop, value, format, mpv_error_string(result));
@@ -66,6 +115,7 @@ static int common_set_property(JNIEnv *env, jstring jproperty, mpv_format format
 }
 
 jni_func(jobject, getPropertyInt, jstring jproperty) {
+    STATS_SCOPE("MPVLib.getPropertyInt");
     int64_t value = 0;
     if (common_get_property(env, jproperty, MPV_FORMAT_INT64, &value) < 0)
         return NULL;
@@ -73,6 +123,7 @@ jni_func(jobject, getPropertyInt, jstring jproperty) {
 }
 
 jni_func(jobject, getPropertyDouble, jstring jproperty) {
+    STATS_SCOPE("MPVLib.getPropertyDouble");
     double value = 0;
     if (common_get_property(env, jproperty, MPV_FORMAT_DOUBLE, &value) < 0)
         return NULL;
@@ -80,6 +131,7 @@ jni_func(jobject, getPropertyDouble, jstring jproperty) {
 }
 
 jni_func(jobject, getPropertyBoolean, jstring jproperty) {
+    STATS_SCOPE("MPVLib.getPropertyBoolean");
     int value = 0;
     if (common_get_property(env, jproperty, MPV_FORMAT_FLAG, &value) < 0)
         return NULL;
@@ -87,6 +139,7 @@ jni_func(jobject, getPropertyBoolean, jstring jproperty) {
 }
 
 jni_func(jstring, getPropertyString, jstring jproperty) {
+    STATS_SCOPE("MPVLib.getPropertyString");
     char *value;
     if (common_get_property(env, jproperty, MPV_FORMAT_STRING, &value) < 0)
         return NULL;
@@ -96,30 +149,38 @@ jni_func(jstring, getPropertyString, jstring jproperty) {
 }
 
 jni_func(void, setPropertyInt, jstring jproperty, jint jvalue) {
+    STATS_SCOPE("MPVLib.setPropertyInt");
     int64_t value = static_cast<int64_t>(jvalue);
     common_set_property(env, jproperty, MPV_FORMAT_INT64, &value);
 }
 
 jni_func(void, setPropertyDouble, jstring jproperty, jdouble jvalue) {
+    STATS_SCOPE("MPVLib.setPropertyDouble");
     double value = static_cast<double>(jvalue);
     common_set_property(env, jproperty, MPV_FORMAT_DOUBLE, &value);
 }
 
 jni_func(void, setPropertyBoolean, jstring jproperty, jboolean jvalue) {
+    STATS_SCOPE("MPVLib.setPropertyBoolean");
     int value = jvalue == JNI_TRUE ? 1 : 0;
     common_set_property(env, jproperty, MPV_FORMAT_FLAG, &value);
 }
 
 jni_func(void, setPropertyString, jstring jproperty, jstring jvalue) {
+    STATS_SCOPE("MPVLib.setPropertyString");
     const char *value = env->GetStringUTFChars(jvalue, NULL);
     common_set_property(env, jproperty, MPV_FORMAT_STRING, &value);
     env->ReleaseStringUTFChars(jvalue, value);
 }
 
 jni_func(jobject, getPropertyNode, jstring jproperty) {
+    TRACE_SCOPE("getPropertyNode");
+    STATS_SCOPE("MPVLib.getPropertyNode");
     CHECK_MPV_INIT();
 
     const char *property = env->GetStringUTFChars(jproperty, NULL);
+    // covers the conversion to Java as well
+    stats_scope prop_stats(property_metric(PROPERTY_GET_NODE, property));
 
     mpv_node result;
     int error = mpv_get_property(g_mpv, property, MPV_FORMAT_NODE, &result);
@@ -135,9 +196,12 @@ jni_func(jobject, getPropertyNode, jstring jproperty) {
 }
 
 jni_func(void, setPropertyNode, jstring jproperty, jobject jnode) {
+    TRACE_SCOPE("setPropertyNode");
+    STATS_SCOPE("MPVLib.setPropertyNode");
     CHECK_MPV_INIT();
 
     const char *property = env->GetStringUTFChars(jproperty, NULL);
+    stats_scope prop_stats(property_metric(PROPERTY_SET_NODE, property));
 
     mpv_node node;
     memset(&node, 0, sizeof(node));
@@ -155,6 +219,7 @@ jni_func(void, setPropertyNode, jstring jproperty, jobject jnode) {
 }
 
 jni_func(void, observeProperty, jstring property, jint format) {
+    STATS_SCOPE("MPVLib.observeProperty");
     CHECK_MPV_INIT();
     const char *prop = env->GetStringUTFChars(property, NULL);
     int result = mpv_observe_property(g_mpv, 0, prop, (mpv_format)format);
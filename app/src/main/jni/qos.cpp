@@ -0,0 +1,443 @@
+#include <jni.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+#include <mpv/client.h>
+
+#include "jni_utils.h"
+#include "globals.h"
+#include "log.h"
+#include "stats.h"
+
+extern "C" {
+    jni_func(void, startQosSampler, jint interval_ms, jint capacity);
+    jni_func(void, stopQosSampler);
+    jni_func(void, setQosThresholds, jdouble max_drop_rate, jdouble min_cache, jdouble max_avsync);
+    jni_func(jdoubleArray, getQosSummary, jdouble window);
+    jni_func(jdoubleArray, getQosSamples);
+};
+
+// ============================================================================
+// PLAYBACK QUALITY OF SERVICE
+// A sampler thread reads the playback health properties at a fixed rate into a
+// ring of samples, so Kotlin gets rolling aggregates in one call instead of
+// polling each property itself. Threshold crossings are reported to
+// MPVLib.qosAlert() from the sampler thread as they happen.
+// ============================================================================
+
+// must match MPVLib.QosAlert
+enum qos_alert {
+    QOS_ALERT_DROP_RATE = 0,  // dropped frames per second above the limit
+    QOS_ALERT_CACHE_LOW = 1,  // demuxer cache below the limit while playing
+    QOS_ALERT_AVSYNC = 2,     // |avsync| above the limit
+    QOS_ALERT_STALL = 3,      // playback paused to wait for the cache
+};
+
+// drop rate alerts look at this many seconds
+static const double ALERT_WINDOW = 5.0;
+
+struct qos_sample {
+    double time;            // seconds since the sampler started
+    int64_t drops;          // frame-drop-count, -1 if unavailable
+    int64_t decoder_drops;  // decoder-frame-drop-count
+    int64_t delayed;        // vo-delayed-frame-count
+    double cache;           // demuxer-cache-duration, NAN if unavailable
+    double fps;             // estimated-vf-fps
+    double avsync;
+    bool buffering;         // paused-for-cache
+    bool paused;
+    // since the previous sample, kept for the running alert window
+    int64_t drop_delta;
+    double play_time;
+};
+
+struct qos_thresholds {
+    double max_drop_rate = 2.0;
+    double min_cache = 1.0;
+    double max_avsync = 0.1;
+};
+
+struct qos_ctx {
+    mpv_handle *mpv;
+    double interval;
+    std::atomic<bool> stop;
+    int64_t start_ns;
+    // below protected by g_qos_mutex
+    std::vector<qos_sample> ring;
+    size_t head, count;     // next write position, number of valid samples
+    uint64_t written;       // samples ever written, ring[n % size] holds sample n
+    // drop rate alerts keep running totals over the samples after window_first
+    // rather than walking the ring on every tick
+    uint64_t window_first;
+    int64_t window_drops;
+    double window_play_time;
+};
+
+struct qos_summary {
+    double samples, span;
+    double drop_rate, decoder_drop_rate, delayed_rate, drop_ratio;
+    double stalls, underruns;
+    double cache_mean, cache_min;
+    double fps_mean;
+    double avsync_mean, avsync_max;
+};
+
+static qos_ctx *g_qos;
+static qos_thresholds g_thresholds;
+static std::mutex g_qos_mutex;
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void read_sample(qos_ctx *ctx, qos_sample *s)
+{
+    STATS_SCOPE("qos:sample");
+    s->time = (now_ns() - ctx->start_ns) / 1e9;
+
+    if (mpv_get_property(ctx->mpv, "frame-drop-count", MPV_FORMAT_INT64, &s->drops) < 0)
+        s->drops = -1;
+    if (mpv_get_property(ctx->mpv, "decoder-frame-drop-count", MPV_FORMAT_INT64, &s->decoder_drops) < 0)
+        s->decoder_drops = -1;
+    if (mpv_get_property(ctx->mpv, "vo-delayed-frame-count", MPV_FORMAT_INT64, &s->delayed) < 0)
+        s->delayed = -1;
+    if (mpv_get_property(ctx->mpv, "demuxer-cache-duration", MPV_FORMAT_DOUBLE, &s->cache) < 0)
+        s->cache = NAN;
+    if (mpv_get_property(ctx->mpv, "estimated-vf-fps", MPV_FORMAT_DOUBLE, &s->fps) < 0)
+        s->fps = NAN;
+    if (mpv_get_property(ctx->mpv, "avsync", MPV_FORMAT_DOUBLE, &s->avsync) < 0)
+        s->avsync = NAN;
+
+    int flag = 0;
+    s->buffering = mpv_get_property(ctx->mpv, "paused-for-cache", MPV_FORMAT_FLAG, &flag) >= 0 && flag;
+    flag = 0;
+    s->paused = mpv_get_property(ctx->mpv, "pause", MPV_FORMAT_FLAG, &flag) >= 0 && flag;
+}
+
+// counter increase between two samples; counters restart with every file
+static int64_t counter_delta(int64_t prev, int64_t cur)
+{
+    if (cur < 0)
+        return 0;
+    if (prev < 0 || cur < prev)
+        return cur;
+    return cur - prev;
+}
+
+// must be called with g_qos_mutex held, window <= 0 means the whole ring
+static void summarize(const qos_ctx *ctx, double window, double min_cache, qos_summary *out)
+{
+    *out = qos_summary();
+    out->cache_min = NAN;
+    if (!ctx->count)
+        return;
+
+    const size_t cap = ctx->ring.size();
+    const qos_sample &last = ctx->ring[(ctx->head + cap - 1) % cap];
+    // samples are in time order, so the window is found from the newest end
+    size_t n = ctx->count;
+    if (window > 0) {
+        n = 0;
+        while (n < ctx->count && ctx->ring[(ctx->head + cap - 1 - n) % cap].time >= last.time - window)
+            n++;
+    }
+    double play_time = 0, frames = 0, drops = 0, decoder_drops = 0, delayed = 0;
+    double cache_sum = 0, fps_sum = 0, avsync_sum = 0;
+    int cache_n = 0, fps_n = 0, avsync_n = 0;
+    const qos_sample *prev = NULL;
+    const qos_sample *first = NULL;
+
+    for (size_t i = 0; i < n; i++) {
+        const qos_sample &s = ctx->ring[(ctx->head + cap - n + i) % cap];
+        if (!first)
+            first = &s;
+        out->samples++;
+
+        bool playing = !s.paused && !s.buffering;
+        if (prev) {
+            drops += counter_delta(prev->drops, s.drops);
+            decoder_drops += counter_delta(prev->decoder_drops, s.decoder_drops);
+            delayed += counter_delta(prev->delayed, s.delayed);
+            if (playing) {
+                double dt = s.time - prev->time;
+                play_time += dt;
+                if (!isnan(s.fps))
+                    frames += s.fps * dt;
+            }
+            if (s.buffering && !prev->buffering)
+                out->stalls++;
+            bool low = !isnan(s.cache) && s.cache < min_cache;
+            bool was_low = !isnan(prev->cache) && prev->cache < min_cache;
+            if (playing && low && !was_low)
+                out->underruns++;
+        }
+
+        if (!isnan(s.cache)) {
+            cache_sum += s.cache;
+            cache_n++;
+            if (isnan(out->cache_min) || s.cache < out->cache_min)
+                out->cache_min = s.cache;
+        }
+        if (!isnan(s.fps)) {
+            fps_sum += s.fps;
+            fps_n++;
+        }
+        if (!isnan(s.avsync)) {
+            avsync_sum += fabs(s.avsync);
+            avsync_n++;
+            out->avsync_max = std::max(out->avsync_max, fabs(s.avsync));
+        }
+        prev = &s;
+    }
+
+    out->span = first ? last.time - first->time : 0;
+    if (play_time > 0) {
+        out->drop_rate = drops / play_time;
+        out->decoder_drop_rate = decoder_drops / play_time;
+        out->delayed_rate = delayed / play_time;
+    }
+    out->drop_ratio = frames > 0 ? std::min(1.0, (drops + decoder_drops) / frames) : 0;
+    out->cache_mean = cache_n ? cache_sum / cache_n : NAN;
+    out->fps_mean = fps_n ? fps_sum / fps_n : NAN;
+    out->avsync_mean = avsync_n ? avsync_sum / avsync_n : 0;
+}
+
+// must be called with g_qos_mutex held
+static void drop_window_first(qos_ctx *ctx)
+{
+    const qos_sample &s = ctx->ring[++ctx->window_first % ctx->ring.size()];
+    ctx->window_drops -= s.drop_delta;
+    ctx->window_play_time -= s.play_time;
+}
+
+// must be called with g_qos_mutex held
+static void push_sample(qos_ctx *ctx, qos_sample *s)
+{
+    const size_t cap = ctx->ring.size();
+    if (ctx->count) {
+        const qos_sample &prev = ctx->ring[(ctx->head + cap - 1) % cap];
+        s->drop_delta = counter_delta(prev.drops, s->drops);
+        s->play_time = !s->paused && !s->buffering ? s->time - prev.time : 0;
+    } else {
+        s->drop_delta = 0;
+        s->play_time = 0;
+        ctx->window_first = ctx->written;
+    }
+    // the window cannot start at a sample that is about to be overwritten
+    if (ctx->count == cap && ctx->window_first == ctx->written - cap)
+        drop_window_first(ctx);
+
+    ctx->ring[ctx->head] = *s;
+    ctx->head = (ctx->head + 1) % cap;
+    ctx->count = std::min(ctx->count + 1, cap);
+    if (ctx->written++ > ctx->window_first) {
+        ctx->window_drops += s->drop_delta;
+        ctx->window_play_time += s->play_time;
+    }
+    while (ctx->window_first + 1 < ctx->written &&
+            ctx->ring[ctx->window_first % cap].time < s->time - ALERT_WINDOW)
+        drop_window_first(ctx);
+}
+
+static void send_alert(JNIEnv *env, int kind, double value)
+{
+    ALOGV("QoS | Alert %d (%f)", kind, value);
+    if (!env)
+        return;
+    env->CallStaticVoidMethod(mpv_MPVLib, mpv_MPVLib_qosAlert_ID, (jint)kind, (jdouble)value);
+    if (env->ExceptionCheck())
+        env->ExceptionClear();
+}
+
+static void *qos_thread(void *arg)
+{
+    pthread_setname_np(pthread_self(), "qos");
+    qos_ctx *ctx = static_cast<qos_ctx*>(arg);
+    JNIEnv *env = NULL;
+    if (!acquire_jni_env(g_vm, &env))
+        env = NULL;
+
+    // alerts fire when a condition starts holding and re-arm once it stops
+    bool active[4] = { false, false, false, false };
+    int64_t next_ns = now_ns();
+
+    while (!ctx->stop) {
+        int64_t wait_ns = next_ns - now_ns();
+        if (wait_ns > 0) {
+            mpv_event *ev = mpv_wait_event(ctx->mpv, wait_ns / 1e9);
+            if (ev->event_id == MPV_EVENT_SHUTDOWN)
+                break;
+            if (ev->event_id != MPV_EVENT_NONE || now_ns() < next_ns)
+                continue;
+        }
+        next_ns += (int64_t)(ctx->interval * 1e9);
+        // after a long stall (e.g. the process was frozen) do not try to catch up
+        next_ns = std::max(next_ns, now_ns());
+
+        qos_sample s;
+        read_sample(ctx, &s);
+
+        double drop_rate;
+        qos_thresholds limits;
+        {
+            std::lock_guard<std::mutex> lock(g_qos_mutex);
+            limits = g_thresholds;
+            push_sample(ctx, &s);
+            drop_rate = ctx->window_play_time > 0 ? ctx->window_drops / ctx->window_play_time : 0;
+        }
+
+        bool playing = !s.paused && !s.buffering;
+        bool now_active[4] = {
+            drop_rate > limits.max_drop_rate,
+            playing && !isnan(s.cache) && s.cache < limits.min_cache,
+            !isnan(s.avsync) && fabs(s.avsync) > limits.max_avsync,
+            s.buffering,
+        };
+        double values[4] = { drop_rate, s.cache, s.avsync, s.cache };
+        for (int i = 0; i < 4; i++) {
+            if (now_active[i] && !active[i])
+                send_alert(env, i, values[i]);
+            active[i] = now_active[i];
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(g_qos_mutex);
+        if (g_qos == ctx)
+            g_qos = NULL;
+    }
+    if (env)
+        g_vm->DetachCurrentThread();
+    mpv_destroy(ctx->mpv);
+    delete ctx;
+    return NULL;
+}
+
+// must be called with g_qos_mutex held
+static void stop_sampler()
+{
+    if (!g_qos)
+        return;
+    // the thread cleans up after itself
+    g_qos->stop = true;
+    mpv_wakeup(g_qos->mpv);
+    g_qos = NULL;
+}
+
+jni_func(void, startQosSampler, jint interval_ms, jint capacity) {
+    STATS_SCOPE("MPVLib.startQosSampler");
+    CHECK_MPV_INIT();
+    init_methods_cache(env);
+    if (interval_ms < 50 || capacity < 2 || capacity > 100000) {
+        ALOGE("QoS | Invalid interval or capacity");
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(g_qos_mutex);
+    stop_sampler();
+
+    qos_ctx *ctx = new qos_ctx();
+    ctx->mpv = mpv_create_client(g_mpv, "qos");
+    if (!ctx->mpv) {
+        ALOGE("QoS | Failed to create client");
+        delete ctx;
+        return;
+    }
+    ctx->interval = interval_ms / 1000.0;
+    ctx->stop = false;
+    ctx->start_ns = now_ns();
+    ctx->ring.resize(capacity);
+    ctx->head = 0;
+    ctx->count = 0;
+    ctx->written = 0;
+    ctx->window_first = 0;
+    ctx->window_drops = 0;
+    ctx->window_play_time = 0;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, &attr, qos_thread, ctx) != 0)
+        die("thread create failed");
+    pthread_attr_destroy(&attr);
+
+    g_qos = ctx;
+}
+
+jni_func(void, stopQosSampler) {
+    STATS_SCOPE("MPVLib.stopQosSampler");
+    std::lock_guard<std::mutex> lock(g_qos_mutex);
+    stop_sampler();
+}
+
+jni_func(void, setQosThresholds, jdouble max_drop_rate, jdouble min_cache, jdouble max_avsync) {
+    STATS_SCOPE("MPVLib.setQosThresholds");
+    std::lock_guard<std::mutex> lock(g_qos_mutex);
+    g_thresholds.max_drop_rate = max_drop_rate;
+    g_thresholds.min_cache = min_cache;
+    g_thresholds.max_avsync = max_avsync;
+}
+
+// [samples, seconds covered, dropped frames/s, decoder drops/s, delayed frames/s,
+//  dropped share of frames, stalls, cache underruns, mean cache, min cache,
+//  mean fps, mean |avsync|, max |avsync|] over the last window seconds (0 = all).
+// Rates are per second of actual playback. Unavailable values are NaN.
+jni_func(jdoubleArray, getQosSummary, jdouble window) {
+    STATS_SCOPE("MPVLib.getQosSummary");
+    qos_summary s;
+    {
+        std::lock_guard<std::mutex> lock(g_qos_mutex);
+        if (!g_qos)
+            return NULL;
+        summarize(g_qos, window, g_thresholds.min_cache, &s);
+    }
+
+    jdouble values[] = {
+        s.samples, s.span, s.drop_rate, s.decoder_drop_rate, s.delayed_rate,
+        s.drop_ratio, s.stalls, s.underruns, s.cache_mean, s.cache_min,
+        s.fps_mean, s.avsync_mean, s.avsync_max,
+    };
+    jdoubleArray jvalues = env->NewDoubleArray(sizeof(values) / sizeof(values[0]));
+    if (jvalues)
+        env->SetDoubleArrayRegion(jvalues, 0, sizeof(values) / sizeof(values[0]), values);
+    return jvalues;
+}
+
+// The ring, oldest first, 8 values per sample:
+// [time, drops, decoder drops, delayed frames, cache, fps, avsync, buffering]
+jni_func(jdoubleArray, getQosSamples) {
+    STATS_SCOPE("MPVLib.getQosSamples");
+    std::vector<jdouble> values;
+    {
+        std::lock_guard<std::mutex> lock(g_qos_mutex);
+        if (!g_qos)
+            return NULL;
+        const size_t cap = g_qos->ring.size();
+        values.reserve(g_qos->count * 8);
+        for (size_t i = 0; i < g_qos->count; i++) {
+            const qos_sample &s = g_qos->ring[(g_qos->head + cap - g_qos->count + i) % cap];
+            values.push_back(s.time);
+            values.push_back((jdouble)s.drops);
+            values.push_back((jdouble)s.decoder_drops);
+            values.push_back((jdouble)s.delayed);
+            values.push_back(s.cache);
+            values.push_back(s.fps);
+            values.push_back(s.avsync);
+            values.push_back(s.buffering ? 1 : 0);
+        }
+    }
+
+    jdoubleArray jvalues = env->NewDoubleArray(values.size());
+    if (jvalues)
+        env->SetDoubleArrayRegion(jvalues, 0, values.size(), values.data());
+    return jvalues;
+}
@@ -0,0 +1,377 @@
+#include "readahead.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+extern "C" {
+    #include <libavformat/avio.h>
+};
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// ============================================================================
+// SOURCES
+// ============================================================================
+
+FileReadaheadSource::FileReadaheadSource(int fd) : fd(fd) {}
+
+FileReadaheadSource::~FileReadaheadSource()
+{
+    close(fd);
+}
+
+int64_t FileReadaheadSource::size()
+{
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+        return st.st_size;
+    off_t end = lseek(fd, 0, SEEK_END);
+    return end >= 0 ? end : -1;
+}
+
+int64_t FileReadaheadSource::read_at(int worker, int64_t offset, uint8_t *dst, size_t len,
+    const std::atomic<bool> *cancel)
+{
+    size_t done = 0;
+    while (done < len && !*cancel) {
+        ssize_t r = pread(fd, dst + done, len - done, offset + done);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0)
+            return done ? (int64_t)done : -1;
+        if (r == 0)
+            break;
+        done += r;
+    }
+    return done;
+}
+
+struct AvioReadaheadSource::connection {
+    AVIOContext *ctx;
+    const std::atomic<bool> *cancel;
+};
+
+static int avio_interrupt_cb(void *opaque)
+{
+    AvioReadaheadSource::connection *c = static_cast<AvioReadaheadSource::connection*>(opaque);
+    return c->cancel && *c->cancel;
+}
+
+AvioReadaheadSource::AvioReadaheadSource(const std::string &url, int workers)
+    : url(url), total_size(-1)
+{
+    for (int i = 0; i < workers; i++) {
+        connection *c = new connection();
+        c->ctx = NULL;
+        c->cancel = NULL;
+        conns.push_back(c);
+    }
+}
+
+AvioReadaheadSource::~AvioReadaheadSource()
+{
+    for (connection *c : conns) {
+        if (c->ctx)
+            avio_closep(&c->ctx);
+        delete c;
+    }
+}
+
+static AVIOContext *open_connection(const std::string &url, AvioReadaheadSource::connection *c)
+{
+    AVIOInterruptCB cb = { avio_interrupt_cb, c };
+    AVIOContext *ctx = NULL;
+    if (avio_open2(&ctx, url.c_str(), AVIO_FLAG_READ, &cb, NULL) < 0)
+        return NULL;
+    return ctx;
+}
+
+bool AvioReadaheadSource::open()
+{
+    if (conns.empty())
+        return false;
+    conns[0]->ctx = open_connection(url, conns[0]);
+    if (!conns[0]->ctx)
+        return false;
+    // parallel range fetches need random access
+    if (!conns[0]->ctx->seekable)
+        return false;
+    total_size = avio_size(conns[0]->ctx);
+    return true;
+}
+
+int64_t AvioReadaheadSource::size()
+{
+    return total_size >= 0 ? total_size : -1;
+}
+
+static int64_t read_range(const std::string &url, AvioReadaheadSource::connection *c, int64_t offset,
+    uint8_t *dst, size_t len, const std::atomic<bool> *cancel)
+{
+    if (!c->ctx)
+        c->ctx = open_connection(url, c);
+    if (!c->ctx)
+        return -1;
+
+    if (avio_seek(c->ctx, offset, SEEK_SET) < 0) {
+        // the connection may have gone stale, retry once on a fresh one
+        avio_closep(&c->ctx);
+        c->ctx = open_connection(url, c);
+        if (!c->ctx || avio_seek(c->ctx, offset, SEEK_SET) < 0)
+            return -1;
+    }
+
+    size_t done = 0;
+    while (done < len && !*cancel) {
+        int r = avio_read(c->ctx, dst + done, (int)std::min<size_t>(len - done, INT32_MAX));
+        if (r == AVERROR_EOF || r == 0)
+            break;
+        if (r < 0)
+            return done ? (int64_t)done : -1;
+        done += r;
+    }
+    return done;
+}
+
+int64_t AvioReadaheadSource::read_at(int worker, int64_t offset, uint8_t *dst, size_t len,
+    const std::atomic<bool> *cancel)
+{
+    connection *c = conns[worker % conns.size()];
+    // the flag lives in a cache block that may be freed once this returns,
+    // while closing the connection later still runs the interrupt callback
+    c->cancel = cancel;
+    int64_t r = read_range(url, c, offset, dst, len, cancel);
+    c->cancel = NULL;
+    return r;
+}
+
+// ============================================================================
+// ENGINE
+// ============================================================================
+
+ReadaheadStream::ReadaheadStream(ReadaheadSource *src, const readahead_config &cfg)
+    : src(src), cfg(cfg), stopping(false), aborted(false), pos(0),
+      depth(cfg.min_depth), hits_since_stall(0), eof_block(-1)
+{
+    total_size = this->src->size();
+    if (total_size >= 0)
+        eof_block = (total_size + cfg.block_size - 1) / cfg.block_size;
+    this->cfg.cache_blocks = std::max(this->cfg.cache_blocks, (size_t)cfg.max_depth + 2);
+    for (int i = 0; i < cfg.threads; i++) {
+        workers.push_back(std::thread(&ReadaheadStream::worker_loop, this, i));
+        pthread_setname_np(workers.back().native_handle(), "readahead");
+    }
+}
+
+ReadaheadStream::~ReadaheadStream()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        for (auto &it : blocks)
+            it.second->cancel = true;
+    }
+    work_cv.notify_all();
+    for (std::thread &t : workers)
+        t.join();
+}
+
+bool ReadaheadStream::in_window(int64_t index)
+{
+    int64_t cur = pos / cfg.block_size;
+    return index >= cur - 1 && index < cur + depth;
+}
+
+void ReadaheadStream::schedule(int64_t first)
+{
+    int64_t last = first + depth;
+    if (eof_block >= 0)
+        last = std::min(last, eof_block);
+    for (int64_t i = first; i < last; i++) {
+        if (blocks.count(i))
+            continue;
+        std::shared_ptr<Block> b = std::make_shared<Block>();
+        b->index = i;
+        b->state = QUEUED;
+        b->len = 0;
+        b->cancel = false;
+        blocks[i] = b;
+        queue.push_back(i);
+    }
+    work_cv.notify_all();
+}
+
+void ReadaheadStream::evict()
+{
+    int64_t cur = pos / cfg.block_size;
+    while (blocks.size() > cfg.cache_blocks) {
+        // drop the finished block farthest from the reader, preferring ones behind it
+        auto victim = blocks.end();
+        int64_t victim_dist = -1;
+        for (auto it = blocks.begin(); it != blocks.end(); ++it) {
+            if (it->second->state != READY && it->second->state != FAILED)
+                continue;
+            int64_t dist = it->first < cur ? (cur - it->first) * 2 : it->first - cur;
+            if (dist > victim_dist) {
+                victim = it;
+                victim_dist = dist;
+            }
+        }
+        if (victim == blocks.end() || in_window(victim->first))
+            break;
+        blocks.erase(victim);
+    }
+}
+
+void ReadaheadStream::worker_loop(int worker)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (1) {
+        work_cv.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (stopping)
+            break;
+
+        int64_t index = queue.front();
+        queue.pop_front();
+        auto it = blocks.find(index);
+        if (it == blocks.end() || it->second->state != QUEUED)
+            continue;
+        std::shared_ptr<Block> b = it->second;
+        b->state = FETCHING;
+
+        // nobody else touches the block's data until it is READY
+        lock.unlock();
+        b->data.resize(cfg.block_size);
+        int64_t t0 = now_ns();
+        int64_t n = src->read_at(worker, index * (int64_t)cfg.block_size, b->data.data(), cfg.block_size, &b->cancel);
+        int64_t elapsed = now_ns() - t0;
+        lock.lock();
+
+        st.fetch_ns += elapsed;
+        if (b->cancel) {
+            // dropped by a seek or shutdown while in flight
+            st.cancelled++;
+            auto cur = blocks.find(index);
+            if (cur != blocks.end() && cur->second == b)
+                blocks.erase(cur);
+        } else if (n < 0) {
+            b->state = FAILED;
+        } else {
+            b->data.resize(n);
+            b->len = n;
+            b->state = READY;
+            st.bytes_fetched += n;
+            if ((size_t)n < cfg.block_size && (eof_block < 0 || index + 1 < eof_block))
+                eof_block = index + 1;
+        }
+        ready_cv.notify_all();
+    }
+}
+
+int64_t ReadaheadStream::read(uint8_t *dst, size_t len)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (aborted)
+        return -1;
+
+    int64_t index = pos / cfg.block_size;
+    if (eof_block >= 0 && index >= eof_block)
+        return 0;
+
+    schedule(index);
+    std::shared_ptr<Block> b = blocks[index];
+    if (b->state == QUEUED || b->state == FETCHING) {
+        int64_t t0 = now_ns();
+        st.stalls++;
+        ready_cv.wait(lock, [&] {
+            auto cur = blocks.find(index);
+            return aborted || b->state == READY || b->state == FAILED ||
+                cur == blocks.end() || cur->second != b;
+        });
+        st.stall_ns += now_ns() - t0;
+        // the reader caught up with the workers, look further ahead
+        depth = std::min(depth * 2, cfg.max_depth);
+        hits_since_stall = 0;
+        schedule(index);
+    } else if (++hits_since_stall >= depth * 4 && depth > cfg.min_depth) {
+        depth--;
+        hits_since_stall = 0;
+    }
+    if (aborted || b->state != READY) {
+        // let the next read retry a failed block
+        auto cur = blocks.find(index);
+        if (cur != blocks.end() && cur->second == b && b->state == FAILED)
+            blocks.erase(cur);
+        return -1;
+    }
+
+    size_t off = pos - index * (int64_t)cfg.block_size;
+    if (off >= b->len)
+        return 0;
+    size_t n = std::min(len, b->len - off);
+    memcpy(dst, b->data.data() + off, n);
+    pos += n;
+    st.bytes_delivered += n;
+    evict();
+    return n;
+}
+
+int64_t ReadaheadStream::seek(int64_t new_pos)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (new_pos < 0)
+        return -1;
+    pos = new_pos;
+
+    // cancel what the new position does not need anymore, in-flight fetches
+    // notice through their cancel flag and are counted by the worker
+    for (auto it = blocks.begin(); it != blocks.end();) {
+        Block *b = it->second.get();
+        if ((b->state == QUEUED || b->state == FETCHING) && !in_window(it->first)) {
+            b->cancel = true;
+            if (b->state == QUEUED)
+                st.cancelled++;
+            it = blocks.erase(it);
+            continue;
+        }
+        ++it;
+    }
+    queue.erase(std::remove_if(queue.begin(), queue.end(),
+        [this](int64_t i) { return !blocks.count(i); }), queue.end());
+    schedule(pos / cfg.block_size);
+    return pos;
+}
+
+int64_t ReadaheadStream::size()
+{
+    return total_size;
+}
+
+void ReadaheadStream::abort()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        aborted = true;
+        for (auto &it : blocks)
+            it.second->cancel = true;
+    }
+    ready_cv.notify_all();
+}
+
+readahead_stats ReadaheadStream::stats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    readahead_stats s = st;
+    s.depth = depth;
+    return s;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Multi-threaded read-ahead for high-latency sources. A stream is split into
+// fixed-size blocks which a pool of workers fetches in parallel ahead of the
+// reader. The prefetch depth grows when the reader stalls and shrinks again
+// while it doesn't; seeking away cancels fetches that are no longer useful.
+//
+// Kept free of JNI, mpv and Android dependencies so benchmarks/readahead can
+// build it on the host.
+
+class ReadaheadSource {
+public:
+    virtual ~ReadaheadSource() {}
+    // total size in bytes, -1 if unknown
+    virtual int64_t size() = 0;
+    // Read up to len bytes at offset. Called concurrently, each worker passes
+    // its own index so sources can keep per-connection state. Should return
+    // early once *cancel becomes true. Returns bytes read, 0 at EOF, <0 on error.
+    virtual int64_t read_at(int worker, int64_t offset, uint8_t *dst, size_t len,
+        const std::atomic<bool> *cancel) = 0;
+};
+
+// Positional reads on a file descriptor, which is closed on destruction.
+class FileReadaheadSource : public ReadaheadSource {
+public:
+    explicit FileReadaheadSource(int fd);
+    ~FileReadaheadSource();
+    int64_t size() override;
+    int64_t read_at(int worker, int64_t offset, uint8_t *dst, size_t len,
+        const std::atomic<bool> *cancel) override;
+
+private:
+    int fd;
+};
+
+// Any URL FFmpeg can open and seek in (http with range requests, etc.),
+// with one connection per worker.
+class AvioReadaheadSource : public ReadaheadSource {
+public:
+    AvioReadaheadSource(const std::string &url, int workers);
+    ~AvioReadaheadSource();
+    // opens the first connection, false if the URL is unusable or not seekable
+    bool open();
+    int64_t size() override;
+    int64_t read_at(int worker, int64_t offset, uint8_t *dst, size_t len,
+        const std::atomic<bool> *cancel) override;
+
+    struct connection;
+
+private:
+    std::string url;
+    std::vector<connection*> conns;
+    int64_t total_size;
+};
+
+struct readahead_config {
+    size_t block_size = 512 * 1024;
+    int threads = 4;
+    int min_depth = 2;    // blocks fetched ahead of the reader
+    int max_depth = 32;
+    size_t cache_blocks = 64;
+};
+
+struct readahead_stats {
+    int64_t bytes_fetched = 0;
+    int64_t bytes_delivered = 0;
+    int64_t fetch_ns = 0;   // summed over all workers
+    int64_t stalls = 0;     // reads that had to wait for a block
+    int64_t stall_ns = 0;
+    int64_t cancelled = 0;  // blocks dropped because of seeks
+    int64_t depth = 0;      // current prefetch depth
+};
+
+class ReadaheadStream {
+public:
+    // takes ownership of src
+    ReadaheadStream(ReadaheadSource *src, const readahead_config &cfg);
+    ~ReadaheadStream();
+
+    // returns bytes read, 0 at EOF, <0 on error or after abort()
+    int64_t read(uint8_t *dst, size_t len);
+    int64_t seek(int64_t pos);
+    int64_t size();
+    // make blocked and future reads fail
+    void abort();
+    readahead_stats stats();
+
+private:
+    enum block_state { QUEUED, FETCHING, READY, FAILED };
+    struct Block {
+        int64_t index;
+        block_state state;
+        std::vector<uint8_t> data;
+        size_t len;
+        std::atomic<bool> cancel;
+    };
+
+    void worker_loop(int worker);
+    void schedule(int64_t first);  // must hold mutex
+    void evict();                  // must hold mutex
+    bool in_window(int64_t index); // must hold mutex
+
+    std::unique_ptr<ReadaheadSource> src;
+    readahead_config cfg;
+    int64_t total_size;
+
+    std::mutex mutex;
+    std::condition_variable work_cv, ready_cv;
+    std::map<int64_t, std::shared_ptr<Block>> blocks;
+    std::deque<int64_t> queue;
+    std::vector<std::thread> workers;
+    bool stopping, aborted;
+    int64_t pos;
+    int depth;
+    int hits_since_stall;
+    int64_t eof_block; // first block known to be past the end, -1 if unknown
+    readahead_stats st;
+};
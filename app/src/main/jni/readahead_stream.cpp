@@ -0,0 +1,189 @@
+#include <jni.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <mutex>
+#include <set>
+
+#include <mpv/client.h>
+#include <mpv/stream_cb.h>
+
+#include "jni_utils.h"
+#include "log.h"
+#include "readahead.h"
+#include "readahead_stream.h"
+#include "stats.h"
+
+extern "C" {
+    jni_func(void, setReadaheadConfig, jint threads, jint block_size, jint max_depth, jlong cache_bytes);
+    jni_func(jlongArray, getReadaheadStats);
+};
+
+// ============================================================================
+// READAHEAD STREAMS
+// "readahead://<url>" plays <url> through the parallel read-ahead engine.
+// <url> may be a local path, file://, fdstream://<fd> or anything FFmpeg can
+// open with random access, such as http(s) servers supporting range requests.
+// ============================================================================
+
+#define READAHEAD_PROTOCOL "readahead"
+
+static readahead_config g_config;
+static std::set<ReadaheadStream*> g_streams;
+static readahead_stats g_closed_stats; // accumulated from streams already closed
+static std::mutex g_readahead_mutex;
+
+static int64_t ra_read(void *cookie, char *buf, uint64_t nbytes)
+{
+    return static_cast<ReadaheadStream*>(cookie)->read(reinterpret_cast<uint8_t*>(buf), nbytes);
+}
+
+static int64_t ra_seek(void *cookie, int64_t offset)
+{
+    int64_t r = static_cast<ReadaheadStream*>(cookie)->seek(offset);
+    return r < 0 ? (int64_t)MPV_ERROR_GENERIC : r;
+}
+
+static int64_t ra_size(void *cookie)
+{
+    int64_t size = static_cast<ReadaheadStream*>(cookie)->size();
+    return size >= 0 ? size : (int64_t)MPV_ERROR_UNSUPPORTED;
+}
+
+static void ra_cancel(void *cookie)
+{
+    static_cast<ReadaheadStream*>(cookie)->abort();
+}
+
+static void ra_close(void *cookie)
+{
+    ReadaheadStream *s = static_cast<ReadaheadStream*>(cookie);
+    readahead_stats st = s->stats();
+    ALOGV("readahead | Closed: %lld bytes fetched, %lld stalls (%lld ms), %lld blocks cancelled",
+        (long long)st.bytes_fetched, (long long)st.stalls, (long long)(st.stall_ns / 1000000),
+        (long long)st.cancelled);
+    {
+        std::lock_guard<std::mutex> lock(g_readahead_mutex);
+        g_streams.erase(s);
+        g_closed_stats.bytes_fetched += st.bytes_fetched;
+        g_closed_stats.bytes_delivered += st.bytes_delivered;
+        g_closed_stats.fetch_ns += st.fetch_ns;
+        g_closed_stats.stalls += st.stalls;
+        g_closed_stats.stall_ns += st.stall_ns;
+        g_closed_stats.cancelled += st.cancelled;
+    }
+    delete s;
+}
+
+static ReadaheadSource *open_source(const char *url, int threads)
+{
+    if (!strncmp(url, "fdstream://", 11)) {
+        int fd = fcntl(atoi(url + 11), F_DUPFD_CLOEXEC, 0);
+        return fd >= 0 ? new FileReadaheadSource(fd) : NULL;
+    }
+    if (!strncmp(url, "file://", 7) || url[0] == '/') {
+        const char *path = url[0] == '/' ? url : url + 7;
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        return fd >= 0 ? new FileReadaheadSource(fd) : NULL;
+    }
+
+    AvioReadaheadSource *src = new AvioReadaheadSource(url, threads);
+    if (!src->open()) {
+        delete src;
+        return NULL;
+    }
+    return src;
+}
+
+static int ra_open(void *user_data, char *uri, mpv_stream_cb_info *info)
+{
+    const char *prefix = READAHEAD_PROTOCOL "://";
+    if (strncmp(uri, prefix, strlen(prefix)) != 0)
+        return MPV_ERROR_LOADING_FAILED;
+    const char *url = uri + strlen(prefix);
+
+    readahead_config cfg;
+    {
+        std::lock_guard<std::mutex> lock(g_readahead_mutex);
+        cfg = g_config;
+    }
+
+    ReadaheadSource *src = open_source(url, cfg.threads);
+    if (!src) {
+        ALOGE("readahead | Cannot open %s", url);
+        return MPV_ERROR_LOADING_FAILED;
+    }
+
+    ReadaheadStream *s = new ReadaheadStream(src, cfg);
+    {
+        std::lock_guard<std::mutex> lock(g_readahead_mutex);
+        g_streams.insert(s);
+    }
+
+    info->cookie = s;
+    info->read_fn = ra_read;
+    info->seek_fn = ra_seek;
+    info->size_fn = ra_size;
+    info->close_fn = ra_close;
+    info->cancel_fn = ra_cancel;
+    return 0;
+}
+
+void readahead_register(mpv_handle *mpv)
+{
+    int result = mpv_stream_cb_add_ro(mpv, READAHEAD_PROTOCOL, NULL, ra_open);
+    if (result < 0)
+        ALOGE("mpv_stream_cb_add_ro(%s) returned error %s", READAHEAD_PROTOCOL, mpv_error_string(result));
+}
+
+// Applies to streams opened afterwards.
+jni_func(void, setReadaheadConfig, jint threads, jint block_size, jint max_depth, jlong cache_bytes) {
+    STATS_SCOPE("MPVLib.setReadaheadConfig");
+    if (threads < 1 || threads > 16 || block_size < 16 * 1024 || max_depth < 1 || cache_bytes < block_size) {
+        ALOGE("readahead | Invalid configuration");
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(g_readahead_mutex);
+    g_config.threads = threads;
+    g_config.block_size = block_size;
+    g_config.max_depth = max_depth;
+    g_config.min_depth = std::min(g_config.min_depth, max_depth);
+    g_config.cache_blocks = cache_bytes / block_size;
+}
+
+// Totals over all streams so far:
+// [bytes fetched, bytes delivered, fetch ns, stalls, stall ns, cancelled blocks,
+//  largest current prefetch depth, open streams]
+jni_func(jlongArray, getReadaheadStats) {
+    STATS_SCOPE("MPVLib.getReadaheadStats");
+    readahead_stats total;
+    jlong open_streams;
+    {
+        std::lock_guard<std::mutex> lock(g_readahead_mutex);
+        total = g_closed_stats;
+        total.depth = 0;
+        for (ReadaheadStream *s : g_streams) {
+            readahead_stats st = s->stats();
+            total.bytes_fetched += st.bytes_fetched;
+            total.bytes_delivered += st.bytes_delivered;
+            total.fetch_ns += st.fetch_ns;
+            total.stalls += st.stalls;
+            total.stall_ns += st.stall_ns;
+            total.cancelled += st.cancelled;
+            total.depth = std::max(total.depth, st.depth);
+        }
+        open_streams = g_streams.size();
+    }
+
+    jlong values[] = {
+        total.bytes_fetched, total.bytes_delivered, total.fetch_ns, total.stalls,
+        total.stall_ns, total.cancelled, total.depth, open_streams,
+    };
+    jlongArray jvalues = env->NewLongArray(sizeof(values) / sizeof(values[0]));
+    if (jvalues)
+        env->SetLongArrayRegion(jvalues, 0, sizeof(values) / sizeof(values[0]), values);
+    return jvalues;
+}
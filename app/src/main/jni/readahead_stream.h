@@ -0,0 +1,7 @@
+#pragma once
+
+struct mpv_handle;
+
+// Registers the "readahead://<url>" protocol, which reads <url> through a
+// pool of parallel block fetchers (see readahead.h).
+void readahead_register(mpv_handle *mpv);
@@ -1,10 +1,14 @@
 #include <jni.h>
+#include <condition_variable>
+#include <mutex>
 
 #include <mpv/client.h>
 
 #include "jni_utils.h"
 #include "log.h"
 #include "globals.h"
+#include "render.h"
+#include "stats.h"
 
 extern "C" {
     jni_func(void, attachSurface, jobject surface_);
@@ -13,9 +17,22 @@ extern "C" {
 
 static jobject surface;
 
+// Surfaces taken from destroyed instances whose VO may still hold them
+static int g_releasing;
+static std::mutex g_release_mutex;
+static std::condition_variable g_release_cv;
+
 jni_func(void, attachSurface, jobject surface_) {
+    STATS_SCOPE("MPVLib.attachSurface");
     CHECK_MPV_INIT();
 
+    {
+        // the same Surface cannot be connected to two VOs; this only waits
+        // when attaching right after destroyAsync()
+        std::unique_lock<std::mutex> lock(g_release_mutex);
+        g_release_cv.wait(lock, [] { return g_releasing == 0; });
+    }
+
     surface = env->NewGlobalRef(surface_);
     if (!surface)
         die("invalid surface provided");
@@ -26,6 +43,7 @@ jni_func(void, attachSurface, jobject surface_) {
 }
 
 jni_func(void, detachSurface) {
+    STATS_SCOPE("MPVLib.detachSurface");
     CHECK_MPV_INIT();
 
     int64_t wid = 0;
@@ -36,3 +54,29 @@ jni_func(void, detachSurface) {
     env->DeleteGlobalRef(surface);
     surface = NULL;
 }
+
+jobject render_take_surface() {
+    jobject taken = surface;
+    surface = NULL;
+    if (taken) {
+        std::lock_guard<std::mutex> lock(g_release_mutex);
+        g_releasing++;
+    }
+    return taken;
+}
+
+void render_release_surface(JNIEnv *env, mpv_handle *mpv, jobject surface) {
+    if (!surface)
+        return;
+    // synchronous, the VO lets go of the Surface before this returns
+    mpv_set_property_string(mpv, "vo", "null");
+    mpv_set_property_string(mpv, "force-window", "no");
+    int64_t wid = 0;
+    mpv_set_option(mpv, "wid", MPV_FORMAT_INT64, &wid);
+
+    if (env)
+        env->DeleteGlobalRef(surface);
+    std::lock_guard<std::mutex> lock(g_release_mutex);
+    g_releasing--;
+    g_release_cv.notify_all();
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <jni.h>
+
+struct mpv_handle;
+
+// Hands over the attached Surface's global reference (NULL if none), so the
+// next instance can attach a Surface while this one is still terminating.
+// attachSurface() waits until it is released.
+jobject render_take_surface();
+
+// Shuts down mpv's video output, which blocks until it let go of `surface`,
+// then drops the reference. For the teardown thread, not the UI thread; must
+// be called for every surface taken, also with a NULL env.
+void render_release_surface(JNIEnv *env, mpv_handle *mpv, jobject surface);
@@ -0,0 +1,498 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <jni.h>
+#include <mpv/client.h>
+
+#include "content_id.h"
+#include "jni_utils.h"
+#include "log.h"
+#include "node.h"
+#include "probe.h"
+#include "stats.h"
+#include "thumbnail.h"
+#include "trace.h"
+#include "workpool.h"
+
+extern "C" {
+    jni_func(jboolean, startLibraryScan, jobjectArray jroots, jstring jindex, jstring jthumbs, jint thumb_size, jint batch_size);
+    jni_func(void, cancelLibraryScan);
+};
+
+// ============================================================================
+// MEDIA LIBRARY SCANNER
+// Walks the library roots one directory level at a time, listing every
+// directory of a level in parallel with raw getdents64 and stat'ing only files
+// with a media extension. Size and mtime are compared against the index from
+// the previous scan; only new or changed files are probed and thumbnailed.
+// Results reach MPVLib.scanBatch() in batches from the scanner thread.
+// ============================================================================
+
+#define INDEX_MAGIC "MPVSCN"
+static const uint32_t INDEX_VERSION = 2;
+static const int THUMB_QUALITY = 80;
+
+struct scan_ctx {
+    JavaVM *vm;
+    std::vector<std::string> roots;
+    std::string index_path;
+    std::string thumb_dir;      // empty: no thumbnails
+    int thumb_size;
+    int batch_size;
+};
+
+struct scan_file {
+    std::string path;
+    int64_t size, mtime;        // mtime in ns
+};
+
+struct index_entry {
+    int64_t size, mtime;
+    std::string id;             // content id, names the thumbnail
+};
+
+static std::atomic<bool> g_scan_running(false);
+static std::atomic<bool> g_scan_cancel(false);
+
+// sorted, compared case-insensitively
+static const char *MEDIA_EXTENSIONS[] = {
+    "3gp", "aac", "ac3", "aif", "aiff", "amr", "ape", "asf", "avi", "dts",
+    "flac", "flv", "m2ts", "m4a", "m4v", "mka", "mkv", "mov", "mp2", "mp3",
+    "mp4", "mpeg", "mpg", "mts", "oga", "ogg", "ogv", "opus", "rm", "rmvb",
+    "ts", "vob", "wav", "webm", "wma", "wmv", "wv",
+};
+
+static bool is_media_name(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    if (!dot || dot == name)
+        return false;
+    const char *ext = dot + 1;
+    return std::binary_search(std::begin(MEDIA_EXTENSIONS), std::end(MEDIA_EXTENSIONS), ext,
+        [] (const char *a, const char *b) { return strcasecmp(a, b) < 0; });
+}
+
+// ----------------------------------------------------------------------------
+// walking
+// ----------------------------------------------------------------------------
+
+struct dir_listing {
+    std::vector<std::string> subdirs;
+    std::vector<scan_file> files;
+};
+
+static inline std::string join_path(const std::string &dir, const char *name)
+{
+    return dir.back() == '/' ? dir + name : dir + "/" + name;
+}
+
+static void list_dir(const std::string &dir, dir_listing *out)
+{
+    TRACE_SCOPE("scanner:list-dir");
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    std::vector<std::string> subdirs;
+    std::vector<scan_file> files;
+    bool nomedia = false;
+    alignas(struct dirent64) char buf[32768];
+    long n;
+    while (!nomedia && (n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+        for (long off = 0; off < n; ) {
+            const struct dirent64 *d = reinterpret_cast<const struct dirent64*>(buf + off);
+            off += d->d_reclen;
+            const char *name = d->d_name;
+            if (!strcmp(name, ".nomedia")) {
+                // same convention as MediaStore, the whole tree is hidden
+                nomedia = true;
+                break;
+            }
+            if (name[0] == '.')
+                continue;
+
+            unsigned char type = d->d_type;
+            struct stat st;
+            if (type == DT_UNKNOWN) {
+                // some file systems leave it to us
+                if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+                    continue;
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : S_ISLNK(st.st_mode) ? DT_LNK : DT_UNKNOWN;
+            }
+            if (type == DT_DIR) {
+                subdirs.push_back(join_path(dir, name));
+                continue;
+            }
+            if ((type != DT_REG && type != DT_LNK) || !is_media_name(name))
+                continue;
+            // symlinked files are followed, symlinked directories are not
+            if (fstatat(fd, name, &st, 0) != 0)
+                continue;
+            if (S_ISREG(st.st_mode)) {
+                scan_file f;
+                f.path = join_path(dir, name);
+                f.size = st.st_size;
+                f.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+                files.push_back(f);
+            }
+        }
+    }
+    close(fd);
+
+    if (!nomedia) {
+        out->subdirs.swap(subdirs);
+        out->files.swap(files);
+    }
+}
+
+// Returns false if cancelled before the walk completed.
+static bool walk(const std::vector<std::string> &roots, std::vector<scan_file> *files)
+{
+    TRACE_SCOPE("scanner:walk");
+    std::vector<std::string> level = roots;
+    std::unordered_set<std::string> seen(roots.begin(), roots.end());
+    while (!level.empty()) {
+        if (g_scan_cancel)
+            return false;
+        std::vector<dir_listing> listings(level.size());
+        workpool_run(level.size(), [&](size_t i) {
+            if (!g_scan_cancel)
+                list_dir(level[i], &listings[i]);
+        });
+        level.clear();
+        for (dir_listing &l : listings) {
+            for (std::string &d : l.subdirs) {
+                // overlapping roots
+                if (seen.insert(d).second)
+                    level.push_back(d);
+            }
+            files->insert(files->end(), l.files.begin(), l.files.end());
+        }
+    }
+    return !g_scan_cancel;
+}
+
+// ----------------------------------------------------------------------------
+// index
+// ----------------------------------------------------------------------------
+
+static void load_index(const std::string &path, std::unordered_map<std::string, index_entry> *index)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f)
+        return;
+    char magic[sizeof(INDEX_MAGIC)];
+    uint32_t version, count;
+    if (fread(magic, sizeof(magic), 1, f) != 1 || memcmp(magic, INDEX_MAGIC, sizeof(magic)) ||
+            fread(&version, sizeof(version), 1, f) != 1 || version != INDEX_VERSION ||
+            fread(&count, sizeof(count), 1, f) != 1) {
+        fclose(f);
+        return;
+    }
+    index->reserve(std::min<uint32_t>(count, 1 << 20));
+    std::string name;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t len;
+        index_entry e;
+        if (fread(&len, sizeof(len), 1, f) != 1 || len > PATH_MAX)
+            break;
+        name.resize(len);
+        if ((len && fread(&name[0], len, 1, f) != 1) ||
+                fread(&e.size, sizeof(e.size), 1, f) != 1 || fread(&e.mtime, sizeof(e.mtime), 1, f) != 1 ||
+                fread(&len, sizeof(len), 1, f) != 1 || len > PATH_MAX)
+            break;
+        e.id.resize(len);
+        if (len && fread(&e.id[0], len, 1, f) != 1)
+            break;
+        (*index)[name] = e;
+    }
+    fclose(f);
+}
+
+static void save_index(const std::string &path, const std::unordered_map<std::string, index_entry> &index)
+{
+    TRACE_SCOPE("scanner:save-index");
+    std::string tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f) {
+        ALOGE("Scanner | Failed to write %s: %s", tmp.c_str(), strerror(errno));
+        return;
+    }
+    uint32_t count = index.size();
+    bool ok = fwrite(INDEX_MAGIC, sizeof(INDEX_MAGIC), 1, f) == 1 &&
+        fwrite(&INDEX_VERSION, sizeof(INDEX_VERSION), 1, f) == 1 &&
+        fwrite(&count, sizeof(count), 1, f) == 1;
+    for (auto it = index.begin(); ok && it != index.end(); ++it) {
+        uint32_t len = it->first.size();
+        ok = fwrite(&len, sizeof(len), 1, f) == 1 &&
+            (!len || fwrite(it->first.data(), len, 1, f) == 1) &&
+            fwrite(&it->second.size, sizeof(it->second.size), 1, f) == 1 &&
+            fwrite(&it->second.mtime, sizeof(it->second.mtime), 1, f) == 1;
+        len = it->second.id.size();
+        ok = ok && fwrite(&len, sizeof(len), 1, f) == 1 &&
+            (!len || fwrite(it->second.id.data(), len, 1, f) == 1);
+    }
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        ALOGE("Scanner | Failed to write %s", path.c_str());
+        unlink(tmp.c_str());
+    }
+}
+
+static bool under_roots(const std::string &path, const std::vector<std::string> &roots)
+{
+    for (const std::string &root : roots) {
+        // only "/" keeps its trailing slash
+        size_t len = root.back() == '/' ? root.size() - 1 : root.size();
+        if (path.size() > len + 1 && path[len] == '/' && !path.compare(0, len, root, 0, len))
+            return true;
+    }
+    return false;
+}
+
+// ----------------------------------------------------------------------------
+// processing
+// ----------------------------------------------------------------------------
+
+// named by content, so moved and copied files share one, and by size, so
+// changing it does not serve the old ones
+static std::string thumb_path(const std::string &dir, const std::string &id, int size)
+{
+    return dir + "/" + id + "-" + std::to_string(size) + ".jpg";
+}
+
+struct scan_result {
+    std::string id;
+    bool probed;
+    media_info info;
+    std::string thumbnail;
+};
+
+static void process_file(const scan_ctx *ctx, const scan_file &f, scan_result *out)
+{
+    content_id(f.path, &out->id);
+    out->probed = probe_media_cached(f.path, &out->info);
+    if (!out->probed || ctx->thumb_dir.empty() || out->info.video_codec.empty() || out->id.empty())
+        return;
+    std::string path = thumb_path(ctx->thumb_dir, out->id, ctx->thumb_size);
+    if (access(path.c_str(), F_OK) == 0) {
+        out->thumbnail = path;
+        return;
+    }
+    // a bit in, past intros and fades from black
+    double position = out->info.duration > 0 ? std::min(out->info.duration * 0.1, 60.0) : 0;
+    bgra_image image;
+    // hardware decoders are few, a scan would hold all of them at once
+    if (!decode_thumbnail(f.path.c_str(), position, ctx->thumb_size, false, &image))
+        return;
+    if (encode_jpeg(image, path.c_str(), THUMB_QUALITY))
+        out->thumbnail = path;
+}
+
+static void send_batch(JNIEnv *env, const std::vector<mpv_node> &nodes)
+{
+    if (!env || nodes.empty())
+        return;
+    jobjectArray arr = env->NewObjectArray(nodes.size(), mpv_MPVNode, NULL);
+    if (!arr) {
+        env->ExceptionClear();
+        return;
+    }
+    for (size_t i = 0; i < nodes.size(); i++) {
+        jobject node = mpv_node_to_jobject(env, &nodes[i]);
+        env->SetObjectArrayElement(arr, i, node);
+        env->DeleteLocalRef(node);
+    }
+    env->CallStaticVoidMethod(mpv_MPVLib, mpv_MPVLib_scanBatch, arr);
+    if (env->ExceptionCheck())
+        env->ExceptionClear();
+    env->DeleteLocalRef(arr);
+}
+
+static void *scan_thread(void *arg)
+{
+    pthread_setname_np(pthread_self(), "scanner");
+    scan_ctx *ctx = static_cast<scan_ctx*>(arg);
+    JNIEnv *env = NULL;
+    if (!acquire_jni_env(ctx->vm, &env))
+        env = NULL;
+
+    std::unordered_map<std::string, index_entry> index;
+    load_index(ctx->index_path, &index);
+
+    std::vector<scan_file> files;
+    bool complete = walk(ctx->roots, &files);
+    ALOGV("Scanner | %zu files, %zu indexed%s", files.size(), index.size(), complete ? "" : " (cancelled)");
+
+    std::vector<const scan_file*> changed;
+    std::vector<bool> is_new;
+    std::unordered_set<std::string> present;
+    for (const scan_file &f : files) {
+        present.insert(f.path);
+        auto it = index.find(f.path);
+        if (it != index.end() && it->second.size == f.size && it->second.mtime == f.mtime)
+            continue;
+        changed.push_back(&f);
+        is_new.push_back(it == index.end());
+    }
+
+    // an interrupted walk did not see everything, so nothing counts as removed
+    int removed = 0;
+    std::vector<std::string> removed_ids;
+    if (complete) {
+        node_builder b;
+        std::vector<mpv_node> nodes;
+        for (auto it = index.begin(); it != index.end(); ) {
+            if (present.count(it->first) || !under_roots(it->first, ctx->roots)) {
+                ++it;
+                continue;
+            }
+            if (!it->second.id.empty())
+                removed_ids.push_back(it->second.id);
+            nodes.push_back(b.map({ { "path", b.str(it->first) }, { "status", b.str("removed") } }));
+            it = index.erase(it);
+            removed++;
+            if (nodes.size() >= (size_t)ctx->batch_size) {
+                send_batch(env, nodes);
+                nodes.clear();
+            }
+        }
+        send_batch(env, nodes);
+    }
+
+    size_t done = 0;
+    for (size_t start = 0; start < changed.size() && !g_scan_cancel; start += ctx->batch_size) {
+        size_t count = std::min(changed.size() - start, (size_t)ctx->batch_size);
+        std::vector<scan_result> results(count);
+        workpool_run(count, [&](size_t i) {
+            if (!g_scan_cancel)
+                process_file(ctx, *changed[start + i], &results[i]);
+        });
+        if (g_scan_cancel)
+            break;
+
+        node_builder b;
+        std::vector<mpv_node> nodes;
+        for (size_t i = 0; i < count; i++) {
+            const scan_file &f = *changed[start + i];
+            const scan_result &r = results[i];
+            std::vector<node_builder::entry> e = {
+                { "path", b.str(f.path) },
+                { "status", b.str(is_new[start + i] ? "new" : "changed") },
+                { "size", b.num(f.size) },
+                { "mtime", b.num(f.mtime / 1000000) },
+                { "info", media_info_to_node(b, r.probed ? &r.info : NULL) },
+            };
+            if (!r.id.empty())
+                e.push_back({ "id", b.str(r.id) });
+            if (!r.thumbnail.empty())
+                e.push_back({ "thumbnail", b.str(r.thumbnail) });
+            nodes.push_back(b.map(e));
+            // files that fail to probe are recorded too, retried only once they change
+            index_entry &ie = index[f.path];
+            ie.size = f.size;
+            ie.mtime = f.mtime;
+            ie.id = r.id;
+        }
+        send_batch(env, nodes);
+        done += count;
+    }
+    // thumbnails of removed files, unless a moved or copied file still uses them
+    if (!ctx->thumb_dir.empty() && !removed_ids.empty()) {
+        std::unordered_set<std::string> used;
+        for (const auto &it : index)
+            used.insert(it.second.id);
+        for (const std::string &id : removed_ids) {
+            if (!used.count(id))
+                unlink(thumb_path(ctx->thumb_dir, id, ctx->thumb_size).c_str());
+        }
+    }
+    probe_cache_save();
+    save_index(ctx->index_path, index);
+
+    bool cancelled = g_scan_cancel;
+    ALOGV("Scanner | Done, %zu of %zu changed files processed, %d removed", done, changed.size(), removed);
+    if (env) {
+        env->CallStaticVoidMethod(mpv_MPVLib, mpv_MPVLib_scanFinished,
+            (jint)files.size(), (jint)done, (jint)removed, (jboolean)cancelled);
+        if (env->ExceptionCheck())
+            env->ExceptionClear();
+        ctx->vm->DetachCurrentThread();
+    }
+
+    delete ctx;
+    g_scan_running = false;
+    return NULL;
+}
+
+// Scans the roots in the background, false if a scan is already running.
+jni_func(jboolean, startLibraryScan, jobjectArray jroots, jstring jindex, jstring jthumbs, jint thumb_size, jint batch_size) {
+    STATS_SCOPE("MPVLib.startLibraryScan");
+    init_methods_cache(env);
+    if (g_scan_running.exchange(true)) {
+        ALOGV("Scanner | Already running");
+        return JNI_FALSE;
+    }
+    g_scan_cancel = false;
+
+    scan_ctx *ctx = new scan_ctx();
+    env->GetJavaVM(&ctx->vm);
+    int count = env->GetArrayLength(jroots);
+    for (int i = 0; i < count; i++) {
+        jstring jroot = (jstring)env->GetObjectArrayElement(jroots, i);
+        const char *root = env->GetStringUTFChars(jroot, NULL);
+        std::string r = root;
+        env->ReleaseStringUTFChars(jroot, root);
+        env->DeleteLocalRef(jroot);
+        while (r.size() > 1 && r.back() == '/')
+            r.pop_back();
+        if (!r.empty())
+            ctx->roots.push_back(r);
+    }
+    const char *index = env->GetStringUTFChars(jindex, NULL);
+    ctx->index_path = index;
+    env->ReleaseStringUTFChars(jindex, index);
+    if (jthumbs) {
+        const char *thumbs = env->GetStringUTFChars(jthumbs, NULL);
+        ctx->thumb_dir = thumbs;
+        env->ReleaseStringUTFChars(jthumbs, thumbs);
+    }
+    ctx->thumb_size = std::max(16, std::min((int)thumb_size, 4096));
+    ctx->batch_size = std::max(1, (int)batch_size);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, &attr, scan_thread, ctx) != 0) {
+        ALOGE("Scanner | Failed to start thread");
+        pthread_attr_destroy(&attr);
+        delete ctx;
+        g_scan_running = false;
+        return JNI_FALSE;
+    }
+    pthread_attr_destroy(&attr);
+    return JNI_TRUE;
+}
+
+// Stops the running scan after the current batch; files processed so far are
+// kept in the index.
+jni_func(void, cancelLibraryScan) {
+    STATS_SCOPE("MPVLib.cancelLibraryScan");
+    g_scan_cancel = true;
+}
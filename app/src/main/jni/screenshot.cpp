@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <strings.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <jni.h>
+#include <mpv/client.h>
+
+extern "C" {
+    #include <libavcodec/avcodec.h>
+    #include <libswscale/swscale.h>
+};
+
+#include "jni_utils.h"
+#include "globals.h"
+#include "log.h"
+#include "stats.h"
+#include "thumbnail.h"
+#include "trace.h"
+
+extern "C" {
+    jni_func(jboolean, captureScreenshot, jstring jpath, jint quality, jboolean subtitles);
+};
+
+// ============================================================================
+// BACKGROUND SCREENSHOTS
+// Takes the unscaled frame with screenshot-raw, which only copies it, and
+// leaves encoding and writing to a low-priority thread, so the mpv core is
+// not blocked for the length of a JPEG or PNG encode as with
+// screenshot-to-file. Captures queue up to a memory budget and finish in
+// order, each reported to MPVLib.screenshotSaved().
+// ============================================================================
+
+static const int ENCODER_NICE = 10;
+// frames waiting to be encoded; 4K frames are 32 MiB each
+static const size_t MAX_QUEUED_BYTES = 160 << 20;
+
+struct still_job {
+    std::string path;
+    int quality;
+    raw_frame frame;
+};
+
+static std::mutex g_still_mutex;
+static std::condition_variable g_still_cv;
+static std::deque<still_job*> g_stills;
+static size_t g_queued_bytes;
+static bool g_encoder_started;
+
+static inline size_t frame_bytes(const raw_frame &frame)
+{
+    return (size_t)frame.stride * frame.h;
+}
+
+static bool is_png(const std::string &path)
+{
+    size_t dot = path.rfind('.');
+    return dot != std::string::npos && !strcasecmp(path.c_str() + dot, ".png");
+}
+
+static bool encode_still(const still_job &job, AVPacket *packet)
+{
+    bool png = is_png(job.path);
+    const AVCodec *codec = avcodec_find_encoder(png ? AV_CODEC_ID_PNG : AV_CODEC_ID_MJPEG);
+    if (!codec) {
+        ALOGE("Screenshot | %s encoder not available", png ? "PNG" : "MJPEG");
+        return false;
+    }
+    AVCodecContext *enc = avcodec_alloc_context3(codec);
+    AVFrame *frame = av_frame_alloc();
+    if (!enc || !frame) {
+        av_frame_free(&frame);
+        avcodec_free_context(&enc);
+        return false;
+    }
+
+    enc->width = job.frame.w;
+    enc->height = job.frame.h;
+    enc->time_base = AVRational{1, 25};
+    if (png) {
+        // the 4th byte of bgr0 is padding, not alpha
+        enc->pix_fmt = AV_PIX_FMT_RGB24;
+    } else {
+        enc->pix_fmt = AV_PIX_FMT_YUVJ420P;
+        enc->color_range = AVCOL_RANGE_JPEG;
+        // same mapping as encode_jpeg(): 1..100 onto qscale 31..2
+        enc->flags |= AV_CODEC_FLAG_QSCALE;
+        enc->global_quality = FF_QP2LAMBDA * (2 + (100 - av_clip(job.quality, 1, 100)) * 29 / 99);
+    }
+    frame->width = enc->width;
+    frame->height = enc->height;
+    frame->format = enc->pix_fmt;
+    frame->quality = enc->global_quality;
+
+    bool ok = avcodec_open2(enc, codec, NULL) >= 0 && av_frame_get_buffer(frame, 0) >= 0;
+    struct SwsContext *sws_ctx = !ok ? NULL : sws_getContext(job.frame.w, job.frame.h, AV_PIX_FMT_BGR0,
+        job.frame.w, job.frame.h, enc->pix_fmt, SWS_BICUBIC, NULL, NULL, NULL);
+    if (sws_ctx) {
+        TRACE_SCOPE("screenshot:convert");
+        const uint8_t *src_data[4] = { job.frame.data };
+        int src_linesize[4] = { job.frame.stride };
+        sws_scale(sws_ctx, src_data, src_linesize, 0, job.frame.h, frame->data, frame->linesize);
+        sws_freeContext(sws_ctx);
+    }
+    {
+        TRACE_SCOPE("screenshot:encode");
+        ok = sws_ctx && avcodec_send_frame(enc, frame) >= 0 && avcodec_receive_packet(enc, packet) >= 0;
+    }
+    if (!ok)
+        ALOGE("Screenshot | Failed to encode %dx%d frame", job.frame.w, job.frame.h);
+
+    av_frame_free(&frame);
+    avcodec_free_context(&enc);
+    return ok;
+}
+
+static bool save_still(const still_job &job)
+{
+    AVPacket *packet = av_packet_alloc();
+    bool ok = packet && encode_still(job, packet);
+    if (ok) {
+        // written next to the target and renamed, readers never see half a file
+        std::string tmp = job.path + ".tmp";
+        FILE *f = fopen(tmp.c_str(), "wb");
+        ok = f && fwrite(packet->data, 1, packet->size, f) == (size_t)packet->size;
+        ok = f && fclose(f) == 0 && ok;
+        ok = ok && rename(tmp.c_str(), job.path.c_str()) == 0;
+        if (!ok) {
+            ALOGE("Screenshot | Failed to write %s", job.path.c_str());
+            unlink(tmp.c_str());
+        }
+    }
+    av_packet_free(&packet);
+    return ok;
+}
+
+static void encoder_loop()
+{
+    pthread_setname_np(pthread_self(), "screenshot");
+    // playback first; a still may take a moment longer
+    setpriority(PRIO_PROCESS, gettid(), ENCODER_NICE);
+    JNIEnv *env = NULL;
+    if (!acquire_jni_env(g_vm, &env))
+        env = NULL;
+
+    std::unique_lock<std::mutex> lock(g_still_mutex);
+    while (1) {
+        g_still_cv.wait(lock, [] { return !g_stills.empty(); });
+        still_job *job = g_stills.front();
+        g_stills.pop_front();
+        lock.unlock();
+
+        bool ok = save_still(*job);
+        ALOGV("Screenshot | %s %s", job->path.c_str(), ok ? "saved" : "failed");
+        size_t bytes = frame_bytes(job->frame);
+        mpv_free_node_contents(&job->frame.node);
+        if (env) {
+            jstring jpath = env->NewStringUTF(job->path.c_str());
+            env->CallStaticVoidMethod(mpv_MPVLib, mpv_MPVLib_screenshotSaved, jpath, (jboolean)ok);
+            if (env->ExceptionCheck())
+                env->ExceptionClear();
+            env->DeleteLocalRef(jpath);
+        }
+        delete job;
+
+        lock.lock();
+        g_queued_bytes -= bytes;
+    }
+}
+
+// Saves the current video frame at full resolution to path, as PNG if it ends
+// in .png and as JPEG otherwise. Returns once the frame is copied; false if
+// there is no frame or the queue is full.
+jni_func(jboolean, captureScreenshot, jstring jpath, jint quality, jboolean subtitles) {
+    STATS_SCOPE("MPVLib.captureScreenshot");
+    CHECK_MPV_INIT();
+    init_methods_cache(env);
+
+    still_job *job = new still_job();
+    if (!grab_raw_frame(g_mpv, subtitles ? "subtitles" : "video", &job->frame)) {
+        delete job;
+        return JNI_FALSE;
+    }
+    const char *path = env->GetStringUTFChars(jpath, NULL);
+    job->path = path;
+    env->ReleaseStringUTFChars(jpath, path);
+    job->quality = quality;
+
+    size_t bytes = frame_bytes(job->frame);
+    std::lock_guard<std::mutex> lock(g_still_mutex);
+    // always take one, however large
+    if (g_queued_bytes > 0 && g_queued_bytes + bytes > MAX_QUEUED_BYTES) {
+        ALOGW("Screenshot | Queue full, dropping %s", job->path.c_str());
+        mpv_free_node_contents(&job->frame.node);
+        delete job;
+        return JNI_FALSE;
+    }
+    g_queued_bytes += bytes;
+    g_stills.push_back(job);
+    if (!g_encoder_started) {
+        std::thread(encoder_loop).detach();
+        g_encoder_started = true;
+    }
+    g_still_cv.notify_one();
+    return JNI_TRUE;
+}
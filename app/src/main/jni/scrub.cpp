@@ -0,0 +1,245 @@
+#include <jni.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+#include <mpv/client.h>
+
+#include "jni_utils.h"
+#include "globals.h"
+#include "log.h"
+#include "stats.h"
+
+extern "C" {
+    jni_func(void, scrubBegin);
+    jni_func(void, scrubTo, jdouble position);
+    jni_func(void, scrubEnd, jdouble position);
+    jni_func(jdoubleArray, getScrubStats);
+};
+
+// ============================================================================
+// SEEK SCRUBBING
+// Seekbar drags produce targets far faster than mpv can seek. Targets are
+// coalesced latest-wins and sent as asynchronous keyframe seeks with at most
+// one in flight, so the picture follows the finger instead of working through
+// a backlog. Releasing the bar issues a final exact seek.
+//
+// Runs on its own client handle: a seek counts as done when that handle sees
+// the PLAYBACK_RESTART it caused, which is when the new frame is up. Restarts
+// only count once the seek command itself was answered, earlier ones belong
+// to seeks from someone else.
+// ============================================================================
+
+// give up waiting for a restart after this long (e.g. seek in a file without video)
+static const int64_t SEEK_TIMEOUT_NS = 1000000000LL;
+
+struct scrub_stats {
+    int64_t issued;
+    int64_t completed;
+    int64_t coalesced;      // targets replaced before they were sent
+    int64_t latency_ns;     // summed over completed drag seeks
+    int64_t max_latency_ns;
+    int64_t final_latency_ns;
+    int64_t begin_ns, end_ns;
+};
+
+struct scrub_ctx {
+    mpv_handle *mpv;
+    mpv_handle *owner; // core the client was made for
+    std::atomic<bool> stop;
+    // below protected by g_scrub_mutex
+    bool pending;
+    bool pending_exact;
+    double target;
+    scrub_stats st;
+};
+
+static scrub_ctx *g_scrub;
+static std::mutex g_scrub_mutex;
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static bool send_seek(mpv_handle *mpv, uint64_t id, double target, bool exact)
+{
+    char pos[32];
+    snprintf(pos, sizeof(pos), "%.6f", target);
+    const char *cmd[] = { "seek", pos, exact ? "absolute+exact" : "absolute+keyframes", NULL };
+    int result = mpv_command_async(mpv, id, cmd);
+    if (result < 0) {
+        ALOGE("Scrub | seek returned error %s", mpv_error_string(result));
+        return false;
+    }
+    return true;
+}
+
+static void *scrub_thread(void *arg)
+{
+    pthread_setname_np(pthread_self(), "scrub");
+    scrub_ctx *ctx = static_cast<scrub_ctx*>(arg);
+    bool in_flight = false, in_flight_exact = false, replied = false;
+    uint64_t seek_id = 0;
+    int64_t sent_at = 0;
+
+    while (1) {
+        mpv_event *ev = mpv_wait_event(ctx->mpv, in_flight ? 0.1 : -1);
+        if (ev->event_id == MPV_EVENT_SHUTDOWN || ctx->stop)
+            break;
+
+        bool done = false;
+        if (in_flight) {
+            if (ev->event_id == MPV_EVENT_COMMAND_REPLY && ev->reply_userdata == seek_id) {
+                replied = true;
+                done = ev->error < 0;
+            } else if (ev->event_id == MPV_EVENT_PLAYBACK_RESTART && replied) {
+                done = true;
+            } else if (now_ns() - sent_at > SEEK_TIMEOUT_NS) {
+                done = true;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(g_scrub_mutex);
+        if (done) {
+            int64_t latency = now_ns() - sent_at;
+            in_flight = false;
+            ctx->st.completed++;
+            if (in_flight_exact) {
+                ctx->st.final_latency_ns = latency;
+            } else {
+                ctx->st.latency_ns += latency;
+                ctx->st.max_latency_ns = std::max(ctx->st.max_latency_ns, latency);
+            }
+        }
+        if (!in_flight && ctx->pending) {
+            ctx->pending = false;
+            in_flight_exact = ctx->pending_exact;
+            if (send_seek(ctx->mpv, ++seek_id, ctx->target, in_flight_exact)) {
+                in_flight = true;
+                replied = false;
+                sent_at = now_ns();
+                ctx->st.issued++;
+            }
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(g_scrub_mutex);
+        if (g_scrub == ctx)
+            g_scrub = NULL;
+    }
+    mpv_destroy(ctx->mpv);
+    delete ctx;
+    return NULL;
+}
+
+// must be called with g_scrub_mutex held
+static scrub_ctx *get_scrub()
+{
+    if (g_scrub && g_scrub->owner != g_mpv) {
+        // the core was recreated; the old client goes away with its thread
+        g_scrub->stop = true;
+        mpv_wakeup(g_scrub->mpv);
+        g_scrub = NULL;
+    }
+    if (g_scrub || !g_mpv)
+        return g_scrub;
+
+    scrub_ctx *ctx = new scrub_ctx();
+    ctx->owner = g_mpv;
+    ctx->stop = false;
+    ctx->mpv = mpv_create_client(g_mpv, "scrub");
+    if (!ctx->mpv) {
+        ALOGE("Scrub | Failed to create client");
+        delete ctx;
+        return NULL;
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, &attr, scrub_thread, ctx) != 0)
+        die("thread create failed");
+    pthread_attr_destroy(&attr);
+
+    g_scrub = ctx;
+    return ctx;
+}
+
+static void post_target(double position, bool exact)
+{
+    std::lock_guard<std::mutex> lock(g_scrub_mutex);
+    scrub_ctx *ctx = get_scrub();
+    if (!ctx)
+        return;
+    if (ctx->pending)
+        ctx->st.coalesced++;
+    ctx->pending = true;
+    ctx->pending_exact = exact;
+    ctx->target = position;
+    mpv_wakeup(ctx->mpv);
+}
+
+// Starts a drag and resets the statistics.
+jni_func(void, scrubBegin) {
+    STATS_SCOPE("MPVLib.scrubBegin");
+    CHECK_MPV_INIT();
+    std::lock_guard<std::mutex> lock(g_scrub_mutex);
+    scrub_ctx *ctx = get_scrub();
+    if (!ctx)
+        return;
+    memset(&ctx->st, 0, sizeof(ctx->st));
+    ctx->st.begin_ns = now_ns();
+}
+
+jni_func(void, scrubTo, jdouble position) {
+    STATS_SCOPE("MPVLib.scrubTo");
+    CHECK_MPV_INIT();
+    post_target(position, false);
+}
+
+jni_func(void, scrubEnd, jdouble position) {
+    STATS_SCOPE("MPVLib.scrubEnd");
+    CHECK_MPV_INIT();
+    post_target(position, true);
+    std::lock_guard<std::mutex> lock(g_scrub_mutex);
+    if (g_scrub)
+        g_scrub->st.end_ns = now_ns();
+}
+
+// [seeks issued, seeks completed, targets coalesced, seeks/s during the drag,
+//  mean and max drag seek latency in ms, exact seek latency in ms]
+jni_func(jdoubleArray, getScrubStats) {
+    STATS_SCOPE("MPVLib.getScrubStats");
+    scrub_stats st;
+    {
+        std::lock_guard<std::mutex> lock(g_scrub_mutex);
+        if (!g_scrub)
+            return NULL;
+        st = g_scrub->st;
+    }
+
+    int64_t drag_ns = (st.end_ns ? st.end_ns : now_ns()) - st.begin_ns;
+    // the exact seek is only part of the counters once it completed
+    int64_t drag_seeks = st.completed - (st.final_latency_ns ? 1 : 0);
+    jdouble values[] = {
+        (jdouble)st.issued,
+        (jdouble)st.completed,
+        (jdouble)st.coalesced,
+        drag_ns > 0 ? drag_seeks * 1e9 / drag_ns : 0,
+        drag_seeks > 0 ? st.latency_ns / 1e6 / drag_seeks : 0,
+        st.max_latency_ns / 1e6,
+        st.final_latency_ns / 1e6,
+    };
+    jdoubleArray jvalues = env->NewDoubleArray(sizeof(values) / sizeof(values[0]));
+    if (jvalues)
+        env->SetDoubleArrayRegion(jvalues, 0, sizeof(values) / sizeof(values[0]), values);
+    return jvalues;
+}
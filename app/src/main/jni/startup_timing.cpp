@@ -0,0 +1,60 @@
+#include "startup_timing.h"
+
+#include <time.h>
+#include <mutex>
+
+static int64_t g_stage_ns[STARTUP_STAGE_COUNT];
+static const void *g_owner;
+static std::mutex g_timing_mutex;
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void startup_timing_reset()
+{
+    std::lock_guard<std::mutex> lock(g_timing_mutex);
+    g_owner = NULL;
+    for (int i = 0; i < STARTUP_STAGE_COUNT; i++)
+        g_stage_ns[i] = 0;
+    g_stage_ns[STARTUP_CREATE] = now_ns();
+}
+
+void startup_timing_bind(const void *owner)
+{
+    std::lock_guard<std::mutex> lock(g_timing_mutex);
+    g_owner = owner;
+}
+
+void startup_timing_mark(const void *owner, startup_stage stage)
+{
+    int64_t t = now_ns();
+    std::lock_guard<std::mutex> lock(g_timing_mutex);
+    if (!owner || owner != g_owner)
+        return;
+    if (stage == STARTUP_LOADFILE) {
+        // every loadfile starts a new time-to-first-frame measurement
+        for (int i = STARTUP_LOADFILE + 1; i < STARTUP_STAGE_COUNT; i++)
+            g_stage_ns[i] = 0;
+        g_stage_ns[stage] = t;
+        return;
+    }
+    // only the first occurrence counts, later seeks also cause PLAYBACK_RESTART
+    if (stage == STARTUP_PLAYBACK_RESTART && !g_stage_ns[STARTUP_FILE_LOADED])
+        return;
+    if (!g_stage_ns[stage])
+        g_stage_ns[stage] = t;
+}
+
+void startup_timing_get(int64_t out[STARTUP_STAGE_COUNT])
+{
+    std::lock_guard<std::mutex> lock(g_timing_mutex);
+    int64_t base = g_stage_ns[STARTUP_CREATE];
+    for (int i = 0; i < STARTUP_STAGE_COUNT; i++) {
+        int64_t t = g_stage_ns[i];
+        out[i] = (base && t) ? t - base : -1;
+    }
+}
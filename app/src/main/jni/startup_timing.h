@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+// Timestamps of the player startup path, from create() until the first frame
+// of a loaded file is shown. Kept free of JNI and Android dependencies so that
+// the host benchmark harness in benchmarks/startup can link it as well.
+
+enum startup_stage {
+    STARTUP_CREATE = 0,
+    STARTUP_INIT,
+    STARTUP_LOADFILE,
+    STARTUP_FILE_LOADED,
+    STARTUP_PLAYBACK_RESTART,
+    STARTUP_STAGE_COUNT
+};
+
+// start a new measurement, marks STARTUP_CREATE; nothing is recorded until
+// startup_timing_bind() names the instance it is for
+void startup_timing_reset();
+// measure the instance `owner` (its mpv_handle); marks of any other instance,
+// e.g. one still terminating after destroyAsync(), are ignored
+void startup_timing_bind(const void *owner);
+// record the given stage for owner unless it was already reached in this
+// measurement; STARTUP_LOADFILE always records and clears the stages following it
+void startup_timing_mark(const void *owner, startup_stage stage);
+// fills out[] with nanoseconds since STARTUP_CREATE, or -1 for stages not reached yet
+void startup_timing_get(int64_t out[STARTUP_STAGE_COUNT]);
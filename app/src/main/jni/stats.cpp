@@ -0,0 +1,272 @@
+#include <jni.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <mpv/client.h>
+
+#include "jni_utils.h"
+#include "node.h"
+#include "stats.h"
+
+extern "C" {
+    jni_func(jobject, getNativeStats, jboolean reset);
+};
+
+// ============================================================================
+// HISTOGRAMS
+// Buckets are log-linear: each power of two is split into SUB_BUCKETS linear
+// steps, so a bucket is never wider than a quarter of its lower bound.
+// Durations from 0 up to 2^MAX_EXPONENT ns (~18 minutes) are covered.
+// ============================================================================
+
+static const int SUB_BITS = 2;
+static const int SUB_BUCKETS = 1 << SUB_BITS;
+static const int MAX_EXPONENT = 40;
+static const int BUCKETS = (MAX_EXPONENT - SUB_BITS + 1) * SUB_BUCKETS;
+static const int MAX_METRICS = 512;
+
+struct histogram {
+    // single writer (the owning thread), relaxed atomics make merging safe
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum_ns;
+    std::atomic<uint64_t> max_ns;
+    std::atomic<uint64_t> buckets[BUCKETS];
+};
+
+struct thread_stats {
+    std::atomic<histogram*> hists[MAX_METRICS];
+};
+
+// merged view of a metric
+struct snapshot {
+    uint64_t count, sum_ns, max_ns;
+    uint64_t buckets[BUCKETS];
+};
+
+static std::mutex g_stats_mutex;
+static std::unordered_map<std::string, int> g_metric_ids;
+static std::vector<std::string> g_metric_names;
+static std::vector<thread_stats*> g_threads; // never freed, counts outlive their thread
+static std::vector<thread_stats*> g_idle;    // left by exited threads, reused by new ones
+static std::vector<snapshot> g_baseline;     // subtracted after a reset
+
+static thread_local thread_stats *t_stats;
+
+// hands the thread's block back on exit, so short-lived threads do not each
+// leave one behind; the next thread keeps adding to the same counts
+struct thread_stats_owner {
+    thread_stats *stats = nullptr;
+
+    ~thread_stats_owner() {
+        if (!stats)
+            return;
+        std::lock_guard<std::mutex> lock(g_stats_mutex);
+        g_idle.push_back(stats);
+    }
+};
+
+static thread_local thread_stats_owner t_owner;
+
+static int bucket_of(uint64_t ns)
+{
+    if (ns < (uint64_t)SUB_BUCKETS)
+        return (int)ns;
+    int e = 63 - __builtin_clzll(ns);
+    if (e >= MAX_EXPONENT)
+        return BUCKETS - 1;
+    return (e - SUB_BITS + 1) * SUB_BUCKETS + (int)((ns >> (e - SUB_BITS)) & (SUB_BUCKETS - 1));
+}
+
+// midpoint of a bucket's range
+static uint64_t bucket_value(int bucket)
+{
+    if (bucket < SUB_BUCKETS)
+        return bucket;
+    int e = bucket / SUB_BUCKETS + SUB_BITS - 1;
+    uint64_t width = 1ULL << (e - SUB_BITS);
+    uint64_t lower = (1ULL << e) + (bucket % SUB_BUCKETS) * width;
+    return lower + width / 2;
+}
+
+int64_t stats_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int stats_metric(const char *name)
+{
+    std::lock_guard<std::mutex> lock(g_stats_mutex);
+    auto it = g_metric_ids.find(name);
+    if (it != g_metric_ids.end())
+        return it->second;
+    if (g_metric_names.size() >= MAX_METRICS)
+        return -1;
+    int id = g_metric_names.size();
+    g_metric_names.push_back(name);
+    g_metric_ids[name] = id;
+    return id;
+}
+
+static histogram *thread_histogram(int metric)
+{
+    if (!t_stats) {
+        std::lock_guard<std::mutex> lock(g_stats_mutex);
+        if (!g_idle.empty()) {
+            t_stats = g_idle.back();
+            g_idle.pop_back();
+        } else {
+            t_stats = new thread_stats();
+            for (int i = 0; i < MAX_METRICS; i++)
+                t_stats->hists[i].store(NULL, std::memory_order_relaxed);
+            g_threads.push_back(t_stats);
+        }
+        t_owner.stats = t_stats;
+    }
+    histogram *h = t_stats->hists[metric].load(std::memory_order_relaxed);
+    if (!h) {
+        h = new histogram();
+        h->count = 0;
+        h->sum_ns = 0;
+        h->max_ns = 0;
+        for (int i = 0; i < BUCKETS; i++)
+            h->buckets[i] = 0;
+        // release: readers must see the zeroed counters
+        t_stats->hists[metric].store(h, std::memory_order_release);
+    }
+    return h;
+}
+
+void stats_record(int metric, int64_t ns)
+{
+    if (metric < 0 || metric >= MAX_METRICS)
+        return;
+    uint64_t v = ns > 0 ? (uint64_t)ns : 0;
+    histogram *h = thread_histogram(metric);
+    // only this thread writes, so load + store instead of read-modify-write
+    h->count.store(h->count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    h->sum_ns.store(h->sum_ns.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    if (v > h->max_ns.load(std::memory_order_relaxed))
+        h->max_ns.store(v, std::memory_order_relaxed);
+    std::atomic<uint64_t> &b = h->buckets[bucket_of(v)];
+    b.store(b.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+// must be called with g_stats_mutex held
+static void merge(int metric, snapshot *out)
+{
+    memset(out, 0, sizeof(*out));
+    for (thread_stats *t : g_threads) {
+        histogram *h = t->hists[metric].load(std::memory_order_acquire);
+        if (!h)
+            continue;
+        out->count += h->count.load(std::memory_order_relaxed);
+        out->sum_ns += h->sum_ns.load(std::memory_order_relaxed);
+        uint64_t max = h->max_ns.load(std::memory_order_relaxed);
+        if (max > out->max_ns)
+            out->max_ns = max;
+        for (int i = 0; i < BUCKETS; i++)
+            out->buckets[i] += h->buckets[i].load(std::memory_order_relaxed);
+    }
+}
+
+static uint64_t percentile(const snapshot &s, double p)
+{
+    uint64_t target = (uint64_t)(p * s.count + 0.5);
+    if (target < 1)
+        target = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += s.buckets[i];
+        if (seen >= target)
+            return std::min(bucket_value(i), s.max_ns);
+    }
+    return s.max_ns;
+}
+
+// ============================================================================
+// JNI
+// ============================================================================
+
+// Returns a map of metric name -> {count, mean, p50, p90, p99, max} with times in
+// nanoseconds, covering metrics recorded since the last reset. The max is only
+// meaningful before the first reset, it is not kept per reset period.
+jni_func(jobject, getNativeStats, jboolean reset) {
+    init_methods_cache(env);
+
+    std::vector<std::string> names;
+    std::vector<snapshot> snaps;
+    {
+        std::lock_guard<std::mutex> lock(g_stats_mutex);
+        names = g_metric_names;
+        snaps.resize(names.size());
+        g_baseline.resize(names.size());
+        for (size_t i = 0; i < names.size(); i++) {
+            snapshot current;
+            merge(i, &current);
+            snapshot &base = g_baseline[i];
+            snaps[i] = current;
+            snaps[i].count -= base.count;
+            snaps[i].sum_ns -= base.sum_ns;
+            for (int b = 0; b < BUCKETS; b++)
+                snaps[i].buckets[b] -= base.buckets[b];
+            if (reset)
+                base = current;
+        }
+    }
+
+    static const char *field_names[] = { "count", "mean", "p50", "p90", "p99", "max" };
+    const int fields = sizeof(field_names) / sizeof(field_names[0]);
+
+    std::vector<const char*> keys;
+    std::vector<mpv_node> entries;
+    std::vector<mpv_node_list> lists;
+    std::vector<mpv_node> values;
+    for (size_t i = 0; i < names.size(); i++) {
+        if (snaps[i].count)
+            keys.push_back(names[i].c_str());
+    }
+    // sized up front, the nodes point into these vectors
+    entries.resize(keys.size());
+    lists.resize(keys.size());
+    values.resize(keys.size() * fields);
+
+    size_t n = 0;
+    for (size_t i = 0; i < names.size(); i++) {
+        const snapshot &s = snaps[i];
+        if (!s.count)
+            continue;
+        int64_t field_values[] = {
+            (int64_t)s.count, (int64_t)(s.sum_ns / s.count),
+            (int64_t)percentile(s, 0.50), (int64_t)percentile(s, 0.90),
+            (int64_t)percentile(s, 0.99), (int64_t)s.max_ns,
+        };
+        mpv_node *v = &values[n * fields];
+        for (int f = 0; f < fields; f++) {
+            v[f].format = MPV_FORMAT_INT64;
+            v[f].u.int64 = field_values[f];
+        }
+        lists[n].num = fields;
+        lists[n].values = v;
+        lists[n].keys = const_cast<char**>(field_names);
+        entries[n].format = MPV_FORMAT_NODE_MAP;
+        entries[n].u.list = &lists[n];
+        n++;
+    }
+
+    mpv_node_list root_list;
+    root_list.num = keys.size();
+    root_list.values = entries.data();
+    root_list.keys = const_cast<char**>(keys.data());
+    mpv_node root;
+    root.format = MPV_FORMAT_NODE_MAP;
+    root.u.list = &root_list;
+    return mpv_node_to_jobject(env, &root);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+// Always-on latency metrics. Every metric is a log-linear histogram of
+// nanosecond durations; each thread records into its own copy without locks
+// and getNativeStats() merges them on demand.
+
+// Id of the metric called name, registering it on first use. Returns -1 once
+// the table is full, recording into -1 is a no-op.
+int stats_metric(const char *name);
+void stats_record(int metric, int64_t ns);
+int64_t stats_now_ns();
+
+class stats_scope {
+public:
+    explicit stats_scope(int metric) : metric(metric), start_ns(stats_now_ns()) {}
+    ~stats_scope() { stats_record(metric, stats_now_ns() - start_ns); }
+
+private:
+    stats_scope(const stats_scope&) = delete;
+    stats_scope &operator=(const stats_scope&) = delete;
+
+    int metric;
+    int64_t start_ns;
+};
+
+#define STATS_CONCAT_(a, b) a##b
+#define STATS_CONCAT(a, b) STATS_CONCAT_(a, b)
+// Times the rest of the enclosing scope. name must be constant for the call site,
+// it is looked up only once.
+#define STATS_SCOPE(name) \
+    static const int STATS_CONCAT(stats_id_, __LINE__) = stats_metric(name); \
+    stats_scope STATS_CONCAT(stats_scope_, __LINE__)(STATS_CONCAT(stats_id_, __LINE__))
@@ -0,0 +1,342 @@
+#include "storyboard.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <dirent.h>
+#include <algorithm>
+#include <list>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "log.h"
+
+struct StoryboardEntry {
+    double interval;
+    std::map<int64_t, storyboard_frame> frames; // by slot
+    size_t bytes;
+    bool dirty;
+    std::list<std::string>::iterator lru_pos;
+};
+
+static std::unordered_map<std::string, StoryboardEntry> g_entries;
+static std::list<std::string> g_lru; // most recently used first
+// keys without a file in g_dir, so capture ticks do not keep trying to open it
+static std::unordered_set<std::string> g_missing;
+static std::string g_dir;
+static size_t g_bytes = 0;
+static size_t g_budget = 32 * 1024 * 1024;
+static std::mutex g_storyboard_mutex;
+
+static const char FILE_MAGIC[4] = { 'M', 'P', 'V', 'S' };
+static const uint8_t FILE_VERSION = 1;
+// longest file worth loading slots for; shorter capture intervals than
+// setTrickplayCapture allows are rejected outright
+static const double MAX_DURATION = 48 * 3600;
+static const double MIN_INTERVAL = 1.0;
+
+static int64_t slot_of(double interval, double position)
+{
+    return (int64_t)floor(position / interval);
+}
+
+// FNV-1a, only used to derive stable file names from cache keys
+static uint64_t hash_key(const std::string &key)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : key) {
+        h ^= c;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static std::string file_for(const std::string &key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.sb", (unsigned long long)hash_key(key));
+    return g_dir + name;
+}
+
+// The on-disk format is written in host byte order, which is little-endian on
+// every ABI we ship: magic, u8 version, f64 interval, u32 key length, key,
+// u32 frame count, count * { f64 position, u16 width, u16 height, BGRA pixels }
+
+static bool save_entry(const std::string &key, const StoryboardEntry &e)
+{
+    std::string path = file_for(key);
+    std::string tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f)
+        return false;
+
+    uint32_t key_len = key.size(), count = e.frames.size();
+    bool ok = fwrite(FILE_MAGIC, sizeof(FILE_MAGIC), 1, f) == 1 &&
+        fwrite(&FILE_VERSION, 1, 1, f) == 1 &&
+        fwrite(&e.interval, sizeof(e.interval), 1, f) == 1 &&
+        fwrite(&key_len, sizeof(key_len), 1, f) == 1 &&
+        fwrite(key.data(), 1, key_len, f) == key_len &&
+        fwrite(&count, sizeof(count), 1, f) == 1;
+    for (auto it = e.frames.begin(); ok && it != e.frames.end(); ++it) {
+        const storyboard_frame &fr = it->second;
+        uint16_t w = fr.width, h = fr.height;
+        ok = fwrite(&fr.position, sizeof(fr.position), 1, f) == 1 &&
+            fwrite(&w, sizeof(w), 1, f) == 1 &&
+            fwrite(&h, sizeof(h), 1, f) == 1 &&
+            fwrite(fr.pixels.data(), 1, fr.pixels.size(), f) == fr.pixels.size();
+    }
+    ok = (fclose(f) == 0) && ok;
+
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        ALOGW("Storyboard | Failed to write %s", path.c_str());
+        remove(tmp.c_str());
+        return false;
+    }
+    g_missing.erase(key);
+    return true;
+}
+
+static bool load_entry(const std::string &key, StoryboardEntry *e)
+{
+    FILE *f = fopen(file_for(key).c_str(), "rb");
+    if (!f)
+        return false;
+    long size = -1;
+    if (fseek(f, 0, SEEK_END) == 0)
+        size = ftell(f);
+    rewind(f);
+
+    char magic[4];
+    uint8_t version;
+    uint32_t key_len, count;
+    std::string stored_key;
+    bool ok = size >= 0 &&
+        fread(magic, sizeof(magic), 1, f) == 1 && !memcmp(magic, FILE_MAGIC, sizeof(magic)) &&
+        fread(&version, 1, 1, f) == 1 && version == FILE_VERSION &&
+        fread(&e->interval, sizeof(e->interval), 1, f) == 1 &&
+        e->interval >= MIN_INTERVAL && e->interval <= MAX_DURATION &&
+        fread(&key_len, sizeof(key_len), 1, f) == 1 && key_len == key.size();
+    if (ok) {
+        stored_key.resize(key_len);
+        ok = fread(&stored_key[0], 1, key_len, f) == key_len && stored_key == key &&
+            fread(&count, sizeof(count), 1, f) == 1 &&
+            count <= (uint32_t)(MAX_DURATION / e->interval) + 1;
+    }
+    e->bytes = 0;
+    for (uint32_t i = 0; ok && i < count; i++) {
+        storyboard_frame fr;
+        uint16_t w, h;
+        ok = fread(&fr.position, sizeof(fr.position), 1, f) == 1 &&
+            fread(&w, sizeof(w), 1, f) == 1 &&
+            fread(&h, sizeof(h), 1, f) == 1 && w > 0 && h > 0 &&
+            w <= STORYBOARD_MAX_DIMENSION && h <= STORYBOARD_MAX_DIMENSION &&
+            fr.position >= 0 && fr.position <= MAX_DURATION;
+        if (!ok)
+            break;
+        fr.width = w;
+        fr.height = h;
+        // a damaged file must not make us allocate more than it holds
+        long pos = ftell(f);
+        size_t len = (size_t)w * h * 4;
+        ok = pos >= 0 && (uint64_t)(size - pos) >= len;
+        if (!ok)
+            break;
+        fr.pixels.resize(len);
+        ok = fread(fr.pixels.data(), 1, fr.pixels.size(), f) == fr.pixels.size();
+        if (ok) {
+            e->bytes += fr.pixels.size();
+            e->frames[slot_of(e->interval, fr.position)] = std::move(fr);
+        }
+    }
+    fclose(f);
+
+    if (!ok) {
+        e->frames.clear();
+        e->bytes = 0;
+    }
+    e->dirty = false;
+    return ok;
+}
+
+// must be called with g_storyboard_mutex held
+static void evict_to_budget()
+{
+    while (g_bytes > g_budget && g_lru.size() > 1) {
+        const std::string key = g_lru.back();
+        auto it = g_entries.find(key);
+        if (it->second.dirty && !g_dir.empty())
+            save_entry(key, it->second);
+        g_bytes -= it->second.bytes;
+        g_entries.erase(it);
+        g_lru.pop_back();
+    }
+}
+
+// must be called with g_storyboard_mutex held
+static StoryboardEntry *lookup(const std::string &key, bool load)
+{
+    auto it = g_entries.find(key);
+    if (it != g_entries.end()) {
+        g_lru.splice(g_lru.begin(), g_lru, it->second.lru_pos);
+        return &it->second;
+    }
+    if (!load || g_dir.empty() || g_missing.count(key))
+        return NULL;
+
+    StoryboardEntry e;
+    if (!load_entry(key, &e)) {
+        g_missing.insert(key);
+        return NULL;
+    }
+    g_lru.push_front(key);
+    e.lru_pos = g_lru.begin();
+    g_bytes += e.bytes;
+    StoryboardEntry *res = &(g_entries[key] = std::move(e));
+    evict_to_budget();
+    return res;
+}
+
+void storyboard_put(const std::string &key, double interval, double position,
+    int width, int height, const uint8_t *bgra, int stride)
+{
+    if (interval < MIN_INTERVAL || width <= 0 || height <= 0 ||
+            width > STORYBOARD_MAX_DIMENSION || height > STORYBOARD_MAX_DIMENSION)
+        return;
+
+    std::lock_guard<std::mutex> lock(g_storyboard_mutex);
+
+    StoryboardEntry *e = lookup(key, true);
+    if (e && e->interval != interval) {
+        // capture interval changed, the old slots don't line up anymore
+        g_bytes -= e->bytes;
+        e->frames.clear();
+        e->bytes = 0;
+    }
+    if (!e) {
+        g_lru.push_front(key);
+        StoryboardEntry &ne = g_entries[key];
+        ne.bytes = 0;
+        ne.lru_pos = g_lru.begin();
+        e = &ne;
+    }
+    e->interval = interval;
+
+    storyboard_frame &fr = e->frames[slot_of(interval, position)];
+    e->bytes -= fr.pixels.size();
+    g_bytes -= fr.pixels.size();
+    fr.position = position;
+    fr.width = width;
+    fr.height = height;
+    fr.pixels.resize((size_t)width * height * 4);
+    for (int y = 0; y < height; y++)
+        memcpy(&fr.pixels[(size_t)y * width * 4], bgra + (size_t)y * stride, (size_t)width * 4);
+    e->bytes += fr.pixels.size();
+    g_bytes += fr.pixels.size();
+    e->dirty = true;
+
+    evict_to_budget();
+}
+
+bool storyboard_has(const std::string &key, double interval, double position)
+{
+    std::lock_guard<std::mutex> lock(g_storyboard_mutex);
+
+    StoryboardEntry *e = lookup(key, true);
+    return e && e->interval == interval && e->frames.count(slot_of(interval, position));
+}
+
+bool storyboard_get(const std::string &key, double position, double max_distance, storyboard_frame *out)
+{
+    std::lock_guard<std::mutex> lock(g_storyboard_mutex);
+
+    StoryboardEntry *e = lookup(key, true);
+    if (!e || e->frames.empty())
+        return false;
+
+    // candidates are the slot itself and its neighbours
+    int64_t slot = slot_of(e->interval, position);
+    const storyboard_frame *best = NULL;
+    for (int64_t s = slot - 1; s <= slot + 1; s++) {
+        auto it = e->frames.find(s);
+        if (it == e->frames.end())
+            continue;
+        if (!best || fabs(it->second.position - position) < fabs(best->position - position))
+            best = &it->second;
+    }
+    if (!best || fabs(best->position - position) > std::min(e->interval, max_distance))
+        return false;
+
+    *out = *best;
+    return true;
+}
+
+void storyboard_flush(const std::string &key)
+{
+    std::lock_guard<std::mutex> lock(g_storyboard_mutex);
+
+    auto it = g_entries.find(key);
+    if (it == g_entries.end() || !it->second.dirty || g_dir.empty())
+        return;
+    if (save_entry(key, it->second))
+        it->second.dirty = false;
+}
+
+void storyboard_set_dir(const std::string &dir)
+{
+    std::lock_guard<std::mutex> lock(g_storyboard_mutex);
+    g_dir = dir;
+    g_missing.clear();
+}
+
+void storyboard_set_budget(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(g_storyboard_mutex);
+    g_budget = bytes;
+    evict_to_budget();
+}
+
+size_t storyboard_budget()
+{
+    std::lock_guard<std::mutex> lock(g_storyboard_mutex);
+    return g_budget;
+}
+
+size_t storyboard_bytes()
+{
+    std::lock_guard<std::mutex> lock(g_storyboard_mutex);
+    return g_bytes;
+}
+
+// storyboard files as named by file_for(), with leftovers of failed writes
+static bool is_storyboard_file(const char *name)
+{
+    size_t len = strlen(name);
+    if (len < 19 || strncmp(name + 16, ".sb", 3) || (len != 19 && strcmp(name + 19, ".tmp")))
+        return false;
+    return strspn(name, "0123456789abcdef") == 16;
+}
+
+void storyboard_clear()
+{
+    std::lock_guard<std::mutex> lock(g_storyboard_mutex);
+    g_entries.clear();
+    g_lru.clear();
+    g_missing.clear();
+    g_bytes = 0;
+
+    if (g_dir.empty())
+        return;
+    DIR *dir = opendir(g_dir.c_str());
+    if (!dir)
+        return;
+    while (struct dirent *de = readdir(dir)) {
+        if (!is_storyboard_file(de->d_name))
+            continue;
+        std::string path = g_dir + "/" + de->d_name;
+        if (remove(path.c_str()) != 0)
+            ALOGW("Storyboard | Failed to remove %s", path.c_str());
+    }
+    closedir(dir);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Per-file cache of small preview frames ("storyboard"), filled while a file
+// plays and used to answer seekbar thumbnail requests without decoding.
+// Frames are stored as packed BGRA. The cache is bounded by a byte budget and
+// can optionally be persisted to a directory. Files are keyed by
+// content_cache_key() (see content_id.h).
+
+// longest side of a stored frame, as allowed by setTrickplayCapture
+static const int STORYBOARD_MAX_DIMENSION = 1024;
+
+struct storyboard_frame {
+    double position;
+    int width, height;
+    std::vector<uint8_t> pixels;
+};
+
+// store a frame for the given file, taken at a capture interval of `interval` seconds
+void storyboard_put(const std::string &key, double interval, double position,
+    int width, int height, const uint8_t *bgra, int stride);
+// whether a frame for the slot containing `position` exists already
+bool storyboard_has(const std::string &key, double interval, double position);
+// find the frame closest to `position`, no further than one capture interval
+// or `max_distance` seconds away, whichever is less
+bool storyboard_get(const std::string &key, double position, double max_distance, storyboard_frame *out);
+// write the file's frames to the cache directory, if one is set
+void storyboard_flush(const std::string &key);
+
+void storyboard_set_dir(const std::string &dir);
+void storyboard_set_budget(size_t bytes);
+size_t storyboard_budget();
+size_t storyboard_bytes();
+// drop every storyboard, including the files in the cache directory
+void storyboard_clear();
@@ -0,0 +1,525 @@
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <jni.h>
+
+extern "C" {
+    #include <libavformat/avformat.h>
+    #include <libavcodec/avcodec.h>
+};
+
+#include "content_id.h"
+#include "jni_utils.h"
+#include "log.h"
+#include "node.h"
+#include "stats.h"
+#include "trace.h"
+#include "workpool.h"
+
+extern "C" {
+    jni_func(jint, indexSubtitles, jstring jdir, jobjectArray jpaths);
+    jni_func(jobjectArray, searchSubtitles, jstring jdir, jobjectArray jpaths, jstring jquery, jint max_hits);
+};
+
+// ============================================================================
+// SUBTITLE SEARCH
+// Text subtitle streams (SRT, ASS, WebVTT, mov_text, ...) are demuxed and
+// decoded without playback, with audio and video discarded at the demuxer,
+// and stripped of styling. Each file gets a flat inverted index (sorted terms
+// pointing at cue numbers) that is mmap'd for searches, so a query over a
+// library only touches the pages of the terms it looks up. Indexes are named
+// by content id and so stay valid when files are moved or renamed.
+// ============================================================================
+
+#define INDEX_MAGIC "MPVSUB"
+static const uint32_t INDEX_VERSION = 2;
+// longer words are cut, queries for them still match by prefix
+static const size_t MAX_TERM_LEN = 32;
+
+struct index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t id;            // content id of the indexed file
+    uint32_t cue_count;
+    uint32_t term_count;
+    uint32_t postings_count;
+    uint32_t strings_size;
+};
+
+// cues are sorted by start time, so cue numbers are too
+struct index_cue {
+    uint32_t start;         // ms from the start of the file
+    uint32_t end;
+    uint32_t text;
+    uint32_t stream;
+};
+
+// terms are sorted, each with an ascending list of cue numbers
+struct index_term {
+    uint32_t str;
+    uint32_t first;
+    uint32_t count;
+};
+
+struct cue {
+    uint32_t start, end;
+    int stream;
+    std::string text;
+};
+
+// ----------------------------------------------------------------------------
+// extraction
+// ----------------------------------------------------------------------------
+
+static bool is_text_codec(enum AVCodecID id)
+{
+    const AVCodecDescriptor *desc = avcodec_descriptor_get(id);
+    return desc && desc->type == AVMEDIA_TYPE_SUBTITLE && (desc->props & AV_CODEC_PROP_TEXT_SUB);
+}
+
+static void append_space(std::string *out)
+{
+    if (!out->empty() && out->back() != ' ')
+        out->push_back(' ');
+}
+
+// Drops {\override} and <html> tags and ASS escapes, folds whitespace.
+static void append_plain(const char *s, std::string *out)
+{
+    for (; *s; s++) {
+        if (*s == '{' || *s == '<') {
+            const char *close = strchr(s, *s == '{' ? '}' : '>');
+            if (close) {
+                s = close;
+                continue;
+            }
+        }
+        if (*s == '\\' && (s[1] == 'N' || s[1] == 'n' || s[1] == 'h')) {
+            append_space(out);
+            s++;
+        } else if (*s == '\n' || *s == '\r' || *s == '\t' || *s == ' ') {
+            append_space(out);
+        } else {
+            out->push_back(*s);
+        }
+    }
+}
+
+// Decoded text subtitles come as ASS events:
+// ReadOrder,Layer,Style,Name,MarginL,MarginR,MarginV,Effect,Text
+static const char *ass_event_text(const char *event)
+{
+    for (int fields = 0; fields < 8; fields++) {
+        event = strchr(event, ',');
+        if (!event)
+            return NULL;
+        event++;
+    }
+    return event;
+}
+
+static std::string subtitle_text(const AVSubtitle *sub)
+{
+    std::string text;
+    for (unsigned i = 0; i < sub->num_rects; i++) {
+        const AVSubtitleRect *rect = sub->rects[i];
+        const char *s = rect->type == SUBTITLE_ASS && rect->ass ? ass_event_text(rect->ass) : rect->text;
+        if (s) {
+            append_space(&text);
+            append_plain(s, &text);
+        }
+    }
+    while (!text.empty() && text.back() == ' ')
+        text.pop_back();
+    return text;
+}
+
+// Cues of all text subtitle streams of path. False if it can't be opened.
+static bool extract_cues(const char *path, std::vector<cue> *cues)
+{
+    TRACE_SCOPE("subindex:extract");
+    AVFormatContext *fmt = NULL;
+    if (avformat_open_input(&fmt, path, NULL, NULL) < 0) {
+        ALOGV("SubIndex | Failed to open %s", path);
+        return false;
+    }
+
+    std::vector<AVCodecContext*> decoders(fmt->nb_streams, NULL);
+    bool any = false;
+    for (unsigned i = 0; i < fmt->nb_streams; i++) {
+        AVStream *st = fmt->streams[i];
+        st->discard = AVDISCARD_ALL;
+        if (!is_text_codec(st->codecpar->codec_id))
+            continue;
+        const AVCodec *codec = avcodec_find_decoder(st->codecpar->codec_id);
+        AVCodecContext *dec = codec ? avcodec_alloc_context3(codec) : NULL;
+        if (!dec)
+            continue;
+        dec->pkt_timebase = st->time_base;
+        if (avcodec_parameters_to_context(dec, st->codecpar) < 0 || avcodec_open2(dec, codec, NULL) < 0) {
+            ALOGV("SubIndex | No decoder for %s", avcodec_get_name(st->codecpar->codec_id));
+            avcodec_free_context(&dec);
+            continue;
+        }
+        decoders[i] = dec;
+        st->discard = AVDISCARD_DEFAULT;
+        any = true;
+    }
+
+    // times as mpv shows them, relative to the start of the file
+    int64_t start_ms = fmt->start_time != AV_NOPTS_VALUE ? fmt->start_time / 1000 : 0;
+    AVRational ms = { 1, 1000 };
+    AVPacket *packet = any ? av_packet_alloc() : NULL;
+    while (packet && av_read_frame(fmt, packet) >= 0) {
+        AVCodecContext *dec = packet->stream_index < (int)decoders.size() ? decoders[packet->stream_index] : NULL;
+        int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+        AVSubtitle sub;
+        int got = 0;
+        if (dec && pts != AV_NOPTS_VALUE && avcodec_decode_subtitle2(dec, &sub, &got, packet) >= 0 && got) {
+            AVRational tb = fmt->streams[packet->stream_index]->time_base;
+            int64_t at = av_rescale_q(pts, tb, ms) - start_ms;
+            int64_t end = at;
+            if (packet->duration > 0)
+                end = at + av_rescale_q(packet->duration, tb, ms);
+            else if (sub.end_display_time != UINT32_MAX && sub.end_display_time > sub.start_display_time)
+                end = at + sub.end_display_time;
+            at += sub.start_display_time;
+            cue c;
+            c.text = subtitle_text(&sub);
+            if (!c.text.empty() && at >= 0 && end <= UINT32_MAX) {
+                c.start = at;
+                c.end = std::max(at, end);
+                c.stream = packet->stream_index;
+                cues->push_back(std::move(c));
+            }
+            avsubtitle_free(&sub);
+        }
+        av_packet_unref(packet);
+    }
+    av_packet_free(&packet);
+    for (AVCodecContext *dec : decoders)
+        avcodec_free_context(&dec);
+    avformat_close_input(&fmt);
+
+    std::stable_sort(cues->begin(), cues->end(), [](const cue &a, const cue &b) {
+        return a.start < b.start;
+    });
+    // layered ASS (outlines, shadows) repeats the same line
+    cues->erase(std::unique(cues->begin(), cues->end(), [](const cue &a, const cue &b) {
+        return a.start == b.start && a.stream == b.stream && a.text == b.text;
+    }), cues->end());
+    return true;
+}
+
+// Lowercased words; bytes of UTF-8 sequences count as letters, so non-Latin
+// text is indexed by whitespace- and punctuation-separated runs.
+static void tokenize(const std::string &text, std::vector<std::string> *terms)
+{
+    std::string term;
+    for (size_t i = 0; i <= text.size(); i++) {
+        unsigned char c = i < text.size() ? text[i] : ' ';
+        if (c == '\'')
+            continue;  // don't -> dont
+        if (c >= 0x80 || isalnum(c)) {
+            if (term.size() < MAX_TERM_LEN)
+                term.push_back(tolower(c));
+        } else if (!term.empty()) {
+            terms->push_back(term);
+            term.clear();
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// index files
+// ----------------------------------------------------------------------------
+
+struct sub_index {
+    const uint8_t *map;
+    size_t size;
+    const index_header *header;
+    const index_cue *cues;
+    const index_term *terms;
+    const uint32_t *postings;
+    const char *strings;
+
+    const char *str(uint32_t offset) const {
+        return offset < header->strings_size ? strings + offset : "";
+    }
+};
+
+static std::string index_path(const std::string &dir, const std::string &id)
+{
+    return dir + "/" + id + ".sub";
+}
+
+// Opens the index of the file with content id, if there is one.
+static bool index_open(const std::string &dir, const std::string &id, sub_index *idx)
+{
+    int fd = open(index_path(dir, id).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(index_header))
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    idx->map = static_cast<const uint8_t*>(map);
+    idx->size = st.st_size;
+    idx->header = reinterpret_cast<const index_header*>(map);
+    const index_header *h = idx->header;
+    uint64_t cues_offset = sizeof(index_header);
+    uint64_t terms_offset = cues_offset + (uint64_t)h->cue_count * sizeof(index_cue);
+    uint64_t postings_offset = terms_offset + (uint64_t)h->term_count * sizeof(index_term);
+    uint64_t strings_offset = postings_offset + (uint64_t)h->postings_count * sizeof(uint32_t);
+    bool valid = !memcmp(h->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) && h->version == INDEX_VERSION &&
+        strings_offset + h->strings_size == idx->size &&
+        h->strings_size > 0 && idx->map[idx->size - 1] == '\0';
+    if (valid) {
+        idx->cues = reinterpret_cast<const index_cue*>(idx->map + cues_offset);
+        idx->terms = reinterpret_cast<const index_term*>(idx->map + terms_offset);
+        idx->postings = reinterpret_cast<const uint32_t*>(idx->map + postings_offset);
+        idx->strings = reinterpret_cast<const char*>(idx->map + strings_offset);
+        valid = id == idx->str(h->id);
+    }
+    if (!valid) {
+        munmap(map, st.st_size);
+        return false;
+    }
+    return true;
+}
+
+static void index_close(sub_index *idx)
+{
+    munmap(const_cast<uint8_t*>(idx->map), idx->size);
+}
+
+static bool write_full(int fd, const void *data, size_t len)
+{
+    const uint8_t *p = static_cast<const uint8_t*>(data);
+    while (len > 0) {
+        ssize_t r = write(fd, p, len);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        p += r;
+        len -= r;
+    }
+    return true;
+}
+
+static uint32_t pool_add(std::string *pool, const std::string &s)
+{
+    uint32_t offset = pool->size();
+    pool->append(s);
+    pool->push_back('\0');
+    return offset;
+}
+
+// Written to a temporary file and renamed, so readers never see a partial index.
+static bool index_write(const std::string &dir, const std::string &id, const std::vector<cue> &cues)
+{
+    std::map<std::string, std::vector<uint32_t>> words;
+    std::vector<std::string> tokens;
+    for (size_t i = 0; i < cues.size(); i++) {
+        tokens.clear();
+        tokenize(cues[i].text, &tokens);
+        for (const std::string &t : tokens) {
+            std::vector<uint32_t> &list = words[t];
+            if (list.empty() || list.back() != i)
+                list.push_back(i);
+        }
+    }
+
+    std::string pool(1, '\0');
+    std::vector<index_cue> icues;
+    icues.reserve(cues.size());
+    for (const cue &c : cues)
+        icues.push_back({ c.start, c.end, pool_add(&pool, c.text), (uint32_t)c.stream });
+    std::vector<index_term> iterms;
+    std::vector<uint32_t> postings;
+    iterms.reserve(words.size());
+    for (const auto &w : words) {
+        iterms.push_back({ pool_add(&pool, w.first), (uint32_t)postings.size(), (uint32_t)w.second.size() });
+        postings.insert(postings.end(), w.second.begin(), w.second.end());
+    }
+
+    index_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    h.version = INDEX_VERSION;
+    h.id = pool_add(&pool, id);
+    h.cue_count = icues.size();
+    h.term_count = iterms.size();
+    h.postings_count = postings.size();
+    h.strings_size = pool.size();
+
+    std::string file = index_path(dir, id), tmp = file + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+    bool ok = write_full(fd, &h, sizeof(h)) &&
+        write_full(fd, icues.data(), icues.size() * sizeof(index_cue)) &&
+        write_full(fd, iterms.data(), iterms.size() * sizeof(index_term)) &&
+        write_full(fd, postings.data(), postings.size() * sizeof(uint32_t)) &&
+        write_full(fd, pool.data(), pool.size());
+    ok = close(fd) == 0 && ok;
+    if (ok && rename(tmp.c_str(), file.c_str()) == 0)
+        return true;
+    unlink(tmp.c_str());
+    return false;
+}
+
+// Number of cues in the index of path, built first unless current; -1 if the
+// file can't be read.
+static int index_file(const std::string &dir, const std::string &path)
+{
+    std::string id;
+    if (!content_id(path, &id))
+        return -1;
+    sub_index idx;
+    if (index_open(dir, id, &idx)) {
+        int count = idx.header->cue_count;
+        index_close(&idx);
+        return count;
+    }
+
+    std::vector<cue> cues;
+    if (!extract_cues(path.c_str(), &cues))
+        return -1;
+    // also for files without text subtitles, so they aren't opened again
+    if (!index_write(dir, id, cues))
+        ALOGE("SubIndex | Failed to write index for %s: %s", path.c_str(), strerror(errno));
+    return cues.size();
+}
+
+// ----------------------------------------------------------------------------
+// search
+// ----------------------------------------------------------------------------
+
+// Ascending cue numbers with a term starting with prefix.
+static std::vector<uint32_t> lookup(const sub_index &idx, const std::string &prefix)
+{
+    const index_term *begin = idx.terms, *end = idx.terms + idx.header->term_count;
+    const index_term *t = std::lower_bound(begin, end, prefix, [&](const index_term &term, const std::string &s) {
+        return strcmp(idx.str(term.str), s.c_str()) < 0;
+    });
+    std::vector<uint32_t> result;
+    for (; t != end && !strncmp(idx.str(t->str), prefix.c_str(), prefix.size()); t++) {
+        if ((uint64_t)t->first + t->count > idx.header->postings_count)
+            break;
+        result.insert(result.end(), idx.postings + t->first, idx.postings + t->first + t->count);
+    }
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+// Cues of path containing every query word (as a prefix), in time order.
+static void search_file(const std::string &dir, const std::string &path, const std::vector<std::string> &words,
+    size_t max_hits, node_builder &nb, std::vector<mpv_node> *hits)
+{
+    std::string id;
+    sub_index idx;
+    if (!content_id(path, &id) || !index_open(dir, id, &idx))
+        return;
+
+    std::vector<uint32_t> matches = lookup(idx, words[0]);
+    for (size_t i = 1; i < words.size() && !matches.empty(); i++) {
+        std::vector<uint32_t> next = lookup(idx, words[i]), both;
+        std::set_intersection(matches.begin(), matches.end(), next.begin(), next.end(), std::back_inserter(both));
+        matches.swap(both);
+    }
+    for (uint32_t n : matches) {
+        if (hits->size() >= max_hits || n >= idx.header->cue_count)
+            break;
+        const index_cue &c = idx.cues[n];
+        hits->push_back(nb.map({
+            { "path", nb.str(path) },
+            { "time", nb.dbl(c.start / 1000.0) },
+            { "end", nb.dbl(c.end / 1000.0) },
+            { "stream", nb.num(c.stream) },
+            { "text", nb.str(idx.str(c.text)) },
+        }));
+    }
+    index_close(&idx);
+}
+
+static std::vector<std::string> string_array(JNIEnv *env, jobjectArray jarr)
+{
+    std::vector<std::string> out;
+    int len = env->GetArrayLength(jarr);
+    for (int i = 0; i < len; i++) {
+        jstring jstr = (jstring)env->GetObjectArrayElement(jarr, i);
+        const char *s = env->GetStringUTFChars(jstr, NULL);
+        out.push_back(s);
+        env->ReleaseStringUTFChars(jstr, s);
+        env->DeleteLocalRef(jstr);
+    }
+    return out;
+}
+
+// Indexes the text subtitles of paths into dir, on the worker pool, skipping
+// files whose index is current. Blocks; returns the number of files with
+// subtitle text.
+jni_func(jint, indexSubtitles, jstring jdir, jobjectArray jpaths) {
+    STATS_SCOPE("MPVLib.indexSubtitles");
+    const char *cdir = env->GetStringUTFChars(jdir, NULL);
+    std::string dir = cdir;
+    env->ReleaseStringUTFChars(jdir, cdir);
+    std::vector<std::string> paths = string_array(env, jpaths);
+    mkdir(dir.c_str(), 0700);
+
+    std::atomic<int> with_text(0);
+    workpool_run(paths.size(), [&](size_t i) {
+        if (index_file(dir, paths[i]) > 0)
+            with_text++;
+    });
+    return with_text;
+}
+
+// Hits for query among the indexed paths, as nodes with path, time and end
+// (seconds, ready for a seek), stream and text. Files not indexed or changed
+// since are skipped.
+jni_func(jobjectArray, searchSubtitles, jstring jdir, jobjectArray jpaths, jstring jquery, jint max_hits) {
+    STATS_SCOPE("MPVLib.searchSubtitles");
+    init_methods_cache(env);
+    const char *cdir = env->GetStringUTFChars(jdir, NULL);
+    std::string dir = cdir;
+    env->ReleaseStringUTFChars(jdir, cdir);
+    const char *cquery = env->GetStringUTFChars(jquery, NULL);
+    std::vector<std::string> words;
+    tokenize(cquery, &words);
+    env->ReleaseStringUTFChars(jquery, cquery);
+    std::vector<std::string> paths = string_array(env, jpaths);
+
+    node_builder nb;
+    std::vector<mpv_node> hits;
+    for (size_t i = 0; i < paths.size() && !words.empty() && (int)hits.size() < max_hits; i++)
+        search_file(dir, paths[i], words, max_hits, nb, &hits);
+
+    jobjectArray arr = env->NewObjectArray(hits.size(), mpv_MPVNode, NULL);
+    if (!arr)
+        return NULL;
+    for (size_t i = 0; i < hits.size(); i++) {
+        jobject node = mpv_node_to_jobject(env, &hits[i]);
+        env->SetObjectArrayElement(arr, i, node);
+        env->DeleteLocalRef(node);
+    }
+    return arr;
+}
@@ -1,5 +1,10 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <mutex>
 #include <stdint.h>
 #include <chrono>
@@ -21,10 +26,18 @@ extern "C" {
 #include "jni_utils.h"
 #include "globals.h"
 #include "log.h"
+#include "content_id.h"
+#include "palette.h"
+#include "storyboard.h"
+#include "thumbnail.h"
+#include "trace.h"
+#include "stats.h"
 
 extern "C" {
     jni_func(jobject, grabThumbnail, jint dimension);
     jni_func(jobject, grabThumbnailFast, jstring jpath, jdouble position, jint dimension, jboolean use_hw_dec);
+    jni_func(jobject, grabThumbnailPalette, jstring jpath, jdouble position, jint dimension, jboolean use_hw_dec,
+        jintArray jpalette);
     jni_func(void, setThumbnailJavaVM, jobject appctx);
     jni_func(void, clearThumbnailCache);
 };
@@ -42,25 +55,23 @@ static inline mpv_node make_node_str(const char *s)
     return r;
 }
 
-jni_func(jobject, grabThumbnail, jint dimension) {
-    auto total_start = std::chrono::high_resolution_clock::now();
-    CHECK_MPV_INIT();
-    init_methods_cache(env);
-
-    mpv_node result{};
+bool grab_raw_frame(mpv_handle *mpv, const char *flags, raw_frame *out) {
+    TRACE_SCOPE("thumbnail:screenshot-raw");
+    mpv_node &result = out->node;
+    result = mpv_node{};
     {
         mpv_node c{}, c_args[2];
         mpv_node_list c_array{};
         c_args[0] = make_node_str("screenshot-raw");
-        c_args[1] = make_node_str("video");
+        c_args[1] = make_node_str(flags);
         c_array.num = 2;
         c_array.values = c_args;
         c.format = MPV_FORMAT_NODE_ARRAY;
         c.u.list = &c_array;
         
-        if (mpv_command_node(g_mpv, &c, &result) < 0) {
+        if (mpv_command_node(mpv, &c, &result) < 0) {
             ALOGE("Thumbnail (MPV) | Screenshot failed");
-            return NULL;
+            return false;
         }
     }
     int w = 0, h = 0, stride = 0;
@@ -95,9 +106,29 @@ jni_func(jobject, grabThumbnail, jint dimension) {
     if (!w || !h || !stride || !format_ok || !data) {
         ALOGE("Thumbnail (MPV) | Failed to extract frame data");
         mpv_free_node_contents(&result);
-        return NULL;
+        return false;
     }
 
+    out->w = w;
+    out->h = h;
+    out->stride = stride;
+    out->data = reinterpret_cast<uint8_t*>(data->data);
+    return true;
+}
+
+jni_func(jobject, grabThumbnail, jint dimension) {
+    TRACE_SCOPE("MPVLib.grabThumbnail");
+    STATS_SCOPE("MPVLib.grabThumbnail");
+    auto total_start = std::chrono::high_resolution_clock::now();
+    CHECK_MPV_INIT();
+    init_methods_cache(env);
+
+    raw_frame frame;
+    if (!grab_raw_frame(g_mpv, "video", &frame))
+        return NULL;
+    mpv_node &result = frame.node;
+    int w = frame.w, h = frame.h, stride = frame.stride;
+
     // Crop to square
     int crop_left = 0, crop_top = 0;
     int new_w = w, new_h = h;
@@ -109,7 +140,7 @@ jni_func(jobject, grabThumbnail, jint dimension) {
         new_h = w;
     }
 
-    uint8_t *new_data = reinterpret_cast<uint8_t*>(data->data);
+    uint8_t *new_data = frame.data;
     new_data += crop_left * sizeof(uint32_t);
     new_data += stride * crop_top;
 
@@ -256,6 +287,7 @@ static void cleanup_thumbnail_resources() {
 }
 
 jni_func(void, setThumbnailJavaVM, jobject appctx) {
+    STATS_SCOPE("MPVLib.setThumbnailJavaVM");
     std::lock_guard<std::mutex> lock(g_thumb_mutex);
     
     if (g_thumb_appctx) {
@@ -277,6 +309,7 @@ jni_func(void, setThumbnailJavaVM, jobject appctx) {
 
 // Clear codec cache and hardware context
 jni_func(void, clearThumbnailCache) {
+    STATS_SCOPE("MPVLib.clearThumbnailCache");
     {
         std::lock_guard<std::mutex> lock(g_codec_cache_mutex);
         g_codec_cache.clear();
@@ -293,11 +326,83 @@ jni_func(void, clearThumbnailCache) {
     }
 }
 
+jobject bgra_to_bitmap(JNIEnv *env, const uint8_t *bgra, int width, int height, int stride) {
+    TRACE_SCOPE("thumbnail:bitmap");
+    init_methods_cache(env);
+
+    jintArray arr = env->NewIntArray(width * height);
+    if (!arr) {
+        ALOGE("Thumbnail | Failed to allocate array");
+        return NULL;
+    }
+    // BGRA bytes read as little-endian ints are exactly Bitmap's ARGB
+    for (int y = 0; y < height; y++)
+        env->SetIntArrayRegion(arr, y * width, width, reinterpret_cast<const jint*>(bgra + (size_t)y * stride));
+
+    jobject bitmap_config = env->GetStaticObjectField(android_graphics_Bitmap_Config, android_graphics_Bitmap_Config_ARGB_8888);
+    jobject bitmap = env->CallStaticObjectMethod(android_graphics_Bitmap, android_graphics_Bitmap_createBitmap,
+        arr, width, height, bitmap_config);
+    if (env->ExceptionCheck()) {
+        ALOGE("Thumbnail | Exception creating bitmap");
+        env->ExceptionClear();
+        bitmap = NULL;
+    }
+    env->DeleteLocalRef(arr);
+    env->DeleteLocalRef(bitmap_config);
+
+    return bitmap;
+}
+
+// Store the swatches of an image in the caller's array, if it passed one.
+// Entries past the colours found are 0.
+static void fill_palette(JNIEnv *env, jintArray palette, const uint8_t *bgra, int width, int height, int stride) {
+    if (!palette)
+        return;
+    int count = env->GetArrayLength(palette);
+    std::vector<uint32_t> colours(count, 0);
+    extract_palette(bgra, width, height, stride, colours.data(), count);
+    env->SetIntArrayRegion(palette, 0, count, reinterpret_cast<const jint*>(colours.data()));
+}
+
+// Look for a preview captured during playback (see trickplay.cpp)
+jobject storyboard_to_bitmap(JNIEnv *env, const char *path, double position, int target_dimension, jintArray palette) {
+    TRACE_SCOPE("thumbnail:storyboard");
+    storyboard_frame frame;
+    if (!storyboard_get(content_cache_key(path), position, THUMBNAIL_TOLERANCE, &frame))
+        return NULL;
+    int longest = std::max(frame.width, frame.height);
+    if (longest < target_dimension)
+        return NULL; // too small, decode instead
+    if (target_dimension <= 0 || longest == target_dimension) {
+        fill_palette(env, palette, frame.pixels.data(), frame.width, frame.height, frame.width * 4);
+        return bgra_to_bitmap(env, frame.pixels.data(), frame.width, frame.height, frame.width * 4);
+    }
+
+    int width = std::max(1, frame.width * target_dimension / longest);
+    int height = std::max(1, frame.height * target_dimension / longest);
+    struct SwsContext *sws_ctx = sws_getContext(
+        frame.width, frame.height, AV_PIX_FMT_BGRA,
+        width, height, AV_PIX_FMT_BGRA,
+        SWS_AREA, NULL, NULL, NULL);
+    if (!sws_ctx)
+        return NULL;
+    std::vector<uint8_t> scaled((size_t)width * height * 4);
+    const uint8_t *src_data[4] = { frame.pixels.data() };
+    int src_linesize[4] = { frame.width * 4 };
+    uint8_t *dst_data[4] = { scaled.data() };
+    int dst_linesize[4] = { width * 4 };
+    sws_scale(sws_ctx, src_data, src_linesize, 0, frame.height, dst_data, dst_linesize);
+    sws_freeContext(sws_ctx);
+
+    fill_palette(env, palette, scaled.data(), width, height, width * 4);
+    return bgra_to_bitmap(env, scaled.data(), width, height, width * 4);
+}
+
 // Fast extraction is the only mode - optimized for speed
 
-// Convert AVFrame to Android Bitmap
-static jobject frame_to_bitmap(JNIEnv *env, AVFrame *frame, int target_dimension) {
-    init_methods_cache(env);
+// Scale an AVFrame to packed BGRA
+static bool scale_frame(AVFrame *frame, int target_dimension, bgra_image *out) {
+    TRACE_SCOPE("thumbnail:scale");
     
     // Calculate scaled dimensions while preserving aspect ratio
     int width = frame->width;
@@ -335,92 +440,33 @@ static jobject frame_to_bitmap(JNIEnv *env, AVFrame *frame, int target_dimension
     
     if (!sws_ctx) {
         ALOGE("Thumbnail | Failed to create scaler");
-        return NULL;
+        return false;
     }
     
-    jintArray arr = env->NewIntArray(width * height);
-    if (!arr) {
-        ALOGE("Thumbnail | Failed to allocate array");
-        sws_freeContext(sws_ctx);
-        return NULL;
-    }
+    out->width = width;
+    out->height = height;
+    out->pixels.resize((size_t)width * height * 4);
     
-    jint *pixels = env->GetIntArrayElements(arr, NULL);
-    if (!pixels) {
-        ALOGE("Thumbnail | Failed to get array elements");
-        env->DeleteLocalRef(arr);
-        sws_freeContext(sws_ctx);
-        return NULL;
-    }
-    
-    uint8_t *dst_data[4] = { (uint8_t*)pixels };
+    uint8_t *dst_data[4] = { out->pixels.data() };
     int dst_linesize[4] = { width * 4 };
     sws_scale(sws_ctx, frame->data, frame->linesize, 0, frame->height, dst_data, dst_linesize);
     sws_freeContext(sws_ctx);
-    env->ReleaseIntArrayElements(arr, pixels, 0);
-    
-    jobject bitmap_config = env->GetStaticObjectField(
-        android_graphics_Bitmap_Config, 
-        android_graphics_Bitmap_Config_ARGB_8888
-    );
-    
-    if (!bitmap_config) {
-        ALOGE("Thumbnail | Failed to get bitmap config");
-        env->DeleteLocalRef(arr);
-        return NULL;
-    }
-    
-    jobject bitmap = env->CallStaticObjectMethod(
-        android_graphics_Bitmap, 
-        android_graphics_Bitmap_createBitmap,
-        arr, width, height, bitmap_config
-    );
-    
-    if (env->ExceptionCheck()) {
-        ALOGE("Thumbnail | Exception creating bitmap");
-        env->ExceptionClear();
-        env->DeleteLocalRef(arr);
-        env->DeleteLocalRef(bitmap_config);
-        return NULL;
-    }
-    
-    env->DeleteLocalRef(arr);
-    env->DeleteLocalRef(bitmap_config);
     
-    return bitmap;
+    return true;
 }
 
-jni_func(jobject, grabThumbnailFast, jstring jpath, jdouble position, jint dimension, jboolean use_hw_dec) {
-    auto total_start = std::chrono::high_resolution_clock::now();
-    
-    std::lock_guard<std::mutex> lock(g_thumb_mutex);
-    init_methods_cache(env);
-    
-    // Validate parameters
-    if (dimension <= 0 || dimension > 4096) {
-        ALOGE("Thumbnail | Invalid dimension");
-        return NULL;
-    }
-    
-    if (position < 0.0) {
-        ALOGE("Thumbnail | Invalid position");
-        return NULL;
-    }
-    
-    const char *path = env->GetStringUTFChars(jpath, NULL);
-    if (!path) {
-        ALOGE("Thumbnail | Invalid path");
-        return NULL;
-    }
-    
+bool decode_thumbnail(const char *path, double position, int dimension, bool use_hw_dec, bgra_image *out) {
     // Open video file
     AVFormatContext *format_ctx = NULL;
-    if (avformat_open_input(&format_ctx, path, NULL, NULL) < 0) {
+    int open_result;
+    {
+        TRACE_SCOPE("thumbnail:open");
+        open_result = avformat_open_input(&format_ctx, path, NULL, NULL);
+    }
+    if (open_result < 0) {
         ALOGE("Thumbnail | Failed to open file");
-        env->ReleaseStringUTFChars(jpath, path);
-        return NULL;
+        return false;
     }
-    env->ReleaseStringUTFChars(jpath, path);
     
     // Find stream information (ultra-fast minimal analysis)
     format_ctx->max_analyze_duration = 100000;
@@ -428,10 +474,15 @@ jni_func(jobject, grabThumbnailFast, jstring jpath, jdouble position, jint dimen
     format_ctx->fps_probe_size = 1;
     format_ctx->max_ts_probe = 1;
     
-    if (avformat_find_stream_info(format_ctx, NULL) < 0) {
+    int probe_result;
+    {
+        TRACE_SCOPE("thumbnail:probe");
+        probe_result = avformat_find_stream_info(format_ctx, NULL);
+    }
+    if (probe_result < 0) {
         ALOGE("Thumbnail | Failed to find stream info");
         avformat_close_input(&format_ctx);
-        return NULL;
+        return false;
     }
     
     // Find video stream
@@ -449,7 +500,7 @@ jni_func(jobject, grabThumbnailFast, jstring jpath, jdouble position, jint dimen
     if (video_stream_idx == -1) {
         ALOGE("Thumbnail | No video stream found");
         avformat_close_input(&format_ctx);
-        return NULL;
+        return false;
     }
     
     AVStream *video_stream = format_ctx->streams[video_stream_idx];
@@ -459,21 +510,21 @@ jni_func(jobject, grabThumbnailFast, jstring jpath, jdouble position, jint dimen
     if (!codec) {
         ALOGE("Thumbnail | Codec not found");
         avformat_close_input(&format_ctx);
-        return NULL;
+        return false;
     }
     
     AVCodecContext *codec_ctx = avcodec_alloc_context3(codec);
     if (!codec_ctx) {
         ALOGE("Thumbnail | Failed to allocate codec context");
         avformat_close_input(&format_ctx);
-        return NULL;
+        return false;
     }
     
     if (avcodec_parameters_to_context(codec_ctx, codec_params) < 0) {
         ALOGE("Thumbnail | Failed to copy codec params");
         avcodec_free_context(&codec_ctx);
         avformat_close_input(&format_ctx);
-        return NULL;
+        return false;
     }
     
     // Optimized for speed
@@ -497,15 +548,21 @@ jni_func(jobject, grabThumbnailFast, jstring jpath, jdouble position, jint dimen
         }
     }
     
-    if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
+    int codec_result;
+    {
+        TRACE_SCOPE("thumbnail:codec-open");
+        codec_result = avcodec_open2(codec_ctx, codec, NULL);
+    }
+    if (codec_result < 0) {
         ALOGE("Thumbnail | Failed to open codec");
         avcodec_free_context(&codec_ctx);
         avformat_close_input(&format_ctx);
-        return NULL;
+        return false;
     }
     
     // Seek to position (skip if near start)
     if (position > 1.0 && position < INT64_MAX / AV_TIME_BASE) {
+        TRACE_SCOPE("thumbnail:seek");
         int64_t timestamp = (int64_t)(position * AV_TIME_BASE);
         if (av_seek_frame(format_ctx, video_stream_idx, 
                           timestamp * video_stream->time_base.den / video_stream->time_base.num / AV_TIME_BASE,
@@ -524,12 +581,9 @@ jni_func(jobject, grabThumbnailFast, jstring jpath, jdouble position, jint dimen
         if (frame) av_frame_free(&frame);
         avcodec_free_context(&codec_ctx);
         avformat_close_input(&format_ctx);
-        return NULL;
+        return false;
     }
     
-    AVFrame *rgb_frame = NULL;
-    jobject bitmap = NULL;
-    
     bool frame_found = false;
     int frames_decoded = 0;
     int packets_read = 0;
@@ -539,6 +593,7 @@ jni_func(jobject, grabThumbnailFast, jstring jpath, jdouble position, jint dimen
         packets_read++;
         
         if (packet->stream_index == video_stream_idx) {
+            TRACE_SCOPE("thumbnail:decode");
             // Send packet to decoder
             if (avcodec_send_packet(codec_ctx, packet) >= 0) {
                 // Receive decoded frame
@@ -555,8 +610,8 @@ jni_func(jobject, grabThumbnailFast, jstring jpath, jdouble position, jint dimen
                     
                     // ULTRA FAST: Accept first frame if within reasonable range
                     // For maximum speed, we accept very lenient matching
-                    const double skip_tolerance = 5.0;   // Skip frames more than 5s before target
-                    const double match_tolerance = 5.0;  // Accept frames within 5s of target
+                    const double skip_tolerance = THUMBNAIL_TOLERANCE;   // Skip frames more than 5s before target
+                    const double match_tolerance = THUMBNAIL_TOLERANCE;  // Accept frames within 5s of target
                     
                     if (position > 0.0 && frame_time < position - skip_tolerance) {
                         av_frame_unref(frame);
@@ -565,8 +620,7 @@ jni_func(jobject, grabThumbnailFast, jstring jpath, jdouble position, jint dimen
                     
                     // Accept frame if close to target
                     if (position == 0.0 || frame_time >= position - match_tolerance) {
-                        bitmap = frame_to_bitmap(env, frame, dimension);
-                        if (bitmap) {
+                        if (scale_frame(frame, dimension, out)) {
                             frame_found = true;
                         } else {
                             ALOGE("Thumbnail | Failed to convert frame");
@@ -593,14 +647,140 @@ jni_func(jobject, grabThumbnailFast, jstring jpath, jdouble position, jint dimen
     avcodec_free_context(&codec_ctx);
     avformat_close_input(&format_ctx);
     
+    return frame_found;
+}
+
+// Encode image into packet with an opened MJPEG encoder
+static bool encode_jpeg_packet(const bgra_image &image, AVCodecContext *enc, AVFrame *frame, AVPacket *packet) {
+    frame->width = image.width;
+    frame->height = image.height;
+    frame->format = AV_PIX_FMT_YUVJ420P;
+    frame->quality = enc->global_quality;
+    if (av_frame_get_buffer(frame, 0) < 0)
+        return false;
+    
+    struct SwsContext *sws_ctx = sws_getContext(image.width, image.height, AV_PIX_FMT_BGRA,
+        image.width, image.height, AV_PIX_FMT_YUVJ420P, SWS_POINT, NULL, NULL, NULL);
+    if (!sws_ctx)
+        return false;
+    const uint8_t *src_data[4] = { image.pixels.data() };
+    int src_linesize[4] = { image.width * 4 };
+    sws_scale(sws_ctx, src_data, src_linesize, 0, image.height, frame->data, frame->linesize);
+    sws_freeContext(sws_ctx);
+    
+    return avcodec_send_frame(enc, frame) >= 0 && avcodec_receive_packet(enc, packet) >= 0;
+}
+
+bool encode_jpeg(const bgra_image &image, const char *path, int quality) {
+    TRACE_SCOPE("thumbnail:jpeg");
+    const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+    if (!codec) {
+        ALOGE("Thumbnail | MJPEG encoder not available");
+        return false;
+    }
+    
+    AVCodecContext *enc = avcodec_alloc_context3(codec);
+    AVFrame *frame = av_frame_alloc();
+    AVPacket *packet = av_packet_alloc();
+    if (!enc || !frame || !packet) {
+        ALOGE("Thumbnail | Failed to allocate encoder");
+        av_packet_free(&packet);
+        av_frame_free(&frame);
+        avcodec_free_context(&enc);
+        return false;
+    }
+    
+    enc->width = image.width;
+    enc->height = image.height;
+    enc->pix_fmt = AV_PIX_FMT_YUVJ420P;
+    enc->time_base = AVRational{1, 25};
+    enc->color_range = AVCOL_RANGE_JPEG;
+    // map 1..100 onto the encoder's qscale, 2 (best) .. 31 (worst)
+    enc->flags |= AV_CODEC_FLAG_QSCALE;
+    enc->global_quality = FF_QP2LAMBDA * (2 + (100 - av_clip(quality, 1, 100)) * 29 / 99);
+    
+    bool ok = avcodec_open2(enc, codec, NULL) >= 0 && encode_jpeg_packet(image, enc, frame, packet);
+    if (!ok) {
+        ALOGE("Thumbnail | Failed to encode JPEG");
+    } else {
+        // written next to the target and renamed, readers never see half a file;
+        // the tmp name is per thread, as several may write the same target
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), ".%d.tmp", (int)gettid());
+        std::string tmp = std::string(path) + suffix;
+        FILE *f = fopen(tmp.c_str(), "wb");
+        ok = f && fwrite(packet->data, 1, packet->size, f) == (size_t)packet->size;
+        ok = f && fclose(f) == 0 && ok;
+        ok = ok && rename(tmp.c_str(), path) == 0;
+        if (!ok) {
+            ALOGE("Thumbnail | Failed to write %s", path);
+            unlink(tmp.c_str());
+        }
+    }
+    
+    av_packet_free(&packet);
+    av_frame_free(&frame);
+    avcodec_free_context(&enc);
+    return ok;
+}
+
+static jobject grab_thumbnail_fast(JNIEnv *env, jstring jpath, double position, int dimension, bool use_hw_dec,
+        jintArray jpalette) {
+    TRACE_SCOPE("MPVLib.grabThumbnailFast");
+    auto total_start = std::chrono::high_resolution_clock::now();
+    
+    std::lock_guard<std::mutex> lock(g_thumb_mutex);
+    init_methods_cache(env);
+    
+    // Validate parameters
+    if (dimension <= 0 || dimension > 4096) {
+        ALOGE("Thumbnail | Invalid dimension");
+        return NULL;
+    }
+    
+    if (position < 0.0) {
+        ALOGE("Thumbnail | Invalid position");
+        return NULL;
+    }
+    
+    const char *path = env->GetStringUTFChars(jpath, NULL);
+    if (!path) {
+        ALOGE("Thumbnail | Invalid path");
+        return NULL;
+    }
+    
+    jobject cached = storyboard_to_bitmap(env, path, position, dimension, jpalette);
+    if (cached) {
+        env->ReleaseStringUTFChars(jpath, path);
+        ALOGV("Thumbnail | Served from storyboard cache");
+        return cached;
+    }
+    
+    bgra_image image;
+    bool decoded = decode_thumbnail(path, position, dimension, use_hw_dec, &image);
+    env->ReleaseStringUTFChars(jpath, path);
+    
     auto total_end = std::chrono::high_resolution_clock::now();
     auto total_duration = std::chrono::duration_cast<std::chrono::milliseconds>(total_end - total_start);
     
-    if (!frame_found) {
+    if (!decoded) {
         ALOGE("Thumbnail | Failed: no frame found");
         return NULL;
     }
     
     ALOGI("Thumbnail | %lldms", (long long)total_duration.count());
-    return bitmap;
+    fill_palette(env, jpalette, image.pixels.data(), image.width, image.height, image.width * 4);
+    return bgra_to_bitmap(env, image.pixels.data(), image.width, image.height, image.width * 4);
+}
+
+jni_func(jobject, grabThumbnailFast, jstring jpath, jdouble position, jint dimension, jboolean use_hw_dec) {
+    STATS_SCOPE("MPVLib.grabThumbnailFast");
+    return grab_thumbnail_fast(env, jpath, position, dimension, use_hw_dec, NULL);
+}
+
+// grabThumbnailFast, also filling jpalette with the thumbnail's dominant colours
+jni_func(jobject, grabThumbnailPalette, jstring jpath, jdouble position, jint dimension, jboolean use_hw_dec,
+        jintArray jpalette) {
+    STATS_SCOPE("MPVLib.grabThumbnailPalette");
+    return grab_thumbnail_fast(env, jpath, position, dimension, use_hw_dec, jpalette);
 }
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <jni.h>
+#include <stdint.h>
+#include <vector>
+
+#include <mpv/client.h>
+
+// A bgr0 frame returned by mpv's screenshot-raw command. `data` points into
+// `node`, which must be released with mpv_free_node_contents().
+struct raw_frame {
+    int w, h, stride;
+    uint8_t *data;
+    mpv_node node;
+};
+
+// Take an unscaled screenshot of the current video frame, without OSD.
+// `flags` is "video", or "subtitles" to include them.
+bool grab_raw_frame(mpv_handle *mpv, const char *flags, raw_frame *out);
+
+// Create an ARGB_8888 Bitmap from packed BGRA pixels.
+jobject bgra_to_bitmap(JNIEnv *env, const uint8_t *bgra, int width, int height, int stride);
+
+// How far from the requested position a thumbnail may have been taken, in
+// seconds, whether decoded or from the storyboard.
+static const double THUMBNAIL_TOLERANCE = 5.0;
+
+// Create a Bitmap from a storyboard preview near `position`, scaled down to
+// `target_dimension` (0 keeps the stored size). Returns NULL if none is cached
+// or it is too small. If `palette` is not NULL, it receives the image's
+// dominant colours (see palette.h), 0 past the ones found.
+jobject storyboard_to_bitmap(JNIEnv *env, const char *path, double position, int target_dimension,
+    jintArray palette);
+
+// Packed BGRA pixels, rows without padding.
+struct bgra_image {
+    int width, height;
+    std::vector<uint8_t> pixels;
+};
+
+// Decode the frame near `position` of the first video stream in `path` with
+// FFmpeg directly, scaled so its longest side is at most `dimension`. Does not
+// need mpv and may be called from several threads at once.
+bool decode_thumbnail(const char *path, double position, int dimension, bool use_hw_dec, bgra_image *out);
+
+// Write `image` as a JPEG file, `quality` from 1 to 100.
+bool encode_jpeg(const bgra_image &image, const char *path, int quality);
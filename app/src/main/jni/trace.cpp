@@ -0,0 +1,142 @@
+#include "trace.h"
+
+#ifdef MPV_TRACE
+
+#include <time.h>
+
+#ifdef __ANDROID__
+
+#include <dlfcn.h>
+
+// ATrace_* is only part of the NDK from API 23, look it up at runtime
+typedef bool (*ATrace_isEnabled_fn)(void);
+typedef void (*ATrace_beginSection_fn)(const char *name);
+typedef void (*ATrace_endSection_fn)(void);
+
+static ATrace_isEnabled_fn atrace_is_enabled;
+static ATrace_beginSection_fn atrace_begin_section;
+static ATrace_endSection_fn atrace_end_section;
+
+static void trace_load() __attribute__((constructor));
+static void trace_load() {
+    void *lib = dlopen("libandroid.so", RTLD_NOW | RTLD_LOCAL);
+    if (!lib)
+        return;
+    atrace_begin_section = (ATrace_beginSection_fn)dlsym(lib, "ATrace_beginSection");
+    atrace_end_section = (ATrace_endSection_fn)dlsym(lib, "ATrace_endSection");
+    // published last, it guards the other two
+    if (atrace_begin_section && atrace_end_section)
+        atrace_is_enabled = (ATrace_isEnabled_fn)dlsym(lib, "ATrace_isEnabled");
+}
+
+bool trace_enabled()
+{
+    return atrace_is_enabled && atrace_is_enabled();
+}
+
+void trace_section_begin(const char *name)
+{
+    atrace_begin_section(name);
+}
+
+void trace_section_end(const char *name, int64_t start_ns)
+{
+    atrace_end_section();
+}
+
+#else
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+struct trace_event {
+    const char *name;
+    int64_t start_ns, end_ns;
+    long tid;
+};
+
+static std::atomic<bool> g_recording(false);
+static std::mutex g_trace_mutex;
+static std::vector<trace_event> g_events;
+static FILE *g_trace_file;
+
+bool trace_enabled()
+{
+    return g_recording.load(std::memory_order_relaxed);
+}
+
+void trace_section_begin(const char *name)
+{
+    // spans are written out as complete events when they end
+}
+
+void trace_section_end(const char *name, int64_t start_ns)
+{
+    trace_event ev = { name, start_ns, trace_now_ns(), (long)syscall(SYS_gettid) };
+    std::lock_guard<std::mutex> lock(g_trace_mutex);
+    if (g_trace_file)
+        g_events.push_back(ev);
+}
+
+bool trace_start(const char *path)
+{
+    std::lock_guard<std::mutex> lock(g_trace_mutex);
+    if (g_trace_file)
+        return false;
+    g_trace_file = fopen(path, "w");
+    if (!g_trace_file)
+        return false;
+    g_events.clear();
+    g_recording = true;
+    return true;
+}
+
+static void write_json_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', f);
+        if ((unsigned char)*s >= 0x20)
+            fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+void trace_stop()
+{
+    g_recording = false;
+    std::lock_guard<std::mutex> lock(g_trace_mutex);
+    if (!g_trace_file)
+        return;
+
+    int pid = getpid();
+    fprintf(g_trace_file, "{\"traceEvents\":[\n");
+    for (size_t i = 0; i < g_events.size(); i++) {
+        const trace_event &ev = g_events[i];
+        fprintf(g_trace_file, "{\"ph\":\"X\",\"name\":");
+        write_json_string(g_trace_file, ev.name);
+        fprintf(g_trace_file, ",\"pid\":%d,\"tid\":%ld,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+            pid, ev.tid, ev.start_ns / 1e3, (ev.end_ns - ev.start_ns) / 1e3,
+            i + 1 < g_events.size() ? "," : "");
+    }
+    fprintf(g_trace_file, "],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(g_trace_file);
+    g_trace_file = NULL;
+    g_events.clear();
+}
+
+#endif
+
+int64_t trace_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,59 @@
+#pragma once
+
+// Scoped trace spans. Build with MPV_TRACE defined (ndk-build MPV_TRACE=1) to
+// get them; otherwise TRACE_SCOPE expands to nothing.
+//
+// On Android spans are ATrace sections, visible in Perfetto and systrace
+// whenever the app is being traced. On the host they are collected between
+// trace_start() and trace_stop() into a Chrome trace JSON file, which
+// chrome://tracing and ui.perfetto.dev open.
+//
+// Span names must outlive the span, use string literals or other static strings.
+
+#ifdef MPV_TRACE
+
+#include <stdint.h>
+
+// whether spans are currently being recorded
+bool trace_enabled();
+void trace_section_begin(const char *name);
+void trace_section_end(const char *name, int64_t start_ns);
+int64_t trace_now_ns();
+
+#ifndef __ANDROID__
+// host only: start recording into the JSON file at path
+bool trace_start(const char *path);
+// write out and close the file
+void trace_stop();
+#endif
+
+class trace_scope {
+public:
+    explicit trace_scope(const char *name) : name(trace_enabled() ? name : nullptr), start_ns(0) {
+        if (this->name) {
+            start_ns = trace_now_ns();
+            trace_section_begin(this->name);
+        }
+    }
+    ~trace_scope() {
+        if (name)
+            trace_section_end(name, start_ns);
+    }
+
+private:
+    trace_scope(const trace_scope&) = delete;
+    trace_scope &operator=(const trace_scope&) = delete;
+
+    const char *name;
+    int64_t start_ns;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+#else
+
+#define TRACE_SCOPE(name) do {} while (0)
+
+#endif
@@ -0,0 +1,240 @@
+#include <jni.h>
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <mpv/client.h>
+
+extern "C" {
+    #include <libswscale/swscale.h>
+};
+
+#include "jni_utils.h"
+#include "globals.h"
+#include "log.h"
+#include "content_id.h"
+#include "storyboard.h"
+#include "thumbnail.h"
+#include "stats.h"
+
+extern "C" {
+    jni_func(void, setTrickplayCapture, jboolean enable, jdouble interval, jint dimension);
+    jni_func(jobject, getTrickplayFrame, jstring jpath, jdouble position, jint dimension);
+    jni_func(void, setTrickplayCacheDir, jstring jdir);
+    jni_func(void, setTrickplayCacheBudget, jlong bytes);
+    jni_func(void, clearTrickplayCache);
+};
+
+// ============================================================================
+// OPPORTUNISTIC TRICKPLAY CAPTURE
+// While a file plays, grab the frame mpv is showing once per capture interval,
+// downscale it and put it into the storyboard cache. grabThumbnailFast then
+// answers seek preview requests for that file without decoding anything.
+//
+// libmpv has no frame tap, so this uses screenshot-raw; at one frame every few
+// seconds the readback cost is negligible. The capture thread owns a separate
+// client handle, which lets it follow the core's shutdown on its own.
+// ============================================================================
+
+// stop trying on a file after this many failed screenshots (e.g. hwdec without copy-back)
+static const int MAX_CAPTURE_FAILURES = 3;
+
+struct capture_ctx {
+    mpv_handle *mpv;
+    double interval;
+    int dimension;
+    std::atomic<bool> stop;
+};
+
+static capture_ctx *g_capture;
+static std::mutex g_capture_mutex;
+
+static bool capture_frame(capture_ctx *ctx, const std::string &key, double position)
+{
+    raw_frame frame;
+    if (!grab_raw_frame(ctx->mpv, "video", &frame))
+        return false;
+
+    int longest = std::max(frame.w, frame.h);
+    float scale = longest > ctx->dimension ? (float)ctx->dimension / longest : 1.0f;
+    int width = std::max(1, (int)(frame.w * scale));
+    int height = std::max(1, (int)(frame.h * scale));
+
+    struct SwsContext *sws_ctx = sws_getContext(
+        frame.w, frame.h, AV_PIX_FMT_BGR0,
+        width, height, AV_PIX_FMT_BGRA,
+        SWS_AREA, NULL, NULL, NULL);
+    if (!sws_ctx) {
+        mpv_free_node_contents(&frame.node);
+        return false;
+    }
+
+    std::vector<uint8_t> scaled((size_t)width * height * 4);
+    const uint8_t *src_data[4] = { frame.data };
+    int src_linesize[4] = { frame.stride };
+    uint8_t *dst_data[4] = { scaled.data() };
+    int dst_linesize[4] = { width * 4 };
+    sws_scale(sws_ctx, src_data, src_linesize, 0, frame.h, dst_data, dst_linesize);
+    sws_freeContext(sws_ctx);
+    mpv_free_node_contents(&frame.node);
+
+    storyboard_put(key, ctx->interval, position, width, height, scaled.data(), width * 4);
+    return true;
+}
+
+// Storyboard key of the playing file: local files by content, so previews
+// stay with them when moved or renamed.
+static bool current_key(mpv_handle *mpv, std::string *out)
+{
+    char *path = mpv_get_property_string(mpv, "path");
+    if (!path)
+        return false;
+    *out = content_cache_key(path);
+    mpv_free(path);
+    return true;
+}
+
+static void *capture_thread(void *arg)
+{
+    pthread_setname_np(pthread_self(), "trickplay");
+    capture_ctx *ctx = static_cast<capture_ctx*>(arg);
+
+    std::string key;
+    bool have_file = current_key(ctx->mpv, &key);
+    int failures = 0;
+    int64_t failed_slot = -1;
+
+    while (!ctx->stop) {
+        mpv_event *ev = mpv_wait_event(ctx->mpv, std::min(ctx->interval / 2, 0.5));
+        if (ev->event_id == MPV_EVENT_SHUTDOWN)
+            break;
+        if (ev->event_id == MPV_EVENT_FILE_LOADED) {
+            if (have_file)
+                storyboard_flush(key);
+            have_file = current_key(ctx->mpv, &key);
+            failures = 0;
+            failed_slot = -1;
+        } else if (ev->event_id == MPV_EVENT_END_FILE) {
+            if (have_file)
+                storyboard_flush(key);
+            have_file = false;
+        }
+        if (ctx->stop || !have_file || failures >= MAX_CAPTURE_FAILURES)
+            continue;
+
+        int vo_configured = 0, seeking = 0;
+        double position = 0;
+        if (mpv_get_property(ctx->mpv, "vo-configured", MPV_FORMAT_FLAG, &vo_configured) < 0 || !vo_configured)
+            continue;
+        if (mpv_get_property(ctx->mpv, "seeking", MPV_FORMAT_FLAG, &seeking) >= 0 && seeking)
+            continue;
+        if (mpv_get_property(ctx->mpv, "time-pos", MPV_FORMAT_DOUBLE, &position) < 0 || position < 0)
+            continue;
+
+        int64_t slot = (int64_t)floor(position / ctx->interval);
+        if (slot == failed_slot || storyboard_has(key, ctx->interval, position))
+            continue;
+
+        if (capture_frame(ctx, key, position)) {
+            failures = 0;
+        } else {
+            failed_slot = slot;
+            if (++failures >= MAX_CAPTURE_FAILURES)
+                ALOGW("Trickplay | Giving up on %s, frames are not readable", key.c_str());
+        }
+    }
+
+    if (have_file)
+        storyboard_flush(key);
+
+    {
+        std::lock_guard<std::mutex> lock(g_capture_mutex);
+        if (g_capture == ctx)
+            g_capture = NULL;
+    }
+    mpv_destroy(ctx->mpv);
+    delete ctx;
+    return NULL;
+}
+
+// must be called with g_capture_mutex held
+static void stop_capture()
+{
+    if (!g_capture)
+        return;
+    // the thread cleans up after itself
+    g_capture->stop = true;
+    mpv_wakeup(g_capture->mpv);
+    g_capture = NULL;
+}
+
+jni_func(void, setTrickplayCapture, jboolean enable, jdouble interval, jint dimension) {
+    STATS_SCOPE("MPVLib.setTrickplayCapture");
+    std::lock_guard<std::mutex> lock(g_capture_mutex);
+    stop_capture();
+    if (!enable)
+        return;
+
+    CHECK_MPV_INIT();
+    if (interval < 1.0 || dimension <= 0 || dimension > STORYBOARD_MAX_DIMENSION) {
+        ALOGE("Trickplay | Invalid interval or dimension");
+        return;
+    }
+
+    capture_ctx *ctx = new capture_ctx();
+    ctx->mpv = mpv_create_client(g_mpv, "trickplay");
+    ctx->interval = interval;
+    ctx->dimension = dimension;
+    ctx->stop = false;
+    if (!ctx->mpv) {
+        ALOGE("Trickplay | Failed to create client");
+        delete ctx;
+        return;
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, &attr, capture_thread, ctx) != 0)
+        die("thread create failed");
+    pthread_attr_destroy(&attr);
+
+    g_capture = ctx;
+}
+
+jni_func(jobject, getTrickplayFrame, jstring jpath, jdouble position, jint dimension) {
+    STATS_SCOPE("MPVLib.getTrickplayFrame");
+    const char *path = env->GetStringUTFChars(jpath, NULL);
+    if (!path)
+        return NULL;
+    jobject bitmap = storyboard_to_bitmap(env, path, position, dimension, NULL);
+    env->ReleaseStringUTFChars(jpath, path);
+    return bitmap;
+}
+
+jni_func(void, setTrickplayCacheDir, jstring jdir) {
+    STATS_SCOPE("MPVLib.setTrickplayCacheDir");
+    if (!jdir) {
+        storyboard_set_dir("");
+        return;
+    }
+    const char *dir = env->GetStringUTFChars(jdir, NULL);
+    storyboard_set_dir(dir);
+    env->ReleaseStringUTFChars(jdir, dir);
+}
+
+jni_func(void, setTrickplayCacheBudget, jlong bytes) {
+    STATS_SCOPE("MPVLib.setTrickplayCacheBudget");
+    storyboard_set_budget(bytes > 0 ? (size_t)bytes : 0);
+}
+
+jni_func(void, clearTrickplayCache) {
+    STATS_SCOPE("MPVLib.clearTrickplayCache");
+    storyboard_clear();
+}
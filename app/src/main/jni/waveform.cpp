@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <list>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <jni.h>
+
+#include "audio_decode.h"
+#include "content_id.h"
+#include "jni_utils.h"
+#include "log.h"
+#include "stats.h"
+#include "trace.h"
+#include "workpool.h"
+
+extern "C" {
+    jni_func(jfloatArray, getWaveform, jstring jpath, jint buckets, jint stream);
+    jni_func(void, setWaveformCacheDir, jstring jdir);
+};
+
+// ============================================================================
+// AUDIO WAVEFORMS
+// Peaks for waveform seekbars: the audio track is decoded in segments on the
+// worker pool and every bucket of the timeline reduced to min, max and RMS
+// over all channels. Results are cached by content id and resolution, in
+// memory and optionally on disk.
+// ============================================================================
+
+#define CACHE_MAGIC "MPVWF"
+static const uint32_t CACHE_VERSION = 1;
+static const size_t MEMORY_CACHE_ENTRIES = 8;
+static const int MAX_BUCKETS = 1 << 20;
+
+struct peak_acc {
+    float min = FLT_MAX, max = -FLT_MAX;
+    double sumsq = 0;
+    int64_t count = 0;
+};
+
+static std::list<std::pair<std::string, std::vector<float>>> g_cache;  // most recent first
+static std::string g_cache_dir;
+static std::mutex g_cache_mutex;
+
+// Min, max and sum of squares of n samples.
+static void reduce_peaks(const float *s, int n, float *out_min, float *out_max, double *out_sumsq)
+{
+    float mn = *out_min, mx = *out_max;
+    double sumsq = 0;
+    int i = 0;
+#if defined(__ARM_NEON)
+    if (n >= 4) {
+        float32x4_t vmin = vdupq_n_f32(mn), vmax = vdupq_n_f32(mx), vsq = vdupq_n_f32(0);
+        for (; i + 4 <= n; i += 4) {
+            float32x4_t v = vld1q_f32(s + i);
+            vmin = vminq_f32(vmin, v);
+            vmax = vmaxq_f32(vmax, v);
+            vsq = vmlaq_f32(vsq, v, v);
+        }
+        float lanes_min[4], lanes_max[4], lanes_sq[4];
+        vst1q_f32(lanes_min, vmin);
+        vst1q_f32(lanes_max, vmax);
+        vst1q_f32(lanes_sq, vsq);
+        for (int k = 0; k < 4; k++) {
+            mn = std::min(mn, lanes_min[k]);
+            mx = std::max(mx, lanes_max[k]);
+            sumsq += lanes_sq[k];
+        }
+    }
+#elif defined(__SSE2__)
+    if (n >= 4) {
+        __m128 vmin = _mm_set1_ps(mn), vmax = _mm_set1_ps(mx), vsq = _mm_setzero_ps();
+        for (; i + 4 <= n; i += 4) {
+            __m128 v = _mm_loadu_ps(s + i);
+            vmin = _mm_min_ps(vmin, v);
+            vmax = _mm_max_ps(vmax, v);
+            vsq = _mm_add_ps(vsq, _mm_mul_ps(v, v));
+        }
+        float lanes_min[4], lanes_max[4], lanes_sq[4];
+        _mm_storeu_ps(lanes_min, vmin);
+        _mm_storeu_ps(lanes_max, vmax);
+        _mm_storeu_ps(lanes_sq, vsq);
+        for (int k = 0; k < 4; k++) {
+            mn = std::min(mn, lanes_min[k]);
+            mx = std::max(mx, lanes_max[k]);
+            sumsq += lanes_sq[k];
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        mn = std::min(mn, s[i]);
+        mx = std::max(mx, s[i]);
+        sumsq += s[i] * s[i];
+    }
+    *out_min = mn;
+    *out_max = mx;
+    *out_sumsq += sumsq;
+}
+
+// Bucket holding a sample of a stream of total samples.
+static int bucket_of(int64_t sample, int64_t total, int buckets)
+{
+    return (int)std::min<int64_t>(sample * buckets / total, buckets - 1);
+}
+
+static bool compute_waveform(const char *path, int stream, int buckets, std::vector<float> *out)
+{
+    TRACE_SCOPE("waveform:compute");
+    audio_stream_info info;
+    if (!audio_stream_open_info(path, stream, &info))
+        return false;
+    const int64_t total = info.total_samples;
+    int segments = std::min<int64_t>(audio_segment_count(info), total);
+
+    // accumulators for the buckets each segment touches, merged afterwards
+    std::vector<int> first_bucket(segments);
+    std::vector<std::vector<peak_acc>> accs(segments);
+    std::vector<char> ok(segments);
+    workpool_run(segments, [&](size_t k) {
+        int64_t first = total * k / segments;
+        // the duration is an estimate, the last segment takes whatever follows
+        int64_t end = (int)k == segments - 1 ? INT64_MAX : total * (k + 1) / segments;
+        int b0 = bucket_of(first, total, buckets);
+        int b1 = end == INT64_MAX ? buckets - 1 : bucket_of(end - 1, total, buckets);
+        first_bucket[k] = b0;
+        std::vector<peak_acc> &acc = accs[k];
+        acc.resize(b1 - b0 + 1);
+        ok[k] = decode_audio_range(path, info, first, end,
+            [&](const float *const *planes, int channels, int64_t pos, int count) {
+                for (int i = 0; i < count; ) {
+                    int64_t sample = pos + i;
+                    int b = bucket_of(sample, total, buckets);
+                    // first sample of the next bucket, rounded up
+                    int64_t next = b == buckets - 1 ? INT64_MAX : ((int64_t)(b + 1) * total + buckets - 1) / buckets;
+                    int n = (int)std::min<int64_t>(next - sample, count - i);
+                    peak_acc &a = acc[std::max(0, std::min(b - b0, (int)acc.size() - 1))];
+                    for (int c = 0; c < channels; c++)
+                        reduce_peaks(planes[c] + i, n, &a.min, &a.max, &a.sumsq);
+                    a.count += (int64_t)n * channels;
+                    i += n;
+                }
+            });
+    });
+    if (std::find(ok.begin(), ok.end(), 1) == ok.end())
+        return false;
+
+    std::vector<peak_acc> merged(buckets);
+    for (int k = 0; k < segments; k++) {
+        for (size_t j = 0; j < accs[k].size(); j++) {
+            peak_acc &m = merged[first_bucket[k] + j];
+            const peak_acc &a = accs[k][j];
+            m.min = std::min(m.min, a.min);
+            m.max = std::max(m.max, a.max);
+            m.sumsq += a.sumsq;
+            m.count += a.count;
+        }
+    }
+    out->resize((size_t)buckets * 3);
+    for (int b = 0; b < buckets; b++) {
+        const peak_acc &m = merged[b];
+        bool empty = m.count == 0;
+        (*out)[b * 3] = empty ? 0 : m.min;
+        (*out)[b * 3 + 1] = empty ? 0 : m.max;
+        (*out)[b * 3 + 2] = empty ? 0 : (float)sqrt(m.sumsq / m.count);
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// cache
+// ----------------------------------------------------------------------------
+
+static std::string cache_file(const std::string &key)
+{
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : key) {
+        h ^= c;
+        h *= 0x100000001b3ULL;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.wf", (unsigned long long)h);
+    return g_cache_dir + name;
+}
+
+// must be called with g_cache_mutex held
+static bool cache_read(const std::string &key, std::vector<float> *out)
+{
+    FILE *f = fopen(cache_file(key).c_str(), "rb");
+    if (!f)
+        return false;
+    char magic[sizeof(CACHE_MAGIC)];
+    uint32_t version, key_len, count;
+    std::string stored;
+    bool ok = fread(magic, sizeof(magic), 1, f) == 1 && !memcmp(magic, CACHE_MAGIC, sizeof(magic)) &&
+        fread(&version, sizeof(version), 1, f) == 1 && version == CACHE_VERSION &&
+        fread(&key_len, sizeof(key_len), 1, f) == 1 && key_len == key.size();
+    if (ok) {
+        stored.resize(key_len);
+        ok = fread(&stored[0], key_len, 1, f) == 1 && stored == key &&
+            fread(&count, sizeof(count), 1, f) == 1 && count <= (uint32_t)MAX_BUCKETS * 3;
+    }
+    if (ok) {
+        out->resize(count);
+        ok = fread(out->data(), sizeof(float), count, f) == count;
+    }
+    fclose(f);
+    return ok;
+}
+
+// must be called with g_cache_mutex held
+static void cache_write(const std::string &key, const std::vector<float> &peaks)
+{
+    std::string path = cache_file(key), tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f)
+        return;
+    uint32_t key_len = key.size(), count = peaks.size();
+    bool ok = fwrite(CACHE_MAGIC, sizeof(CACHE_MAGIC), 1, f) == 1 &&
+        fwrite(&CACHE_VERSION, sizeof(CACHE_VERSION), 1, f) == 1 &&
+        fwrite(&key_len, sizeof(key_len), 1, f) == 1 &&
+        fwrite(key.data(), key_len, 1, f) == 1 &&
+        fwrite(&count, sizeof(count), 1, f) == 1 &&
+        fwrite(peaks.data(), sizeof(float), count, f) == count;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        ALOGE("Waveform | Failed to write %s", path.c_str());
+        unlink(tmp.c_str());
+    }
+}
+
+// must be called with g_cache_mutex held
+static void cache_put(const std::string &key, const std::vector<float> &peaks)
+{
+    g_cache.emplace_front(key, peaks);
+    if (g_cache.size() > MEMORY_CACHE_ENTRIES)
+        g_cache.pop_back();
+}
+
+static bool cache_get(const std::string &key, std::vector<float> *out)
+{
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    for (auto it = g_cache.begin(); it != g_cache.end(); ++it) {
+        if (it->first == key) {
+            g_cache.splice(g_cache.begin(), g_cache, it);
+            *out = it->second;
+            return true;
+        }
+    }
+    if (g_cache_dir.empty() || !cache_read(key, out))
+        return false;
+    cache_put(key, *out);
+    return true;
+}
+
+// Returns min, max and RMS for each of `buckets` equal slices of the audio
+// stream (-1: the default one), interleaved. null if there is no audio or its
+// duration is unknown.
+jni_func(jfloatArray, getWaveform, jstring jpath, jint buckets, jint stream) {
+    STATS_SCOPE("MPVLib.getWaveform");
+    if (buckets <= 0 || buckets > MAX_BUCKETS) {
+        ALOGE("Waveform | Invalid bucket count %d", buckets);
+        return NULL;
+    }
+    const char *cpath = env->GetStringUTFChars(jpath, NULL);
+    std::string path = cpath;
+    env->ReleaseStringUTFChars(jpath, cpath);
+
+    // local files by content, so moved and copied files hit too
+    std::string id;
+    bool local = content_id(path, &id);
+    char params[32];
+    snprintf(params, sizeof(params), "|%d|%d", (int)stream, (int)buckets);
+    std::string key = (local ? id : path) + params;
+
+    std::vector<float> peaks;
+    if (!cache_get(key, &peaks)) {
+        if (!compute_waveform(path.c_str(), stream, buckets, &peaks))
+            return NULL;
+        std::lock_guard<std::mutex> lock(g_cache_mutex);
+        cache_put(key, peaks);
+        if (local && !g_cache_dir.empty())
+            cache_write(key, peaks);
+    }
+
+    jfloatArray arr = env->NewFloatArray(peaks.size());
+    if (arr)
+        env->SetFloatArrayRegion(arr, 0, peaks.size(), peaks.data());
+    return arr;
+}
+
+// Also keep waveforms of local files as files in dir; null only caches in memory.
+jni_func(void, setWaveformCacheDir, jstring jdir) {
+    STATS_SCOPE("MPVLib.setWaveformCacheDir");
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    if (!jdir) {
+        g_cache_dir.clear();
+        return;
+    }
+    const char *dir = env->GetStringUTFChars(jdir, NULL);
+    g_cache_dir = dir;
+    env->ReleaseStringUTFChars(jdir, dir);
+    mkdir(g_cache_dir.c_str(), 0700);
+}
@@ -0,0 +1,127 @@
+#include <pthread.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "workpool.h"
+
+// ============================================================================
+// WORKER POOL
+// Batches are queued; every worker and the submitting thread pull indices from
+// the oldest unfinished batch with an atomic counter, so a batch of small
+// items costs one queue operation per thread rather than per item.
+// ============================================================================
+
+// most batch work here waits on storage, a few threads more than cores keeps it busy
+static const int MIN_THREADS = 4;
+static const int MAX_THREADS = 8;
+
+struct batch {
+    const std::function<void(size_t)> *fn;
+    size_t count;
+    std::atomic<size_t> next;
+    // protected by g_pool_mutex
+    size_t done;
+    int workers;    // pool threads currently inside the batch
+};
+
+// Never destroyed: detached workers wait on these until the process exits,
+// and destroying a condition variable with waiters blocks.
+static std::mutex &g_pool_mutex = *new std::mutex();
+static std::condition_variable &g_work_cv = *new std::condition_variable();
+static std::condition_variable &g_done_cv = *new std::condition_variable();
+static std::deque<batch*> &g_batches = *new std::deque<batch*>();
+static int g_threads;
+
+// Runs items of b until none are left, returns how many this thread ran.
+static size_t run_items(batch *b)
+{
+    size_t ran = 0;
+    for (size_t i; (i = b->next.fetch_add(1)) < b->count; ran++)
+        (*b->fn)(i);
+    return ran;
+}
+
+// must be called with g_pool_mutex held
+static bool finished(const batch *b)
+{
+    return b->done == b->count && !b->workers;
+}
+
+static void worker_loop()
+{
+    pthread_setname_np(pthread_self(), "workpool");
+    std::unique_lock<std::mutex> lock(g_pool_mutex);
+    while (1) {
+        g_work_cv.wait(lock, [] { return !g_batches.empty(); });
+        batch *b = g_batches.front();
+        // all of its items are taken, the submitter removes it once they're done
+        if (b->next.load() >= b->count) {
+            g_batches.pop_front();
+            continue;
+        }
+        // the submitter waits for us to leave before the batch goes away
+        b->workers++;
+        lock.unlock();
+        size_t ran = run_items(b);
+        lock.lock();
+        b->done += ran;
+        b->workers--;
+        if (finished(b))
+            g_done_cv.notify_all();
+    }
+}
+
+// must be called with g_pool_mutex held
+static void start_threads()
+{
+    if (g_threads)
+        return;
+    int cores = std::thread::hardware_concurrency();
+    g_threads = std::min(MAX_THREADS, std::max(MIN_THREADS, cores));
+    for (int i = 0; i < g_threads; i++)
+        std::thread(worker_loop).detach();
+}
+
+int workpool_threads()
+{
+    std::lock_guard<std::mutex> lock(g_pool_mutex);
+    start_threads();
+    return g_threads;
+}
+
+void workpool_run(size_t count, const std::function<void(size_t)> &fn)
+{
+    if (count == 0)
+        return;
+    if (count == 1) {
+        fn(0);
+        return;
+    }
+
+    batch b;
+    b.fn = &fn;
+    b.count = count;
+    b.next = 0;
+    b.done = 0;
+    b.workers = 0;
+    {
+        std::lock_guard<std::mutex> lock(g_pool_mutex);
+        start_threads();
+        g_batches.push_back(&b);
+    }
+    g_work_cv.notify_all();
+
+    size_t ran = run_items(&b);
+
+    std::unique_lock<std::mutex> lock(g_pool_mutex);
+    b.done += ran;
+    g_done_cv.wait(lock, [&b] { return finished(&b); });
+    // workers may not have reached it yet
+    auto it = std::find(g_batches.begin(), g_batches.end(), &b);
+    if (it != g_batches.end())
+        g_batches.erase(it);
+}
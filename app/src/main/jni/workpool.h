@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+#include <functional>
+
+// Process-wide pool of worker threads for batch jobs over many independent
+// items (probing files, hashing, analysis). Threads are started on first use
+// and live for the rest of the process.
+//
+// Kept free of JNI, mpv and Android dependencies so benchmarks can build it
+// on the host.
+
+// Number of worker threads, not counting callers.
+int workpool_threads();
+
+// Runs fn(0) .. fn(count - 1) across the pool and returns once all calls have
+// finished. The calling thread works on the batch too, so nested or concurrent
+// calls from several threads cannot deadlock. fn must not throw.
+void workpool_run(size_t count, const std::function<void(size_t)> &fn);
@@ -0,0 +1,142 @@
+// Host-side read-ahead benchmark.
+//
+// Plays back a file through readahead.cpp, the code used on device, from a
+// source that simulates a remote server: every request pays a fixed latency
+// and each connection is bandwidth limited. The reader consumes the stream in
+// small sequential reads like a demuxer and seeks to random positions every
+// so often. Prints throughput and stall statistics per configuration.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "readahead.h"
+
+static int latency_ms = 40;
+static int bandwidth_kbps = 16 * 1024; // per connection, KiB/s
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sleep_ns(int64_t ns)
+{
+    struct timespec ts = { (time_t)(ns / 1000000000LL), (long)(ns % 1000000000LL) };
+    nanosleep(&ts, NULL);
+}
+
+class ThrottledSource : public FileReadaheadSource {
+public:
+    explicit ThrottledSource(int fd) : FileReadaheadSource(fd) {}
+
+    int64_t read_at(int worker, int64_t offset, uint8_t *dst, size_t len,
+        const std::atomic<bool> *cancel) override
+    {
+        int64_t cost = latency_ms * 1000000LL + (int64_t)len * 1000000000LL / (bandwidth_kbps * 1024LL);
+        // sleep in slices so cancellation is noticed like on a real socket
+        for (int64_t slept = 0; slept < cost && !*cancel; slept += 5000000)
+            sleep_ns(std::min<int64_t>(5000000, cost - slept));
+        if (*cancel)
+            return 0;
+        return FileReadaheadSource::read_at(worker, offset, dst, len, cancel);
+    }
+};
+
+struct result {
+    double seconds;
+    int64_t bytes;
+    readahead_stats st;
+};
+
+static bool run_once(const char *path, const readahead_config &cfg, int seeks, result *out)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    ReadaheadStream stream(new ThrottledSource(fd), cfg);
+    int64_t size = stream.size();
+    if (size <= 0)
+        return false;
+
+    // fixed seed so every configuration sees the same access pattern
+    srand(1);
+    int64_t segment = size / (seeks + 1);
+    std::vector<uint8_t> buf(64 * 1024);
+    int64_t t0 = now_ns(), total = 0;
+    for (int i = 0; i <= seeks; i++) {
+        if (i > 0)
+            stream.seek((int64_t)((double)rand() / RAND_MAX * (size - segment)));
+        int64_t remaining = segment;
+        while (remaining > 0) {
+            int64_t n = stream.read(buf.data(), std::min<int64_t>(buf.size(), remaining));
+            if (n <= 0)
+                break;
+            remaining -= n;
+            total += n;
+        }
+    }
+
+    out->seconds = (now_ns() - t0) / 1e9;
+    out->bytes = total;
+    out->st = stream.stats();
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = NULL;
+    int seeks = 8;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--latency") && i + 1 < argc)
+            latency_ms = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--bandwidth") && i + 1 < argc)
+            bandwidth_kbps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--seeks") && i + 1 < argc)
+            seeks = atoi(argv[++i]);
+        else
+            path = argv[i];
+    }
+    if (!path) {
+        fprintf(stderr, "usage: %s [--latency MS] [--bandwidth KIB_PER_S] [--seeks N] FILE\n", argv[0]);
+        return 1;
+    }
+
+    struct {
+        const char *name;
+        int threads, min_depth, max_depth;
+    } configs[] = {
+        { "serial", 1, 1, 1 },
+        { "1 thread", 1, 2, 32 },
+        { "4 threads", 4, 2, 32 },
+        { "8 threads", 8, 2, 32 },
+    };
+
+    printf("latency %d ms, %d KiB/s per connection, %d seeks\n\n", latency_ms, bandwidth_kbps, seeks);
+    printf("%-10s %10s %8s %10s %10s %6s\n", "config", "MiB/s", "stalls", "stall ms", "cancelled", "depth");
+    for (auto &c : configs) {
+        readahead_config cfg;
+        cfg.threads = c.threads;
+        cfg.min_depth = c.min_depth;
+        cfg.max_depth = c.max_depth;
+
+        result r;
+        if (!run_once(path, cfg, seeks, &r)) {
+            fprintf(stderr, "cannot read %s\n", path);
+            return 1;
+        }
+        printf("%-10s %10.2f %8lld %10lld %10lld %6lld\n", c.name,
+            r.bytes / r.seconds / (1024 * 1024), (long long)r.st.stalls,
+            (long long)(r.st.stall_ns / 1000000), (long long)r.st.cancelled, (long long)r.st.depth);
+    }
+    return 0;
+}
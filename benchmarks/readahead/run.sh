@@ -0,0 +1,20 @@
+#!/bin/bash -e
+
+# Builds readahead_bench against the host FFmpeg and runs it on a file,
+# a 64 MiB random one by default.
+# usage: run.sh [--latency MS] [--bandwidth KIB_PER_S] [--seeks N] [FILE]
+
+cd "$(dirname "$0")"
+jni=../../app/src/main/jni
+
+${CXX:-c++} -std=c++11 -O2 -pthread -I$jni -o readahead_bench \
+	readahead_bench.cpp $jni/readahead.cpp \
+	$(pkg-config --cflags --libs libavformat libavutil)
+
+args=("$@")
+if [ $# -eq 0 ] || [[ "${@: -1}" == --* ]] || [ ! -f "${@: -1}" ]; then
+	[ -f sample.bin ] || head -c $((64 << 20)) /dev/urandom > sample.bin
+	args+=(sample.bin)
+fi
+
+./readahead_bench "${args[@]}"
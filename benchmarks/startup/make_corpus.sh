@@ -0,0 +1,18 @@
+#!/bin/bash -e
+
+# Generates a small synthetic media corpus for startup_bench using the ffmpeg CLI.
+
+out=${1:-corpus}
+mkdir -p "$out"
+
+src=(-f lavfi -i "testsrc2=size=1280x720:rate=30:duration=10"
+	-f lavfi -i "sine=frequency=440:sample_rate=48000:duration=10")
+
+ffmpeg -y -loglevel error "${src[@]}" -c:v mpeg4 -q:v 4 -c:a aac "$out/mpeg4-aac.mp4"
+ffmpeg -y -loglevel error "${src[@]}" -c:v mpeg4 -g 300 -q:v 4 -c:a flac "$out/mpeg4-longgop.mkv"
+ffmpeg -y -loglevel error "${src[@]}" -c:v mpeg2video -q:v 4 -c:a mp2 "$out/mpeg2-mp2.ts"
+ffmpeg -y -loglevel error "${src[@]}" -c:v mjpeg -q:v 4 -c:a pcm_s16le "$out/mjpeg-pcm.avi"
+ffmpeg -y -loglevel error -f lavfi -i "sine=frequency=440:sample_rate=44100:duration=10" \
+	-c:a flac "$out/audio-only.flac"
+
+echo "Corpus written to $out"
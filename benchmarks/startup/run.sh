@@ -0,0 +1,15 @@
+#!/bin/bash -e
+
+# Builds startup_bench against the host libmpv and runs it over the corpus.
+# usage: run.sh [--runs N] [--vo VO] [--trace FILE]
+
+cd "$(dirname "$0")"
+jni=../../app/src/main/jni
+
+[ -d corpus ] || ./make_corpus.sh corpus
+
+${CXX:-c++} -std=c++11 -O2 -DMPV_TRACE -I$jni -o startup_bench \
+	startup_bench.cpp $jni/startup_timing.cpp $jni/trace.cpp \
+	$(pkg-config --cflags --libs mpv)
+
+./startup_bench "$@" corpus/*
@@ -0,0 +1,155 @@
+// Host-side time-to-first-frame benchmark.
+//
+// Runs the same create -> init -> loadfile sequence as MPVLib with null audio
+// and video outputs and records every stage through startup_timing.cpp, the
+// code used on device. Prints per-stage percentiles over all runs.
+// With --trace FILE the stages are also written as a Chrome trace through
+// trace.cpp.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <mpv/client.h>
+
+#include "startup_timing.h"
+#include "trace.h"
+
+static const char *stage_names[STARTUP_STAGE_COUNT] = {
+    "create", "init", "loadfile", "file-loaded", "playback-restart",
+};
+
+static bool run_once(const char *path, const char *vo, int64_t out[STARTUP_STAGE_COUNT])
+{
+    TRACE_SCOPE("run");
+    startup_timing_reset();
+
+    mpv_handle *mpv = mpv_create();
+    if (!mpv)
+        return false;
+    startup_timing_bind(mpv);
+
+    // mirror MPVLib.create() and BaseMPVView.initialize()
+    mpv_set_option_string(mpv, "msg-level", "all=v");
+    mpv_set_option_string(mpv, "config", "no");
+    mpv_set_option_string(mpv, "vo", vo);
+    mpv_set_option_string(mpv, "ao", "null");
+    mpv_set_option_string(mpv, "idle", "once");
+    mpv_set_option_string(mpv, "force-window", "no");
+
+    int init_result;
+    {
+        TRACE_SCOPE("init");
+        init_result = mpv_initialize(mpv);
+    }
+    if (init_result < 0) {
+        mpv_terminate_destroy(mpv);
+        return false;
+    }
+    startup_timing_mark(mpv, STARTUP_INIT);
+
+    const char *cmd[] = { "loadfile", path, NULL };
+    startup_timing_mark(mpv, STARTUP_LOADFILE);
+    mpv_command(mpv, cmd);
+
+    bool ok = false;
+    TRACE_SCOPE("loadfile -> first frame");
+    while (1) {
+        mpv_event *ev = mpv_wait_event(mpv, 10.0);
+        if (ev->event_id == MPV_EVENT_NONE) {
+            fprintf(stderr, "%s: timed out\n", path);
+            break;
+        }
+        if (ev->event_id == MPV_EVENT_FILE_LOADED) {
+            startup_timing_mark(mpv, STARTUP_FILE_LOADED);
+        } else if (ev->event_id == MPV_EVENT_PLAYBACK_RESTART) {
+            startup_timing_mark(mpv, STARTUP_PLAYBACK_RESTART);
+            ok = true;
+            break;
+        } else if (ev->event_id == MPV_EVENT_END_FILE || ev->event_id == MPV_EVENT_SHUTDOWN) {
+            fprintf(stderr, "%s: playback ended before first frame\n", path);
+            break;
+        }
+    }
+
+    startup_timing_get(out);
+    mpv_terminate_destroy(mpv);
+    return ok;
+}
+
+static double percentile(std::vector<double> v, double p)
+{
+    if (v.empty())
+        return 0;
+    std::sort(v.begin(), v.end());
+    size_t idx = (size_t)(p / 100.0 * (v.size() - 1) + 0.5);
+    return v[std::min(idx, v.size() - 1)];
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [--runs N] [--vo VO] [--trace FILE] file...\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    int runs = 10;
+    const char *vo = "null";
+    const char *trace_path = NULL;
+    std::vector<const char*> files;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--runs") && i + 1 < argc)
+            runs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--vo") && i + 1 < argc)
+            vo = argv[++i];
+        else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+            trace_path = argv[++i];
+        else if (argv[i][0] == '-')
+            usage(argv[0]);
+        else
+            files.push_back(argv[i]);
+    }
+    if (files.empty() || runs < 1)
+        usage(argv[0]);
+
+    if (trace_path && !trace_start(trace_path)) {
+        fprintf(stderr, "cannot write %s\n", trace_path);
+        return 2;
+    }
+
+    // samples[i] holds the duration from stage i-1 to stage i, [0] the total
+    std::vector<double> samples[STARTUP_STAGE_COUNT];
+    int failures = 0;
+    for (const char *path : files) {
+        for (int r = 0; r < runs; r++) {
+            int64_t t[STARTUP_STAGE_COUNT];
+            if (!run_once(path, vo, t)) {
+                failures++;
+                continue;
+            }
+            for (int s = 1; s < STARTUP_STAGE_COUNT; s++)
+                samples[s].push_back((t[s] - t[s - 1]) / 1e6);
+            samples[0].push_back(t[STARTUP_STAGE_COUNT - 1] / 1e6);
+        }
+    }
+
+    if (trace_path)
+        trace_stop();
+
+    printf("%-30s %8s %8s %8s %8s\n", "stage (ms)", "p50", "p90", "p99", "max");
+    for (int s = 1; s <= STARTUP_STAGE_COUNT; s++) {
+        int i = s % STARTUP_STAGE_COUNT;
+        std::string name = i ? std::string(stage_names[i - 1]) + " -> " + stage_names[i]
+                             : "total";
+        printf("%-30s %8.2f %8.2f %8.2f %8.2f\n", name.c_str(),
+            percentile(samples[i], 50), percentile(samples[i], 90),
+            percentile(samples[i], 99), percentile(samples[i], 100));
+    }
+    printf("runs: %zu ok, %d failed\n", samples[0].size(), failures);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,37 @@
+#!/bin/bash -e
+
+# Builds tls_bench against the host mbedtls (3.6 or newer), once plain and once
+# with the tls_share wrappers, and runs both against a local openssl s_server
+# using a throwaway certificate appended to the system CA bundle.
+# usage: run.sh [CONNECTIONS] [TLS_VERSION_FLAG, e.g. -tls1_2]
+
+cd "$(dirname "$0")"
+share=../../buildscripts/tls_share
+count=${1:-50}
+port=${PORT:-14433}
+
+work=$(mktemp -d)
+trap 'kill $server 2>/dev/null; rm -rf "$work"' EXIT
+
+libs=$(pkg-config --cflags --libs mbedtls mbedx509 mbedcrypto 2>/dev/null || echo "-lmbedtls -lmbedx509 -lmbedcrypto")
+wrap=
+for func in x509_crt_parse_file x509_crt_free ssl_conf_ca_chain ssl_set_hostname \
+	ssl_set_bio ssl_handshake ssl_read ssl_free; do
+	wrap="$wrap -Wl,--wrap=mbedtls_$func"
+done
+${CC:-cc} -std=c99 -D_POSIX_C_SOURCE=200809L -O2 -o tls_bench_plain tls_bench.c $libs
+${CC:-cc} -std=c99 -D_POSIX_C_SOURCE=200809L -O2 -DTLS_SHARE -I$share -o tls_bench_shared \
+	tls_bench.c $share/tls_share.c $wrap $libs -pthread
+
+openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes -days 1 \
+	-subj /CN=localhost -addext subjectAltName=DNS:localhost \
+	-keyout "$work/key.pem" -out "$work/cert.pem" 2>/dev/null
+cat /etc/ssl/certs/ca-certificates.crt "$work/cert.pem" > "$work/bundle.pem" 2>/dev/null || \
+	cp "$work/cert.pem" "$work/bundle.pem"
+
+openssl s_server -quiet -www -accept $port -cert "$work/cert.pem" -key "$work/key.pem" $2 &
+server=$!
+sleep 1
+
+./tls_bench_plain localhost $port "$work/bundle.pem" $count
+./tls_bench_shared localhost $port "$work/bundle.pem" $count
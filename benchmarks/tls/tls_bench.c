@@ -0,0 +1,153 @@
+// Host-side TLS connection benchmark.
+//
+// Opens HTTPS connections to a local server the way FFmpeg's mbedtls backend
+// does (CA bundle parsed into a per-connection chain, hostname set, handshake,
+// one request), and times them. Built once plain and once linked with
+// tls_share.c under the same -Wl,--wrap flags as libavformat, so the two
+// runs compare per-connection parsing and full handshakes against a shared
+// chain and resumed sessions.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/x509_crt.h>
+
+#ifdef TLS_SHARE
+#include "tls_share.h"
+#endif
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+struct result {
+    double parse_ms, handshake_ms, total_ms;
+    int reused;
+};
+
+// mirrors tls_open() in libavformat/tls_mbedtls.c
+static int connect_once(const char *host, const char *port, const char *ca_file, struct result *r)
+{
+    mbedtls_net_context net;
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_config conf;
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context drbg;
+    mbedtls_x509_crt ca;
+    int ret = -1;
+
+    double start = now_ms();
+    mbedtls_net_init(&net);
+    mbedtls_ssl_init(&ssl);
+    mbedtls_ssl_config_init(&conf);
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&drbg);
+    mbedtls_x509_crt_init(&ca);
+
+    if (mbedtls_x509_crt_parse_file(&ca, ca_file) != 0) {
+        fprintf(stderr, "failed to parse %s\n", ca_file);
+        goto end;
+    }
+    r->parse_ms = now_ms() - start;
+
+    if (mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy, NULL, 0) != 0 ||
+        mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT) != 0)
+        goto end;
+    mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &drbg);
+    mbedtls_ssl_conf_ca_chain(&conf, &ca, NULL);
+    if (mbedtls_ssl_setup(&ssl, &conf) != 0 || mbedtls_ssl_set_hostname(&ssl, host) != 0)
+        goto end;
+    if (mbedtls_net_connect(&net, host, port, MBEDTLS_NET_PROTO_TCP) != 0) {
+        fprintf(stderr, "failed to connect to %s:%s\n", host, port);
+        goto end;
+    }
+    mbedtls_ssl_set_bio(&ssl, &net, mbedtls_net_send, mbedtls_net_recv, NULL);
+
+    double hs_start = now_ms();
+    while ((ret = mbedtls_ssl_handshake(&ssl)) != 0) {
+        if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+            char err[128];
+            mbedtls_strerror(ret, err, sizeof(err));
+            fprintf(stderr, "handshake failed: %s\n", err);
+            goto end;
+        }
+    }
+    r->handshake_ms = now_ms() - hs_start;
+
+    // openssl s_server -www answers with a status page that says whether the
+    // session was reused
+    const char *req = "GET / HTTP/1.0\r\n\r\n";
+    mbedtls_ssl_write(&ssl, (const unsigned char *)req, strlen(req));
+    char page[16384];
+    size_t len = 0;
+    while (len < sizeof(page) - 1) {
+        int n = mbedtls_ssl_read(&ssl, (unsigned char *)page + len, sizeof(page) - 1 - len);
+        if (n == MBEDTLS_ERR_SSL_WANT_READ || n == MBEDTLS_ERR_SSL_WANT_WRITE)
+            continue;
+        if (n <= 0)
+            break;
+        len += n;
+    }
+    page[len] = '\0';
+    r->reused = strstr(page, "Reused,") != NULL;
+    mbedtls_ssl_close_notify(&ssl);
+    r->total_ms = now_ms() - start;
+    ret = 0;
+
+end:
+    mbedtls_net_free(&net);
+    mbedtls_x509_crt_free(&ca);
+    mbedtls_ssl_free(&ssl);
+    mbedtls_ssl_config_free(&conf);
+    mbedtls_ctr_drbg_free(&drbg);
+    mbedtls_entropy_free(&entropy);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s HOST PORT CA_FILE [CONNECTIONS]\n", argv[0]);
+        return 1;
+    }
+    int count = argc > 4 ? atoi(argv[4]) : 50;
+
+    struct result sum = { 0 };
+    int reused = 0;
+    for (int i = 0; i < count; i++) {
+        struct result r = { 0 };
+        if (connect_once(argv[1], argv[2], argv[3], &r) != 0)
+            return 1;
+        sum.parse_ms += r.parse_ms;
+        sum.handshake_ms += r.handshake_ms;
+        sum.total_ms += r.total_ms;
+        reused += r.reused;
+    }
+
+#ifdef TLS_SHARE
+    const char *name = "shared";
+#else
+    const char *name = "plain";
+#endif
+    printf("%-8s %4d connections: CA parse %7.3f ms, handshake %7.3f ms, total %7.3f ms, %d resumed\n",
+           name, count, sum.parse_ms / count, sum.handshake_ms / count, sum.total_ms / count, reused);
+#ifdef TLS_SHARE
+    struct tls_share_stats st;
+    tls_share_get_stats(&st);
+    printf("         bundles parsed %llu, reused %llu; sessions stored %llu, offered %llu\n",
+           (unsigned long long)st.chain_parses, (unsigned long long)st.chain_reuses,
+           (unsigned long long)st.sessions_stored, (unsigned long long)st.sessions_offered);
+#endif
+    return 0;
+}
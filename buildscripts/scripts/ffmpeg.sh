@@ -22,6 +22,13 @@ cpu=armv7-a
 cpuflags=
 [[ "$ndk_triple" == "arm"* ]] && cpuflags="$cpuflags -mfpu=neon -mcpu=cortex-a8"
 
+# route FFmpeg's mbedtls calls through libtlsshare (see tls_share.h)
+tlsflags=
+for func in x509_crt_parse_file x509_crt_free ssl_conf_ca_chain ssl_set_hostname \
+	ssl_set_bio ssl_handshake ssl_read ssl_free; do
+	tlsflags="$tlsflags -Wl,--wrap=mbedtls_$func"
+done
+
 args=(
 	--target-os=android --enable-cross-compile
 	--cross-prefix=$ndk_triple- --cc=$CC --pkg-config=pkg-config --nm=llvm-nm
@@ -44,5 +51,9 @@ args=(
 )
 ../configure "${args[@]}"
 
+# only the libavformat link gets the wrappers, configure's link tests stay as they are
+sed -i "s|^EXTRALIBS-avformat=|EXTRALIBS-avformat=$tlsflags -ltlsshare |" ffbuild/config.mak
+grep -q "^EXTRALIBS-avformat=.*-ltlsshare" ffbuild/config.mak
+
 make -j$cores
 make DESTDIR="$prefix_dir" install
@@ -20,3 +20,7 @@ fi
 
 make -j$cores no_test
 make DESTDIR="$prefix_dir" install
+
+# shared CA chains and session cache for FFmpeg, see tls_share.h
+$CC -O2 -fPIC -I"$prefix_dir/include" -c "$DIR/tls_share/tls_share.c" -o tls_share.o
+$AR rcs "$prefix_dir/lib/libtlsshare.a" tls_share.o
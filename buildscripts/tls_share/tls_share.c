@@ -0,0 +1,437 @@
+// See tls_share.h. Built into libtlsshare.a by scripts/mbedtls.sh.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/x509_crt.h>
+
+#include "tls_share.h"
+
+// cached sessions are dropped after this long, servers rarely accept older ones
+#define SESSION_MAX_AGE (2 * 3600)
+#define MAX_SESSIONS 32
+#define MAX_HOST 256
+#define MAX_KEY (MAX_HOST + 6) // host:port
+
+int __real_mbedtls_x509_crt_parse_file(mbedtls_x509_crt *chain, const char *path);
+void __real_mbedtls_x509_crt_free(mbedtls_x509_crt *crt);
+void __real_mbedtls_ssl_conf_ca_chain(mbedtls_ssl_config *conf, mbedtls_x509_crt *ca_chain,
+                                      mbedtls_x509_crl *ca_crl);
+int __real_mbedtls_ssl_set_hostname(mbedtls_ssl_context *ssl, const char *hostname);
+int __real_mbedtls_ssl_handshake(mbedtls_ssl_context *ssl);
+int __real_mbedtls_ssl_read(mbedtls_ssl_context *ssl, unsigned char *buf, size_t len);
+void __real_mbedtls_ssl_set_bio(mbedtls_ssl_context *ssl, void *p_bio, mbedtls_ssl_send_t *f_send,
+                                mbedtls_ssl_recv_t *f_recv, mbedtls_ssl_recv_timeout_t *f_recv_timeout);
+void __real_mbedtls_ssl_free(mbedtls_ssl_context *ssl);
+
+// The transport is only known from its callbacks. In libavformat it is a
+// URLContext, anywhere else (benchmarks/tls) mbedtls' own sockets. Both are
+// weak so neither pulls in code the other link does not have.
+struct URLContext;
+int ffurl_get_file_handle(struct URLContext *h) __attribute__((weak));
+#pragma weak mbedtls_net_send
+
+// TLS 1.3 tickets are only handed out when the application asks for them (3.6.1+)
+#if defined(MBEDTLS_SSL_PROTO_TLS1_3) && defined(MBEDTLS_SSL_SESSION_TICKETS) && \
+    defined(MBEDTLS_SSL_TLS1_3_SIGNAL_NEW_SESSION_TICKETS_ENABLED)
+#define HAVE_TLS13_TICKETS 1
+#endif
+
+struct shared_chain {
+    char *path;
+    off_t size;
+    time_t mtime;
+    mbedtls_x509_crt crt;
+    int refs;
+    int retired;    // the file changed, freed once unreferenced
+    struct shared_chain *next;
+};
+
+// a connection's empty chain standing in for a shared one
+struct chain_ref {
+    const mbedtls_x509_crt *crt;
+    struct shared_chain *chain;
+    struct chain_ref *next;
+};
+
+struct cached_session {
+    char key[MAX_KEY];
+    unsigned char *data;    // mbedtls_ssl_session_save() format
+    size_t len;
+    time_t stored;
+};
+
+// destination of a live client connection
+struct connection {
+    const mbedtls_ssl_context *ssl;
+    char host[MAX_HOST];    // empty until mbedtls_ssl_set_hostname()
+    int port;               // 0 until mbedtls_ssl_set_bio()
+    char key[MAX_KEY];      // host:port once both are known
+    int stored;
+    struct connection *next;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct shared_chain *chains;
+static struct chain_ref *chain_refs;
+static struct cached_session sessions[MAX_SESSIONS];
+static struct connection *connections;
+static struct tls_share_stats stats;
+
+void tls_share_get_stats(struct tls_share_stats *out)
+{
+    pthread_mutex_lock(&lock);
+    *out = stats;
+    pthread_mutex_unlock(&lock);
+}
+
+// ----------------------------------------------------------------------------
+// CA chains
+// ----------------------------------------------------------------------------
+
+static void chain_release(struct shared_chain *chain)
+{
+    if (--chain->refs > 0 || !chain->retired)
+        return;
+    for (struct shared_chain **p = &chains; *p; p = &(*p)->next) {
+        if (*p == chain) {
+            *p = chain->next;
+            break;
+        }
+    }
+    __real_mbedtls_x509_crt_free(&chain->crt);
+    free(chain->path);
+    free(chain);
+}
+
+// must be called with lock held
+static struct shared_chain *chain_get(const char *path, const struct stat *st)
+{
+    for (struct shared_chain *c = chains; c; c = c->next) {
+        if (c->retired || strcmp(c->path, path))
+            continue;
+        if (c->size == st->st_size && c->mtime == st->st_mtime) {
+            stats.chain_reuses++;
+            return c;
+        }
+        // connections still using the old contents keep it alive
+        c->retired = 1;
+        c->refs++;
+        chain_release(c);
+        break;
+    }
+
+    struct shared_chain *c = calloc(1, sizeof(*c));
+    if (!c || !(c->path = strdup(path))) {
+        free(c);
+        return NULL;
+    }
+    mbedtls_x509_crt_init(&c->crt);
+    // partial parses are errors to the caller, leave those to the real function
+    if (__real_mbedtls_x509_crt_parse_file(&c->crt, path) != 0) {
+        __real_mbedtls_x509_crt_free(&c->crt);
+        free(c->path);
+        free(c);
+        return NULL;
+    }
+    c->size = st->st_size;
+    c->mtime = st->st_mtime;
+    c->next = chains;
+    chains = c;
+    stats.chain_parses++;
+    return c;
+}
+
+int __wrap_mbedtls_x509_crt_parse_file(mbedtls_x509_crt *crt, const char *path)
+{
+    struct stat st;
+    // only an empty chain can stand in for a shared one
+    if (crt->raw.p || stat(path, &st) < 0)
+        return __real_mbedtls_x509_crt_parse_file(crt, path);
+
+    struct chain_ref *ref = malloc(sizeof(*ref));
+    if (!ref)
+        return __real_mbedtls_x509_crt_parse_file(crt, path);
+    pthread_mutex_lock(&lock);
+    struct shared_chain *chain = chain_get(path, &st);
+    if (chain) {
+        chain->refs++;
+        ref->crt = crt;
+        ref->chain = chain;
+        ref->next = chain_refs;
+        chain_refs = ref;
+    }
+    pthread_mutex_unlock(&lock);
+    if (!chain) {
+        free(ref);
+        return __real_mbedtls_x509_crt_parse_file(crt, path);
+    }
+    return 0;
+}
+
+void __wrap_mbedtls_x509_crt_free(mbedtls_x509_crt *crt)
+{
+    pthread_mutex_lock(&lock);
+    for (struct chain_ref **p = &chain_refs; *p; p = &(*p)->next) {
+        struct chain_ref *ref = *p;
+        if (ref->crt == crt) {
+            *p = ref->next;
+            chain_release(ref->chain);
+            free(ref);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    __real_mbedtls_x509_crt_free(crt);
+}
+
+void __wrap_mbedtls_ssl_conf_ca_chain(mbedtls_ssl_config *conf, mbedtls_x509_crt *ca_chain,
+                                      mbedtls_x509_crl *ca_crl)
+{
+    pthread_mutex_lock(&lock);
+    for (struct chain_ref *ref = chain_refs; ref; ref = ref->next) {
+        if (ref->crt == ca_chain) {
+            // only read during verification, so connections can share it
+            ca_chain = &ref->chain->crt;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    __real_mbedtls_ssl_conf_ca_chain(conf, ca_chain, ca_crl);
+#ifdef HAVE_TLS13_TICKETS
+    // every connection configures its CA chain, so this is the place to opt in
+    mbedtls_ssl_conf_tls13_enable_signal_new_session_tickets(conf,
+        MBEDTLS_SSL_TLS1_3_SIGNAL_NEW_SESSION_TICKETS_ENABLED);
+#endif
+}
+
+// ----------------------------------------------------------------------------
+// sessions
+// ----------------------------------------------------------------------------
+
+// must be called with lock held
+static struct connection *connection_find(const mbedtls_ssl_context *ssl)
+{
+    for (struct connection *c = connections; c; c = c->next) {
+        if (c->ssl == ssl)
+            return c;
+    }
+    return NULL;
+}
+
+// must be called with lock held
+static struct connection *connection_get(const mbedtls_ssl_context *ssl)
+{
+    struct connection *conn = connection_find(ssl);
+    if (!conn && (conn = calloc(1, sizeof(*conn)))) {
+        conn->ssl = ssl;
+        conn->next = connections;
+        connections = conn;
+    }
+    return conn;
+}
+
+// must be called with lock held
+static struct cached_session *session_find(const char *key)
+{
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        if (sessions[i].data && !strcmp(sessions[i].key, key))
+            return &sessions[i];
+    }
+    return NULL;
+}
+
+static void session_store(mbedtls_ssl_context *ssl)
+{
+    char key[MAX_KEY];
+    pthread_mutex_lock(&lock);
+    struct connection *conn = connection_find(ssl);
+    if (conn)
+        memcpy(key, conn->key, sizeof(key));
+    pthread_mutex_unlock(&lock);
+    if (!conn || !key[0])
+        return;
+
+    // serialized outside the lock, it involves copying the peer certificate
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    unsigned char *data = NULL;
+    size_t len = 0;
+    if (mbedtls_ssl_get_session(ssl, &session) == 0 &&
+        mbedtls_ssl_session_save(&session, NULL, 0, &len) == MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL &&
+        (data = malloc(len)) && mbedtls_ssl_session_save(&session, data, len, &len) != 0) {
+        free(data);
+        data = NULL;
+    }
+    mbedtls_ssl_session_free(&session);
+    if (!data)
+        return;
+
+    pthread_mutex_lock(&lock);
+    struct cached_session *slot = session_find(key);
+    if (!slot) {
+        // a free slot, or else the oldest session
+        slot = &sessions[0];
+        for (int i = 0; i < MAX_SESSIONS && slot->data; i++) {
+            if (!sessions[i].data || sessions[i].stored < slot->stored)
+                slot = &sessions[i];
+        }
+    }
+    free(slot->data);
+    memcpy(slot->key, key, sizeof(slot->key));
+    slot->data = data;
+    slot->len = len;
+    slot->stored = time(NULL);
+    if ((conn = connection_find(ssl)))
+        conn->stored = 1;
+    stats.sessions_stored++;
+    pthread_mutex_unlock(&lock);
+}
+
+static void session_offer(mbedtls_ssl_context *ssl, const char *key)
+{
+    unsigned char *data = NULL;
+    size_t len = 0;
+    pthread_mutex_lock(&lock);
+    struct cached_session *cached = session_find(key);
+    if (cached && time(NULL) - cached->stored > SESSION_MAX_AGE) {
+        free(cached->data);
+        cached->data = NULL;
+    } else if (cached && (data = malloc(cached->len))) {
+        memcpy(data, cached->data, cached->len);
+        len = cached->len;
+    }
+    pthread_mutex_unlock(&lock);
+    if (!data)
+        return;
+
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    if (mbedtls_ssl_session_load(&session, data, len) == 0 && mbedtls_ssl_set_session(ssl, &session) == 0) {
+        pthread_mutex_lock(&lock);
+        stats.sessions_offered++;
+        pthread_mutex_unlock(&lock);
+    }
+    mbedtls_ssl_session_free(&session);
+    free(data);
+}
+
+// remote port of the transport, 0 if it is not a socket we know
+static int transport_port(void *p_bio, mbedtls_ssl_send_t *f_send)
+{
+    int fd = -1;
+    if (mbedtls_net_send && f_send == mbedtls_net_send)
+        fd = ((mbedtls_net_context*)p_bio)->fd;
+    else if (ffurl_get_file_handle)
+        fd = ffurl_get_file_handle(p_bio);
+    if (fd < 0)
+        return 0;
+
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if (getpeername(fd, (struct sockaddr*)&addr, &len) < 0)
+        return 0;
+    if (addr.ss_family == AF_INET)
+        return ntohs(((struct sockaddr_in*)&addr)->sin_port);
+    if (addr.ss_family == AF_INET6)
+        return ntohs(((struct sockaddr_in6*)&addr)->sin6_port);
+    return 0;
+}
+
+// offers a cached session once both host and port of the connection are known
+static void connection_update(mbedtls_ssl_context *ssl, const char *host, int port)
+{
+    char key[MAX_KEY] = "";
+    pthread_mutex_lock(&lock);
+    struct connection *conn = connection_get(ssl);
+    if (conn) {
+        if (host)
+            strcpy(conn->host, host);
+        if (port)
+            conn->port = port;
+        conn->key[0] = '\0';
+        conn->stored = 0;
+        if (conn->host[0] && conn->port) {
+            snprintf(conn->key, sizeof(conn->key), "%s:%d", conn->host, conn->port);
+            memcpy(key, conn->key, sizeof(key));
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    if (key[0])
+        session_offer(ssl, key);
+}
+
+int __wrap_mbedtls_ssl_set_hostname(mbedtls_ssl_context *ssl, const char *hostname)
+{
+    int ret = __real_mbedtls_ssl_set_hostname(ssl, hostname);
+    if (ret == 0 && hostname && hostname[0] && strlen(hostname) < MAX_HOST)
+        connection_update(ssl, hostname, 0);
+    return ret;
+}
+
+void __wrap_mbedtls_ssl_set_bio(mbedtls_ssl_context *ssl, void *p_bio, mbedtls_ssl_send_t *f_send,
+                                mbedtls_ssl_recv_t *f_recv, mbedtls_ssl_recv_timeout_t *f_recv_timeout)
+{
+    __real_mbedtls_ssl_set_bio(ssl, p_bio, f_send, f_recv, f_recv_timeout);
+    // sessions are per server, and several may share a hostname on different ports
+    int port = transport_port(p_bio, f_send);
+    if (port)
+        connection_update(ssl, NULL, port);
+}
+
+int __wrap_mbedtls_ssl_handshake(mbedtls_ssl_context *ssl)
+{
+    int ret = __real_mbedtls_ssl_handshake(ssl);
+#ifdef HAVE_TLS13_TICKETS
+    while (ret == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET) {
+        session_store(ssl);
+        ret = __real_mbedtls_ssl_handshake(ssl);
+    }
+#endif
+    // a TLS 1.3 session is only worth keeping once it has a ticket, and
+    // mbedtls_ssl_get_session() may only be called once per TLS 1.2 connection
+    if (ret == 0 && mbedtls_ssl_get_version_number(ssl) != MBEDTLS_SSL_VERSION_TLS1_3) {
+        pthread_mutex_lock(&lock);
+        struct connection *conn = connection_find(ssl);
+        int stored = !conn || conn->stored;
+        pthread_mutex_unlock(&lock);
+        if (!stored)
+            session_store(ssl);
+    }
+    return ret;
+}
+
+int __wrap_mbedtls_ssl_read(mbedtls_ssl_context *ssl, unsigned char *buf, size_t len)
+{
+    int ret = __real_mbedtls_ssl_read(ssl, buf, len);
+#ifdef HAVE_TLS13_TICKETS
+    while (ret == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET) {
+        session_store(ssl);
+        ret = __real_mbedtls_ssl_read(ssl, buf, len);
+    }
+#endif
+    return ret;
+}
+
+void __wrap_mbedtls_ssl_free(mbedtls_ssl_context *ssl)
+{
+    pthread_mutex_lock(&lock);
+    for (struct connection **p = &connections; *p; p = &(*p)->next) {
+        struct connection *conn = *p;
+        if (conn->ssl == ssl) {
+            *p = conn->next;
+            free(conn);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    __real_mbedtls_ssl_free(ssl);
+}
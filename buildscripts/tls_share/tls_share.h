@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+// Shared CA chains and a TLS session cache for FFmpeg's mbedtls backend.
+//
+// FFmpeg parses its ca_file into a fresh mbedtls_x509_crt for every
+// connection and never resumes sessions. libavformat is linked with
+// -Wl,--wrap for the mbedtls functions below (see scripts/ffmpeg.sh), which
+// routes those calls through tls_share.c:
+//  - mbedtls_x509_crt_parse_file() parses each CA bundle once per process;
+//    the connection's own (empty) chain stands in for the shared one, which
+//    mbedtls_ssl_conf_ca_chain() substitutes.
+//  - The session of every completed client handshake is kept per host and
+//    port, and offered again on the next connection to the same server once
+//    mbedtls_ssl_set_hostname() and mbedtls_ssl_set_bio() have named it.
+//    TLS 1.3 tickets arrive after the handshake and are picked up in
+//    mbedtls_ssl_read(), invisibly to FFmpeg.
+//  - mbedtls_x509_crt_free() and mbedtls_ssl_free() drop the bookkeeping.
+
+struct tls_share_stats {
+    uint64_t chain_parses;      // CA bundles actually parsed
+    uint64_t chain_reuses;      // parses answered from a shared chain
+    uint64_t sessions_stored;
+    uint64_t sessions_offered;  // connections that offered a cached session
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void tls_share_get_stats(struct tls_share_stats *out);
+
+#ifdef __cplusplus
+}
+#endif